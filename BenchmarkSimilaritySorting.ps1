@@ -0,0 +1,182 @@
+<#
+.SYNOPSIS
+  Compares the ratio and the speed of solid 7z archives created with and
+  without the similarity-based file ordering (-mqsim).
+
+.DESCRIPTION
+  The script generates a reproducible corpus: several families of similar
+  files (a base file and the variants with small edits). The file names are
+  random, so the default name ordering separates the files of one family.
+  Then it creates the archive with -mqsim=off and -mqsim=on, tests it, and
+  prints the size, the ratio and the speed of both runs.
+
+.EXAMPLE
+  .\BenchmarkSimilaritySorting.ps1
+
+.EXAMPLE
+  .\BenchmarkSimilaritySorting.ps1 -Method LZMA2 -Level 9 -Threads 8 -Repeat 5
+
+.EXAMPLE
+  .\BenchmarkSimilaritySorting.ps1 -Dictionary 1m
+#>
+param(
+  [string]$Executable = "$PSScriptRoot\Output\Binaries\Release\NanaZipPackage\x64\NanaZip.Universal.Console.exe",
+  [string]$WorkFolder = "$PSScriptRoot\Output\BenchmarkSimilaritySorting",
+  [string]$Method = "LZMA2",
+  [int]$Level = 5,
+  [string]$Dictionary = "",
+  [int]$Threads = 0,
+  [int]$Families = 64,
+  [int]$Variants = 8,
+  [int]$FileSize = 128KB,
+  [int]$Seed = 1,
+  [int]$Repeat = 3
+)
+
+$ErrorActionPreference = "Stop"
+
+if (-not (Test-Path $Executable)) {
+  throw "Can't find $Executable. Build NanaZip first or pass -Executable."
+}
+
+Add-Type -TypeDefinition @"
+using System;
+using System.IO;
+using System.Text;
+
+public static class SimilarityCorpus
+{
+  static byte[] MakeText(Random random, string[] words, int size)
+  {
+    StringBuilder sb = new StringBuilder(size + 64);
+    while (sb.Length < size)
+    {
+      sb.Append(words[random.Next(words.Length)]);
+      sb.Append(random.Next(12) == 0 ? "\r\n" : " ");
+    }
+    return Encoding.ASCII.GetBytes(sb.ToString(0, size));
+  }
+
+  static byte[] MakeRecords(Random random, int size)
+  {
+    // the table of fixed-size records with slowly changing fields
+    byte[] data = new byte[size];
+    uint id = (uint)random.Next();
+    for (int pos = 0; pos + 32 <= size; pos += 32)
+    {
+      BitConverter.GetBytes(id++).CopyTo(data, pos);
+      BitConverter.GetBytes((uint)random.Next(1000)).CopyTo(data, pos + 4);
+      for (int i = 8; i < 32; i++)
+        data[pos + i] = (byte)(random.Next(4) == 0 ? random.Next(256) : i);
+    }
+    return data;
+  }
+
+  static byte[] MakeVariant(Random random, byte[] data)
+  {
+    MemoryStream ms = new MemoryStream(data.Length + 4096);
+    int pos = 0;
+    int numEdits = 4 + random.Next(12);
+    for (int i = 0; i < numEdits; i++)
+    {
+      int next = pos + random.Next(data.Length / numEdits);
+      if (next > data.Length)
+        next = data.Length;
+      ms.Write(data, pos, next - pos);
+      byte[] insert = new byte[random.Next(256)];
+      random.NextBytes(insert);
+      ms.Write(insert, 0, insert.Length);
+      pos = next + random.Next(64);
+      if (pos > data.Length)
+        pos = data.Length;
+    }
+    ms.Write(data, pos, data.Length - pos);
+    return ms.ToArray();
+  }
+
+  public static long Generate(string folder, int numFamilies, int numVariants, int fileSize, int seed)
+  {
+    Random random = new Random(seed);
+    string[] words = new string[4096];
+    for (int i = 0; i < words.Length; i++)
+    {
+      char[] w = new char[2 + random.Next(9)];
+      for (int k = 0; k < w.Length; k++)
+        w[k] = (char)('a' + random.Next(26));
+      words[i] = new string(w);
+    }
+    Directory.CreateDirectory(folder);
+    long totalSize = 0;
+    for (int f = 0; f < numFamilies; f++)
+    {
+      bool isText = (f % 2 == 0);
+      byte[] data = isText ? MakeText(random, words, fileSize) : MakeRecords(random, fileSize);
+      for (int v = 0; v < numVariants; v++)
+      {
+        byte[] file = (v == 0) ? data : MakeVariant(random, data);
+        string name = random.Next().ToString("x8") + (isText ? ".txt" : ".dat");
+        File.WriteAllBytes(Path.Combine(folder, name), file);
+        totalSize += file.Length;
+      }
+    }
+    return totalSize;
+  }
+}
+"@
+
+$CorpusFolder = Join-Path $WorkFolder "Corpus"
+if (Test-Path $WorkFolder) {
+  Remove-Item -Recurse -Force $WorkFolder
+}
+$TotalSize = [SimilarityCorpus]::Generate($CorpusFolder, $Families, $Variants, $FileSize, $Seed)
+Write-Host ("Corpus: {0} files, {1:N0} bytes" -f ($Families * $Variants), $TotalSize)
+
+$ThreadsSwitch = "-mmt=on"
+if ($Threads -gt 0) {
+  $ThreadsSwitch = "-mmt=$Threads"
+}
+
+function Measure-Best([scriptblock]$Command) {
+  $Best = [double]::MaxValue
+  for ($i = 0; $i -lt $Repeat; $i++) {
+    $Watch = [System.Diagnostics.Stopwatch]::StartNew()
+    & $Command | Out-Null
+    $Watch.Stop()
+    if ($LASTEXITCODE -ne 0) {
+      throw "NanaZip returned exit code $LASTEXITCODE"
+    }
+    if ($Watch.Elapsed.TotalSeconds -lt $Best) {
+      $Best = $Watch.Elapsed.TotalSeconds
+    }
+  }
+  return $Best
+}
+
+$Results = @()
+foreach ($Mode in @("off", "on")) {
+  $Archive = Join-Path $WorkFolder "qsim-$Mode.7z"
+  $Switches = @("-t7z", "-m0=$Method", "-mx=$Level", "-ms=on", $ThreadsSwitch, "-mqsim=$Mode", "-bso0", "-bsp0")
+  if ($Dictionary -ne "") {
+    $Switches += "-md=$Dictionary"
+  }
+  $AddTime = Measure-Best {
+    if (Test-Path $Archive) {
+      Remove-Item -Force $Archive
+    }
+    & $Executable a $Switches $Archive "$CorpusFolder\*"
+  }
+  $TestTime = Measure-Best {
+    & $Executable t $ThreadsSwitch "-bso0" "-bsp0" $Archive
+  }
+  $PackSize = (Get-Item $Archive).Length
+  $Results += [pscustomobject]@{
+    "qsim" = $Mode
+    "Archive size" = $PackSize
+    "Ratio %" = [math]::Round(100.0 * $PackSize / $TotalSize, 2)
+    "Add s" = [math]::Round($AddTime, 3)
+    "Add MB/s" = [math]::Round($TotalSize / $AddTime / 1MB, 1)
+    "Test MB/s" = [math]::Round($TotalSize / $TestTime / 1MB, 1)
+  }
+}
+
+$Results | Format-Table -AutoSize
@@ -11,41 +11,437 @@
 #include "NanaZip.Codecs.h"
 
 #include <blake3.h>
+#include <blake3_impl.h>
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace
+{
+    /**
+     * @brief The size of the subtree hashed by one worker. It must be a power
+     *        of two multiple of BLAKE3_CHUNK_LEN.
+     */
+    const SIZE_T Blake3PartSize = 1 << 20;
+
+    /**
+     * @brief The number of parts buffered for each thread before dispatching
+     *        them to the workers. HashCalc feeds the hasher with 32 KiB blocks,
+     *        so the input needs to be collected before it can be split.
+     */
+    const SIZE_T Blake3PartsPerThread = 2;
+
+    const UINT32 Blake3MaximumThreads = 64;
+}
 
 namespace NanaZip::Codecs::Hash
 {
-    struct Blake3 : public Mile::ComObject<Blake3, IHasher>
+    struct Blake3 : public Mile::ComObject<
+        Blake3,
+        IHasher,
+        ICompressSetCoderProperties>
     {
     private:
 
         blake3_hasher Context;
 
+        UINT32 NumberOfThreads = 1;
+        std::vector<std::uint8_t> Buffer;
+        SIZE_T BufferLength = 0;
+        std::uint64_t InputLength = 0;
+
+        PTP_WORK Work = nullptr;
+        const std::uint8_t* PartInput = nullptr;
+        std::uint64_t PartChunkCounter = 0;
+        SIZE_T PartCount = 0;
+        volatile LONG NextPart = 0;
+        std::vector<std::uint8_t> PartCvs;
+
+        void ComputeParentCv(
+            const std::uint8_t* Block,
+            std::uint8_t* Cv)
+        {
+            std::uint32_t Words[8];
+            std::memcpy(Words, this->Context.key, BLAKE3_KEY_LEN);
+            ::blake3_compress_in_place(
+                Words,
+                Block,
+                BLAKE3_BLOCK_LEN,
+                0,
+                this->Context.chunk.flags | PARENT);
+            ::store_cv_words(Cv, Words);
+        }
+
+        /**
+         * @brief Condenses the chaining values of a complete subtree to its
+         *        top-level CVs, pairing neighbours the same way as the
+         *        reference implementation.
+         */
+        SIZE_T CondenseCvs(
+            std::uint8_t* Cvs,
+            SIZE_T Count,
+            SIZE_T Target)
+        {
+            while (Count > Target)
+            {
+                SIZE_T Parents = Count / 2;
+                for (SIZE_T i = 0; i < Parents; ++i)
+                {
+                    this->ComputeParentCv(
+                        &Cvs[2 * i * BLAKE3_OUT_LEN],
+                        &Cvs[i * BLAKE3_OUT_LEN]);
+                }
+                if (Count & 1)
+                {
+                    std::memmove(
+                        &Cvs[Parents * BLAKE3_OUT_LEN],
+                        &Cvs[(Count - 1) * BLAKE3_OUT_LEN],
+                        BLAKE3_OUT_LEN);
+                    ++Parents;
+                }
+                Count = Parents;
+            }
+            return Count;
+        }
+
+        /**
+         * @brief Mirrors the lazy merging of hasher_push_cv in blake3.c.
+         */
+        void PushCv(
+            const std::uint8_t* Cv,
+            std::uint64_t ChunkCounter)
+        {
+            SIZE_T PostMergeStackLength = ::popcnt(ChunkCounter);
+            while (this->Context.cv_stack_len > PostMergeStackLength)
+            {
+                std::uint8_t* ParentNode = &this->Context.cv_stack[
+                    (this->Context.cv_stack_len - 2) * BLAKE3_OUT_LEN];
+                this->ComputeParentCv(ParentNode, ParentNode);
+                --this->Context.cv_stack_len;
+            }
+            std::memcpy(
+                &this->Context.cv_stack[
+                    this->Context.cv_stack_len * BLAKE3_OUT_LEN],
+                Cv,
+                BLAKE3_OUT_LEN);
+            ++this->Context.cv_stack_len;
+        }
+
+        /**
+         * @brief Finalizes the completely filled chunk held in the chunk state
+         *        and pushes its CV, which blake3_hasher_update only does once
+         *        more input arrives.
+         */
+        void PushFullChunk()
+        {
+            blake3_chunk_state& Chunk = this->Context.chunk;
+            std::uint32_t Words[8];
+            std::memcpy(Words, Chunk.cv, sizeof(Words));
+            ::blake3_compress_in_place(
+                Words,
+                Chunk.buf,
+                Chunk.buf_len,
+                Chunk.chunk_counter,
+                Chunk.flags
+                | (Chunk.blocks_compressed ? 0 : CHUNK_START)
+                | CHUNK_END);
+            std::uint8_t Cv[BLAKE3_OUT_LEN];
+            ::store_cv_words(Cv, Words);
+            this->PushCv(Cv, Chunk.chunk_counter);
+
+            std::memcpy(Chunk.cv, this->Context.key, BLAKE3_KEY_LEN);
+            ++Chunk.chunk_counter;
+            std::memset(Chunk.buf, 0, BLAKE3_BLOCK_LEN);
+            Chunk.buf_len = 0;
+            Chunk.blocks_compressed = 0;
+        }
+
+        void HashParts()
+        {
+            const SIZE_T PartChunks = Blake3PartSize / BLAKE3_CHUNK_LEN;
+            for (;;)
+            {
+                SIZE_T Index = static_cast<SIZE_T>(
+                    ::InterlockedIncrement(&this->NextPart) - 1);
+                if (Index >= this->PartCount)
+                {
+                    break;
+                }
+                std::uint8_t Cvs[MAX_SIMD_DEGREE_OR_2 * BLAKE3_OUT_LEN];
+                SIZE_T Count = ::blake3_compress_subtree_wide(
+                    this->PartInput + Index * Blake3PartSize,
+                    Blake3PartSize,
+                    this->Context.key,
+                    this->PartChunkCounter + Index * PartChunks,
+                    this->Context.chunk.flags,
+                    Cvs,
+                    false);
+                this->CondenseCvs(Cvs, Count, 1);
+                std::memcpy(
+                    &this->PartCvs[Index * BLAKE3_OUT_LEN],
+                    Cvs,
+                    BLAKE3_OUT_LEN);
+            }
+        }
+
+        static void CALLBACK HashPartsCallback(
+            _Inout_ PTP_CALLBACK_INSTANCE Instance,
+            _Inout_opt_ PVOID Context,
+            _Inout_ PTP_WORK Work)
+        {
+            UNREFERENCED_PARAMETER(Instance);
+            UNREFERENCED_PARAMETER(Work);
+            static_cast<Blake3*>(Context)->HashParts();
+        }
+
+        /**
+         * @brief Hashes a complete, aligned subtree on the workers and pushes
+         *        its top two CVs like compress_subtree_to_parent_node does.
+         */
+        void HashSubtreeParallel(
+            const std::uint8_t* Input,
+            SIZE_T Length)
+        {
+            this->PartInput = Input;
+            this->PartChunkCounter = this->Context.chunk.chunk_counter;
+            this->PartCount = Length / Blake3PartSize;
+            this->NextPart = 0;
+
+            SIZE_T Workers = this->NumberOfThreads - 1;
+            if (Workers > this->PartCount - 1)
+            {
+                Workers = this->PartCount - 1;
+            }
+            for (SIZE_T i = 0; i < Workers; ++i)
+            {
+                ::SubmitThreadpoolWork(this->Work);
+            }
+            this->HashParts();
+            ::WaitForThreadpoolWorkCallbacks(this->Work, FALSE);
+
+            this->CondenseCvs(this->PartCvs.data(), this->PartCount, 2);
+
+            std::uint64_t SubtreeChunks = Length / BLAKE3_CHUNK_LEN;
+            this->PushCv(
+                &this->PartCvs[0],
+                this->Context.chunk.chunk_counter);
+            this->PushCv(
+                &this->PartCvs[BLAKE3_OUT_LEN],
+                this->Context.chunk.chunk_counter + SubtreeChunks / 2);
+            this->Context.chunk.chunk_counter += SubtreeChunks;
+        }
+
+        /**
+         * @brief Splits the input into subtrees following the rules of
+         *        blake3_hasher_update. Subtrees which are large enough are
+         *        hashed in parallel and the others are left to the library, so
+         *        the hasher state and the digest are identical to the single
+         *        threaded result.
+         */
+        void ParallelUpdate(
+            const std::uint8_t* Input,
+            SIZE_T Length)
+        {
+            SIZE_T ChunkLength =
+                BLAKE3_BLOCK_LEN * this->Context.chunk.blocks_compressed
+                + this->Context.chunk.buf_len;
+            if (ChunkLength)
+            {
+                SIZE_T Take = BLAKE3_CHUNK_LEN - ChunkLength;
+                if (Take > Length)
+                {
+                    Take = Length;
+                }
+                ::blake3_hasher_update(&this->Context, Input, Take);
+                Input += Take;
+                Length -= Take;
+            }
+
+            while (Length > BLAKE3_CHUNK_LEN)
+            {
+                if (this->Context.chunk.buf_len)
+                {
+                    this->PushFullChunk();
+                }
+
+                std::uint64_t CountSoFar =
+                    this->Context.chunk.chunk_counter * BLAKE3_CHUNK_LEN;
+                SIZE_T SubtreeLength = static_cast<SIZE_T>(
+                    ::round_down_to_power_of_2(Length));
+                while (((SubtreeLength - 1) & CountSoFar) != 0)
+                {
+                    SubtreeLength /= 2;
+                }
+
+                if (SubtreeLength >= 2 * Blake3PartSize)
+                {
+                    this->HashSubtreeParallel(Input, SubtreeLength);
+                }
+                else
+                {
+                    ::blake3_hasher_update(
+                        &this->Context,
+                        Input,
+                        SubtreeLength);
+                }
+                Input += SubtreeLength;
+                Length -= SubtreeLength;
+            }
+
+            if (Length)
+            {
+                ::blake3_hasher_update(&this->Context, Input, Length);
+            }
+        }
+
+        SIZE_T GetParallelCapacity()
+        {
+            return this->NumberOfThreads
+                * Blake3PartsPerThread
+                * Blake3PartSize;
+        }
+
+        bool PrepareParallel()
+        {
+            if (this->NumberOfThreads <= 1)
+            {
+                return false;
+            }
+            if (this->Work)
+            {
+                return true;
+            }
+
+            SIZE_T Capacity = this->GetParallelCapacity();
+            try
+            {
+                this->Buffer.resize(Capacity);
+                this->PartCvs.resize(
+                    (Capacity / Blake3PartSize) * BLAKE3_OUT_LEN);
+            }
+            catch (const std::bad_alloc&)
+            {
+                this->Buffer.clear();
+                this->PartCvs.clear();
+                this->NumberOfThreads = 1;
+                return false;
+            }
+
+            this->Work = ::CreateThreadpoolWork(
+                Blake3::HashPartsCallback,
+                this,
+                nullptr);
+            if (!this->Work)
+            {
+                this->NumberOfThreads = 1;
+                return false;
+            }
+            return true;
+        }
+
+        void ReleaseParallel()
+        {
+            if (this->Work)
+            {
+                ::CloseThreadpoolWork(this->Work);
+                this->Work = nullptr;
+            }
+            std::vector<std::uint8_t>().swap(this->Buffer);
+            std::vector<std::uint8_t>().swap(this->PartCvs);
+            this->BufferLength = 0;
+        }
+
+        void FlushBuffer()
+        {
+            if (this->BufferLength)
+            {
+                this->ParallelUpdate(this->Buffer.data(), this->BufferLength);
+                this->BufferLength = 0;
+            }
+        }
+
     public:
 
         Blake3()
         {
+            // The caller can run several hashers at the same time, so the
+            // hasher uses own threads only if "mt" property asks for them.
+            this->NumberOfThreads = 1;
             this->Init();
         }
 
+        ~Blake3()
+        {
+            this->ReleaseParallel();
+        }
+
         void STDMETHODCALLTYPE Init()
         {
             ::blake3_hasher_init(
                 &this->Context);
+            this->BufferLength = 0;
+            this->InputLength = 0;
         }
 
         void STDMETHODCALLTYPE Update(
             _In_ LPCVOID Data,
             _In_ UINT32 Size)
         {
-            ::blake3_hasher_update(
-                &this->Context,
-                Data,
-                Size);
+            if (!this->Work)
+            {
+                // The input which is too small to be split is hashed by the
+                // library, so the buffer isn't allocated for small files.
+                this->InputLength += Size;
+                if (this->InputLength < this->GetParallelCapacity()
+                    || !this->PrepareParallel())
+                {
+                    ::blake3_hasher_update(
+                        &this->Context,
+                        Data,
+                        Size);
+                    return;
+                }
+            }
+
+            const std::uint8_t* Input = static_cast<const std::uint8_t*>(Data);
+            SIZE_T Length = Size;
+            while (Length)
+            {
+                SIZE_T Capacity = this->Buffer.size();
+                if (!this->BufferLength && Length >= Capacity)
+                {
+                    // Large blocks are hashed in place without buffering.
+                    this->ParallelUpdate(Input, Capacity);
+                    Input += Capacity;
+                    Length -= Capacity;
+                    continue;
+                }
+
+                SIZE_T Take = Capacity - this->BufferLength;
+                if (Take > Length)
+                {
+                    Take = Length;
+                }
+                std::memcpy(
+                    &this->Buffer[this->BufferLength],
+                    Input,
+                    Take);
+                this->BufferLength += Take;
+                Input += Take;
+                Length -= Take;
+                if (this->BufferLength == Capacity)
+                {
+                    this->FlushBuffer();
+                }
+            }
         }
 
         void STDMETHODCALLTYPE Final(
             _Out_ PBYTE Digest)
         {
+            this->FlushBuffer();
             ::blake3_hasher_finalize(
                 &this->Context,
                 Digest,
@@ -56,6 +452,61 @@ namespace NanaZip::Codecs::Hash
         {
             return BLAKE3_OUT_LEN;
         }
+
+        HRESULT STDMETHODCALLTYPE SetCoderProperties(
+            _In_ const PROPID* PropIds,
+            _In_ REFPROPVARIANT Props,
+            _In_ UINT32 NumProps)
+        {
+            const PROPVARIANT* Values = &Props;
+            for (UINT32 i = 0; i < NumProps; ++i)
+            {
+                if (PropIds[i] != SevenZipCoderNumThreads)
+                {
+                    // Other coder properties don't affect the hash.
+                    continue;
+                }
+
+                UINT32 Threads = 0;
+                if (Values[i].vt == VT_UI4)
+                {
+                    Threads = Values[i].ulVal;
+                }
+                else if (Values[i].vt == VT_BOOL)
+                {
+                    Threads = (Values[i].boolVal == VARIANT_FALSE)
+                        ? 1
+                        : ::GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+                }
+                else
+                {
+                    return E_INVALIDARG;
+                }
+
+                if (Threads < 1)
+                {
+                    Threads = 1;
+                }
+                if (Threads > Blake3MaximumThreads)
+                {
+                    Threads = Blake3MaximumThreads;
+                }
+                if (this->Work && Threads != this->NumberOfThreads)
+                {
+                    if (this->BufferLength)
+                    {
+                        // The buffered input is split for the previous
+                        // thread count.
+                        return E_UNEXPECTED;
+                    }
+                    // The buffer is sized for the previous thread count.
+                    this->ReleaseParallel();
+                }
+                this->NumberOfThreads = Threads;
+            }
+
+            return S_OK;
+        }
     };
 
     IHasher* CreateBlake3()
@@ -3,6 +3,8 @@
 #include "../../SevenZip/CPP/7zip/Compress/StdAfx.h"
 #include "ZstdDecoder.h"
 
+#include "../../SevenZip/CPP/Windows/FileIO.h"
+
 namespace NCompress {
 namespace NZSTD {
 
@@ -15,13 +17,18 @@ CDecoder::CDecoder():
   _processedIn(0),
   _processedOut(0),
   _readSrcPos(0),
-  _readSrcLen(0)
+  _readSrcLen(0),
+  _numThreads(1),
+  _memUsage((UInt64)sizeof(size_t) << 28),
+  _ddict(NULL)
 {
   _props.clear();
 }
 
 CDecoder::~CDecoder()
 {
+  if (_ddict)
+    ZSTD_freeDDict(_ddict);
   if (_ctx) {
     ZSTD_freeDCtx(_ctx);
     MyFree(_srcBuf);
@@ -36,18 +43,74 @@ Z7_COM7F_IMF(CDecoder::SetDecoderProperties2(const Byte * prop, UInt32 size))
     _props._flags = *prop;
     // flags currently unused, todo: maybe some handling is necessary if set to not 0
     // if (_props._flags != 0) ...
-    return S_OK;
+    return SetDictionary(NULL, 0);
   // for backwards compatibility only:
   // size 3 or 5 was accepted in previous versions, so allow it here too
   // (since the old props members _ver/_level seemed to be unused anyway)
   case 3:
   case 5:
-    return S_OK;
+    return SetDictionary(NULL, 0);
   default:
+    // the props of 7z folders compressed with "dict" are followed by the dictionary
+    if (size > 5 && size - 5 <= ZSTD_DICT_SIZE_MAX)
+      return SetDictionary(prop + 5, size - 5);
     return E_NOTIMPL;
   }
 }
 
+HRESULT CDecoder::SetDictionary(const Byte * dict, size_t size)
+{
+  /* 7z calls this for each folder, so don't digest the same dictionary again */
+  if (size == _dict.Size() && (size == 0 || memcmp(dict, _dict, size) == 0))
+    return S_OK;
+
+  if (_ddict) {
+    ZSTD_freeDDict(_ddict);
+    _ddict = NULL;
+  }
+  _dict.Free();
+
+  if (size != 0) {
+    _dict.CopyFrom(dict, size);
+    _ddict = ZSTD_createDDict_byReference(_dict, size);
+    if (!_ddict) {
+      _dict.Free();
+      return E_OUTOFMEMORY;
+    }
+  }
+
+  if (_ctx) {
+    const size_t result = ZSTD_DCtx_refDDict(_ctx, _ddict);
+    if (ZSTD_isError(result))
+      return E_FAIL;
+  }
+  return S_OK;
+}
+
+HRESULT ReadDictionaryFile(const PROPVARIANT &prop, CByteBuffer &dict)
+{
+  if (prop.vt != VT_BSTR)
+    return E_INVALIDARG;
+
+  NWindows::NFile::NIO::CInFile file;
+  if (!file.Open(us2fs(prop.bstrVal)))
+    return GetLastError_noZero_HRESULT();
+
+  UInt64 fileSize;
+  if (!file.GetLength(fileSize))
+    return GetLastError_noZero_HRESULT();
+  if (fileSize == 0 || fileSize > ZSTD_DICT_SIZE_MAX)
+    return E_INVALIDARG;
+
+  dict.Alloc((size_t)fileSize);
+  size_t processed;
+  if (!file.ReadFull(dict, (size_t)fileSize, processed))
+    return GetLastError_noZero_HRESULT();
+  if (processed != fileSize)
+    return E_FAIL;
+  return S_OK;
+}
+
 HRESULT CDecoder::SetOutStreamSizeResume(const UInt64 * /*outSize*/)
 {
   _processedOut = 0;
@@ -63,14 +126,28 @@ Z7_COM7F_IMF(CDecoder::SetOutStreamSize(const UInt64 * outSize))
   return S_OK;
 }
 
-HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
-  ISequentialOutStream * outStream, ICompressProgressInfo * progress)
+static HRESULT ErrorToHRESULT(size_t result)
 {
-  size_t srcBufLen, result;
-  ZSTD_inBuffer zIn;
-  ZSTD_outBuffer zOut;
+  switch (ZSTD_getErrorCode(result)) {
+    /* @Igor: would be nice, if we have an API to store the errmsg */
+    case ZSTD_error_memory_allocation:
+      return E_OUTOFMEMORY;
+    case ZSTD_error_frameParameter_unsupported:
+    case ZSTD_error_parameter_unsupported:
+    case ZSTD_error_version_unsupported:
+      return E_NOTIMPL;
+    case ZSTD_error_frameParameter_windowTooLarge:
+    case ZSTD_error_parameter_outOfBound:
+      return E_INVALIDARG;
+    default:
+      return E_FAIL;
+  }
+}
+
+HRESULT CDecoder::CreateDecompressor()
+{
+  size_t result;
 
-  /* 1) create context */
   if (!_ctx) {
     _ctx = ZSTD_createDCtx();
     if (!_ctx)
@@ -87,21 +164,42 @@ HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
     result = ZSTD_DCtx_setParameter(_ctx, ZSTD_d_windowLogMax, ZSTD_WINDOWLOG_MAX);
     if (ZSTD_isError(result))
       return E_OUTOFMEMORY;
+
+    /* the referenced dictionary stays over the session resets */
+    result = ZSTD_DCtx_refDDict(_ctx, _ddict);
+    if (ZSTD_isError(result))
+      return E_FAIL;
   } else {
     result = ZSTD_DCtx_reset(_ctx, ZSTD_reset_session_only);
     if (ZSTD_isError(result))
       return E_FAIL;
   }
+  return S_OK;
+}
+
+/* (prefix) is input data that was already read from (inStream) */
+HRESULT CDecoder::CodeSt(ISequentialInStream * inStream,
+  ISequentialOutStream * outStream, ICompressProgressInfo * progress,
+  const Byte * prefix, size_t prefixSize)
+{
+  size_t srcBufLen, result;
+  ZSTD_inBuffer zIn;
+  ZSTD_outBuffer zOut;
 
   zOut.dst = _dstBuf;
-  srcBufLen = _srcBufSize;
 
-  /* read first input block */
-  RINOK(ReadStream(inStream, _srcBuf, &srcBufLen))
-  _processedIn += srcBufLen;
+  if (prefixSize) {
+    zIn.src = prefix;
+    zIn.size = prefixSize;
+  } else {
+    /* read first input block */
+    srcBufLen = _srcBufSize;
+    RINOK(ReadStream(inStream, _srcBuf, &srcBufLen))
+    _processedIn += srcBufLen;
 
-  zIn.src = _srcBuf;
-  zIn.size = srcBufLen;
+    zIn.src = _srcBuf;
+    zIn.size = srcBufLen;
+  }
   zIn.pos = 0;
 
   /* Main decompression Loop */
@@ -112,22 +210,8 @@ HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
       zOut.pos = 0;
 
       result = ZSTD_decompressStream(_ctx, &zOut, &zIn);
-      if (ZSTD_isError(result)) {
-        switch (ZSTD_getErrorCode(result)) {
-          /* @Igor: would be nice, if we have an API to store the errmsg */
-          case ZSTD_error_memory_allocation:
-            return E_OUTOFMEMORY;
-          case ZSTD_error_frameParameter_unsupported:
-          case ZSTD_error_parameter_unsupported:
-          case ZSTD_error_version_unsupported:
-            return E_NOTIMPL;
-          case ZSTD_error_frameParameter_windowTooLarge:
-          case ZSTD_error_parameter_outOfBound:
-            return E_INVALIDARG;
-          default:
-            return E_FAIL;
-        }
-      }
+      if (ZSTD_isError(result))
+        return ErrorToHRESULT(result);
 
       /* write decompressed result */
       if (zOut.pos) {
@@ -167,11 +251,275 @@ HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
     if (srcBufLen == 0)
       return S_OK;
 
+    zIn.src = _srcBuf;
     zIn.size = srcBufLen;
     zIn.pos = 0;
   }
 }
 
+#ifndef Z7_ST
+
+void CFrameDecoderThread::Execute()
+{
+  Result = S_OK;
+  DestSize = 0;
+
+  if (!Ctx) {
+    Ctx = ZSTD_createDCtx();
+    if (!Ctx) {
+      Result = E_OUTOFMEMORY;
+      return;
+    }
+  }
+
+  /* the main thread has checked the bound against the unpack size limit */
+  const size_t bound = (size_t)ZSTD_decompressBound(Src, SrcSize);
+  if (bound == 0)
+    return; /* skippable frame or empty frame */
+
+  try {
+    Dest.AllocAtLeast(bound);
+  } catch(...) {
+    Result = E_OUTOFMEMORY;
+    return;
+  }
+
+  /* (DDict) is read-only and shared by all threads, NULL means no dictionary */
+  const size_t result = ZSTD_decompress_usingDDict(Ctx, Dest, bound, Src, SrcSize, DDict);
+  if (ZSTD_isError(result)) {
+    Result = ErrorToHRESULT(result);
+    return;
+  }
+  DestSize = result;
+}
+
+HRESULT CDecoder::CodeMt(ISequentialInStream * inStream,
+  ISequentialOutStream * outStream, ICompressProgressInfo * progress)
+{
+  /* memory usage: input buffer + unpacked frames of one batch
+     + (context and kept output buffer) for each thread */
+  const UInt64 memPerThread = ZSTD_estimateDCtxSize() + ZSTD_MT_DEST_SIZE_KEEP;
+  size_t inBufSizeMax = ZSTD_MT_INBUF_SIZE_MAX;
+  if (inBufSizeMax > _memUsage / 4)
+    inBufSizeMax = (size_t)(_memUsage / 4);
+  if (inBufSizeMax < ZSTD_MT_INBUF_SIZE_START)
+    inBufSizeMax = ZSTD_MT_INBUF_SIZE_START;
+  const UInt64 memRem = _memUsage > inBufSizeMax ? _memUsage - inBufSizeMax : 0;
+
+  UInt32 numThreads = _numThreads;
+  {
+    /* each thread must be able to unpack at least one frame of ZSTD_MT_DEST_SIZE_KEEP */
+    const UInt64 numThreadsMax = memRem / (memPerThread + ZSTD_MT_DEST_SIZE_KEEP);
+    if (numThreads > numThreadsMax)
+      numThreads = (UInt32)numThreadsMax;
+  }
+  if (numThreads < 2)
+    return CodeSt(inStream, outStream, progress, NULL, 0);
+
+  UInt64 batchUnpackMax = memRem - memPerThread * numThreads;
+  if (batchUnpackMax > ZSTD_MT_BATCH_UNPACK_MAX)
+    batchUnpackMax = ZSTD_MT_BATCH_UNPACK_MAX;
+  /* the first frame of batch can be larger than the (batchUnpackMax) otherwise */
+  UInt64 unpackSizeMax = ZSTD_MT_UNPACK_SIZE_MAX;
+  if (unpackSizeMax > batchUnpackMax)
+    unpackSizeMax = batchUnpackMax;
+
+  if (_mtInBuf.Size() > inBufSizeMax)
+    _mtInBuf.Free();
+  if (_mtInBuf.Size() < ZSTD_MT_INBUF_SIZE_START)
+    _mtInBuf.Alloc(ZSTD_MT_INBUF_SIZE_START);
+
+  while (_threads.Size() < numThreads)
+  {
+    CFrameDecoderThread &t = _threads.AddNew();
+    WRes wres = t.Create();
+    if (wres != 0)
+    {
+      _threads.DeleteBack();
+      if (_threads.IsEmpty())
+        return HRESULT_FROM_WIN32(wres);
+      break;
+    }
+  }
+
+  size_t inPos = 0;
+  size_t inLim = 0;
+  bool inFinished = false;
+
+  size_t frameOffsets[ZSTD_THREAD_MAX];
+  size_t frameSizes[ZSTD_THREAD_MAX];
+
+  for (;;)
+  {
+    /* collect a batch of complete frames from the input buffer */
+    unsigned numFrames = 0;
+    UInt64 batchUnpackSize = 0;
+    bool needSt = false;
+    size_t framePos = inPos;
+
+    while (numFrames < _threads.Size() && numFrames < numThreads)
+    {
+      const size_t avail = inLim - framePos;
+      size_t frameSize = 0;
+      bool needInput = (avail == 0);
+
+      if (!needInput)
+      {
+        const Byte *p = _mtInBuf + framePos;
+        const unsigned long long contentSize = ZSTD_getFrameContentSize(p, avail);
+        if (contentSize != ZSTD_CONTENTSIZE_UNKNOWN
+            && contentSize != ZSTD_CONTENTSIZE_ERROR
+            && contentSize > unpackSizeMax)
+        {
+          /* large frame: no gain from buffering it */
+          needSt = true;
+          break;
+        }
+        frameSize = ZSTD_findFrameCompressedSize(p, avail);
+        if (ZSTD_isError(frameSize))
+        {
+          if (ZSTD_getErrorCode(frameSize) != ZSTD_error_srcSize_wrong)
+          {
+            /* the streaming decoder reports the data error */
+            needSt = true;
+            break;
+          }
+          needInput = true;
+        }
+      }
+
+      if (needInput)
+      {
+        if (inFinished)
+        {
+          /* (avail != 0) here is unexpected end of data */
+          if (avail != 0)
+            needSt = true;
+          break;
+        }
+        /* move the unparsed data to the start of the buffer, and read more */
+        if (inPos != 0)
+        {
+          memmove(_mtInBuf, _mtInBuf + inPos, inLim - inPos);
+          for (unsigned k = 0; k < numFrames; k++)
+            frameOffsets[k] -= inPos;
+          inLim -= inPos;
+          framePos -= inPos;
+          inPos = 0;
+        }
+        if (inLim == _mtInBuf.Size())
+        {
+          if (inLim >= inBufSizeMax)
+          {
+            /* the frame doesn't fit into the buffer */
+            if (numFrames == 0)
+              needSt = true;
+            break;
+          }
+          size_t newSize = inLim * 2;
+          if (newSize > inBufSizeMax)
+            newSize = inBufSizeMax;
+          _mtInBuf.ChangeSize_KeepData(newSize, inLim);
+        }
+        size_t size = _mtInBuf.Size() - inLim;
+        RINOK(ReadStream(inStream, _mtInBuf + inLim, &size))
+        _processedIn += size;
+        inLim += size;
+        if (size == 0)
+          inFinished = true;
+        continue;
+      }
+
+      const unsigned long long bound = ZSTD_decompressBound(_mtInBuf + framePos, frameSize);
+      if (bound == ZSTD_CONTENTSIZE_ERROR || bound > unpackSizeMax)
+      {
+        needSt = true;
+        break;
+      }
+      if (numFrames != 0 && batchUnpackSize + bound > batchUnpackMax)
+        break;
+      batchUnpackSize += bound;
+
+      frameOffsets[numFrames] = framePos;
+      frameSizes[numFrames] = frameSize;
+      numFrames++;
+      framePos += frameSize;
+    }
+
+    /* decode the batch, and write the results in order */
+    unsigned i;
+    for (i = 0; i < numFrames; i++)
+    {
+      CFrameDecoderThread &t = _threads[i];
+      t.Src = _mtInBuf + frameOffsets[i];
+      t.SrcSize = frameSizes[i];
+      t.DDict = _ddict;
+      WRes wres = t.Start();
+      if (wres != 0)
+      {
+        /* decode the remaining frames of the batch on this thread */
+        for (; i < numFrames; i++)
+        {
+          _threads[i].Src = _mtInBuf + frameOffsets[i];
+          _threads[i].SrcSize = frameSizes[i];
+          _threads[i].DDict = _ddict;
+          _threads[i].Execute();
+          _threads[i].FinishedEvent.Set();
+        }
+        break;
+      }
+    }
+
+    HRESULT res = S_OK;
+    for (i = 0; i < numFrames; i++)
+    {
+      CFrameDecoderThread &t = _threads[i];
+      t.WaitExecuteFinish();
+      if (res != S_OK)
+        continue;
+      res = t.Result;
+      if (res == S_OK && t.DestSize != 0)
+      {
+        res = WriteStream(outStream, t.Dest, t.DestSize);
+        _processedOut += t.DestSize;
+      }
+      if (res == S_OK && progress)
+        res = progress->SetRatioInfo(&_processedIn, &_processedOut);
+      /* big output buffers are not kept for next batches */
+      if (t.Dest.Size() > ZSTD_MT_DEST_SIZE_KEEP)
+        t.Dest.Free();
+    }
+    RINOK(res)
+
+    inPos = framePos;
+
+    if (needSt)
+    {
+      RINOK(CreateDecompressor())
+      return CodeSt(inStream, outStream, progress, _mtInBuf + inPos, inLim - inPos);
+    }
+
+    if (numFrames == 0 && inFinished)
+      return S_OK;
+  }
+}
+
+#endif
+
+HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
+  ISequentialOutStream * outStream, ICompressProgressInfo * progress)
+{
+  /* 1) create context */
+  RINOK(CreateDecompressor())
+
+#ifndef Z7_ST
+  if (_numThreads > 1)
+    return CodeMt(inStream, outStream, progress);
+#endif
+
+  return CodeSt(inStream, outStream, progress, NULL, 0);
+}
+
 Z7_COM7F_IMF(CDecoder::Code(ISequentialInStream * inStream, ISequentialOutStream * outStream,
   const UInt64 * /*inSize */, const UInt64 *outSize, ICompressProgressInfo * progress))
 {
@@ -209,6 +557,7 @@ Z7_COM7F_IMF(CDecoder::Read(void *data, UInt32 size, UInt32 *processedSize))
     if (!_dstBuf)
       return E_OUTOFMEMORY;
     ZSTD_DCtx_setParameter(_ctx, ZSTD_d_windowLogMax, ZSTD_WINDOWLOG_MAX);
+    ZSTD_DCtx_refDDict(_ctx, _ddict);
     _readSrcPos = 0;
     _readSrcLen = 0;
   }
@@ -257,8 +606,18 @@ Z7_COM7F_IMF(CDecoder::Read(void *data, UInt32 size, UInt32 *processedSize))
 }
 #endif
 
-Z7_COM7F_IMF(CDecoder::SetNumberOfThreads(UInt32 /* numThreads */))
+Z7_COM7F_IMF(CDecoder::SetNumberOfThreads(UInt32 numThreads))
+{
+  const UInt32 kNumThreadsMax = ZSTD_THREAD_MAX;
+  if (numThreads < 1) numThreads = 1;
+  if (numThreads > kNumThreadsMax) numThreads = kNumThreadsMax;
+  _numThreads = numThreads;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CDecoder::SetMemLimit(UInt64 memUsage))
 {
+  _memUsage = memUsage;
   return S_OK;
 }
 
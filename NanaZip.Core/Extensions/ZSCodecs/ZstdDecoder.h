@@ -7,12 +7,17 @@
 
 #include "../../SevenZip/CPP/Windows/System.h"
 #include "../../SevenZip/CPP/Common/Common.h"
+#include "../../SevenZip/CPP/Common/MyBuffer.h"
 #include "../../SevenZip/CPP/Common/MyCom.h"
 #include "../../SevenZip/CPP/7zip/ICoder.h"
 #include "../../SevenZip/CPP/7zip/Common/StreamUtils.h"
 #include "../../SevenZip/CPP/7zip/Common/RegisterCodec.h"
 #include "../../SevenZip/CPP/7zip/Common/ProgressMt.h"
 
+#ifndef Z7_ST
+#include "../../SevenZip/CPP/7zip/Common/VirtThread.h"
+#endif
+
 /**
  * possible return values @ 7zip:
  * S_OK / S_FALSE
@@ -28,9 +33,61 @@
 #define ZSTD_LEVEL_MAX     22
 #define ZSTD_THREAD_MAX   256
 
+/**
+ * zstd seekable format (contrib/seekable_format in zstd):
+ * the seek table is a skippable frame at the end of the stream,
+ * followed by its footer (number of frames, descriptor, magic)
+ */
+#define ZSTD_SEEKABLE_MAGICNUMBER     0x8F92EAB1
+#define ZSTD_SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEKABLE_MAXFRAMES       0x8000000U
+#define ZSTD_SEEKABLE_MAX_FRAME_DECOMPRESSED_SIZE 0x40000000U
+#define ZSTD_SEEKABLE_FRAME_SIZE_MIN  ((UInt32)1 << 12)
+#define ZSTD_seekTableFooterSize      9
+#define ZSTD_SEEKABLE_CHECKSUM_FLAG   0x80
+
+/* max size of a dictionary (zstd --train output) given by the "dict" property */
+#define ZSTD_DICT_SIZE_MAX  ((UInt32)1 << 26)
+
 namespace NCompress {
 namespace NZSTD {
 
+/* reads the dictionary file, the path is given as VT_BSTR by NCoderPropID::kDictionary */
+HRESULT ReadDictionaryFile(const PROPVARIANT &prop, CByteBuffer &dict);
+
+#ifndef Z7_ST
+/* frame-parallel decoding:
+ * independent frames (pzstd, zstd -B, concatenated .zst) are decoded
+ * concurrently, frames larger than these limits fall back to streaming.
+ * The limits are reduced further to fit into the memory limit (-memuse) */
+#define ZSTD_MT_INBUF_SIZE_START ((size_t)1 << 22)
+#define ZSTD_MT_INBUF_SIZE_MAX    ((size_t)1 << 27)
+#define ZSTD_MT_UNPACK_SIZE_MAX   ((UInt64)1 << 27)
+#define ZSTD_MT_BATCH_UNPACK_MAX  ((UInt64)1 << 29)
+/* the output buffer of the thread is kept for next batch, if it's not larger */
+#define ZSTD_MT_DEST_SIZE_KEEP    ((size_t)1 << 22)
+
+struct CFrameDecoderThread Z7_final: public CVirtThread
+{
+  ZSTD_DCtx* Ctx;
+  const Byte *Src;
+  size_t SrcSize;
+  const ZSTD_DDict *DDict;
+  CByteBuffer Dest;
+  size_t DestSize;
+  HRESULT Result;
+
+  CFrameDecoderThread(): Ctx(NULL), Src(NULL), SrcSize(0), DDict(NULL), DestSize(0), Result(S_OK) {}
+  ~CFrameDecoderThread()
+  {
+    CVirtThread::WaitThreadFinish();
+    if (Ctx)
+      ZSTD_freeDCtx(Ctx);
+  }
+  virtual void Execute() Z7_override;
+};
+#endif
+
 struct DProps
 {
   DProps() { clear (); }
@@ -46,6 +103,7 @@ class CDecoder Z7_final:
   public ICompressCoder,
   public ICompressSetDecoderProperties2,
   public ICompressSetCoderMt,
+  public ICompressSetMemLimit,
   public ICompressSetOutStreamSize,
 #ifndef Z7_NO_READ_FROM_CODER
   public ICompressSetInStream,
@@ -68,14 +126,31 @@ public:
   UInt64 _processedOut;
   size_t _readSrcPos;  // current read position in _srcBuf (for Read())
   size_t _readSrcLen;  // valid bytes in _srcBuf (for Read())
+  UInt32 _numThreads;
+  UInt64 _memUsage;
 
+  /* the digested dictionary is kept while the same dictionary is set again */
+  CByteBuffer _dict;
+  ZSTD_DDict* _ddict;
+
+#ifndef Z7_ST
+  CObjectVector<CFrameDecoderThread> _threads;
+  CByteBuffer _mtInBuf;
+
+  HRESULT CodeMt(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress);
+#endif
+  HRESULT CreateDecompressor();
+  HRESULT CodeSt(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress,
+      const Byte *prefix, size_t prefixSize);
   HRESULT CodeSpec(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress);
   HRESULT CodeResume(ISequentialOutStream * outStream, const UInt64 * outSize, ICompressProgressInfo * progress);
   HRESULT SetOutStreamSizeResume(const UInt64 *outSize);
+  HRESULT SetDictionary(const Byte *dict, size_t size);
 
   Z7_COM_QI_BEGIN2(ICompressCoder)
   Z7_COM_QI_ENTRY(ICompressSetDecoderProperties2)
   Z7_COM_QI_ENTRY(ICompressSetCoderMt)
+  Z7_COM_QI_ENTRY(ICompressSetMemLimit)
   Z7_COM_QI_ENTRY(ICompressSetOutStreamSize)
 #ifndef Z7_NO_READ_FROM_CODER
   Z7_COM_QI_ENTRY(ICompressSetInStream)
@@ -88,6 +163,7 @@ public:
   Z7_IFACE_COM7_IMP(ICompressSetDecoderProperties2)
 public:
   Z7_IFACE_COM7_IMP(ICompressSetCoderMt)
+  Z7_IFACE_COM7_IMP(ICompressSetMemLimit)
 
   Z7_IFACE_COM7_IMP(ICompressSetOutStreamSize)
 #ifndef Z7_NO_READ_FROM_CODER
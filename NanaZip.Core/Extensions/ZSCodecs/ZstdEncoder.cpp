@@ -1,6 +1,7 @@
 ﻿// (C) 2016 - 2020 Tino Reichardt
 
 #include "../../SevenZip/CPP/7zip/Compress/StdAfx.h"
+#include "../../SevenZip/C/CpuArch.h"
 #include "ZstdEncoder.h"
 #include "ZstdDecoder.h"
 
@@ -34,7 +35,8 @@ CEncoder::CEncoder():
   _LdmHashRateLog(-1),
   dictIDFlag(-1),
   checksumFlag(-1),
-  unpackSize(0)
+  unpackSize(0),
+  _FrameSize(0)
 {
   _props.clear();
 }
@@ -51,6 +53,7 @@ CEncoder::~CEncoder()
 Z7_COM7F_IMF(CEncoder::SetCoderProperties(const PROPID * propIDs, const PROPVARIANT * coderProps, UInt32 numProps))
 {
   _props.clear();
+  _dict.Free();
 
   for (UInt32 i = 0; i < numProps; i++)
   {
@@ -64,6 +67,24 @@ Z7_COM7F_IMF(CEncoder::SetCoderProperties(const PROPID * propIDs, const PROPVARI
         SetNumberOfThreads(v);
         break;
       }
+    case NCoderPropID::kBlockSize:
+      {
+        /* seekable format: compress to independent frames of this size */
+        UInt64 size = v;
+        if (prop.vt == VT_UI8)
+          size = prop.uhVal.QuadPart;
+        if (size != 0 && size < ZSTD_SEEKABLE_FRAME_SIZE_MIN)
+          size = ZSTD_SEEKABLE_FRAME_SIZE_MIN;
+        if (size > ZSTD_SEEKABLE_MAX_FRAME_DECOMPRESSED_SIZE)
+          size = ZSTD_SEEKABLE_MAX_FRAME_DECOMPRESSED_SIZE;
+        _FrameSize = (UInt32)size;
+        break;
+      }
+    case NCoderPropID::kDictionary:
+      {
+        RINOK(ReadDictionaryFile(prop, _dict))
+        break;
+      }
     case NCoderPropID::kStrategy:
       {
         if (v < 1) v = 1;
@@ -244,7 +265,10 @@ Z7_COM7F_IMF(CEncoder::SetCoderPropertiesOpt(const PROPID *propIDs,
 
 Z7_COM7F_IMF(CEncoder::WriteCoderProperties(ISequentialOutStream * outStream))
 {
-  return WriteStream(outStream, &_props, sizeof (_props));
+  RINOK(WriteStream(outStream, &_props, sizeof (_props)))
+  if (_dict.Size() != 0)
+    return WriteStream(outStream, _dict, _dict.Size());
+  return S_OK;
 }
 
 Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
@@ -388,6 +412,12 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
       if (ZSTD_isError(err)) return E_INVALIDARG;
     }
 
+    /* the dictionary is sticky, it's used for all following frames */
+    if (_dict.Size() != 0) {
+      err = ZSTD_CCtx_loadDictionary(_ctx, _dict, _dict.Size());
+      if (ZSTD_isError(err)) return E_INVALIDARG;
+    }
+
     //err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_literalCompressionMode, (int)ZSTD_ps_auto);
     //if (ZSTD_isError(err)) return E_INVALIDARG;
 
@@ -395,34 +425,43 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
     //if (ZSTD_isError(err)) return E_INVALIDARG;
   }
 
+  _seekTable.Clear();
+  UInt32 frameIn = 0;
+  UInt64 frameOutStart = 0;
+
   for (;;) {
 
     /* read input */
     srcSize = _srcBufSize;
+    if (_FrameSize && srcSize > _FrameSize - frameIn)
+      srcSize = _FrameSize - frameIn;
     RINOK(ReadStream(inStream, _srcBuf, &srcSize))
 
     /* eof */
-    if (srcSize == 0)
+    if (srcSize == 0) {
+      /* the previous seekable frame was closed at the eof exactly */
+      if (_FrameSize && frameIn == 0 && !_seekTable.IsEmpty())
+        return WriteSeekTable(outStream);
       ZSTD_todo = ZSTD_e_end;
+    }
 
     /* compress data */
     _processedIn += srcSize;
+    frameIn += (UInt32)srcSize;
+
+    /* the seekable frame is full */
+    if (_FrameSize && frameIn == _FrameSize)
+      ZSTD_todo = ZSTD_e_end;
+
+    inBuff.src = _srcBuf;
+    inBuff.size = srcSize;
+    inBuff.pos = 0;
 
     for (;;) {
       outBuff.dst = _dstBuf;
       outBuff.size = _dstBufSize;
       outBuff.pos = 0;
 
-      if (ZSTD_todo == ZSTD_e_continue) {
-        inBuff.src = _srcBuf;
-        inBuff.size = srcSize;
-        inBuff.pos = 0;
-      } else {
-        inBuff.src = 0;
-        inBuff.size = srcSize;
-        inBuff.pos = 0;
-      }
-
       err = ZSTD_compressStream2(_ctx, &outBuff, &inBuff, ZSTD_todo);
       if (ZSTD_isError(err)) {
         switch (ZSTD_getErrorCode(err)) {
@@ -450,17 +489,56 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
       if (progress)
         RINOK(progress->SetRatioInfo(&_processedIn, &_processedOut))
 
-      /* done */
+      /* frame is done */
       if (ZSTD_todo == ZSTD_e_end && err == 0)
-        return S_OK;
+        break;
 
       /* need more input */
-      if (inBuff.pos == inBuff.size)
+      if (ZSTD_todo == ZSTD_e_continue && inBuff.pos == inBuff.size)
         break;
     }
+
+    if (ZSTD_todo == ZSTD_e_end) {
+      if (!_FrameSize)
+        return S_OK;
+
+      if (_seekTable.Size() >= ZSTD_SEEKABLE_MAXFRAMES * 2)
+        return E_INVALIDARG;
+      _seekTable.Add((UInt32)(_processedOut - frameOutStart));
+      _seekTable.Add(frameIn);
+      frameOutStart = _processedOut;
+      frameIn = 0;
+
+      if (srcSize == 0)
+        return WriteSeekTable(outStream);
+      ZSTD_todo = ZSTD_e_continue;
+    }
   }
 }
 
+HRESULT CEncoder::WriteSeekTable(ISequentialOutStream * outStream)
+{
+  const unsigned numFrames = _seekTable.Size() / 2;
+  const size_t tableSize = 8 + (size_t)numFrames * 8 + ZSTD_seekTableFooterSize;
+
+  CByteBuffer buf(tableSize);
+  Byte *p = buf;
+  SetUi32(p, ZSTD_SEEKABLE_SKIPPABLE_MAGIC)
+  SetUi32(p + 4, (UInt32)(tableSize - 8))
+  p += 8;
+  for (unsigned i = 0; i < numFrames; i++, p += 8) {
+    SetUi32(p, _seekTable[i * 2])
+    SetUi32(p + 4, _seekTable[i * 2 + 1])
+  }
+  SetUi32(p, (UInt32)numFrames)
+  p[4] = 0; /* descriptor: no checksums, zstd frames have their own */
+  SetUi32(p + 5, ZSTD_SEEKABLE_MAGICNUMBER)
+
+  RINOK(WriteStream(outStream, buf, tableSize))
+  _processedOut += tableSize;
+  return S_OK;
+}
+
 Z7_COM7F_IMF(CEncoder::SetNumberOfThreads(UInt32 numThreads))
 {
   const UInt32 kNumThreadsMax = ZSTD_THREAD_MAX;
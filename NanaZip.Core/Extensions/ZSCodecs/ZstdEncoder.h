@@ -6,7 +6,9 @@
 #include <zstd.h>
 
 #include "../../SevenZip/CPP/Common/Common.h"
+#include "../../SevenZip/CPP/Common/MyBuffer.h"
 #include "../../SevenZip/CPP/Common/MyCom.h"
+#include "../../SevenZip/CPP/Common/MyVector.h"
 #include "../../SevenZip/CPP/7zip/ICoder.h"
 #include "../../SevenZip/CPP/7zip/Common/StreamUtils.h"
 
@@ -73,6 +75,15 @@ public:
   int checksumFlag;
   UInt64 unpackSize;
 
+  /* seekable format: max unpacked size of each frame, 0 = single frame */
+  UInt32 _FrameSize;
+  CRecordVector<UInt32> _seekTable; /* pairs of compressed / decompressed frame sizes */
+
+  HRESULT WriteSeekTable(ISequentialOutStream *outStream);
+
+  /* dictionary given by the "dict" property, 7z stores it after the props */
+  CByteBuffer _dict;
+
   CEncoder();
   ~CEncoder();
 };
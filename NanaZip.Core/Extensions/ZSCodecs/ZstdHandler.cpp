@@ -22,11 +22,19 @@ using namespace NWindows;
 namespace NArchive {
 namespace NZSTD {
 
-Z7_CLASS_IMP_CHandler_IInArchive_3(
+struct CFrameInfo
+{
+  UInt64 PackPos;
+  UInt64 UnpackPos;
+};
+
+Z7_CLASS_IMP_CHandler_IInArchive_4(
   IArchiveOpenSeq,
+  IInArchiveGetStream,
   IOutArchive,
   ISetProperties
 )
+public:
   CMyComPtr<IInStream> _stream;
   CMyComPtr<ISequentialInStream> _seqStream;
 
@@ -41,8 +49,30 @@ Z7_CLASS_IMP_CHandler_IInArchive_3(
   UInt64 _unpackSize;
 
   CSingleMethodProps _props;
+
+  /* frames from the seek table of seekable format, with end position as last item */
+  CRecordVector<CFrameInfo> _frames;
+  UInt32 _maxFrameSize;
+
+  HRESULT ReadSeekTable(IInStream *stream);
+
+  /* dictionary given by the "dict" property, needed for frames compressed with it */
+  CByteBuffer _dict;
+
+  HRESULT LoadDictionary();
 };
 
+HRESULT CHandler::LoadDictionary()
+{
+  const int i = _props.FindProp(NCoderPropID::kDictionary);
+  if (i < 0)
+  {
+    _dict.Free();
+    return S_OK;
+  }
+  return NCompress::NZSTD::ReadDictionaryFile(_props.Props[(unsigned)i].Value, _dict);
+}
+
 static const Byte kProps[] =
 {
   kpidSize,
@@ -58,8 +88,14 @@ static const Byte kArcProps[] =
 IMP_IInArchive_Props
 IMP_IInArchive_ArcProps
 
-Z7_COM7F_IMF(CHandler::GetArchiveProperty(PROPID /*propID*/, PROPVARIANT * /*value*/))
+Z7_COM7F_IMF(CHandler::GetArchiveProperty(PROPID propID, PROPVARIANT *value))
 {
+  NCOM::CPropVariant prop;
+  switch (propID)
+  {
+    case kpidNumBlocks: if (!_frames.IsEmpty()) prop = (UInt32)(_frames.Size() - 1); break;
+  }
+  prop.Detach(value);
   return S_OK;
 }
 
@@ -115,6 +151,78 @@ API_FUNC_static_IsArc IsArc_zstd(const Byte *p, size_t size)
 }
 }
 
+HRESULT CHandler::ReadSeekTable(IInStream *stream)
+{
+  UInt64 fileSize;
+  RINOK(InStream_GetSize_SeekToEnd(stream, fileSize))
+  if (fileSize < 8 + ZSTD_seekTableFooterSize)
+    return S_OK;
+
+  Byte footer[ZSTD_seekTableFooterSize];
+  RINOK(InStream_SeekSet(stream, fileSize - ZSTD_seekTableFooterSize))
+  RINOK(ReadStream_FALSE(stream, footer, ZSTD_seekTableFooterSize))
+  if (GetUi32(footer + 5) != ZSTD_SEEKABLE_MAGICNUMBER)
+    return S_OK;
+
+  const UInt32 numFrames = GetUi32(footer);
+  const Byte descriptor = footer[4];
+  if ((descriptor & 0x7C) != 0 || numFrames > ZSTD_SEEKABLE_MAXFRAMES)
+    return S_OK;
+  const unsigned entrySize = (descriptor & ZSTD_SEEKABLE_CHECKSUM_FLAG) ? 12 : 8;
+  const UInt64 tableSize = 8 + (UInt64)numFrames * entrySize + ZSTD_seekTableFooterSize;
+  if (tableSize > fileSize)
+    return S_OK;
+
+  CByteBuffer table((size_t)tableSize);
+  RINOK(InStream_SeekSet(stream, fileSize - tableSize))
+  RINOK(ReadStream_FALSE(stream, table, (size_t)tableSize))
+  if (GetUi32(table) != ZSTD_SEEKABLE_SKIPPABLE_MAGIC
+      || GetUi32(table + 4) != tableSize - 8)
+    return S_OK;
+
+  CRecordVector<CFrameInfo> frames;
+  frames.ClearAndReserve(numFrames + 1);
+  UInt64 packPos = 0;
+  UInt64 unpackPos = 0;
+  UInt32 maxFrameSize = 0;
+  const Byte *p = table + 8;
+  for (UInt32 i = 0; i < numFrames; i++, p += entrySize)
+  {
+    CFrameInfo frame;
+    frame.PackPos = packPos;
+    frame.UnpackPos = unpackPos;
+    frames.AddInReserved(frame);
+    const UInt32 packSize = GetUi32(p);
+    const UInt32 unpackSize = GetUi32(p + 4);
+    if (maxFrameSize < unpackSize)
+      maxFrameSize = unpackSize;
+    /* zstd frame can't be larger than the bound for its data */
+    if (packSize > ZSTD_COMPRESSBOUND(unpackSize))
+      return S_OK;
+    packPos += packSize;
+    unpackPos += unpackSize;
+  }
+  {
+    CFrameInfo frame;
+    frame.PackPos = packPos;
+    frame.UnpackPos = unpackPos;
+    frames.AddInReserved(frame);
+  }
+
+  /* the seek table must describe all data before it */
+  if (packPos != fileSize - tableSize
+      || maxFrameSize > ZSTD_SEEKABLE_MAX_FRAME_DECOMPRESSED_SIZE)
+    return S_OK;
+
+  _frames = frames;
+  _maxFrameSize = maxFrameSize;
+  _packSize = fileSize;
+  _packSize_Defined = true;
+  _unpackSize = unpackPos;
+  _unpackSize_Defined = true;
+  return S_OK;
+}
+
 Z7_COM7F_IMF(CHandler::Open(IInStream *stream, const UInt64 *, IArchiveOpenCallback *))
 {
   COM_TRY_BEGIN
@@ -127,6 +235,7 @@ Z7_COM7F_IMF(CHandler::Open(IInStream *stream, const UInt64 *, IArchiveOpenCallb
     _isArc = true;
     _stream = stream;
     _seqStream = stream;
+    RINOK(ReadSeekTable(stream))
     RINOK(_stream->Seek(0, STREAM_SEEK_SET, NULL));
   }
   return S_OK;
@@ -153,11 +262,172 @@ Z7_COM7F_IMF(CHandler::Close())
 
   _packSize = 0;
 
+  _frames.Clear();
+  _maxFrameSize = 0;
+
   _seqStream.Release();
   _stream.Release();
   return S_OK;
 }
 
+Z7_CLASS_IMP_IInStream(
+  CInStream
+)
+  UInt64 _virtPos;
+public:
+  UInt64 Size;
+  UInt64 _cacheStartPos;
+  size_t _cacheSize;
+  CByteBuffer _cache;
+  CByteBuffer _packBuf;
+  ZSTD_DCtx *_ctx;
+
+  CMyComPtr2<IInArchive, CHandler> _handlerSpec;
+
+  void InitAndSeek()
+  {
+    _virtPos = 0;
+    _cacheStartPos = 0;
+    _cacheSize = 0;
+  }
+
+  CInStream(): _ctx(NULL) {}
+  ~CInStream()
+  {
+    if (_ctx)
+      ZSTD_freeDCtx(_ctx);
+  }
+};
+
+static unsigned FindFrame(const CFrameInfo *frames, unsigned numFrames, UInt64 pos)
+{
+  unsigned left = 0, right = numFrames;
+  for (;;)
+  {
+    const unsigned mid = (left + right) / 2;
+    if (mid == left)
+      return left;
+    if (pos < frames[mid].UnpackPos)
+      right = mid;
+    else
+      left = mid;
+  }
+}
+
+Z7_COM7F_IMF(CInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+  COM_TRY_BEGIN
+
+  if (processedSize)
+    *processedSize = 0;
+  if (size == 0)
+    return S_OK;
+  if (_virtPos >= Size)
+    return S_OK;
+  {
+    const UInt64 rem = Size - _virtPos;
+    if (size > rem)
+      size = (UInt32)rem;
+  }
+
+  if (_virtPos < _cacheStartPos || _virtPos >= _cacheStartPos + _cacheSize)
+  {
+    const CRecordVector<CFrameInfo> &frames = _handlerSpec->_frames;
+    const unsigned fi = FindFrame(frames.ConstData(), frames.Size() - 1, _virtPos);
+    const CFrameInfo &frame = frames[fi];
+    const size_t packSize = (size_t)(frames[fi + 1].PackPos - frame.PackPos);
+    const size_t unpackSize = (size_t)(frames[fi + 1].UnpackPos - frame.UnpackPos);
+    if (_cache.Size() < unpackSize)
+      return E_FAIL;
+
+    _cacheSize = 0;
+
+    if (!_ctx)
+    {
+      _ctx = ZSTD_createDCtx();
+      if (!_ctx)
+        return E_OUTOFMEMORY;
+      const CByteBuffer &dict = _handlerSpec->_dict;
+      if (dict.Size() != 0)
+        if (ZSTD_isError(ZSTD_DCtx_loadDictionary_byReference(_ctx, dict, dict.Size())))
+          return E_OUTOFMEMORY;
+    }
+    _packBuf.AllocAtLeast(packSize);
+    RINOK(InStream_SeekSet(_handlerSpec->_stream, frame.PackPos))
+    RINOK(ReadStream_FALSE(_handlerSpec->_stream, _packBuf, packSize))
+
+    const size_t result = ZSTD_decompressDCtx(_ctx, _cache, unpackSize, _packBuf, packSize);
+    if (ZSTD_isError(result) || result != unpackSize)
+      return S_FALSE;
+    _cacheStartPos = frame.UnpackPos;
+    _cacheSize = unpackSize;
+  }
+
+  {
+    const size_t offset = (size_t)(_virtPos - _cacheStartPos);
+    const size_t rem = _cacheSize - offset;
+    if (size > rem)
+      size = (UInt32)rem;
+    memcpy(data, _cache.ConstData() + offset, size);
+    _virtPos += size;
+    if (processedSize)
+      *processedSize = size;
+    return S_OK;
+  }
+
+  COM_TRY_END
+}
+
+Z7_COM7F_IMF(CInStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
+{
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _virtPos; break;
+    case STREAM_SEEK_END: offset += Size; break;
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _virtPos = (UInt64)offset;
+  if (newPosition)
+    *newPosition = (UInt64)offset;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CHandler::GetStream(UInt32 index, ISequentialInStream **stream))
+{
+  COM_TRY_BEGIN
+
+  *stream = NULL;
+
+  if (index != 0)
+    return E_INVALIDARG;
+
+  /* random access is possible only with seek table */
+  if (_frames.IsEmpty() || !_stream)
+    return S_FALSE;
+
+  /* the frame size is taken from the seek table, that can be crafted.
+     So we don't allocate the frame cache over the memory limit. */
+  if (_maxFrameSize > _props._memUsage_Decompress)
+    return S_FALSE;
+
+  RINOK(LoadDictionary())
+
+  CMyComPtr2<ISequentialInStream, CInStream> spec;
+  spec.Create_if_Empty();
+  spec->_cache.Alloc(_maxFrameSize);
+  spec->_handlerSpec.SetFromCls(this);
+  spec->Size = _unpackSize;
+  spec->InitAndSeek();
+
+  *stream = spec.Detach();
+  return S_OK;
+
+  COM_TRY_END
+}
+
 Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testMode, IArchiveExtractCallback *extractCallback))
 {
@@ -187,6 +457,12 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   NCompress::NZSTD::CDecoder *decoderSpec = new NCompress::NZSTD::CDecoder;
   CMyComPtr<ICompressCoder> decoder = decoderSpec;
   decoderSpec->SetInStream(_seqStream);
+  RINOK(LoadDictionary())
+  RINOK(decoderSpec->SetDictionary(_dict, _dict.Size()))
+#ifndef Z7_ST
+  decoderSpec->SetNumberOfThreads(_props._numThreads);
+#endif
+  decoderSpec->SetMemLimit(_props._memUsage_Decompress);
 
   CDummyOutStream *outStreamSpec = new CDummyOutStream;
   CMyComPtr<ISequentialOutStream> outStream(outStreamSpec);
@@ -7,6 +7,13 @@
 #include "../../../Common/ComTry.h"
 
 #include "../../Common/ProgressUtils.h"
+// **************** NanaZip Modification Start ****************
+#include "../../Common/StreamObjects.h"
+#include "../../Common/StreamUtils.h"
+#if !defined(Z7_ST) && !defined(Z7_SFX)
+#include "../../Common/VirtThread.h"
+#endif
+// **************** NanaZip Modification End ****************
 
 #include "7zDecode.h"
 #include "7zHandler.h"
@@ -226,6 +233,415 @@ Z7_COM7F_IMF(CFolderOutStream::GetSubStreamSize(UInt64 subStream, UInt64 *value)
 */
 
 
+// **************** NanaZip Modification Start ****************
+
+struct CExtractGroup
+{
+  UInt32 StartFileIndex;
+  UInt32 NumSolidFiles;
+  CNum FolderIndex;
+  UInt64 UnpackSize;
+  UInt64 PackSize;
+};
+
+/* it returns the group of files from (indices[itemIndex]) that are extracted
+   with one call of CDecoder::Decode() */
+
+static void GetExtractGroup(const CDbEx &db, const UInt32 *indices, UInt32 numItems,
+    UInt32 itemIndex, CExtractGroup &g)
+{
+  UInt32 fileIndex = indices ? indices[itemIndex] : itemIndex;
+  const CNum folderIndex = db.FileIndexToFolderIndexMap[fileIndex];
+  g.FolderIndex = folderIndex;
+  g.NumSolidFiles = 1;
+  g.UnpackSize = 0;
+  g.PackSize = 0;
+
+  if (folderIndex != kNumNoIndex)
+  {
+    g.PackSize = db.GetFolderFullPackSize(folderIndex);
+    UInt32 nextFile = fileIndex + 1;
+    fileIndex = db.FolderStartFileIndex[folderIndex];
+    UInt32 k;
+
+    for (k = itemIndex + 1; k < numItems; k++)
+    {
+      const UInt32 fileIndex2 = indices ? indices[k] : k;
+      if (db.FileIndexToFolderIndexMap[fileIndex2] != folderIndex
+          || fileIndex2 < nextFile)
+        break;
+      nextFile = fileIndex2 + 1;
+    }
+    
+    g.NumSolidFiles = k - itemIndex;
+    
+    for (k = fileIndex; k < nextFile; k++)
+      g.UnpackSize += db.Files[k].Size;
+  }
+  g.StartFileIndex = fileIndex;
+}
+
+
+#if !defined(Z7_ST) && !defined(Z7_SFX)
+
+/*
+Multi-threaded extraction:
+  The threads decode several folders at same time to memory buffers.
+  Each thread uses its own CDecoder object and its own view of archive stream.
+  The main thread calls IArchiveExtractCallback methods in the order of items,
+  and it writes the decoded data of folder to CFolderOutStream.
+  Encrypted folders (they can require password callback) and big folders
+  are decoded by the main thread as before.
+  The memory buffers of all threads use no more than half of
+  memory allowed for decompression.
+*/
+
+static const unsigned kMtNumThreadsMax = 64;
+
+Z7_CLASS_IMP_COM_0(
+  CSharedInStream
+)
+public:
+  CMyComPtr<IInStream> Stream;
+  UInt64 Pos;
+  UInt64 Size;
+  NWindows::NSynchronization::CCriticalSection CriticalSection;
+};
+
+
+Z7_CLASS_IMP_IInStream(
+  CSharedInStreamView
+)
+  CSharedInStream *_glob;
+  CMyComPtr<IUnknown> _globRef;
+  UInt64 _pos;
+public:
+  void Init(CSharedInStream *glob)
+  {
+    _globRef = glob;
+    _glob = glob;
+    _pos = 0;
+  }
+};
+
+Z7_COM7F_IMF(CSharedInStreamView::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+  if (processedSize)
+    *processedSize = 0;
+  if (size == 0 || _pos >= _glob->Size)
+    return S_OK;
+  NWindows::NSynchronization::CCriticalSectionLock lock(_glob->CriticalSection);
+  if (_pos != _glob->Pos)
+  {
+    _glob->Pos = (UInt64)(Int64)-1;
+    RINOK(InStream_SeekSet(_glob->Stream, _pos))
+    _glob->Pos = _pos;
+  }
+  UInt32 realProcessedSize = 0;
+  const HRESULT res = _glob->Stream->Read(data, size, &realProcessedSize);
+  _pos += realProcessedSize;
+  _glob->Pos = _pos;
+  if (processedSize)
+    *processedSize = realProcessedSize;
+  return res;
+}
+
+Z7_COM7F_IMF(CSharedInStreamView::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
+{
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _pos; break;
+    case STREAM_SEEK_END: offset += _glob->Size; break;
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _pos = (UInt64)offset;
+  if (newPosition)
+    *newPosition = (UInt64)offset;
+  return S_OK;
+}
+
+
+class CFolderThread Z7_final: public CVirtThread
+{
+public:
+  CDecoder *Decoder;
+  CMyComPtr<IInStream> InStream;
+  const CDbEx *Db;
+  UInt32 NumThreads;
+  UInt64 MemUsage;
+  DECL_EXTERNAL_CODECS_LOC_VARS_DECL
+
+  UInt32 ItemIndex;
+  CNum FolderIndex;
+  UInt64 UnpackSize;
+  CByteBuffer Buf;
+  size_t OutSize;
+  HRESULT Result;
+  bool DataAfterEnd_Error;
+  bool WasException;
+  bool IsStarted;
+
+  CFolderThread(): Decoder(NULL), IsStarted(false) {}
+  ~CFolderThread() Z7_DESTRUCTOR_override
+  {
+    CVirtThread::WaitThreadFinish();
+    delete Decoder;
+  }
+  void Execute() Z7_override;
+
+  // the main thread decodes the folder again, if there was unexpected error
+  bool IsResultOK() const
+  {
+    return !WasException
+        && (Result == S_OK || Result == S_FALSE || Result == E_NOTIMPL);
+  }
+};
+
+
+void CFolderThread::Execute()
+{
+  Result = E_FAIL;
+  OutSize = 0;
+  DataAfterEnd_Error = false;
+  WasException = false;
+  try
+  {
+    CMyComPtr2_Create<ISequentialOutStream, CBufPtrSeqOutStream> outStream;
+    outStream->Init(Buf, (size_t)UnpackSize);
+
+    #ifndef Z7_NO_CRYPTO
+    ICryptoGetTextPassword *getTextPassword = NULL;
+    bool isEncrypted = false;
+    bool passwordIsDefined = false;
+    UString_Wipe password;
+    #endif
+
+    bool dataAfterEnd_Error = false;
+
+    Result = Decoder->Decode(
+        EXTERNAL_CODECS_LOC_VARS
+        InStream,
+        Db->ArcInfo.DataStartPosition,
+        *Db, FolderIndex,
+        &UnpackSize,
+        outStream,
+        NULL,
+        NULL
+        , dataAfterEnd_Error
+        Z7_7Z_DECODER_CRYPRO_VARS
+        , true, NumThreads, MemUsage
+        );
+
+    OutSize = outStream->GetPos();
+    DataAfterEnd_Error = dataAfterEnd_Error;
+  }
+  catch(...) { WasException = true; }
+}
+
+
+static void MtAllocBuf(CByteBuffer &buf, size_t size)
+{
+  // we don't keep big buffer after big folder
+  if (buf.Size() < size || buf.Size() > size * 2)
+    buf.Alloc(size);
+}
+
+
+class CMtFolderExtract
+{
+  const CDbEx *_db;
+  const UInt32 *_indices;
+  UInt32 _numItems;
+  const CRecordVector<bool> *_canDecodeFolder;
+  UInt32 _nextItem;
+  unsigned _fillIndex;
+  unsigned _readIndex;
+  unsigned _numFilled;
+  size_t _memUsage;
+  size_t _memLimit;
+  CFolderThread *_curThread;
+
+  HRESULT Fill();
+  HRESULT ReleaseHead();
+public:
+  CObjectVector<CFolderThread> Threads;
+  // the view of archive stream for decoding in the main thread
+  CMyComPtr<IInStream> MainInStream;
+
+  CMtFolderExtract(): _curThread(NULL) {}
+
+  void Create(const CDbEx &db, IInStream *inStream,
+      const UInt32 *indices, UInt32 numItems,
+      const CRecordVector<bool> &canDecodeFolder,
+      bool useMixerMT, UInt32 numThreads, UInt64 memUsage
+      #ifdef Z7_EXTERNAL_CODECS
+      , const CExternalCodecs *externalCodecs
+      #endif
+      );
+  HRESULT GetThread(UInt32 itemIndex, CFolderThread *&thread);
+};
+
+
+void CMtFolderExtract::Create(const CDbEx &db, IInStream *inStream,
+    const UInt32 *indices, UInt32 numItems,
+    const CRecordVector<bool> &canDecodeFolder,
+    bool useMixerMT, UInt32 numThreads, UInt64 memUsage
+    #ifdef Z7_EXTERNAL_CODECS
+    , const CExternalCodecs *externalCodecs
+    #endif
+    )
+{
+  _db = &db;
+  _indices = indices;
+  _numItems = numItems;
+  _canDecodeFolder = &canDecodeFolder;
+  _nextItem = 0;
+  _fillIndex = 0;
+  _readIndex = 0;
+  _numFilled = 0;
+  _memUsage = 0;
+
+  UInt64 limit = memUsage / 2;
+  if (limit > ((size_t)0 - 1) / 2)
+    limit = ((size_t)0 - 1) / 2;
+  _memLimit = (size_t)limit;
+
+  UInt32 numWorkers = numThreads;
+  if (numWorkers > kMtNumThreadsMax)
+    numWorkers = kMtNumThreadsMax;
+  if (numWorkers > db.NumFolders)
+    numWorkers = db.NumFolders;
+
+  CSharedInStream *sharedStream = new CSharedInStream;
+  CMyComPtr<IUnknown> sharedStreamRef = sharedStream;
+  sharedStream->Stream = inStream;
+  sharedStream->Pos = (UInt64)(Int64)-1;
+  if (InStream_GetSize_SeekToEnd(inStream, sharedStream->Size) != S_OK)
+    return;
+  {
+    CSharedInStreamView *view = new CSharedInStreamView;
+    MainInStream = view;
+    view->Init(sharedStream);
+  }
+
+  for (UInt32 i = 0; i < numWorkers; i++)
+  {
+    CFolderThread &t = Threads.AddNew();
+    t.Decoder = new CDecoder(useMixerMT);
+    CSharedInStreamView *view = new CSharedInStreamView;
+    t.InStream = view;
+    view->Init(sharedStream);
+    t.Db = &db;
+    t.NumThreads = numThreads / numWorkers;
+    t.MemUsage = memUsage / numWorkers;
+    #ifdef Z7_EXTERNAL_CODECS
+    t._externalCodecs = externalCodecs;
+    #endif
+    if (t.Create() != 0)
+    {
+      Threads.DeleteBack();
+      break;
+    }
+  }
+}
+
+
+HRESULT CMtFolderExtract::Fill()
+{
+  while (_numFilled < Threads.Size() && _nextItem < _numItems)
+  {
+    CExtractGroup g;
+    GetExtractGroup(*_db, _indices, _numItems, _nextItem, g);
+    if (g.FolderIndex == kNumNoIndex
+        || g.UnpackSize == 0
+        || g.UnpackSize > _memLimit
+        || !(*_canDecodeFolder)[g.FolderIndex])
+    {
+      _nextItem += g.NumSolidFiles;
+      continue;
+    }
+    const size_t need = (size_t)g.UnpackSize;
+    if (_numFilled != 0 && _memUsage + need > _memLimit)
+      break;
+    CFolderThread &t = Threads[_fillIndex];
+    t.ItemIndex = _nextItem;
+    t.FolderIndex = g.FolderIndex;
+    t.UnpackSize = g.UnpackSize;
+    MtAllocBuf(t.Buf, need);
+    _memUsage += t.Buf.Size();
+    _numFilled++;
+    if (++_fillIndex == Threads.Size())
+      _fillIndex = 0;
+    _nextItem += g.NumSolidFiles;
+    const WRes wres = t.Start();
+    if (wres != 0)
+      return HRESULT_FROM_WIN32(wres);
+    t.IsStarted = true;
+  }
+  return S_OK;
+}
+
+
+HRESULT CMtFolderExtract::ReleaseHead()
+{
+  CFolderThread &t = Threads[_readIndex];
+  if (t.IsStarted)
+  {
+    t.IsStarted = false;
+    const WRes wres = t.WaitExecuteFinish();
+    if (wres != 0)
+      return HRESULT_FROM_WIN32(wres);
+  }
+  _memUsage -= t.Buf.Size();
+  _numFilled--;
+  if (++_readIndex == Threads.Size())
+    _readIndex = 0;
+  return S_OK;
+}
+
+
+HRESULT CMtFolderExtract::GetThread(UInt32 itemIndex, CFolderThread *&thread)
+{
+  thread = NULL;
+  if (_curThread)
+  {
+    // the main thread has written the data of previous folder
+    _curThread = NULL;
+    RINOK(ReleaseHead())
+  }
+  // the folders that were skipped by the main thread
+  while (_numFilled != 0 && Threads[_readIndex].ItemIndex < itemIndex)
+  {
+    RINOK(ReleaseHead())
+  }
+  RINOK(Fill())
+  if (_numFilled == 0)
+    return S_OK;
+  CFolderThread &t = Threads[_readIndex];
+  if (t.ItemIndex != itemIndex)
+    return S_OK;
+  if (t.IsStarted)
+  {
+    t.IsStarted = false;
+    const WRes wres = t.WaitExecuteFinish();
+    if (wres != 0)
+      return HRESULT_FROM_WIN32(wres);
+  }
+  if (!t.IsResultOK())
+    return ReleaseHead();
+  _curThread = &t;
+  thread = &t;
+  return S_OK;
+}
+
+#endif
+
+// **************** NanaZip Modification End ****************
+
+
 Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testModeSpec, IArchiveExtractCallback *extractCallbackSpec))
 {
@@ -274,7 +690,10 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   CMyComPtr2_Create<ICompressProgressInfo, CLocalProgress> lps;
   lps->Init(extractCallback, false);
 
-  CDecoder decoder(
+  // **************** NanaZip Modification Start ****************
+  // CDecoder decoder(
+  const bool useMixerMT =
+  // **************** NanaZip Modification End ****************
     #if !defined(USE_MIXER_MT)
       false
     #elif !defined(USE_MIXER_ST)
@@ -288,7 +707,11 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     #else
       _useMultiThreadMixer
     #endif
-    );
+  // **************** NanaZip Modification Start ****************
+    // );
+    ;
+  CDecoder decoder(useMixerMT);
+  // **************** NanaZip Modification End ****************
 
   UInt64 curPacked, curUnpacked;
 
@@ -303,6 +726,31 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   folderOutStream->TestMode = (testModeSpec != 0);
   folderOutStream->CheckCrc = (_crcSize != 0);
 
+  // **************** NanaZip Modification Start ****************
+  #if !defined(Z7_ST) && !defined(Z7_SFX)
+  CRecordVector<bool> canDecodeFolder;
+  CMtFolderExtract mt;
+  if (_numThreads > 1 && _db.NumFolders > 1)
+  {
+    canDecodeFolder.ClearAndReserve(_db.NumFolders);
+    for (CNum f = 0; f < _db.NumFolders; f++)
+      canDecodeFolder.AddInReserved(!IsFolderEncrypted(f));
+    mt.Create(_db, _inStream, allFilesMode ? NULL : indices, numItems,
+        canDecodeFolder, useMixerMT, _numThreads, _memUsage_Decompress
+        #ifdef Z7_EXTERNAL_CODECS
+        , EXTERNAL_CODECS_VARS2
+        #endif
+        );
+  }
+  // all reads from archive must go through shared stream, if there are threads
+  CMyComPtr<IInStream> mainInStream = _inStream;
+  if (!mt.Threads.IsEmpty())
+    mainInStream = mt.MainInStream;
+  #else
+  IInStream *mainInStream = _inStream;
+  #endif
+  // **************** NanaZip Modification End ****************
+
   for (UInt32 i = 0;; lps->OutSize += curUnpacked, lps->InSize += curPacked)
   {
     RINOK(lps->SetCur())
@@ -310,35 +758,19 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     if (i >= numItems)
       break;
 
-    curUnpacked = 0;
-    curPacked = 0;
-
-    UInt32 fileIndex = allFilesMode ? i : indices[i];
-    const CNum folderIndex = _db.FileIndexToFolderIndexMap[fileIndex];
-
-    UInt32 numSolidFiles = 1;
-
-    if (folderIndex != kNumNoIndex)
-    {
-      curPacked = _db.GetFolderFullPackSize(folderIndex);
-      UInt32 nextFile = fileIndex + 1;
-      fileIndex = _db.FolderStartFileIndex[folderIndex];
-      UInt32 k;
-
-      for (k = i + 1; k < numItems; k++)
-      {
-        const UInt32 fileIndex2 = allFilesMode ? k : indices[k];
-        if (_db.FileIndexToFolderIndexMap[fileIndex2] != folderIndex
-            || fileIndex2 < nextFile)
-          break;
-        nextFile = fileIndex2 + 1;
-      }
-      
-      numSolidFiles = k - i;
-      
-      for (k = fileIndex; k < nextFile; k++)
-        curUnpacked += _db.Files[k].Size;
-    }
+    // **************** NanaZip Modification Start ****************
+    // that code was moved to GetExtractGroup()
+    CExtractGroup group;
+    GetExtractGroup(_db, allFilesMode ? NULL : indices, numItems, i, group);
+    curUnpacked = group.UnpackSize;
+    curPacked = group.PackSize;
+    const UInt32 fileIndex = group.StartFileIndex;
+    const CNum folderIndex = group.FolderIndex;
+    const UInt32 numSolidFiles = group.NumSolidFiles;
+    #if !defined(Z7_ST) && !defined(Z7_SFX)
+    const UInt32 groupItemIndex = i;
+    #endif
+    // **************** NanaZip Modification End ****************
 
     {
       const HRESULT result = folderOutStream->Init(fileIndex,
@@ -360,6 +792,16 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     if (folderIndex == kNumNoIndex)
       return E_FAIL;
 
+    // **************** NanaZip Modification Start ****************
+    #if !defined(Z7_ST) && !defined(Z7_SFX)
+    CFolderThread *thread = NULL;
+    if (!mt.Threads.IsEmpty())
+    {
+      RINOK(mt.GetThread(groupItemIndex, thread))
+    }
+    #endif
+    // **************** NanaZip Modification End ****************
+
     #ifndef Z7_NO_CRYPTO
     CMyComPtr<ICryptoGetTextPassword> getTextPassword;
     if (extractCallback)
@@ -376,9 +818,30 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
       bool dataAfterEnd_Error = false;
 
-      const HRESULT result = decoder.Decode(
+      // **************** NanaZip Modification Start ****************
+      // const HRESULT result = decoder.Decode(
+      HRESULT result;
+      #if !defined(Z7_ST) && !defined(Z7_SFX)
+      if (thread)
+      {
+        // we write the data decoded by thread, and we use the result of thread
+        result = thread->Result;
+        dataAfterEnd_Error = thread->DataAfterEnd_Error;
+        HRESULT writeRes = WriteStream(outStream, thread->Buf, thread->OutSize);
+        if (writeRes == k_My_HRESULT_WritingWasCut)
+          writeRes = S_OK;
+        if (writeRes != S_OK)
+          result = writeRes;
+      }
+      else
+      #endif
+      result = decoder.Decode(
+      // **************** NanaZip Modification End ****************
           EXTERNAL_CODECS_VARS
-          _inStream,
+          // **************** NanaZip Modification Start ****************
+          // _inStream,
+          mainInStream,
+          // **************** NanaZip Modification End ****************
           _db.ArcInfo.DataStartPosition,
           _db, folderIndex,
           &curUnpacked,
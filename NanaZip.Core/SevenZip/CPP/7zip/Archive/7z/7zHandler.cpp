@@ -876,6 +876,14 @@ HRESULT CHandler::ObtainBlockMethods(CNum folderIndex, PROPVARIANT *prop, CHandl
         if (info) continue;
         name = "SPARC";
         break;
+      // **************** NanaZip Modification Start ****************
+      case k_Dedup:
+        if (info) continue;
+        name = "Dedup";
+        if (propsSize == 1 && props[0] < 32)
+          GetStringForSizeValue(s, (UInt32)1 << props[0]);
+        break;
+      // **************** NanaZip Modification End ****************
       // and encryption (also ignore by obtaining info):
       case k_AES:
         if (info) continue;
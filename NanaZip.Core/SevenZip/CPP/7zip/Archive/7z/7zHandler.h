@@ -57,6 +57,11 @@ public:
   bool _removeSfxBlock;
   // bool _volumeMode;
 
+  // **************** NanaZip Modification Start ****************
+  UInt64 _dedupWindowSize;
+  bool _useSimilaritySorting;
+  // **************** NanaZip Modification End ****************
+
   UInt32 _decoderCompatibilityVersion;
   CUIntVector _enabledFilters;
   CUIntVector _disabledFilters;
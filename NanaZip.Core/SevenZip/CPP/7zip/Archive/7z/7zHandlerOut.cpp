@@ -9,6 +9,10 @@
 #include "../Common/ItemNameUtils.h"
 #include "../Common/ParseProperties.h"
 
+// **************** NanaZip Modification Start ****************
+#include "../../Compress/DedupEncoder.h"
+// **************** NanaZip Modification End ****************
+
 #include "7zHandler.h"
 #include "7zOut.h"
 #include "7zUpdate.h"
@@ -830,6 +834,11 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
 
   options.MultiThreadMixer = _useMultiThreadMixer;
 
+  // **************** NanaZip Modification Start ****************
+  options.DedupWindowSize = _dedupWindowSize;
+  options.UseSimilaritySorting = _useSimilaritySorting;
+  // **************** NanaZip Modification End ****************
+
   /*
   if (secureBlocks.Sorted.Size() > 1)
   {
@@ -894,6 +903,11 @@ void COutHandler::InitProps7z()
 
   // _volumeMode = false;
 
+  // **************** NanaZip Modification Start ****************
+  _dedupWindowSize = 0;
+  _useSimilaritySorting = false;
+  // **************** NanaZip Modification End ****************
+
   InitSolid();
   _useTypeSorting = false;
 
@@ -1069,6 +1083,29 @@ HRESULT COutHandler::SetProperty(const wchar_t *nameSpec, const PROPVARIANT &val
 
     if (name.IsEqualTo("qs")) return PROPVARIANT_to_bool(value, _useTypeSorting);
 
+    // **************** NanaZip Modification Start ****************
+    if (name.IsEqualTo("qsim")) return PROPVARIANT_to_bool(value, _useSimilaritySorting);
+
+    // dedup=on, dedup=off or dedup=<windowSize>
+    if (name.IsEqualTo("dedup"))
+    {
+      bool enabled;
+      if (value.vt == VT_EMPTY
+          || value.vt == VT_BOOL
+          || (value.vt == VT_BSTR && StringToBool(value.bstrVal, enabled)))
+      {
+        RINOK(PROPVARIANT_to_bool(value, enabled))
+        _dedupWindowSize = enabled ? NCompress::NDedup::kWindowSizeDefault : 0;
+        return S_OK;
+      }
+      UInt64 v;
+      if (!ParseSizeString(L"", value, _memAvail, v) || v == 0)
+        return E_INVALIDARG;
+      _dedupWindowSize = v;
+      return S_OK;
+    }
+    // **************** NanaZip Modification End ****************
+
     if (name.IsPrefixedBy_Ascii_NoCase("yv"))
     {
       name.Delete(0, 2);
@@ -131,6 +131,10 @@ const UInt32 k_LZ5   = 0x4F71105;
 const UInt32 k_LIZARD= 0x4F71106;
 // **************** 7-Zip ZS Modification End ****************
 
+// **************** NanaZip Modification Start ****************
+const UInt32 k_Dedup = 0x4F71201;
+// **************** NanaZip Modification End ****************
+
 const UInt32 k_AES   = 0x6F10701;
 
 // const UInt32 k_ZSTD = 0x4015D; // winzip zstd
@@ -5,14 +5,24 @@
 #include "../../../../C/CpuArch.h"
 
 #include "../../../Common/MyLinux.h"
+// **************** NanaZip Modification Start ****************
+#include "../../../Common/MyBuffer2.h"
+// **************** NanaZip Modification End ****************
 #include "../../../Common/StringToInt.h"
 #include "../../../Common/Wildcard.h"
 
 #include "../../Common/CreateCoder.h"
 #include "../../Common/LimitedStreams.h"
 #include "../../Common/ProgressUtils.h"
+// **************** NanaZip Modification Start ****************
+#include "../../Common/StreamObjects.h"
+#include "../../Common/StreamUtils.h"
+// **************** NanaZip Modification End ****************
 
 #include "../../Compress/CopyCoder.h"
+// **************** NanaZip Modification Start ****************
+#include "../../Compress/DedupEncoder.h"
+// **************** NanaZip Modification End ****************
 
 #include "../Common/ItemNameUtils.h"
 
@@ -580,17 +590,45 @@ static unsigned Get_FilterGroup_for_Folder(
 
 
 
+// **************** NanaZip Modification Start ****************
+/* WriteRange() copies old folders without changes.
+   We use big buffer instead of CCopyCoder buffer, so there are
+   less Read() / Write() calls for big solid blocks. If archive stream
+   is mapped to memory, Read() is one memcpy() from view. */
+
+static const size_t k_WriteRange_BufSize = (size_t)1 << 22;
+
 static HRESULT WriteRange(IInStream *inStream, ISequentialOutStream *outStream,
     UInt64 position, UInt64 size, ICompressProgressInfo *progress)
 {
   RINOK(InStream_SeekSet(inStream, position))
-  CMyComPtr2_Create<ISequentialInStream, CLimitedSequentialInStream> streamSpec;
-  streamSpec->SetStream(inStream);
-  streamSpec->Init(size);
-  CMyComPtr2_Create<ICompressCoder, NCompress::CCopyCoder> copyCoder;
-  RINOK(copyCoder.Interface()->Code(streamSpec, outStream, NULL, NULL, progress))
-  return (copyCoder->TotalSize == size ? S_OK : E_FAIL);
+  size_t bufSize = k_WriteRange_BufSize;
+  if (bufSize > size)
+    bufSize = (size_t)size;
+  CMidBuffer buf;
+  buf.AllocAtLeast(bufSize);
+  if (!buf.IsAllocated())
+    return E_OUTOFMEMORY;
+  UInt64 pos = 0;
+  while (pos != size)
+  {
+    size_t cur = bufSize;
+    if (cur > size - pos)
+      cur = (size_t)(size - pos);
+    const size_t requested = cur;
+    RINOK(ReadStream(inStream, buf, &cur))
+    if (cur != requested)
+      return E_FAIL;
+    RINOK(WriteStream(outStream, buf, cur))
+    pos += cur;
+    if (progress)
+    {
+      RINOK(progress->SetRatioInfo(&pos, &pos))
+    }
+  }
+  return S_OK;
 }
+// **************** NanaZip Modification End ****************
 
 /*
 unsigned CUpdateItem::GetExtensionPos() const
@@ -937,6 +975,320 @@ static int CompareUpdateItems(const CRefItem *p1, const CRefItem *p2, void *para
   return 0;
 }
 
+// **************** NanaZip Modification Start ****************
+/*
+Similarity sorting (-mqsim) changes the order of files in solid group,
+so the files with similar content are placed together in solid block,
+and the window of LZ-based coder can find more matches:
+  - the main thread reads first (kSketchReadSize) bytes of each file
+    with GetStream2(kAnalyze). So all IArchiveUpdateCallbackFile calls
+    are made from one thread in sorted order.
+  - the worker threads compute MinHash sketches of these buffers.
+  - then we build the chain of files: each next file is the file with nearest
+    sketch among the first (kSimSortWindow) remaining files in name order.
+    So the order is same for any number of threads.
+If type sorting is enabled, the files are reordered only in the range of
+same extension, because solid blocks can be split by extension.
+*/
+
+static const size_t kSketchReadSize = (size_t)1 << 20;
+static const UInt64 kSketchFileSizeMin = 1 << 8;
+static const unsigned kSimSortWindow = 1 << 10;
+static const unsigned kSketchNumThreadsMax = 16;
+
+/* b-bit MinHash of 8-byte shingles with one hash function:
+   the shingle hash selects one of (kSketchNumParts) parts by high bits,
+   and each part of sketch keeps low 4 bits of minimal hash in that part.
+   The minimum depends on the set of shingles only, so the sketch doesn't
+   depend on the offset of data in file, and the shingles that are repeated
+   in all files (headers, padding) don't hide the differences of files.
+   The distance is the number of different parts. */
+
+static const unsigned kSketchNumParts = 16;
+
+static UInt64 GetMinHash(const Byte *p, size_t size)
+{
+  UInt64 mins[kSketchNumParts];
+  unsigned k;
+  for (k = 0; k < kSketchNumParts; k++)
+    mins[k] = (UInt64)(Int64)-1;
+  if (size >= 8)
+  {
+    const Byte *lim = p + size - 7;
+    for (; p != lim; p++)
+    {
+      UInt64 h = GetUi64(p) * UINT64_CONST(0x9E3779B97F4A7C15);
+      h = (h ^ (h >> 29)) * UINT64_CONST(0xBF58476D1CE4E5B9);
+      h ^= h >> 32;
+      const unsigned part = (unsigned)(h >> 60);
+      if (mins[part] > h)
+        mins[part] = h;
+    }
+  }
+  UInt64 res = 0;
+  for (k = 0; k < kSketchNumParts; k++)
+    res |= (mins[k] & 15) << (k * 4);
+  return res;
+}
+
+static unsigned GetNumDiffParts(UInt64 a, UInt64 b)
+{
+  UInt64 v = a ^ b;
+  unsigned num = 0;
+  for (unsigned k = 0; k < kSketchNumParts; k++, v >>= 4)
+    if ((v & 15) != 0)
+      num++;
+  return num;
+}
+
+struct CSketch
+{
+  UInt64 Hash;
+  bool Defined;
+};
+
+/* it returns (size == 0), if the file was not opened or read.
+   The read errors are ignored here, because the file is read again later.
+   It returns error code, if callback returns error (E_ABORT) for opening. */
+static HRESULT ReadSketchData(IArchiveUpdateCallbackFile *callback, UInt32 index, Byte *buf, size_t &size)
+{
+  const size_t maxSize = size;
+  size = 0;
+  CMyComPtr<ISequentialInStream> stream;
+  const HRESULT result = callback->GetStream2(index, &stream, NUpdateNotifyOp::kAnalyze);
+  if (result == S_FALSE || !stream)
+    return S_OK;
+  RINOK(result)
+  size_t processed = maxSize;
+  if (ReadStream(stream, buf, &processed) == S_OK)
+    size = processed;
+  return S_OK;
+}
+
+#ifndef Z7_ST
+
+class CSketchThread Z7_final: public CVirtThread
+{
+public:
+  CByteBuffer Buf;
+  size_t Size;
+  unsigned ItemIndex;
+  UInt64 Hash;
+  bool Busy; // the thread was started and its result was not collected
+
+  CSketchThread(): Size(0), ItemIndex(0), Hash(0), Busy(false) {}
+  ~CSketchThread() Z7_DESTRUCTOR_override
+  {
+    CVirtThread::WaitThreadFinish();
+  }
+private:
+  virtual void Execute() Z7_override;
+};
+
+void CSketchThread::Execute()
+{
+  Hash = GetMinHash(Buf, Size);
+}
+
+#endif
+
+static HRESULT GetSketches(IArchiveUpdateCallbackFile *callback,
+    UInt32 numThreads,
+    const CRecordVector<CRefItem> &refItems,
+    CRecordVector<CSketch> &sketches)
+{
+  const unsigned numItems = refItems.Size();
+  sketches.ClearAndSetSize(numItems);
+  
+  #ifndef Z7_ST
+  CObjectVector<CSketchThread> threads;
+  if (numThreads > kSketchNumThreadsMax)
+    numThreads = kSketchNumThreadsMax;
+  if (numThreads > 1)
+  {
+    for (UInt32 t = 0; t < numThreads; t++)
+    {
+      CSketchThread &thread = threads.AddNew();
+      thread.Buf.Alloc(kSketchReadSize);
+      const WRes wres = thread.Create();
+      if (wres != 0)
+        return HRESULT_FROM_WIN32(wres);
+    }
+  }
+  #else
+  UNUSED_VAR(numThreads)
+  #endif
+
+  CByteBuffer buf;
+  #ifndef Z7_ST
+  unsigned numStarted = 0;
+  HRESULT res = S_OK;
+  #endif
+
+  for (unsigned i = 0; i < numItems; i++)
+  {
+    CSketch &sketch = sketches[i];
+    sketch.Hash = 0;
+    sketch.Defined = false;
+    const CUpdateItem &ui = *refItems[i].UpdateItem;
+    if (ui.Size < kSketchFileSizeMin)
+      continue;
+
+    #ifndef Z7_ST
+    if (!threads.IsEmpty())
+    {
+      // the slot is not restarted, if the file was not read. So we wait only for busy slot.
+      CSketchThread &thread = threads[numStarted % threads.Size()];
+      if (thread.Busy)
+      {
+        thread.Busy = false;
+        const WRes wres = thread.WaitExecuteFinish();
+        if (wres != 0)
+        {
+          res = HRESULT_FROM_WIN32(wres);
+          break;
+        }
+        sketches[thread.ItemIndex].Hash = thread.Hash;
+      }
+      size_t size = kSketchReadSize;
+      res = ReadSketchData(callback, refItems[i].Index, thread.Buf, size);
+      if (res != S_OK)
+        break;
+      if (size == 0)
+        continue;
+      sketch.Defined = true;
+      thread.Size = size;
+      thread.ItemIndex = i;
+      const WRes wres = thread.Start();
+      if (wres != 0)
+      {
+        res = HRESULT_FROM_WIN32(wres);
+        break;
+      }
+      thread.Busy = true;
+      numStarted++;
+      continue;
+    }
+    #endif
+
+    if (buf.Size() != kSketchReadSize)
+      buf.Alloc(kSketchReadSize);
+    size_t size = kSketchReadSize;
+    RINOK(ReadSketchData(callback, refItems[i].Index, buf, size))
+    if (size == 0)
+      continue;
+    sketch.Defined = true;
+    sketch.Hash = GetMinHash(buf, size);
+  }
+
+  #ifndef Z7_ST
+  // we wait for all busy threads, also if there was error
+  FOR_VECTOR (t, threads)
+  {
+    CSketchThread &thread = threads[t];
+    if (!thread.Busy)
+      continue;
+    thread.Busy = false;
+    const WRes wres = thread.WaitExecuteFinish();
+    if (wres != 0)
+    {
+      if (res == S_OK)
+        res = HRESULT_FROM_WIN32(wres);
+      continue;
+    }
+    sketches[thread.ItemIndex].Hash = thread.Hash;
+  }
+  return res;
+  #else
+  return S_OK;
+  #endif
+}
+
+/* it adds items [start, end) of (src) to (dest) in the order of greedy chain.
+   If first remaining item has no sketch, it's added next,
+   so the items without sketch keep their place in name order. */
+
+static void SortRangeBySketches(
+    const CRecordVector<CRefItem> &src, const CRecordVector<CSketch> &sketches,
+    unsigned start, unsigned end,
+    CRecordVector<CRefItem> &dest)
+{
+  // (cands) contains indexes of remaining items in name order
+  CRecordVector<unsigned> cands;
+  unsigned next = start;
+  const CSketch *cur = NULL;
+
+  for (;;)
+  {
+    while (cands.Size() < kSimSortWindow && next != end)
+      cands.Add(next++);
+    if (cands.IsEmpty())
+      break;
+    unsigned best = 0;
+    if (cur && cur->Defined && sketches[cands[0]].Defined)
+    {
+      unsigned bestDist = kSketchNumParts + 1;
+      FOR_VECTOR (k, cands)
+      {
+        const CSketch &s = sketches[cands[k]];
+        if (!s.Defined)
+          continue;
+        const unsigned dist = GetNumDiffParts(cur->Hash, s.Hash);
+        if (dist < bestDist)
+        {
+          bestDist = dist;
+          best = k;
+          if (dist == 0)
+            break;
+        }
+      }
+    }
+    const unsigned index = cands[best];
+    cands.Delete(best);
+    dest.Add(src[index]);
+    cur = &sketches[index];
+  }
+}
+
+static HRESULT SortBySimilarity(IArchiveUpdateCallbackFile *callback,
+    UInt32 numThreads, bool sortByType,
+    CRecordVector<CRefItem> &refItems)
+{
+  CRecordVector<CSketch> sketches;
+  RINOK(GetSketches(callback, numThreads, refItems, sketches))
+
+  const unsigned numItems = refItems.Size();
+  CRecordVector<CRefItem> sorted;
+  sorted.ClearAndReserve(numItems);
+
+  for (unsigned start = 0; start < numItems;)
+  {
+    unsigned end = start + 1;
+    if (!sortByType)
+      end = numItems;
+    else
+    {
+      // the range of items with same extension
+      const CRefItem &a1 = refItems[start];
+      for (; end < numItems; end++)
+      {
+        const CRefItem &a2 = refItems[end];
+        if (a1.ExtensionIndex != a2.ExtensionIndex
+            || CompareFileNames(
+                a1.UpdateItem->Name.Ptr(a1.ExtensionPos),
+                a2.UpdateItem->Name.Ptr(a2.ExtensionPos)) != 0)
+          break;
+      }
+    }
+    SortRangeBySketches(refItems, sketches, start, end, sorted);
+    start = end;
+  }
+
+  refItems = sorted;
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
+
 struct CSolidGroup
 {
   CRecordVector<UInt32> Indices;
@@ -1424,6 +1776,43 @@ static HRESULT MakeExeMethod(CCompressionMethodMode &mode,
 }
 
 
+// **************** NanaZip Modification Start ****************
+
+/* Dedup coder is inserted as first coder of folder:
+   it removes repeated chunks of files before filter and main coder.
+   The window is reduced to keep the memory usage of encoder
+   in half of MemoryUsageLimit. */
+
+static HRESULT AddDedupMethod(CCompressionMethodMode &mode, UInt64 windowSize)
+{
+  while (windowSize > ((UInt64)1 << NCompress::NDedup::kWindowLogMin)
+      && NCompress::NDedup::GetEncoderMemUsage(windowSize) > mode.MemoryUsageLimit / 2)
+    windowSize >>= 1;
+
+  CMethodFull &m = mode.Methods.InsertNew(0);
+  {
+    // we move all coder indexes in bonds up for 1 position:
+    FOR_VECTOR (k, mode.Bonds)
+    {
+      CBond2 &bond = mode.Bonds[k];
+      bond.InCoder++;
+      bond.OutCoder++;
+    }
+  }
+  GetMethodFull(k_Dedup, 1, m);
+  {
+    CProp &prop = m.Props.AddNew();
+    prop.Id = NCoderPropID::kDictionarySize;
+    prop.Value = windowSize;
+  }
+  if (mode.Bonds.IsEmpty())
+    return S_OK;
+  return AddBondForFilter(mode);
+}
+
+// **************** NanaZip Modification End ****************
+
+
 static void UpdateItem_To_FileItem2(const CUpdateItem &ui, CFileItem2 &file2)
 {
   file2.Attrib = ui.Attrib;  file2.AttribDefined = ui.AttribDefined;
@@ -1522,6 +1911,9 @@ public:
 
   HRESULT Init(UInt32 startIndex, const CBoolVector *extractStatuses);
   HRESULT CheckFinishedState() const { return (_currentIndex == _extractStatuses->Size()) ? S_OK: E_FAIL; }
+  // **************** NanaZip Modification Start ****************
+  unsigned GetNumProcessedFiles() const { return _currentIndex; }
+  // **************** NanaZip Modification End ****************
 };
 
 HRESULT CRepackStreamBase::Init(UInt32 startIndex, const CBoolVector *extractStatuses)
@@ -1890,117 +2282,957 @@ static void GetFile(const CDatabase &inDb, unsigned index, CFileItem &file, CFil
   // file2.IsAux = inDb.IsItemAux(index);
 }
 
-HRESULT Update(
-    DECL_EXTERNAL_CODECS_LOC_VARS
-    IInStream *inStream,
+// **************** NanaZip Modification Start ****************
+/* AddNewFolderFiles() adds the files of new folder to (newDatabase)
+   from the results of CFolderInStream.
+   It's used for the folders encoded in main thread and in worker threads. */
+
+static HRESULT AddNewFolderFiles(
+    const CFolderInStream *inStreamSpec,
+    const CObjectVector<CUpdateItem> &updateItems,
+    const UInt32 *indices,
+    unsigned numSubFiles,
     const CDbEx *db,
-    CObjectVector<CUpdateItem> &updateItems,
-    // const CObjectVector<CTreeFolder> &treeFolders,
-    // const CUniqBlocks &secureBlocks,
-    ISequentialOutStream *seqOutStream,
-    IArchiveUpdateCallback *updateCallback,
-    const CUpdateOptions &options)
+    UInt64 curFolderUnpackSize,
+    CArchiveDatabaseOut &newDatabase,
+    UInt64 &procSize,
+    UInt64 &skippedSize)
 {
-  UInt64 numSolidFiles = options.NumSolidFiles;
-  if (numSolidFiles == 0)
-    numSolidFiles = 1;
-
-  Z7_DECL_CMyComPtr_QI_FROM(
-      IArchiveUpdateCallbackFile,
-      opCallback, updateCallback)
-
-  Z7_DECL_CMyComPtr_QI_FROM(
-      IArchiveExtractCallbackMessage2,
-      extractCallback, updateCallback)
-
-  /*
-  Z7_DECL_CMyComPtr_QI_FROM(
-      IArchiveUpdateCallbackArcProp,
-      reportArcProp, updateCallback)
-  */
-
-  // size_t totalSecureDataSize = (size_t)secureBlocks.GetTotalSizeInBytes();
+  CNum numUnpackStreams = 0;
+  skippedSize = 0;
+  procSize = 0;
+  // unsigned numProcessedFiles = 0;
 
-  CMyComPtr<IStreamSetRestriction> v_StreamSetRestriction;
+  for (unsigned subIndex = 0; subIndex < numSubFiles; subIndex++)
   {
-    Z7_DECL_CMyComPtr_QI_FROM(
-        IOutStream,
-        outStream, seqOutStream)
-    if (!outStream)
-      return E_NOTIMPL;
-    const UInt64 sfxBlockSize = (db && !options.RemoveSfxBlock) ?
-        db->ArcInfo.StartPosition: 0;
-    seqOutStream->QueryInterface(IID_IStreamSetRestriction, (void **)&v_StreamSetRestriction);
-    if (v_StreamSetRestriction)
+    const CUpdateItem &ui = updateItems[indices[subIndex]];
+    CFileItem file;
+    CFileItem2 file2;
+    UString name;
+    if (ui.NewProps)
     {
-      UInt64 offset = 0;
-      RINOK(outStream->Seek(0, STREAM_SEEK_CUR, &offset))
-      RINOK(v_StreamSetRestriction->SetRestriction(
-          outStream ? offset + sfxBlockSize : 0,
-          outStream ? offset + sfxBlockSize + k_StartHeadersRewriteSize : 0))
+      UpdateItem_To_FileItem(ui, file, file2);
+      name = ui.Name;
     }
-    outStream.Release();
-    if (sfxBlockSize != 0)
+    else
     {
-      RINOK(WriteRange(inStream, seqOutStream, 0, sfxBlockSize, NULL))
+      GetFile(*db, (unsigned)ui.IndexInArchive, file, file2);
+      db->GetPath((unsigned)ui.IndexInArchive, name);
+    }
+    if (file2.IsAnti || file.IsDir)
+      return E_FAIL;
+    
+    /*
+    CFileItem &file = newDatabase.Files[
+          startFileIndexInDatabase + i + subIndex];
+    */
+    if (!inStreamSpec->Processed[subIndex])
+    {
+      // we don't add file here
+      skippedSize += ui.Size;
+      continue; // comment it for debug
+      // name += ".locked"; // for debug
     }
-  }
-
-  CIntArr fileIndexToUpdateIndexMap;
-  UInt64 complexity = 0;
-  bool isThere_UnknownSize = false;
-  UInt64 inSizeForReduce2 = 0;
-
- #ifndef Z7_NO_CRYPTO
-  bool needEncryptedRepack = false;
- #endif
-
-  CRecordVector<CFilterMode2> filters;
-  CObjectVector<CSolidGroup> groups;
-  
-  #ifndef Z7_ST
-  bool thereAreRepacks = false;
-  #endif
 
-  bool useFilters = options.UseFilters;
-  if (useFilters)
-  {
-    const CCompressionMethodMode &method = *options.Method;
+    // if (inStreamSpec->Need_Crc)
+    file.Crc = inStreamSpec->CRCs[subIndex];
+    file.Size = inStreamSpec->Sizes[subIndex];
+    
+    procSize += file.Size;
+    // if (file.Size >= 0) // for debug: test purposes
+    if (file.Size != 0)
+    {
+      file.CrcDefined = true; // inStreamSpec->Need_Crc;
+      file.HasStream = true;
+      numUnpackStreams++;
+    }
+    else
+    {
+      file.CrcDefined = false;
+      file.HasStream = false;
+    }
 
-    FOR_VECTOR (i, method.Methods)
+    if (inStreamSpec->TimesDefined[subIndex])
     {
-      /* IsFilterMethod() knows only built-in codecs
-         FIXME: we should check IsFilter status for external filters too */
-      if (IsFilterMethod(method.Methods[i].Id))
+      if (inStreamSpec->Need_CTime)
+        { file2.CTimeDefined = true;  file2.CTime = inStreamSpec->CTimes[subIndex]; }
+      if (inStreamSpec->Need_ATime
+          // && !ui.ATime_WasReadByAnalysis
+          )
+        { file2.ATimeDefined = true;  file2.ATime = inStreamSpec->ATimes[subIndex]; }
+      if (inStreamSpec->Need_MTime)
+        { file2.MTimeDefined = true;  file2.MTime = inStreamSpec->MTimes[subIndex]; }
+      if (inStreamSpec->Need_Attrib)
       {
-        useFilters = false;
-        break;
+        file2.AttribDefined = true;
+        file2.Attrib = inStreamSpec->Attribs[subIndex];
       }
     }
-  }
-  
-  if (db)
-  {
-    fileIndexToUpdateIndexMap.Alloc(db->Files.Size());
-    unsigned i;
-    
-    for (i = 0; i < db->Files.Size(); i++)
-      fileIndexToUpdateIndexMap[i] = -1;
 
-    for (i = 0; i < updateItems.Size(); i++)
+    /*
+    file.Parent = ui.ParentFolderIndex;
+    if (ui.TreeFolderIndex >= 0)
+      treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
+    if (totalSecureDataSize != 0)
+      newDatabase.SecureIDs.Add(ui.SecureIndex);
+    */
+    /*
+    if (reportArcProp)
     {
-      int index = updateItems[i].IndexInArchive;
-      if (index != -1)
-        fileIndexToUpdateIndexMap[(unsigned)index] = (int)i;
+      RINOK(ReportItemProps(reportArcProp, ui.IndexInClient, file.Size,
+          file.CrcDefined ? &file.Crc : NULL))
     }
+    */
 
-    for (i = 0; i < db->NumFolders; i++)
-    {
-      CNum indexInFolder = 0;
-      CNum numCopyItems = 0;
-      const CNum numUnpackStreams = db->NumUnpackStreamsVector[i];
-      UInt64 repackSize = 0;
-      
+    // numProcessedFiles++;
+    newDatabase.AddFile(file, file2, name);
+  }
+
+  /*
+  // for debug:
+  // we can write crc to folders area, if folder contains only one file
+  if (numUnpackStreams == 1 && numSubFiles == 1)
+  {
+    const CFileItem &file = newDatabase.Files.Back();
+    if (file.CrcDefined)
+      newDatabase.FolderUnpackCRCs.SetItem(folderIndex_New, true, file.Crc);
+  }
+  */
+
+  /*
+  // it's optional check to ensure that sizes are correct
+  if (inStreamSpec->TotalSize_for_Coder != curFolderUnpackSize)
+    return E_FAIL;
+  */
+  // if (inStreamSpec->AlignLog == 0)
+  {
+    if (procSize != curFolderUnpackSize)
+      return E_FAIL;
+  }
+
+  // numUnpackStreams = 0 is very bad case for locked files
+  // v3.13 doesn't understand it.
+  newDatabase.NumUnpackStreamsVector.Add(numUnpackStreams);
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
+
+// **************** NanaZip Modification Start ****************
+/* AddOldFolderFiles() adds the files of copied or repacked old folder
+   to (newDatabase). */
+
+static void AddOldFolderFiles(
+    const CDbEx &db,
+    const CObjectVector<CUpdateItem> &updateItems,
+    const int *fileIndexToUpdateIndexMap,
+    unsigned folderIndex,
+    CNum numCopyFiles,
+    CArchiveDatabaseOut &newDatabase)
+{
+  const CNum numUnpackStreams = db.NumUnpackStreamsVector[folderIndex];
+
+  newDatabase.NumUnpackStreamsVector.Add(numCopyFiles);
+  
+  CNum indexInFolder = 0;
+  for (CNum fi = db.FolderStartFileIndex[folderIndex]; indexInFolder < numUnpackStreams; fi++)
+  {
+    if (db.Files[fi].HasStream)
+    {
+      indexInFolder++;
+      const int updateIndex = fileIndexToUpdateIndexMap[fi];
+      if (updateIndex >= 0)
+      {
+        const CUpdateItem &ui = updateItems[(unsigned)updateIndex];
+        if (ui.NewData)
+          continue;
+
+        UString name;
+        CFileItem file;
+        CFileItem2 file2;
+        GetFile(db, fi, file, file2);
+
+        if (ui.NewProps)
+        {
+          UpdateItem_To_FileItem2(ui, file2);
+          file.IsDir = ui.IsDir;
+          name = ui.Name;
+        }
+        else
+          db.GetPath(fi, name);
+
+        /*
+        file.Parent = ui.ParentFolderIndex;
+        if (ui.TreeFolderIndex >= 0)
+          treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
+        if (totalSecureDataSize != 0)
+          newDatabase.SecureIDs.Add(ui.SecureIndex);
+        */
+        newDatabase.AddFile(file, file2, name);
+      }
+    }
+  }
+}
+// **************** NanaZip Modification End ****************
+
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+/*
+The encoders of some methods (LZMA, PPMd, Deflate, BZip2, Brotli) can't load
+all cores with one folder. If there are several new folders in group,
+CMtFolderEncoder encodes them concurrently:
+  - the main thread reads the data of next folder to memory buffer
+    with CFolderInStream. So all IArchiveUpdateCallback calls are made
+    from one thread in original order.
+  - the worker thread encodes that buffer with its own CEncoder
+    to another memory buffer.
+  - the main thread writes the encoded folders to archive and adds them
+    to database in original order. So the archive has same layout
+    of folders, as in single-thread mode.
+The number of workers and the maximum size of folder are selected to keep
+(encoder memory + input buffer + output buffer) of all workers
+in MemoryUsageLimit. Bigger folders are encoded in main thread.
+
+The old folders that must be repacked are processed by same workers:
+  - the main thread reads the pack streams of folder to memory buffer.
+  - the worker thread decodes that buffer with its own CDecoder and
+    encodes the data of remaining files.
+  - the main thread sends the notifications about the files of folder,
+    reports the errors, and adds the files to database.
+The memory of decoder is estimated from the methods of archive (CParsedMethods).
+If there are unknown methods, the old folders are repacked in main thread.
+*/
+
+static const UInt32 k_MtFolder_NumThreadsMax = 64;
+static const UInt64 k_MtFolder_MinFolderSize = (UInt64)1 << 20;
+static const UInt64 k_MtFolder_MaxFolderSize = (UInt64)1 << (sizeof(size_t) > 4 ? 32 : 28);
+
+/* it returns false, if the encoder of (method) has good internal
+   multithreading (LZMA2, ZSTD), or if it needs the sizes of files
+   in folder (BCJ2) */
+
+static bool MtFolder_GetEncoderParams(const CCompressionMethodMode &method,
+    UInt32 &numCoderThreads, UInt64 &encoderMemUsage)
+{
+  numCoderThreads = 1;
+  encoderMemUsage = 0;
+  bool thereIsCoder = false;
+  FOR_VECTOR (i, method.Methods)
+  {
+    const CMethodFull &m = method.Methods[i];
+    if (!m.IsSimpleCoder())
+      return false;
+    switch (m.Id)
+    {
+      case k_LZMA:
+        numCoderThreads = m.Get_Lzma_NumThreads();
+        encoderMemUsage += m.Get_Lzma_MemUsage(true);
+        break;
+      case k_PPMD:
+        encoderMemUsage += m.Get_Ppmd_MemSize();
+        break;
+      case k_BZip2:
+        encoderMemUsage += (UInt64)m.Get_BZip2_BlockSize() * 10;
+        break;
+      case k_Deflate:
+      case k_Deflate64:
+        encoderMemUsage += (UInt64)1 << 23;
+        break;
+      case k_BROTLI:
+        encoderMemUsage += (UInt64)1 << 27;
+        break;
+      case k_Dedup:
+      {
+        UInt64 windowSize;
+        if (!m.Get_DicSize(windowSize))
+          windowSize = NCompress::NDedup::kWindowSizeDefault;
+        encoderMemUsage += NCompress::NDedup::GetEncoderMemUsage(windowSize);
+        continue;
+      }
+      default:
+        if (m.Id != k_AES && !IsFilterMethod(m.Id))
+          return false;
+        encoderMemUsage += (UInt64)1 << 20;
+        continue;
+    }
+    if (thereIsCoder)
+      return false;
+    thereIsCoder = true;
+  }
+  return thereIsCoder;
+}
+
+
+/* it returns false, if the memory usage of decoder of old folders
+   can't be estimated from the methods of archive */
+
+static bool MtFolder_GetDecoderMemUsage(const CParsedMethods &pm, UInt64 &decoderMemUsage)
+{
+  // the buffers of coder mixer and the decoders with small state
+  decoderMemUsage = (UInt64)1 << 23;
+  // CInArchive stores no more than 128 ids
+  if (pm.IDs.Size() >= 128)
+    return false;
+  FOR_VECTOR (i, pm.IDs)
+  {
+    const UInt64 id = pm.IDs[i];
+    switch (id)
+    {
+      case k_LZMA:
+        decoderMemUsage += pm.LzmaDic;
+        break;
+      case k_LZMA2:
+      {
+        const unsigned p = pm.Lzma2Prop;
+        if (p > 40)
+          return false;
+        decoderMemUsage += (p == 40) ?
+            (UInt64)0xFFFFFFFF :
+            (UInt64)(2 | (p & 1)) << (p / 2 + 11);
+        break;
+      }
+      case k_Copy:
+      case k_AES:
+      case k_Deflate:
+      case k_Deflate64:
+      case k_BZip2:
+        break;
+      default:
+        if (!IsFilterMethod(id))
+          return false;
+    }
+  }
+  return true;
+}
+
+
+class CMtFolderEncoderThread Z7_final: public CVirtThread
+{
+public:
+  CEncoder Encoder;
+
+  CMyComPtr2<ISequentialInStream, CFolderInStream> FolderInStream;
+  CMyComPtr2_Create<ISequentialOutStream, CDynBufSeqOutStream> InBuf;
+  CMyComPtr2_Create<ISequentialOutStream, CDynBufSeqOutStream> OutBuf;
+  
+  CFolder *Folder;
+  const UInt32 *Indices;
+  unsigned NumSubFiles;
+  UInt64 ExpectedDataSize;
+  UInt64 InSizeForReduce;
+  CRecordVector<UInt64> PackSizes;
+  CRecordVector<UInt64> CoderUnpackSizes;
+  HRESULT Result;
+
+  // for repack of old folder (RepackFolderIndex >= 0):
+  //   (InBuf) contains the pack streams of folder
+  int RepackFolderIndex;
+  CNum NumCopyFiles;
+  const CDbEx *Db;
+  CDecoder Decoder;
+  CBoolVector ExtractStatuses;
+  CMyComPtr2<ISequentialInStream, CFolderInStream2> RepackInStream;
+  HRESULT EncodeResult;
+  UInt64 UnpackSize;
+
+  #ifndef Z7_NO_CRYPTO
+  CMyComPtr<ICryptoGetTextPassword> getTextPassword;
+  #endif
+
+  DECL_EXTERNAL_CODECS_LOC_VARS_DECL
+
+  CMtFolderEncoderThread(const CCompressionMethodMode &method):
+      Encoder(method),
+      Folder(NULL),
+      Indices(NULL),
+      NumSubFiles(0),
+      ExpectedDataSize(0),
+      InSizeForReduce(0),
+      Result(E_FAIL),
+      RepackFolderIndex(-1),
+      NumCopyFiles(0),
+      Db(NULL),
+      Decoder(false), // mixerST: the decoded stream is read by encoder in same thread
+      EncodeResult(E_FAIL),
+      UnpackSize(0)
+      {}
+
+  ~CMtFolderEncoderThread() Z7_DESTRUCTOR_override
+  {
+    /* WaitThreadFinish() will be called in ~CVirtThread().
+       But we need WaitThreadFinish() call before
+       destructors of this class members.
+    */
+    CVirtThread::WaitThreadFinish();
+  }
+private:
+  HRESULT Repack();
+  virtual void Execute() Z7_override;
+};
+
+HRESULT CMtFolderEncoderThread::Repack()
+{
+  const unsigned folderIndex = (unsigned)RepackFolderIndex;
+
+  CMyComPtr2_Create<IInStream, CBufInStream> packStream;
+  packStream->Init(InBuf->GetBuffer(), InBuf->GetSize());
+
+  #ifndef Z7_NO_CRYPTO
+  bool isEncrypted = false;
+  bool passwordIsDefined = false;
+  UString password;
+  #endif
+
+  CMyComPtr<ISequentialInStream> decodedStream;
+  bool dataAfterEnd_Error = false;
+
+  /* (InBuf) contains only the pack streams of folder.
+     The decoder seeks to (startPos + PackPositions[i]). So we use such (startPos)
+     that the first pack stream of folder is at offset 0 in (InBuf).
+     The sum is calculated modulo 2^64. */
+  const UInt64 startPos = Db->ArcInfo.DataStartPosition - Db->GetFolderStreamPos(folderIndex, 0);
+
+  RINOK(Decoder.Decode(
+      EXTERNAL_CODECS_LOC_VARS
+      packStream,
+      startPos,
+      *Db, folderIndex,
+      NULL, // *unpackSize : FULL unpack
+      NULL, // *outStream
+      NULL, // *compressProgress
+      &decodedStream
+      , dataAfterEnd_Error
+      Z7_7Z_DECODER_CRYPRO_VARS
+      , false // mtMode
+      , 1 // numThreads
+      , 0 // memUsage
+      ))
+  if (!decodedStream)
+    return E_FAIL;
+
+  CFolderInStream2 *inStreamSpec = RepackInStream.ClsPtr();
+  inStreamSpec->_inStream = decodedStream;
+  // the callbacks are not set: the main thread reports the files of folder
+  CRepackStreamBase *repackBase = inStreamSpec;
+  repackBase->_db = Db;
+  const UInt32 startIndex = Db->FolderStartFileIndex[folderIndex];
+
+  EncodeResult = repackBase->Init(startIndex, &ExtractStatuses);
+  if (EncodeResult == S_OK)
+  {
+    CMyComPtr2_Create<ISequentialInStream, CRepackInStreamWithSizes> inStreamSizeCount;
+    inStreamSizeCount->_db = Db;
+    inStreamSizeCount->Init(RepackInStream, startIndex, &ExtractStatuses);
+    EncodeResult = Encoder.Encode1(
+        EXTERNAL_CODECS_LOC_VARS
+        inStreamSizeCount,
+        &InSizeForReduce,
+        ExpectedDataSize,
+        *Folder,
+        OutBuf, PackSizes,
+        NULL);
+    UnpackSize = inStreamSizeCount->GetSize();
+    if (EncodeResult == S_OK)
+      Encoder.Encode_Post(UnpackSize, CoderUnpackSizes);
+  }
+  inStreamSpec->_inStream.Release();
+  return S_OK;
+}
+
+void CMtFolderEncoderThread::Execute()
+{
+  if (RepackFolderIndex >= 0)
+  {
+    try
+    {
+      Result = Repack();
+    }
+    catch(...)
+    {
+      Result = E_FAIL;
+    }
+    return;
+  }
+  try
+  {
+    CMyComPtr2_Create<IInStream, CBufInStream> inStream;
+    inStream->Init(InBuf->GetBuffer(), InBuf->GetSize());
+    Result = Encoder.Encode1(
+        EXTERNAL_CODECS_LOC_VARS
+        inStream,
+        &InSizeForReduce,
+        ExpectedDataSize,
+        *Folder,
+        OutBuf, PackSizes,
+        NULL); // compressProgress: the main thread reports progress after each folder
+    if (Result == S_OK)
+      Encoder.Encode_Post(FolderInStream->Get_TotalSize_for_Coder(), CoderUnpackSizes);
+  }
+  catch(...)
+  {
+    Result = E_FAIL;
+  }
+}
+
+
+class CMtFolderEncoder
+{
+  CObjectVector<CMtFolderEncoderThread> _threads;
+  unsigned _head; // index of oldest busy thread
+  unsigned _numBusy;
+  UInt64 _maxFolderSize;
+  UInt64 _maxRepackSize;
+
+  CMtFolderEncoderThread &GetFreeThread() { return _threads[(_head + _numBusy) % _threads.Size()]; }
+  HRESULT StartThread(CMtFolderEncoderThread &t, UInt64 expectedDataSize);
+  HRESULT CheckRepackResult(const CMtFolderEncoderThread &t);
+  HRESULT FinishOldest();
+public:
+  // these parameters must be set before Create() call
+  ISequentialOutStream *OutStream;
+  IArchiveUpdateCallback *UpdateCallback;
+  CLocalProgress *Progress;
+  const CObjectVector<CUpdateItem> *UpdateItems;
+  const CDbEx *Db;
+  CArchiveDatabaseOut *NewDatabase;
+  UInt64 *Complexity;
+
+  bool Need_CTime;
+  bool Need_ATime;
+  bool Need_MTime;
+  bool Need_Attrib;
+
+  // the sizes of new items must be known for Submit()
+  bool AllowNewFolders;
+
+  // for SubmitRepack()
+  IInStream *InStream;
+  IArchiveUpdateCallbackFile *OpCallback;
+  IArchiveExtractCallbackMessage2 *ExtractCallback;
+  const int *FileIndexToUpdateIndexMap;
+  #ifndef Z7_NO_CRYPTO
+  /* the password for encrypted old folders. It's requested from update callback
+     in main thread before Create(). The workers don't call the update callback. */
+  const UString *Password;
+  #endif
+
+  CMtFolderEncoder():
+      _head(0), _numBusy(0), _maxFolderSize(0), _maxRepackSize(0),
+      AllowNewFolders(false),
+      InStream(NULL),
+      OpCallback(NULL),
+      ExtractCallback(NULL),
+      FileIndexToUpdateIndexMap(NULL)
+      #ifndef Z7_NO_CRYPTO
+      , Password(NULL)
+      #endif
+      {}
+
+  HRESULT Create(
+      DECL_EXTERNAL_CODECS_LOC_VARS
+      const CCompressionMethodMode &method,
+      UInt64 inSizeForReduce);
+  bool IsCreated() const { return !_threads.IsEmpty(); }
+  bool CanEncode(UInt64 folderSize) const
+    { return IsCreated() && AllowNewFolders && folderSize <= _maxFolderSize; }
+  bool CanRepack(UInt64 packSize, UInt64 unpackSize) const
+    { return IsCreated() && packSize <= _maxRepackSize && unpackSize <= _maxRepackSize; }
+
+  HRESULT Submit(const UInt32 *indices, unsigned numSubFiles, UInt64 expectedDataSize);
+  HRESULT SubmitRepack(unsigned folderIndex, CNum numCopyFiles,
+      const CBoolVector &extractStatuses, UInt64 expectedDataSize);
+  // it writes all submitted folders to archive
+  HRESULT Flush();
+};
+
+
+HRESULT CMtFolderEncoder::Create(
+    DECL_EXTERNAL_CODECS_LOC_VARS
+    const CCompressionMethodMode &method,
+    UInt64 inSizeForReduce)
+{
+  UInt32 numCoderThreads;
+  UInt64 encoderMemUsage;
+  if (method.NumThreads <= 1
+      || !MtFolder_GetEncoderParams(method, numCoderThreads, encoderMemUsage))
+    return S_OK;
+
+  UInt32 numThreads = method.NumThreads / numCoderThreads;
+  if (numThreads > k_MtFolder_NumThreadsMax)
+    numThreads = k_MtFolder_NumThreadsMax;
+  for (; numThreads > 1; numThreads--)
+  {
+    const UInt64 memPerThread = method.MemoryUsageLimit / numThreads;
+    if (memPerThread >= encoderMemUsage + k_MtFolder_MinFolderSize * 2)
+    {
+      // each thread keeps input buffer and output buffer of folder
+      _maxFolderSize = (memPerThread - encoderMemUsage) / 2;
+      break;
+    }
+  }
+  if (numThreads <= 1)
+    return S_OK;
+  if (_maxFolderSize > k_MtFolder_MaxFolderSize)
+    _maxFolderSize = k_MtFolder_MaxFolderSize;
+
+  UInt64 decoderMemUsage;
+  if (Db && MtFolder_GetDecoderMemUsage(Db->ParsedMethods, decoderMemUsage))
+  {
+    const UInt64 memPerThread = method.MemoryUsageLimit / numThreads;
+    const UInt64 coderMemUsage = encoderMemUsage + decoderMemUsage;
+    // each thread keeps pack streams of old folder and output buffer
+    if (memPerThread >= coderMemUsage + k_MtFolder_MinFolderSize * 2)
+      _maxRepackSize = (memPerThread - coderMemUsage) / 2;
+    if (_maxRepackSize > k_MtFolder_MaxFolderSize)
+      _maxRepackSize = k_MtFolder_MaxFolderSize;
+  }
+
+  // the workers share the threads of (method)
+  CCompressionMethodMode mtMethod = method;
+  mtMethod.NumThreads = numCoderThreads;
+  FOR_VECTOR (i, mtMethod.Methods)
+  {
+    CMethodFull &m = mtMethod.Methods[i];
+    CMultiMethodProps::SetMethodThreadsTo_Replace(m, numCoderThreads);
+    m.NumThreads = numCoderThreads;
+  }
+
+  for (UInt32 i = 0; i < numThreads; i++)
+  {
+    VECTOR_ADD_NEW_OBJECT(_threads, CMtFolderEncoderThread(mtMethod))
+    CMtFolderEncoderThread &t = _threads.Back();
+    #ifdef Z7_EXTERNAL_CODECS
+    t._externalCodecs = _externalCodecs;
+    #endif
+    t.InSizeForReduce = inSizeForReduce;
+    t.Db = Db;
+    #ifndef Z7_NO_CRYPTO
+    if (Password)
+    {
+      // each worker has own object, because its reference counter is not thread-safe
+      CCryptoGetTextPassword *getPasswordSpec = new CCryptoGetTextPassword;
+      t.getTextPassword = getPasswordSpec;
+      getPasswordSpec->Password = *Password;
+    }
+    #endif
+    const WRes wres = t.Create();
+    if (wres != 0)
+    {
+      _threads.Clear();
+      return HRESULT_FROM_WIN32(wres);
+    }
+  }
+  return S_OK;
+}
+
+
+HRESULT CMtFolderEncoder::Submit(const UInt32 *indices, unsigned numSubFiles, UInt64 expectedDataSize)
+{
+  if (_numBusy == _threads.Size())
+  {
+    RINOK(FinishOldest())
+  }
+  
+  CMtFolderEncoderThread &t = GetFreeThread();
+  
+  t.RepackFolderIndex = -1;
+  t.FolderInStream.SetFromCls(new CFolderInStream);
+  CFolderInStream *inStreamSpec = t.FolderInStream.ClsPtr();
+  inStreamSpec->Need_CTime = Need_CTime;
+  inStreamSpec->Need_ATime = Need_ATime;
+  inStreamSpec->Need_MTime = Need_MTime;
+  inStreamSpec->Need_Attrib = Need_Attrib;
+  inStreamSpec->Init(UpdateCallback, indices, numSubFiles);
+
+  t.InBuf->Init();
+  if (!t.InBuf->GetBufPtrForWriting((size_t)expectedDataSize))
+    return E_OUTOFMEMORY;
+  RINOK(NCompress::CopyStream(t.FolderInStream, t.InBuf, NULL))
+  if (!inStreamSpec->WasFinished())
+    return E_FAIL;
+
+  t.Indices = indices;
+  t.NumSubFiles = numSubFiles;
+  return StartThread(t, expectedDataSize);
+}
+
+
+HRESULT CMtFolderEncoder::SubmitRepack(unsigned folderIndex, CNum numCopyFiles,
+    const CBoolVector &extractStatuses, UInt64 expectedDataSize)
+{
+  if (_numBusy == _threads.Size())
+  {
+    RINOK(FinishOldest())
+  }
+  
+  CMtFolderEncoderThread &t = GetFreeThread();
+
+  const UInt64 packSize = Db->GetFolderFullPackSize(folderIndex);
+  t.InBuf->Init();
+  if (!t.InBuf->GetBufPtrForWriting((size_t)packSize))
+    return E_OUTOFMEMORY;
+  RINOK(WriteRange(InStream, t.InBuf, Db->GetFolderStreamPos(folderIndex, 0), packSize, NULL))
+
+  t.RepackFolderIndex = (int)folderIndex;
+  t.NumCopyFiles = numCopyFiles;
+  t.ExtractStatuses = extractStatuses;
+  t.RepackInStream.SetFromCls(new CFolderInStream2);
+  t.EncodeResult = E_FAIL;
+  t.UnpackSize = 0;
+  t.Indices = NULL;
+  t.NumSubFiles = 0;
+  return StartThread(t, expectedDataSize);
+}
+
+
+HRESULT CMtFolderEncoder::StartThread(CMtFolderEncoderThread &t, UInt64 expectedDataSize)
+{
+  t.OutBuf->Init();
+  t.PackSizes.Clear();
+  t.CoderUnpackSizes.Clear();
+  t.ExpectedDataSize = expectedDataSize;
+  // the folders are added to database in order of submission
+  t.Folder = &NewDatabase->Folders.AddNew();
+  t.Result = E_FAIL;
+
+  const WRes wres = t.Start();
+  if (wres != 0)
+    return HRESULT_FROM_WIN32(wres);
+  _numBusy++;
+  return S_OK;
+}
+
+
+/* the worker thread doesn't call the callbacks.
+   So we send the notifications about the files of repacked folder here,
+   and we check the results in same order as in single-thread repack code. */
+
+HRESULT CMtFolderEncoder::CheckRepackResult(const CMtFolderEncoderThread &t)
+{
+  const unsigned folderIndex = (unsigned)t.RepackFolderIndex;
+  const CFolderInStream2 *inStreamSpec = t.RepackInStream.ClsPtr();
+  const UInt32 startIndex = Db->FolderStartFileIndex[folderIndex];
+  const unsigned numProcessed = inStreamSpec->GetNumProcessedFiles();
+
+  if (OpCallback)
+    for (unsigned k = 0; k < numProcessed; k++)
+    {
+      RINOK(OpCallback->ReportOperation(
+          NEventIndexType::kInArcIndex, startIndex + k,
+          t.ExtractStatuses[k] ?
+              NUpdateNotifyOp::kRepack :
+              NUpdateNotifyOp::kSkip))
+    }
+
+  if (t.EncodeResult == k_My_HRESULT_CRC_ERROR)
+  {
+    // CRC error was detected at closing of last processed file
+    if (ExtractCallback && numProcessed != 0)
+    {
+      RINOK(ExtractCallback->ReportExtractResult(
+          NEventIndexType::kInArcIndex, startIndex + numProcessed - 1,
+          NExtract::NOperationResult::kCRCError))
+    }
+    return E_FAIL;
+  }
+
+  if (inStreamSpec->Result == S_FALSE)
+  {
+    if (ExtractCallback)
+    {
+      RINOK(ExtractCallback->ReportExtractResult(
+          NEventIndexType::kBlockIndex, (UInt32)folderIndex,
+          NExtract::NOperationResult::kDataError))
+    }
+    return E_FAIL;
+  }
+  RINOK(inStreamSpec->Result)
+  RINOK(t.EncodeResult)
+  RINOK(inStreamSpec->CheckFinishedState())
+  if (t.UnpackSize != t.ExpectedDataSize)
+    return E_FAIL;
+  return S_OK;
+}
+
+
+HRESULT CMtFolderEncoder::FinishOldest()
+{
+  CMtFolderEncoderThread &t = _threads[_head];
+  const WRes wres = t.WaitExecuteFinish();
+  _head = (_head + 1) % _threads.Size();
+  _numBusy--;
+  if (wres != 0)
+    return HRESULT_FROM_WIN32(wres);
+  RINOK(t.Result)
+  if (t.RepackFolderIndex >= 0)
+  {
+    RINOK(CheckRepackResult(t))
+  }
+
+  RINOK(WriteStream(OutStream, t.OutBuf->GetBuffer(), t.OutBuf->GetSize()))
+
+  UInt64 packSize = 0;
+  FOR_VECTOR (i, t.PackSizes)
+  {
+    NewDatabase->PackSizes.Add(t.PackSizes[i]);
+    packSize += t.PackSizes[i];
+  }
+  if (packSize != t.OutBuf->GetSize())
+    return E_FAIL;
+  NewDatabase->CoderUnpackSizes += t.CoderUnpackSizes;
+  Progress->OutSize += packSize;
+
+  if (t.RepackFolderIndex >= 0)
+  {
+    Progress->InSize += t.UnpackSize;
+    AddOldFolderFiles(*Db, *UpdateItems, FileIndexToUpdateIndexMap,
+        (unsigned)t.RepackFolderIndex, t.NumCopyFiles, *NewDatabase);
+    t.RepackInStream.SetFromCls(NULL);
+    return Progress->SetCur();
+  }
+
+  UInt64 skippedSize;
+  UInt64 procSize;
+  RINOK(AddNewFolderFiles(t.FolderInStream.ClsPtr(), *UpdateItems,
+      t.Indices, t.NumSubFiles, Db,
+      t.FolderInStream->Get_TotalSize_for_Coder(),
+      *NewDatabase, procSize, skippedSize))
+  t.FolderInStream.SetFromCls(NULL);
+
+  Progress->InSize += procSize;
+
+  if (skippedSize != 0 && *Complexity >= skippedSize)
+  {
+    *Complexity -= skippedSize;
+    RINOK(UpdateCallback->SetTotal(*Complexity))
+  }
+  return Progress->SetCur();
+}
+
+
+HRESULT CMtFolderEncoder::Flush()
+{
+  while (_numBusy != 0)
+  {
+    RINOK(FinishOldest())
+  }
+  return S_OK;
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
+HRESULT Update(
+    DECL_EXTERNAL_CODECS_LOC_VARS
+    IInStream *inStream,
+    const CDbEx *db,
+    CObjectVector<CUpdateItem> &updateItems,
+    // const CObjectVector<CTreeFolder> &treeFolders,
+    // const CUniqBlocks &secureBlocks,
+    ISequentialOutStream *seqOutStream,
+    IArchiveUpdateCallback *updateCallback,
+    const CUpdateOptions &options)
+{
+  UInt64 numSolidFiles = options.NumSolidFiles;
+  if (numSolidFiles == 0)
+    numSolidFiles = 1;
+
+  Z7_DECL_CMyComPtr_QI_FROM(
+      IArchiveUpdateCallbackFile,
+      opCallback, updateCallback)
+
+  Z7_DECL_CMyComPtr_QI_FROM(
+      IArchiveExtractCallbackMessage2,
+      extractCallback, updateCallback)
+
+  /*
+  Z7_DECL_CMyComPtr_QI_FROM(
+      IArchiveUpdateCallbackArcProp,
+      reportArcProp, updateCallback)
+  */
+
+  // size_t totalSecureDataSize = (size_t)secureBlocks.GetTotalSizeInBytes();
+
+  CMyComPtr<IStreamSetRestriction> v_StreamSetRestriction;
+  {
+    Z7_DECL_CMyComPtr_QI_FROM(
+        IOutStream,
+        outStream, seqOutStream)
+    if (!outStream)
+      return E_NOTIMPL;
+    const UInt64 sfxBlockSize = (db && !options.RemoveSfxBlock) ?
+        db->ArcInfo.StartPosition: 0;
+    seqOutStream->QueryInterface(IID_IStreamSetRestriction, (void **)&v_StreamSetRestriction);
+    if (v_StreamSetRestriction)
+    {
+      UInt64 offset = 0;
+      RINOK(outStream->Seek(0, STREAM_SEEK_CUR, &offset))
+      RINOK(v_StreamSetRestriction->SetRestriction(
+          outStream ? offset + sfxBlockSize : 0,
+          outStream ? offset + sfxBlockSize + k_StartHeadersRewriteSize : 0))
+    }
+    outStream.Release();
+    if (sfxBlockSize != 0)
+    {
+      RINOK(WriteRange(inStream, seqOutStream, 0, sfxBlockSize, NULL))
+    }
+  }
+
+  CIntArr fileIndexToUpdateIndexMap;
+  UInt64 complexity = 0;
+  bool isThere_UnknownSize = false;
+  UInt64 inSizeForReduce2 = 0;
+
+ #ifndef Z7_NO_CRYPTO
+  bool needEncryptedRepack = false;
+ #endif
+
+  CRecordVector<CFilterMode2> filters;
+  CObjectVector<CSolidGroup> groups;
+  
+  #ifndef Z7_ST
+  bool thereAreRepacks = false;
+  #endif
+
+  bool useFilters = options.UseFilters;
+  if (useFilters)
+  {
+    const CCompressionMethodMode &method = *options.Method;
+
+    FOR_VECTOR (i, method.Methods)
+    {
+      /* IsFilterMethod() knows only built-in codecs
+         FIXME: we should check IsFilter status for external filters too */
+      if (IsFilterMethod(method.Methods[i].Id))
+      {
+        useFilters = false;
+        break;
+      }
+    }
+  }
+  
+  if (db)
+  {
+    fileIndexToUpdateIndexMap.Alloc(db->Files.Size());
+    unsigned i;
+    
+    for (i = 0; i < db->Files.Size(); i++)
+      fileIndexToUpdateIndexMap[i] = -1;
+
+    for (i = 0; i < updateItems.Size(); i++)
+    {
+      int index = updateItems[i].IndexInArchive;
+      if (index != -1)
+        fileIndexToUpdateIndexMap[(unsigned)index] = (int)i;
+    }
+
+    for (i = 0; i < db->NumFolders; i++)
+    {
+      CNum indexInFolder = 0;
+      CNum numCopyItems = 0;
+      const CNum numUnpackStreams = db->NumUnpackStreamsVector[i];
+      UInt64 repackSize = 0;
+      
       for (CNum fi = db->FolderStartFileIndex[i]; indexInFolder < numUnpackStreams; fi++)
       {
         if (fi >= db->Files.Size())
@@ -2359,12 +3591,60 @@ HRESULT Update(
       method.Password.Empty();
     }
 
+    // **************** NanaZip Modification Start ****************
+    if (options.DedupWindowSize != 0 && !method.Methods.IsEmpty())
+    {
+      RINOK(AddDedupMethod(method, options.DedupWindowSize))
+    }
+    // **************** NanaZip Modification End ****************
+
     CEncoder encoder(method);
 
     // ---------- Repack and copy old solid blocks ----------
 
     const CSolidGroup &group = groups[filterMode.GroupIndex];
     
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    CMtFolderEncoder mtEncoder;
+    {
+      unsigned numRepacks = 0;
+      FOR_VECTOR (k, group.folderRefs)
+      {
+        const CFolderRepack &rep = group.folderRefs[k];
+        if (rep.NumCopyFiles != db->NumUnpackStreamsVector[rep.FolderIndex])
+          numRepacks++;
+      }
+      // the size of folder must be known to keep the memory usage in limit
+      mtEncoder.AllowNewFolders = (group.Indices.Size() > 1 && !isThere_UnknownSize);
+      if (mtEncoder.AllowNewFolders || numRepacks > 1)
+      {
+        mtEncoder.OutStream = archive.SeqStream;
+        mtEncoder.UpdateCallback = updateCallback;
+        mtEncoder.Progress = lps.ClsPtr();
+        mtEncoder.UpdateItems = &updateItems;
+        mtEncoder.Db = db;
+        mtEncoder.NewDatabase = &newDatabase;
+        mtEncoder.Complexity = &complexity;
+        mtEncoder.Need_CTime = options.Need_CTime;
+        mtEncoder.Need_ATime = options.Need_ATime;
+        mtEncoder.Need_MTime = options.Need_MTime;
+        mtEncoder.Need_Attrib = options.Need_Attrib;
+        mtEncoder.InStream = inStream;
+        mtEncoder.OpCallback = opCallback;
+        mtEncoder.ExtractCallback = extractCallback;
+        mtEncoder.FileIndexToUpdateIndexMap = fileIndexToUpdateIndexMap;
+        #ifndef Z7_NO_CRYPTO
+        mtEncoder.Password = getPasswordSpec ? &getPasswordSpec->Password : NULL;
+        #endif
+        RINOK(mtEncoder.Create(
+            EXTERNAL_CODECS_LOC_VARS
+            method, inSizeForReduce))
+      }
+    }
+    #endif
+    // **************** NanaZip Modification End ****************
+
     FOR_VECTOR (folderRefIndex, group.folderRefs)
     {
       const CFolderRepack &rep = group.folderRefs[folderRefIndex];
@@ -2375,6 +3655,13 @@ HRESULT Update(
 
       if (rep.NumCopyFiles == numUnpackStreams)
       {
+        // **************** NanaZip Modification Start ****************
+        #ifndef Z7_ST
+        // the folders must be written in order
+        RINOK(mtEncoder.Flush())
+        #endif
+        // **************** NanaZip Modification End ****************
+
         if (opCallback)
         {
           RINOK(opCallback->ReportOperation(
@@ -2477,6 +3764,17 @@ HRESULT Update(
 
         // extractStatuses.DeleteFrom(numImportantFiles);
 
+        // **************** NanaZip Modification Start ****************
+        #ifndef Z7_ST
+        if (mtEncoder.CanRepack(db->GetFolderFullPackSize(folderIndex), sizeToEncode))
+        {
+          RINOK(mtEncoder.SubmitRepack(folderIndex, rep.NumCopyFiles, extractStatuses, sizeToEncode))
+          continue;
+        }
+        RINOK(mtEncoder.Flush())
+        #endif
+        // **************** NanaZip Modification End ****************
+
         unsigned startPackIndex = newDatabase.PackSizes.Size();
         UInt64 curUnpackSize;
         {
@@ -2656,46 +3954,10 @@ HRESULT Update(
         lps->InSize += curUnpackSize;
       }
       
-      newDatabase.NumUnpackStreamsVector.Add(rep.NumCopyFiles);
-      
-      CNum indexInFolder = 0;
-      for (CNum fi = db->FolderStartFileIndex[folderIndex]; indexInFolder < numUnpackStreams; fi++)
-      {
-        if (db->Files[fi].HasStream)
-        {
-          indexInFolder++;
-          const int updateIndex = fileIndexToUpdateIndexMap[fi];
-          if (updateIndex >= 0)
-          {
-            const CUpdateItem &ui = updateItems[(unsigned)updateIndex];
-            if (ui.NewData)
-              continue;
-
-            UString name;
-            CFileItem file;
-            CFileItem2 file2;
-            GetFile(*db, fi, file, file2);
-
-            if (ui.NewProps)
-            {
-              UpdateItem_To_FileItem2(ui, file2);
-              file.IsDir = ui.IsDir;
-              name = ui.Name;
-            }
-            else
-              db->GetPath(fi, name);
-
-            /*
-            file.Parent = ui.ParentFolderIndex;
-            if (ui.TreeFolderIndex >= 0)
-              treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
-            if (totalSecureDataSize != 0)
-              newDatabase.SecureIDs.Add(ui.SecureIndex);
-            */
-            newDatabase.AddFile(file, file2, name);
-          }
-        }
-      }
+      // **************** NanaZip Modification Start ****************
+      AddOldFolderFiles(*db, updateItems, fileIndexToUpdateIndexMap,
+          folderIndex, rep.NumCopyFiles, newDatabase);
+      // **************** NanaZip Modification End ****************
     }
 
 
@@ -2703,7 +3965,14 @@ HRESULT Update(
 
     const unsigned numFiles = group.Indices.Size();
     if (numFiles == 0)
+    // **************** NanaZip Modification Start ****************
+    {
+      #ifndef Z7_ST
+      RINOK(mtEncoder.Flush())
+      #endif
       continue;
+    }
+    // **************** NanaZip Modification End ****************
     CRecordVector<CRefItem> refItems;
     refItems.ClearAndSetSize(numFiles);
     // bool sortByType = (options.UseTypeSorting && isSoid); // numSolidFiles > 1
@@ -2718,6 +3987,18 @@ HRESULT Update(
     // sortParam.TreeFolders = &treeFolders;
     sortParam.SortByType = sortByType;
     refItems.Sort(CompareUpdateItems, (void *)&sortParam);
+
+    // **************** NanaZip Modification Start ****************
+    if (options.UseSimilaritySorting && opCallback
+        && numSolidFiles > 1 && options.NumSolidBytes != 0 && numFiles > 2)
+    {
+      UInt32 numSketchThreads = 1;
+      #ifndef Z7_ST
+      numSketchThreads = options.Method->NumThreads;
+      #endif
+      RINOK(SortBySimilarity(opCallback, numSketchThreads, sortByType, refItems))
+    }
+    // **************** NanaZip Modification End ****************
     
     CObjArray<UInt32> indices(numFiles);
 
@@ -2768,6 +4049,19 @@ HRESULT Update(
 
       RINOK(lps->SetCur())
 
+      // **************** NanaZip Modification Start ****************
+      #ifndef Z7_ST
+      if (totalSize != 0 && mtEncoder.CanEncode(totalSize))
+      {
+        RINOK(mtEncoder.Submit(&indices[i], numSubFiles, totalSize))
+        i += numSubFiles;
+        continue;
+      }
+      // the folders must be written in order
+      RINOK(mtEncoder.Flush())
+      #endif
+      // **************** NanaZip Modification End ****************
+
       /*
       const unsigned folderIndex = newDatabase.NumUnpackStreamsVector.Size();
 
@@ -2831,117 +4125,14 @@ HRESULT Update(
       // newDatabase.PackCRCsDefined.Add(false);
       // newDatabase.PackCRCs.Add(0);
 
-      CNum numUnpackStreams = 0;
-      UInt64 skippedSize = 0;
-      UInt64 procSize = 0;
-      // unsigned numProcessedFiles = 0;
-
-      for (unsigned subIndex = 0; subIndex < numSubFiles; subIndex++)
-      {
-        const CUpdateItem &ui = updateItems[indices[i + subIndex]];
-        CFileItem file;
-        CFileItem2 file2;
-        UString name;
-        if (ui.NewProps)
-        {
-          UpdateItem_To_FileItem(ui, file, file2);
-          name = ui.Name;
-        }
-        else
-        {
-          GetFile(*db, (unsigned)ui.IndexInArchive, file, file2);
-          db->GetPath((unsigned)ui.IndexInArchive, name);
-        }
-        if (file2.IsAnti || file.IsDir)
-          return E_FAIL;
-        
-        /*
-        CFileItem &file = newDatabase.Files[
-              startFileIndexInDatabase + i + subIndex];
-        */
-        if (!inStreamSpec->Processed[subIndex])
-        {
-          // we don't add file here
-          skippedSize += ui.Size;
-          continue; // comment it for debug
-          // name += ".locked"; // for debug
-        }
-
-        // if (inStreamSpec->Need_Crc)
-        file.Crc = inStreamSpec->CRCs[subIndex];
-        file.Size = inStreamSpec->Sizes[subIndex];
-        
-        procSize += file.Size;
-        // if (file.Size >= 0) // for debug: test purposes
-        if (file.Size != 0)
-        {
-          file.CrcDefined = true; // inStreamSpec->Need_Crc;
-          file.HasStream = true;
-          numUnpackStreams++;
-        }
-        else
-        {
-          file.CrcDefined = false;
-          file.HasStream = false;
-        }
-
-        if (inStreamSpec->TimesDefined[subIndex])
-        {
-          if (inStreamSpec->Need_CTime)
-            { file2.CTimeDefined = true;  file2.CTime = inStreamSpec->CTimes[subIndex]; }
-          if (inStreamSpec->Need_ATime
-              // && !ui.ATime_WasReadByAnalysis
-              )
-            { file2.ATimeDefined = true;  file2.ATime = inStreamSpec->ATimes[subIndex]; }
-          if (inStreamSpec->Need_MTime)
-            { file2.MTimeDefined = true;  file2.MTime = inStreamSpec->MTimes[subIndex]; }
-          if (inStreamSpec->Need_Attrib)
-          {
-            file2.AttribDefined = true;
-            file2.Attrib = inStreamSpec->Attribs[subIndex];
-          }
-        }
-
-        /*
-        file.Parent = ui.ParentFolderIndex;
-        if (ui.TreeFolderIndex >= 0)
-          treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
-        if (totalSecureDataSize != 0)
-          newDatabase.SecureIDs.Add(ui.SecureIndex);
-        */
-        /*
-        if (reportArcProp)
-        {
-          RINOK(ReportItemProps(reportArcProp, ui.IndexInClient, file.Size,
-              file.CrcDefined ? &file.Crc : NULL))
-        }
-        */
-
-        // numProcessedFiles++;
-        newDatabase.AddFile(file, file2, name);
-      }
-
-      /*
-      // for debug:
-      // we can write crc to folders area, if folder contains only one file
-      if (numUnpackStreams == 1 && numSubFiles == 1)
-      {
-        const CFileItem &file = newDatabase.Files.Back();
-        if (file.CrcDefined)
-          newDatabase.FolderUnpackCRCs.SetItem(folderIndex_New, true, file.Crc);
-      }
-      */
+      // **************** NanaZip Modification Start ****************
+      UInt64 skippedSize;
+      UInt64 procSize;
+      RINOK(AddNewFolderFiles(inStreamSpec.ClsPtr(), updateItems,
+          &indices[i], numSubFiles, db, curFolderUnpackSize,
+          newDatabase, procSize, skippedSize))
+      // **************** NanaZip Modification End ****************
 
-      /*
-      // it's optional check to ensure that sizes are correct
-      if (inStreamSpec->TotalSize_for_Coder != curFolderUnpackSize)
-        return E_FAIL;
-      */
-      // if (inStreamSpec->AlignLog == 0)
-      {
-        if (procSize != curFolderUnpackSize)
-          return E_FAIL;
-      }
       // else
       {
         /*
@@ -2982,9 +4173,6 @@ HRESULT Update(
       lps->InSize += procSize;
       // lps->InSize += curFolderUnpackSize;
 
-      // numUnpackStreams = 0 is very bad case for locked files
-      // v3.13 doesn't understand it.
-      newDatabase.NumUnpackStreamsVector.Add(numUnpackStreams);
       i += numSubFiles;
 
       if (skippedSize != 0 && complexity >= skippedSize)
@@ -3031,6 +4219,12 @@ HRESULT Update(
       }
       */
     }
+
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    RINOK(mtEncoder.Flush())
+    #endif
+    // **************** NanaZip Modification End ****************
   }
 
   RINOK(lps->SetCur())
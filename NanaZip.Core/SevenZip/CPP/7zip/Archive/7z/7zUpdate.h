@@ -103,6 +103,13 @@ struct CUpdateOptions
   bool RemoveSfxBlock;
   bool MultiThreadMixer;
 
+  // **************** NanaZip Modification Start ****************
+  // (DedupWindowSize != 0) : Dedup coder is added before other coders of new folders
+  UInt64 DedupWindowSize;
+  // the files with similar content are placed together in solid blocks
+  bool UseSimilaritySorting;
+  // **************** NanaZip Modification End ****************
+
   bool Need_CTime;
   bool Need_ATime;
   bool Need_MTime;
@@ -142,6 +149,10 @@ struct CUpdateOptions
       UseTypeSorting(true),
       RemoveSfxBlock(false),
       MultiThreadMixer(true),
+      // **************** NanaZip Modification Start ****************
+      DedupWindowSize(0),
+      UseSimilaritySorting(false),
+      // **************** NanaZip Modification End ****************
       Need_CTime(false),
       Need_ATime(false),
       Need_MTime(false),
@@ -209,6 +209,9 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
   #ifndef Z7_ST
   RINOK(decoder->SetNumberOfThreads(_props._numThreads))
+  // **************** NanaZip Modification Start ****************
+  RINOK(decoder->SetMemLimit(_props._memUsage_Decompress))
+  // **************** NanaZip Modification End ****************
   #endif
 
   CMyComPtr2_Create<ISequentialOutStream, CDummyOutStream> outStream;
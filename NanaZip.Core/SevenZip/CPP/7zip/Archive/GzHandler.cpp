@@ -4,20 +4,32 @@
 
 // #include  <stdio.h>
 
+// **************** NanaZip Modification Start ****************
+#include "../../../C/7zCrc.h"
+// **************** NanaZip Modification End ****************
 #include "../../../C/CpuArch.h"
 
 #include "../../Common/ComTry.h"
 #include "../../Common/Defs.h"
+// **************** NanaZip Modification Start ****************
+#include "../../Common/MyBuffer.h"
+// **************** NanaZip Modification End ****************
 #include "../../Common/StringConvert.h"
 
 #include "../../Windows/PropVariantUtils.h"
 #include "../../Windows/TimeUtils.h"
 
+// **************** NanaZip Modification Start ****************
+#include "../Common/LimitedStreams.h"
+// **************** NanaZip Modification End ****************
 #include "../Common/ProgressUtils.h"
 #include "../Common/RegisterArc.h"
 #include "../Common/StreamUtils.h"
 
 #include "../Compress/CopyCoder.h"
+// **************** NanaZip Modification Start ****************
+#include "../Compress/DeflateBlockDecoder.h"
+// **************** NanaZip Modification End ****************
 #include "../Compress/DeflateDecoder.h"
 #include "../Compress/DeflateEncoder.h"
 
@@ -446,11 +458,109 @@ HRESULT CItem::WriteFooter(ISequentialOutStream *stream)
   return WriteStream(stream, buf, 8);
 }
 
-Z7_CLASS_IMP_CHandler_IInArchive_3(
+// **************** NanaZip Modification Start ****************
+/*
+CIndex is the list of access points in gzip stream (as in zran.c from zlib).
+The access point is the start of gzip member, or the start of Deflate block
+with the copy of last 32 KB of data before that block.
+CInStream adds the points, when it decodes the data for first time.
+So the next reads and backward seeks in same archive can continue
+decoding from nearest access point instead of the start of stream.
+The member that contains a block larger than (kIndexBlockSizeMax)
+is decoded sequentially from the start of that member.
+*/
+
+static const unsigned kIndexChunkSizeLog = 18;
+static const UInt64 kIndexSpanMin = (UInt64)1 << 20;
+static const unsigned kIndexNumPointsMax = 1 << 10;
+// the maximum size of output data of one Deflate block that CInStream decodes by blocks
+static const size_t kIndexBlockSizeMax = (size_t)1 << 26;
+static const size_t kSeqSkipBufSize = (size_t)1 << 16;
+
+struct CAccessPoint
+{
+  UInt64 InBitPos;  // the start of member header, or the start of Deflate block
+  UInt64 OutPos;
+  UInt64 MemberDataPos; // the start of Deflate data of the member that contains the point
+  UInt64 MemberOutPos;
+  bool IsMemberStart;
+  CByteBuffer Window;
+};
+
+struct CIndex
+{
+  CObjectVector<CAccessPoint> Points;
+  UInt64 Span;
+  UInt64 Size;
+  bool Size_Defined;
+
+  CIndex() { Clear(); }
+
+  void Clear()
+  {
+    Points.Clear();
+    Span = kIndexSpanMin;
+    Size = 0;
+    Size_Defined = false;
+  }
+
+  bool NeedPoint(UInt64 outPos) const
+  {
+    return Points.IsEmpty() || outPos >= Points.Back().OutPos + Span;
+  }
+
+  // it returns the index of last point with (OutPos <= pos)
+  unsigned FindPoint(UInt64 pos) const
+  {
+    unsigned left = 0, right = Points.Size();
+    for (;;)
+    {
+      const unsigned mid = (left + right) / 2;
+      if (mid == left)
+        return left;
+      if (pos < Points[mid].OutPos)
+        right = mid;
+      else
+        left = mid;
+    }
+  }
+
+  void AddPoint(UInt64 inBitPos, UInt64 outPos,
+      UInt64 memberDataPos, UInt64 memberOutPos,
+      bool isMemberStart, const Byte *window, size_t windowSize)
+  {
+    if (Points.Size() >= kIndexNumPointsMax)
+    {
+      // we remove every second point
+      for (unsigned i = Points.Size(); i > 1;)
+        if ((--i & 1) != 0)
+          Points.Delete(i);
+      Span <<= 1;
+      if (!NeedPoint(outPos))
+        return;
+    }
+    CAccessPoint &p = Points.AddNew();
+    p.InBitPos = inBitPos;
+    p.OutPos = outPos;
+    p.MemberDataPos = memberDataPos;
+    p.MemberOutPos = memberOutPos;
+    p.IsMemberStart = isMemberStart;
+    p.Window.CopyFrom(window, windowSize);
+  }
+};
+
+class CInStream;
+// **************** NanaZip Modification End ****************
+
+// **************** NanaZip Modification Start ****************
+Z7_CLASS_IMP_CHandler_IInArchive_4(
+  IInArchiveGetStream,
   IArchiveOpenSeq,
   IOutArchive,
   ISetProperties
 )
+  friend class CInStream;
+// **************** NanaZip Modification End ****************
   CItem _item;
 
   bool _isArc;
@@ -473,6 +583,10 @@ Z7_CLASS_IMP_CHandler_IInArchive_3(
   CSingleMethodProps _props;
   CHandlerTimeOptions _timeOptions;
 
+  // **************** NanaZip Modification Start ****************
+  CIndex _index;
+  // **************** NanaZip Modification End ****************
+
 public:
   CHandler():
       _isArc(false)
@@ -666,9 +780,632 @@ Z7_COM7F_IMF(CHandler::Close())
   _stream.Release();
   if (_decoder)
     _decoder->ReleaseInStream();
+  // **************** NanaZip Modification Start ****************
+  _index.Clear();
+  // **************** NanaZip Modification End ****************
+  return S_OK;
+}
+
+
+// **************** NanaZip Modification Start ****************
+
+class CIndexChunkReader: public NDecoder::CInChunkSource
+{
+  NDecoder::CInChunk _chunks[2];
+  UInt64 _indexes[2];
+  unsigned _last;
+public:
+  IInStream *Stream;
+  UInt64 StreamSize;
+  HRESULT Res;
+
+  void Init(IInStream *stream, UInt64 streamSize)
+  {
+    Stream = stream;
+    StreamSize = streamSize;
+    _indexes[0] = _indexes[1] = (UInt64)(Int64)-1;
+    _last = 0;
+    Res = S_OK;
+  }
+
+  // CBlockBitReader uses only the last returned chunk, so we can replace another chunk.
+  const NDecoder::CInChunk *GetChunk(UInt64 index) Z7_override
+  {
+    for (unsigned i = 0; i < 2; i++)
+      if (_indexes[i] == index)
+      {
+        _last = i;
+        return &_chunks[i];
+      }
+    const UInt64 offset = index << kIndexChunkSizeLog;
+    if (offset >= StreamSize || Res != S_OK)
+      return NULL;
+    const unsigned i = _last ^ 1;
+    NDecoder::CInChunk &c = _chunks[i];
+    _indexes[i] = (UInt64)(Int64)-1;
+    if (!c.Data)
+    {
+      c.Data = (Byte *)::MidAlloc((size_t)1 << kIndexChunkSizeLog);
+      if (!c.Data)
+      {
+        Res = E_OUTOFMEMORY;
+        return NULL;
+      }
+    }
+    size_t size = (size_t)1 << kIndexChunkSizeLog;
+    if (size > StreamSize - offset)
+      size = (size_t)(StreamSize - offset);
+    Res = InStream_SeekSet(Stream, offset);
+    if (Res == S_OK)
+      Res = ReadStream_FALSE(Stream, c.Data, size);
+    if (Res != S_OK)
+      return NULL;
+    c.Offset = offset;
+    c.Size = size;
+    _indexes[i] = index;
+    _last = i;
+    return &c;
+  }
+
+  // it returns false, if there is no such data in stream, or if (Res != S_OK)
+  bool ReadBytes(UInt64 pos, Byte *data, size_t size)
+  {
+    while (size != 0)
+    {
+      const NDecoder::CInChunk *c = GetChunk(pos >> kIndexChunkSizeLog);
+      if (!c)
+        return false;
+      const size_t offset = (size_t)(pos - c->Offset);
+      if (offset >= c->Size)
+        return false;
+      size_t cur = c->Size - offset;
+      if (cur > size)
+        cur = size;
+      memcpy(data, c->Data + offset, cur);
+      data += cur;
+      pos += cur;
+      size -= cur;
+    }
+    return true;
+  }
+};
+
+
+// the sink for CBlockDecoder that keeps all data of current block and 32 KB before it
+
+class CIndexOutWindow
+{
+  CByteBuffer _buf;
+
+  bool Grow(size_t size)
+  {
+    if (_buf.Size() - Pos >= size)
+      return true;
+    const size_t sizeMax = kHistorySize32 + kIndexBlockSizeMax;
+    if (size > sizeMax - Pos)
+      return false;
+    size_t newSize = _buf.Size() * 2;
+    if (newSize > sizeMax)
+      newSize = sizeMax;
+    if (newSize < Pos + size)
+      newSize = Pos + size;
+    _buf.ChangeSize_KeepData(newSize, Pos);
+    return true;
+  }
+
+public:
+  size_t Pos;
+  size_t HistStart; // the start of current gzip member in window
+  bool DistError;
+
+  Byte *Data() { return _buf; }
+
+  void Init()
+  {
+    if (_buf.Size() == 0)
+      _buf.Alloc(kHistorySize32 << 2);
+    Pos = 0;
+    HistStart = 0;
+    DistError = false;
+  }
+
+  // it keeps only 32 KB of data before (Pos), and it returns the size of removed data
+  size_t Compact()
+  {
+    if (Pos <= kHistorySize32)
+      return 0;
+    const size_t shift = Pos - kHistorySize32;
+    memmove(_buf, _buf + shift, kHistorySize32);
+    Pos = kHistorySize32;
+    HistStart = (HistStart > shift ? HistStart - shift : 0);
+    return shift;
+  }
+
+  Z7_FORCE_INLINE
+  bool PutByte(unsigned b)
+  {
+    if (Pos == _buf.Size() && !Grow(1))
+      return false;
+    _buf[Pos++] = (Byte)b;
+    return true;
+  }
+
+  bool CopyMatch(UInt32 dist, unsigned len)
+  {
+    if (dist > Pos - HistStart)
+    {
+      DistError = true;
+      return false;
+    }
+    if (!Grow(len))
+      return false;
+    Byte *p = _buf + Pos;
+    Pos += len;
+    do
+    {
+      *p = *(p - dist);
+      p++;
+    }
+    while (--len);
+    return true;
+  }
+};
+
+
+/*
+CInStream decodes gzip stream from (_handlerSpec->_stream) block by block.
+It supports multi-member gzip streams. It stops at the data that is not gzip member.
+CRC of member is checked, only if the decoding was started from the start of member.
+If some block is too large for (_window), CInStream switches to sequential mode:
+the current member is decoded by (_seqDecoder) from the start of the member,
+and the blocks are used again after the end of that member.
+*/
+
+Z7_CLASS_IMP_IInStream(
+  CInStream
+)
+  UInt64 _virtPos;
+  UInt64 _bufOutPos;   // the position in output stream of first byte in (_window)
+  UInt64 _headerPos;   // the position of next member header in input stream
+  UInt64 _memberOutPos;
+  UInt64 _memberDataPos;
+  UInt64 _seqOutPos;   // the position in output stream of next byte from (_seqDecoder)
+  UInt32 _crc;
+  bool _crcMode;
+  bool _needHeader;
+  bool _finished;
+  bool _stateIsValid;
+  bool _seqMode;
+
+  CMyComPtr<IInStream> _stream;
+  CIndexChunkReader _inReader;
+  NDecoder::CBlockBitReader _bitReader;
+  NDecoder::CBlockDecoder _decoder;
+  CIndexOutWindow _window;
+  CMyComPtr2<ISequentialInStream, NDecoder::CCOMCoder> _seqDecoder;
+  CByteBuffer _seqBuf;
+
+  bool ReadMemberHeader(UInt64 pos, UInt64 &dataPos);
+  HRESULT InitBitReader(UInt64 bitPos);
+  HRESULT StartFromPoint(unsigned pointIndex);
+  HRESULT DecodeStep();
+  HRESULT Seq_Start();
+  HRESULT Seq_FinishMember();
+  HRESULT Seq_Read(void *data, UInt32 size, UInt32 &processed);
+  HRESULT Seq_DecodeToPos(UInt64 pos);
+  HRESULT DecodeToPos(UInt64 pos);
+public:
+  CMyComPtr2<IInArchive, CHandler> _handlerSpec;
+
+  HRESULT Init();
+};
+
+
+HRESULT CInStream::Init()
+{
+  _stream = _handlerSpec->_stream;
+  UInt64 streamSize;
+  RINOK(InStream_GetSize_SeekToEnd(_stream, streamSize))
+  _inReader.Init(_stream, streamSize);
+  _window.Init();
+  _virtPos = 0;
+  _bufOutPos = 0;
+  _stateIsValid = false;
+  _seqMode = false;
+  CIndex &index = _handlerSpec->_index;
+  if (index.Points.IsEmpty())
+    index.AddPoint(0, 0, 0, 0, true, NULL, 0);
+  return S_OK;
+}
+
+
+bool CInStream::ReadMemberHeader(UInt64 pos, UInt64 &dataPos)
+{
+  Byte buf[10];
+  if (!_inReader.ReadBytes(pos, buf, 10))
+    return false;
+  if (buf[0] != kSignature_0 ||
+      buf[1] != kSignature_1 ||
+      buf[2] != kSignature_2)
+    return false;
+  const Byte flags = buf[3];
+  if ((flags & NFlags::kReserved) != 0)
+    return false;
+  pos += 10;
+  if ((flags & NFlags::kExtra) != 0)
+  {
+    if (!_inReader.ReadBytes(pos, buf, 2))
+      return false;
+    pos += 2 + (UInt32)GetUi16(buf);
+  }
+  for (unsigned k = 0; k < 2; k++)
+  {
+    if ((flags & (k == 0 ? NFlags::kName : NFlags::kComment)) == 0)
+      continue;
+    const size_t limit = (k == 0 ? kNameMaxLen : kCommentMaxLen);
+    for (size_t i = 0;; i++)
+    {
+      if (i == limit || !_inReader.ReadBytes(pos++, buf, 1))
+        return false;
+      if (buf[0] == 0)
+        break;
+    }
+  }
+  if ((flags & NFlags::kCrc) != 0)
+    pos += 2;
+  dataPos = pos;
+  return pos < _inReader.StreamSize;
+}
+
+
+HRESULT CInStream::InitBitReader(UInt64 bitPos)
+{
+  if (_bitReader.Init(&_inReader, bitPos >> (kIndexChunkSizeLog + 3), bitPos))
+    return S_OK;
+  RINOK(_inReader.Res)
+  return S_FALSE;
+}
+
+
+HRESULT CInStream::StartFromPoint(unsigned pointIndex)
+{
+  const CAccessPoint &p = _handlerSpec->_index.Points[pointIndex];
+  const size_t winSize = p.Window.Size();
+  _window.Init();
+  memcpy(_window.Data(), p.Window, winSize);
+  _window.Pos = winSize;
+  _bufOutPos = p.OutPos - winSize;
+  _finished = false;
+  _crcMode = false;
+  _needHeader = p.IsMemberStart;
+  _seqMode = false;
+  _memberDataPos = p.MemberDataPos;
+  _memberOutPos = p.MemberOutPos;
+  if (p.IsMemberStart)
+    _headerPos = p.InBitPos >> 3;
+  else
+  {
+    RINOK(InitBitReader(p.InBitPos))
+  }
+  _stateIsValid = true;
+  return S_OK;
+}
+
+
+HRESULT CInStream::DecodeStep()
+{
+  CIndex &index = _handlerSpec->_index;
+
+  if (_needHeader)
+  {
+    const UInt64 outPos = _bufOutPos + _window.Pos;
+    UInt64 dataPos;
+    if (!ReadMemberHeader(_headerPos, dataPos))
+    {
+      RINOK(_inReader.Res)
+      if (_headerPos == 0)
+        return S_FALSE;
+      // it's end of archive, or there is some data after the end of archive
+      _finished = true;
+      index.Size = outPos;
+      index.Size_Defined = true;
+      return S_OK;
+    }
+    if (index.NeedPoint(outPos))
+      index.AddPoint(_headerPos << 3, outPos, dataPos, outPos, true, NULL, 0);
+    _window.HistStart = _window.Pos;
+    _memberOutPos = outPos;
+    _memberDataPos = dataPos;
+    _crc = CRC_INIT_VAL;
+    _crcMode = true;
+    RINOK(InitBitReader(dataPos << 3))
+    _needHeader = false;
+    return S_OK;
+  }
+
+  _bufOutPos += _window.Compact();
+  {
+    const UInt64 outPos = _bufOutPos + _window.Pos;
+    if (index.NeedPoint(outPos))
+      index.AddPoint(_bitReader.GetBitPos(), outPos,
+          _memberDataPos, _memberOutPos, false,
+          _window.Data() + _window.HistStart, _window.Pos - _window.HistStart);
+  }
+
+  const size_t start = _window.Pos;
+  const int res = _decoder.DecodeBlock(_bitReader, _window, false);
+  RINOK(_inReader.Res)
+  if (res == NDecoder::k_Block_Stop)
+  {
+    // the block is too large for (_window)
+    _seqMode = true;
+    return Seq_Start();
+  }
+  if (res != NDecoder::k_Block_OK || _bitReader.ExtraBitsWereRead())
+    return S_FALSE;
+  if (_crcMode)
+    _crc = CrcUpdate(_crc, _window.Data() + start, _window.Pos - start);
+  if (!_decoder.IsFinal)
+    return S_OK;
+
+  const UInt64 footerPos = (_bitReader.GetBitPos() + 7) >> 3;
+  Byte footer[8];
+  if (!_inReader.ReadBytes(footerPos, footer, 8))
+  {
+    RINOK(_inReader.Res)
+    return S_FALSE;
+  }
+  if (_crcMode)
+  {
+    const UInt64 memberSize = _bufOutPos + _window.Pos - _memberOutPos;
+    if (Get32(footer) != CRC_GET_DIGEST(_crc) ||
+        Get32(footer + 4) != (UInt32)memberSize)
+      return S_FALSE;
+  }
+  _headerPos = footerPos + 8;
+  _needHeader = true;
+  return S_OK;
+}
+
+
+HRESULT CInStream::Seq_Start()
+{
+  CMyComPtr<ISequentialInStream> inStream;
+  RINOK(CreateLimitedInStream(_stream, _memberDataPos,
+      _inReader.StreamSize - _memberDataPos, &inStream))
+  _seqDecoder.Create_if_Empty();
+  _seqDecoder->SetInStream(inStream);
+  {
+    Z7_DECL_CMyComPtr_QI_FROM(
+        ICompressSetOutStreamSize,
+        setOutStreamSize, _seqDecoder.Interface())
+    RINOK(setOutStreamSize->SetOutStreamSize(NULL))
+  }
+  RINOK(_seqDecoder->InitInStream_AtPos(_memberDataPos))
+  if (_seqBuf.Size() == 0)
+    _seqBuf.Alloc(kSeqSkipBufSize);
+  _seqOutPos = _memberOutPos;
+  _crc = CRC_INIT_VAL;
+  return S_OK;
+}
+
+
+HRESULT CInStream::Seq_FinishMember()
+{
+  _seqDecoder->AlignToByte();
+  const UInt64 footerPos = _seqDecoder->GetInputProcessedSize();
+  _seqDecoder->ReleaseInStream();
+  Byte footer[8];
+  if (!_inReader.ReadBytes(footerPos, footer, 8))
+  {
+    RINOK(_inReader.Res)
+    return S_FALSE;
+  }
+  if (Get32(footer) != CRC_GET_DIGEST(_crc) ||
+      Get32(footer + 4) != (UInt32)(_seqOutPos - _memberOutPos))
+    return S_FALSE;
+  // the next member is decoded by blocks
+  _seqMode = false;
+  _window.Init();
+  _bufOutPos = _seqOutPos;
+  _headerPos = footerPos + 8;
+  _needHeader = true;
+  _crcMode = false;
+  _finished = false;
+  return S_OK;
+}
+
+
+// it can leave sequential mode, if the member was finished
+HRESULT CInStream::Seq_Read(void *data, UInt32 size, UInt32 &processed)
+{
+  processed = 0;
+  RINOK(_seqDecoder.Interface()->Read(data, size, &processed))
+  if (_seqDecoder->InputEofError())
+    return S_FALSE;
+  _crc = CrcUpdate(_crc, data, processed);
+  _seqOutPos += processed;
+  if (_seqDecoder->IsFinished())
+    return Seq_FinishMember();
+  if (processed == 0)
+    return S_FALSE;
+  return S_OK;
+}
+
+
+HRESULT CInStream::Seq_DecodeToPos(UInt64 pos)
+{
+  if (pos < _seqOutPos)
+  {
+    RINOK(Seq_Start())
+  }
+  while (_seqMode && _seqOutPos < pos)
+  {
+    UInt32 cur = (UInt32)kSeqSkipBufSize;
+    if (cur > pos - _seqOutPos)
+      cur = (UInt32)(pos - _seqOutPos);
+    UInt32 processed;
+    RINOK(Seq_Read(_seqBuf, cur, processed))
+  }
+  return S_OK;
+}
+
+
+HRESULT CInStream::DecodeToPos(UInt64 pos)
+{
+  const CIndex &index = _handlerSpec->_index;
+  if (index.Size_Defined && pos >= index.Size)
+    return S_OK;
+  if (_stateIsValid && _seqMode && pos < _memberOutPos)
+    _stateIsValid = false;
+  if (!_stateIsValid
+      || (!_seqMode
+        && (pos < _bufOutPos
+          || pos >= _bufOutPos + _window.Pos)))
+  {
+    const unsigned pointIndex = index.FindPoint(pos);
+    if (!_stateIsValid
+        || pos < _bufOutPos
+        || index.Points[pointIndex].OutPos > _bufOutPos + _window.Pos)
+    {
+      _stateIsValid = false;
+      RINOK(StartFromPoint(pointIndex))
+    }
+  }
+  for (;;)
+  {
+    HRESULT res;
+    if (_seqMode)
+    {
+      res = Seq_DecodeToPos(pos);
+      if (res == S_OK && _seqMode)
+        break;
+    }
+    else if (pos >= _bufOutPos + _window.Pos && !_finished)
+      res = DecodeStep();
+    else
+      break;
+    if (res != S_OK)
+    {
+      _stateIsValid = false;
+      return res;
+    }
+  }
+  return S_OK;
+}
+
+
+Z7_COM7F_IMF(CInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+  COM_TRY_BEGIN
+
+  if (processedSize)
+    *processedSize = 0;
+  if (size == 0)
+    return S_OK;
+
+  for (;;)
+  {
+    RINOK(DecodeToPos(_virtPos))
+    if (!_stateIsValid)
+      return S_OK;
+    if (!_seqMode)
+      break;
+    if (_seqOutPos != _virtPos)
+    {
+      // (_virtPos) is after the end of stream
+      return S_OK;
+    }
+    UInt32 processed;
+    const HRESULT res = Seq_Read(data, size, processed);
+    if (res != S_OK)
+    {
+      _stateIsValid = false;
+      return res;
+    }
+    if (processed != 0)
+    {
+      _virtPos += processed;
+      if (processedSize)
+        *processedSize = processed;
+      return S_OK;
+    }
+    // the member was finished at (_virtPos), and the next member is decoded by blocks
+  }
+  if (!_stateIsValid || _virtPos < _bufOutPos)
+    return S_OK;
+  {
+    const UInt64 end = _bufOutPos + _window.Pos;
+    if (_virtPos >= end)
+      return S_OK;
+    const UInt64 rem = end - _virtPos;
+    if (size > rem)
+      size = (UInt32)rem;
+  }
+  memcpy(data, _window.Data() + (size_t)(_virtPos - _bufOutPos), size);
+  _virtPos += size;
+  if (processedSize)
+    *processedSize = size;
   return S_OK;
+
+  COM_TRY_END
 }
 
+
+Z7_COM7F_IMF(CInStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
+{
+  COM_TRY_BEGIN
+
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _virtPos; break;
+    case STREAM_SEEK_END:
+    {
+      const CIndex &index = _handlerSpec->_index;
+      if (!index.Size_Defined)
+      {
+        // we decode all data to get the size of stream
+        RINOK(DecodeToPos((UInt64)(Int64)-1))
+      }
+      offset += index.Size;
+      break;
+    }
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _virtPos = (UInt64)offset;
+  if (newPosition)
+    *newPosition = (UInt64)offset;
+  return S_OK;
+
+  COM_TRY_END
+}
+
+
+Z7_COM7F_IMF(CHandler::GetStream(UInt32 index, ISequentialInStream **stream))
+{
+  COM_TRY_BEGIN
+
+  *stream = NULL;
+  if (index != 0)
+    return E_INVALIDARG;
+  if (!_stream)
+    return S_FALSE;
+
+  CMyComPtr2<ISequentialInStream, CInStream> spec;
+  spec.Create_if_Empty();
+  spec->_handlerSpec.SetFromCls(this);
+  RINOK(spec->Init())
+  *stream = spec.Detach();
+  return S_OK;
+
+  COM_TRY_END
+}
+
+// **************** NanaZip Modification End ****************
+
 Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testMode, IArchiveExtractCallback *extractCallback))
 {
@@ -720,6 +1457,16 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   bool firstItem = true;
 
   UInt64 packSize = _decoder->GetInputProcessedSize();
+
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  /* big member is decoded by CMtDecoder directly from (_stream).
+     BGZF-like files contain many small members, so we stop to try CMtDecoder
+     after first small member. */
+  NDecoder::CMtDecoder mtDecoder;
+  bool useMt = (_stream && _props._numThreads > 1);
+  #endif
+  // **************** NanaZip Modification End ****************
   // printf("\npackSize = %d", (unsigned)packSize);
 
   UInt64 unpackedSize = 0;
@@ -775,6 +1522,39 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     const UInt64 startOffset = outStream->GetSize();
     outStream->InitCRC();
 
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    const UInt64 startPos = _decoder->GetInputProcessedSize();
+    if (useMt && startPos < _packSize && _packSize - startPos >= NDecoder::kMtStreamSizeMin)
+    {
+      RINOK(InStream_SeekSet(_stream, startPos))
+      result = mtDecoder.Code(_stream, outStream, NULL, false, lps,
+          _props._numThreads, _props._memUsage_Decompress);
+      packSize = startPos + mtDecoder.InSize;
+      unpackedSize = outStream->GetSize();
+      if (mtDecoder.InSize < NDecoder::kMtStreamSizeMin)
+        useMt = false;
+
+      if (result != S_OK && result != S_FALSE)
+        return result;
+
+      if (mtDecoder.InputEofError)
+      {
+        _needMoreInput = true;
+        result = S_FALSE;
+      }
+
+      if (result != S_OK)
+        break;
+
+      // the footer and next members are read by (_decoder)
+      RINOK(InStream_SeekSet(_stream, packSize))
+      RINOK(_decoder->InitInStream_AtPos(packSize))
+    }
+    else
+    #endif
+    {
+    // **************** NanaZip Modification End ****************
     result = _decoder->CodeResume(outStream, NULL, lps);
 
     packSize = _decoder->GetInputProcessedSize();
@@ -792,6 +1572,9 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
     if (result != S_OK)
       break;
+    // **************** NanaZip Modification Start ****************
+    }
+    // **************** NanaZip Modification End ****************
 
     _decoder->AlignToByte();
     
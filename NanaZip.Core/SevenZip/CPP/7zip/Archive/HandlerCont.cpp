@@ -164,6 +164,13 @@ void CHandlerImg::CloseAtError()
   Stream.Release();
 }
 
+// **************** NanaZip Modification Start ****************
+Z7_COM7F_IMF(CHandlerImg::SetProperties(const wchar_t * const * /* names */, const PROPVARIANT * /* values */, UInt32 /* numProps */))
+{
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
+
 void CHandlerImg::Clear_HandlerImg_Vars()
 {
   _imgExt = NULL;
@@ -66,18 +66,33 @@ class CHandlerImg:
   public IInArchive,
   public IInArchiveGetStream,
   public IInStream,
+  // **************** NanaZip Modification Start ****************
+  public ISetProperties,
+  // **************** NanaZip Modification End ****************
   public CMyUnknownImp
 {
-  Z7_COM_UNKNOWN_IMP_4(
+  // **************** NanaZip Modification Start ****************
+  // Z7_COM_UNKNOWN_IMP_4(
+  //     IInArchive,
+  //     IInArchiveGetStream,
+  //     ISequentialInStream,
+  //     IInStream)
+  Z7_COM_UNKNOWN_IMP_5(
       IInArchive,
       IInArchiveGetStream,
       ISequentialInStream,
-      IInStream)
+      IInStream,
+      ISetProperties)
+  // **************** NanaZip Modification End ****************
 
   Z7_COM7F_IMP(Open(IInStream *stream, const UInt64 *maxCheckStartPosition, IArchiveOpenCallback *openCallback))
   Z7_COM7F_IMP(GetNumberOfItems(UInt32 *numItems))
   Z7_COM7F_IMP(Extract(const UInt32 *indices, UInt32 numItems, Int32 testMode, IArchiveExtractCallback *extractCallback))
   Z7_IFACE_COM7_IMP(IInStream)
+  // **************** NanaZip Modification Start ****************
+  // default implementation ignores all properties
+  Z7_IFACE_COM7_IMP_NONFINAL(ISetProperties)
+  // **************** NanaZip Modification End ****************
   // Z7_IFACEM_IInArchive_Img(Z7_COM7F_PUREO)
 
 protected:
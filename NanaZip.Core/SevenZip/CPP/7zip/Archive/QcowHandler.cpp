@@ -16,9 +16,18 @@
 #include "../Common/RegisterArc.h"
 #include "../Common/StreamObjects.h"
 #include "../Common/StreamUtils.h"
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../Common/VirtThread.h"
+#endif
+// **************** NanaZip Modification End ****************
 
 #include "../Compress/DeflateDecoder.h"
 
+// **************** NanaZip Modification Start ****************
+#include "Common/HandlerOut.h"
+// **************** NanaZip Modification End ****************
+
 #include "HandlerCont.h"
 
 #define Get32(p) GetBe32a(p)
@@ -38,11 +47,112 @@ VA to PA maps:
   low bits       : _clusterBits : offset inside cluster.
 */
 
+// **************** NanaZip Modification Start ****************
+static const UInt64 kEmptyCluster = (UInt64)(Int64)-1;
+
+struct CCacheCluster
+{
+  UInt64 Cluster; // (Cluster == kEmptyCluster) means that there is no valid data in Data
+  UInt64 LastUse;
+  CByteBuffer Data;
+};
+
+// location of compressed cluster in archive
+struct CComprCluster
+{
+  UInt64 Cluster;
+  UInt64 Offset; // it's aligned for 512-bytes
+  size_t Size;   // it includes OffsetInSector
+  size_t OffsetInSector;
+};
+
+class CClusterUnpacker
+{
+  CMyComPtr2<ISequentialInStream, CBufInStream> _bufInStream;
+  CMyComPtr2<ISequentialOutStream, CBufPtrSeqOutStream> _bufOutStream;
+  CMyComPtr2<ICompressCoder, NCompress::NDeflate::NDecoder::CCOMCoder> _deflateDecoder;
+public:
+  HRESULT Unpack(const Byte *src, size_t srcSize, Byte *dest, size_t clusterSize);
+};
+
+HRESULT CClusterUnpacker::Unpack(const Byte *src, size_t srcSize, Byte *dest, size_t clusterSize)
+{
+  if (!_deflateDecoder)
+  {
+    _bufInStream.Create_if_Empty();
+    _bufOutStream.Create_if_Empty();
+    _deflateDecoder.Create_if_Empty();
+    _deflateDecoder->Set_NeedFinishInput(true);
+  }
+  _bufInStream->Init(src, srcSize);
+  _bufOutStream->Init(dest, clusterSize);
+  // Do we need to use smaller block than clusterSize for last cluster?
+  const UInt64 blockSize64 = clusterSize;
+  HRESULT res = _deflateDecoder.Interface()->Code(_bufInStream, _bufOutStream, NULL, &blockSize64, NULL);
+  /*
+  if (_bufOutStreamSpec->GetPos() != clusterSize)
+    memset(_cache + _bufOutStreamSpec->GetPos(), 0, clusterSize - _bufOutStreamSpec->GetPos());
+  */
+  if (res == S_OK)
+    if (!_deflateDecoder->IsFinished()
+        || _bufOutStream->GetPos() != clusterSize)
+      res = S_FALSE;
+  return res;
+}
+
+#ifndef Z7_ST
+
+class CUnpackThread Z7_final: public CVirtThread
+{
+public:
+  CClusterUnpacker Unpacker;
+  const Byte *Src;
+  size_t SrcSize;
+  Byte *Dest;
+  size_t ClusterSize;
+  HRESULT Result;
+
+  ~CUnpackThread() Z7_DESTRUCTOR_override
+  {
+    /* WaitThreadFinish() will be called in ~CVirtThread().
+       But we need WaitThreadFinish() call before
+       destructors of this class members.
+    */
+    CVirtThread::WaitThreadFinish();
+  }
+private:
+  virtual void Execute() Z7_override;
+};
+
+void CUnpackThread::Execute()
+{
+  try
+  {
+    Result = Unpacker.Unpack(Src, SrcSize, Dest, ClusterSize);
+  }
+  catch(...)
+  {
+    Result = E_FAIL;
+  }
+}
+
+#endif
+
+static const unsigned kNumThreadsMax = 32;
+// read-ahead doesn't unpack more than 16 MiB at once
+static const unsigned kReadAheadSizeLog = 24;
+static const UInt64 kCacheSize_Default = (UInt64)1 << 24;
+static const unsigned kNumCacheClustersMax = 1 << 10;
+// **************** NanaZip Modification End ****************
+
 Z7_class_CHandler_final: public CHandlerImg
 {
   Z7_IFACE_COM7_IMP(IInArchive_Img)
   Z7_IFACE_COM7_IMP(IInArchiveGetStream)
   Z7_IFACE_COM7_IMP(ISequentialInStream)
+  // **************** NanaZip Modification Start ****************
+  Z7_IFACE_COM7_IMP(ISetProperties)
+  // **************** NanaZip Modification End ****************
 
   unsigned _clusterBits;
   unsigned _numMidBits;
@@ -50,9 +160,25 @@ Z7_class_CHandler_final: public CHandlerImg
 
   CObjArray2<UInt32> _dir;
   CAlignedBuffer _table;
-  CByteBuffer _cache;
+  // **************** NanaZip Modification Start ****************
+  // CByteBuffer _cache;
+  // UInt64 _cacheCluster;
+  /* LRU cache of unpacked compressed clusters.
+     The clusters that are stored without compression are not cached. */
+  CObjectVector<CCacheCluster> _clusterCache;
+  UInt64 _cacheUseCounter;
+  unsigned _lastCacheIndex;
+  unsigned _numCacheClustersMax;
+  // the cluster of previous Read() call. It's used to detect sequential reading
+  UInt64 _prevCluster;
+  UInt64 _cacheSize;
+  UInt32 _numThreads;
+  CClusterUnpacker _unpacker;
+  #ifndef Z7_ST
+  CObjectVector<CUnpackThread> _threads;
+  #endif
+  // **************** NanaZip Modification End ****************
   CByteBuffer _cacheCompressed;
-  UInt64 _cacheCluster;
 
   UInt64 _comprPos;
   size_t _comprSize;
@@ -64,10 +190,6 @@ Z7_class_CHandler_final: public CHandlerImg
 
   UInt64 _phySize;
 
-  CMyComPtr2<ISequentialInStream, CBufInStream> _bufInStream;
-  CMyComPtr2<ISequentialOutStream, CBufPtrSeqOutStream> _bufOutStream;
-  CMyComPtr2<ICompressCoder, NCompress::NDeflate::NDecoder::CCOMCoder> _deflateDecoder;
-
   UInt32 _version;
   UInt32 _cryptMethod;
   UInt64 _incompatFlags;
@@ -85,6 +207,47 @@ Z7_class_CHandler_final: public CHandlerImg
   }
 
   HRESULT Open2(IInStream *stream, IArchiveOpenCallback *openCallback) Z7_override;
+
+  // **************** NanaZip Modification Start ****************
+  void ClearCache()
+  {
+    _clusterCache.Clear();
+    _cacheUseCounter = 0;
+    _lastCacheIndex = 0;
+    _prevCluster = kEmptyCluster;
+  }
+
+  void InitProps()
+  {
+    _numThreads = NSystem::GetNumberOfProcessors();
+    _cacheSize = kCacheSize_Default;
+  }
+
+  unsigned GetNumReadAheadClusters() const
+  {
+    unsigned num = _numThreads;
+    if (num == 0)
+      num = 1;
+    if (num > kNumThreadsMax)
+      num = kNumThreadsMax;
+    while (num > 1 && ((UInt64)num << _clusterBits) > ((UInt64)1 << kReadAheadSizeLog))
+      num--;
+    return num;
+  }
+
+  UInt64 GetClusterRecord(UInt64 cluster) const;
+  void GetComprCluster(UInt64 v, CComprCluster &c) const;
+  CCacheCluster *FindCacheCluster(UInt64 cluster);
+  CCacheCluster &AllocCacheCluster();
+  HRESULT UnpackClusters(UInt64 cluster, UInt64 v, bool isSequential, const CCacheCluster *&cc);
+public:
+  CHandler():
+      _numCacheClustersMax(0)
+  {
+    ClearCache();
+    InitProps();
+  }
+  // **************** NanaZip Modification End ****************
 };
 
 
@@ -115,131 +278,49 @@ Z7_COM7F_IMF(CHandler::Read(void *data, UInt32 size, UInt32 *processedSize))
       if (size > rem)
         size = (UInt32)rem;
     }
-    if (cluster == _cacheCluster)
+    // **************** NanaZip Modification Start ****************
+    const CCacheCluster *cc = FindCacheCluster(cluster);
+    if (cc)
     {
-      memcpy(data, _cache + lowBits, size);
+      _prevCluster = cluster;
+      memcpy(data, cc->Data + lowBits, size);
       break;
     }
    
-    const UInt64 high = cluster >> _numMidBits;
- 
-    if (high < _dir.Size())
+    UInt64 v = GetClusterRecord(cluster);
+    const bool isSequential = (cluster == _prevCluster + 1);
+    _prevCluster = cluster;
+        
+    if (v)
     {
-      const UInt32 tabl = _dir[(size_t)high];
-      if (tabl != kEmptyDirItem)
+      if (v & _compressedFlag)
       {
-        const size_t midBits = (size_t)cluster & (((size_t)1 << _numMidBits) - 1);
-        const Byte *p = _table + ((((size_t)tabl << _numMidBits) + midBits) << 3);
-        UInt64 v = Get64(p);
-        
-        if (v)
-        {
-          if (v & _compressedFlag)
-          {
-            if (_version <= 1)
-              return E_FAIL;
-            /*
-            the example of table record for 12-bit clusters (4KB uncompressed):
-              2 bits : isCompressed status
-              (4 == _clusterBits - 8) bits : (num_sectors - 1)
-                  packSize = num_sectors * 512;
-                  it uses one additional bit over unpacked cluster_bits.
-              (49 == 61 - _clusterBits) bits : offset of 512-byte sector
-              9 bits : offset in 512-byte sector
-            */
-            const unsigned numOffsetBits = 62 - (_clusterBits - 8);
-            const UInt64 offset = v & (((UInt64)1 << 62) - 1);
-            const size_t dataSize = ((size_t)(offset >> numOffsetBits) + 1) << 9;
-            UInt64 sectorOffset = offset & (((UInt64)1 << numOffsetBits) - (1 << 9));
-            const UInt64 offset2inCache = sectorOffset - _comprPos;
-            
-            // _comprPos is aligned for 512-bytes
-            // we try to use previous _cacheCompressed that contains compressed data
-            // that was read for previous unpacking
-
-            if (sectorOffset >= _comprPos && offset2inCache < _comprSize)
-            {
-              if (offset2inCache)
-              {
-                _comprSize -= (size_t)offset2inCache;
-                memmove(_cacheCompressed, _cacheCompressed + (size_t)offset2inCache, _comprSize);
-                _comprPos = sectorOffset;
-              }
-              sectorOffset += _comprSize;
-            }
-            else
-            {
-              _comprPos = sectorOffset;
-              _comprSize = 0;
-            }
-            
-            if (dataSize > _comprSize)
-            {
-              if (sectorOffset != _posInArc)
-              {
-                // printf("\nDeflate-Seek %12I64x %12I64x\n", sectorOffset, sectorOffset - _posInArc);
-                RINOK(Seek2(sectorOffset))
-              }
-              if (_cacheCompressed.Size() < dataSize)
-                return E_FAIL;
-              const size_t dataSize3 = dataSize - _comprSize;
-              size_t dataSize2 = dataSize3;
-              // printf("\n\n=======\nReadStream = %6d _comprPos = %6d \n", (UInt32)dataSize2, (UInt32)_comprPos);
-              const HRESULT hres = ReadStream(Stream, _cacheCompressed + _comprSize, &dataSize2);
-              _posInArc += dataSize2;
-              RINOK(hres)
-              if (dataSize2 != dataSize3)
-                return E_FAIL;
-              _comprSize += dataSize2;
-            }
-            
-            const size_t kSectorMask = (1 << 9) - 1;
-            const size_t offsetInSector = (size_t)offset & kSectorMask;
-            _bufInStream->Init(_cacheCompressed + offsetInSector, dataSize - offsetInSector);
-            _cacheCluster = (UInt64)(Int64)-1;
-            if (_cache.Size() < clusterSize)
-              return E_FAIL;
-            _bufOutStream->Init(_cache, clusterSize);
-            // Do we need to use smaller block than clusterSize for last cluster?
-            const UInt64 blockSize64 = clusterSize;
-            HRESULT res = _deflateDecoder.Interface()->Code(_bufInStream, _bufOutStream, NULL, &blockSize64, NULL);
-            /*
-            if (_bufOutStreamSpec->GetPos() != clusterSize)
-              memset(_cache + _bufOutStreamSpec->GetPos(), 0, clusterSize - _bufOutStreamSpec->GetPos());
-            */
-            if (res == S_OK)
-              if (!_deflateDecoder->IsFinished()
-                  || _bufOutStream->GetPos() != clusterSize)
-                res = S_FALSE;
-            RINOK(res)
-            _cacheCluster = cluster;
-            continue;
-            /*
-            memcpy(data, _cache + lowBits, size);
-            break;
-            */
-          }
+        if (_version <= 1)
+          return E_FAIL;
+        RINOK(UnpackClusters(cluster, v, isSequential, cc))
+        memcpy(data, cc->Data + lowBits, size);
+        break;
+      }
 
-          // version_3 supports zero clusters
-          if (((UInt32)v & 511) != 1)
-          {
-            v &= _compressedFlag - 1;
-            v += lowBits;
-            if (v != _posInArc)
-            {
-              // printf("\n%12I64x\n", v - _posInArc);
-              RINOK(Seek2(v))
-            }
-            const HRESULT res = Stream->Read(data, size, &size);
-            _posInArc += size;
-            _virtPos += size;
-            if (processedSize)
-              *processedSize = size;
-            return res;
-          }
+      // version_3 supports zero clusters
+      if (((UInt32)v & 511) != 1)
+      {
+        v &= _compressedFlag - 1;
+        v += lowBits;
+        if (v != _posInArc)
+        {
+          // printf("\n%12I64x\n", v - _posInArc);
+          RINOK(Seek2(v))
         }
+        const HRESULT res = Stream->Read(data, size, &size);
+        _posInArc += size;
+        _virtPos += size;
+        if (processedSize)
+          *processedSize = size;
+        return res;
       }
     }
+    // **************** NanaZip Modification End ****************
     
     memset(data, 0, size);
     break;
@@ -252,6 +333,250 @@ Z7_COM7F_IMF(CHandler::Read(void *data, UInt32 size, UInt32 *processedSize))
 }
 
 
+// **************** NanaZip Modification Start ****************
+UInt64 CHandler::GetClusterRecord(UInt64 cluster) const
+{
+  const UInt64 high = cluster >> _numMidBits;
+  if (high < _dir.Size())
+  {
+    const UInt32 tabl = _dir[(size_t)high];
+    if (tabl != kEmptyDirItem)
+    {
+      const size_t midBits = (size_t)cluster & (((size_t)1 << _numMidBits) - 1);
+      const Byte *p = _table + ((((size_t)tabl << _numMidBits) + midBits) << 3);
+      return Get64(p);
+    }
+  }
+  return 0;
+}
+
+void CHandler::GetComprCluster(UInt64 v, CComprCluster &c) const
+{
+  /*
+  the example of table record for 12-bit clusters (4KB uncompressed):
+    2 bits : isCompressed status
+    (4 == _clusterBits - 8) bits : (num_sectors - 1)
+        packSize = num_sectors * 512;
+        it uses one additional bit over unpacked cluster_bits.
+    (49 == 61 - _clusterBits) bits : offset of 512-byte sector
+    9 bits : offset in 512-byte sector
+  */
+  const unsigned numOffsetBits = 62 - (_clusterBits - 8);
+  const UInt64 offset = v & (((UInt64)1 << 62) - 1);
+  const size_t kSectorMask = (1 << 9) - 1;
+  c.Size = ((size_t)(offset >> numOffsetBits) + 1) << 9;
+  c.Offset = offset & (((UInt64)1 << numOffsetBits) - (1 << 9));
+  c.OffsetInSector = (size_t)offset & kSectorMask;
+}
+
+CCacheCluster *CHandler::FindCacheCluster(UInt64 cluster)
+{
+  if (_lastCacheIndex < _clusterCache.Size())
+  {
+    CCacheCluster &cc = _clusterCache[_lastCacheIndex];
+    if (cc.Cluster == cluster)
+    {
+      cc.LastUse = ++_cacheUseCounter;
+      return &cc;
+    }
+  }
+  FOR_VECTOR (i, _clusterCache)
+  {
+    CCacheCluster &cc = _clusterCache[i];
+    if (cc.Cluster == cluster)
+    {
+      _lastCacheIndex = i;
+      cc.LastUse = ++_cacheUseCounter;
+      return &cc;
+    }
+  }
+  return NULL;
+}
+
+CCacheCluster &CHandler::AllocCacheCluster()
+{
+  CCacheCluster *cc;
+  if (_clusterCache.Size() < _numCacheClustersMax)
+  {
+    cc = &_clusterCache.AddNew();
+    cc->Data.Alloc((size_t)1 << _clusterBits);
+  }
+  else
+  {
+    // we replace least recently used cluster
+    cc = &_clusterCache[0];
+    for (unsigned i = 1; i < _clusterCache.Size(); i++)
+      if (_clusterCache[i].LastUse < cc->LastUse)
+        cc = &_clusterCache[i];
+  }
+  cc->Cluster = kEmptyCluster;
+  cc->LastUse = ++_cacheUseCounter;
+  return *cc;
+}
+
+/*
+  UnpackClusters() unpacks compressed (cluster) to cache.
+  If (isSequential), it also unpacks next compressed clusters
+  that are not in cache yet. The compressed data of all these clusters
+  is read with one read call. (cluster) is unpacked in this thread,
+  and next clusters are unpacked in read-ahead threads.
+  It returns error only for (cluster). If another cluster can't be
+  unpacked, it's just not added to cache.
+*/
+
+HRESULT CHandler::UnpackClusters(UInt64 cluster, UInt64 v, bool isSequential, const CCacheCluster *&ccRes)
+{
+  ccRes = NULL;
+  const size_t clusterSize = (size_t)1 << _clusterBits;
+  
+  CComprCluster items[kNumThreadsMax];
+  GetComprCluster(v, items[0]);
+  items[0].Cluster = cluster;
+  #ifndef Z7_ST
+  unsigned numClusters = 1;
+  #endif
+  const UInt64 spanStart = items[0].Offset;
+  UInt64 spanEnd = spanStart + items[0].Size;
+  if (_cacheCompressed.Size() < items[0].Size)
+    return E_FAIL;
+  
+  #ifdef Z7_ST
+  UNUSED_VAR(isSequential)
+  #else
+  if (isSequential)
+  {
+    unsigned numClustersMax = GetNumReadAheadClusters();
+    while (_threads.Size() < numClustersMax - 1)
+    {
+      CUnpackThread &t = _threads.AddNew();
+      if (t.Create() != 0)
+      {
+        _threads.DeleteBack();
+        break;
+      }
+    }
+    if (numClustersMax > _threads.Size() + 1)
+      numClustersMax = _threads.Size() + 1;
+    
+    const UInt64 numClustersInImage = (_size + clusterSize - 1) >> _clusterBits;
+    for (UInt64 next = cluster + 1;
+        numClusters < numClustersMax && next < numClustersInImage;
+        next++)
+    {
+      if (FindCacheCluster(next))
+        break;
+      const UInt64 v2 = GetClusterRecord(next);
+      if ((v2 & _compressedFlag) == 0)
+        break;
+      CComprCluster &c = items[numClusters];
+      GetComprCluster(v2, c);
+      c.Cluster = next;
+      if (c.Offset < spanStart || c.Offset + c.Size - spanStart > _cacheCompressed.Size())
+        break;
+      if (spanEnd < c.Offset + c.Size)
+        spanEnd = c.Offset + c.Size;
+      numClusters++;
+    }
+  }
+  #endif
+  
+  // we try to use previous _cacheCompressed that contains compressed data
+  // that was read for previous unpacking
+
+  UInt64 readPos = spanStart;
+  {
+    const UInt64 offset2inCache = spanStart - _comprPos;
+    if (spanStart >= _comprPos && offset2inCache < _comprSize)
+    {
+      if (offset2inCache)
+      {
+        _comprSize -= (size_t)offset2inCache;
+        memmove(_cacheCompressed, _cacheCompressed + (size_t)offset2inCache, _comprSize);
+        _comprPos = spanStart;
+      }
+      readPos += _comprSize;
+    }
+    else
+    {
+      _comprPos = spanStart;
+      _comprSize = 0;
+    }
+  }
+  
+  const size_t spanSize = (size_t)(spanEnd - spanStart);
+  if (spanSize > _comprSize)
+  {
+    if (readPos != _posInArc)
+    {
+      RINOK(Seek2(readPos))
+    }
+    size_t size = spanSize - _comprSize;
+    const HRESULT hres = ReadStream(Stream, _cacheCompressed + _comprSize, &size);
+    _posInArc += size;
+    _comprSize += size;
+    RINOK(hres)
+    if (_comprSize < items[0].Size)
+      return E_FAIL;
+  }
+
+  const Byte *buf = _cacheCompressed;
+  CCacheCluster &cc = AllocCacheCluster();
+  
+  #ifndef Z7_ST
+  CCacheCluster *threadClusters[kNumThreadsMax];
+  unsigned numThreads = 0;
+  for (unsigned i = 1; i < numClusters; i++)
+  {
+    const CComprCluster &c = items[i];
+    const size_t pos = (size_t)(c.Offset - spanStart);
+    if (pos > _comprSize || _comprSize - pos < c.Size)
+      break;
+    CCacheCluster &cc2 = AllocCacheCluster();
+    CUnpackThread &t = _threads[numThreads];
+    t.Src = buf + pos + c.OffsetInSector;
+    t.SrcSize = c.Size - c.OffsetInSector;
+    t.Dest = cc2.Data;
+    t.ClusterSize = clusterSize;
+    t.Result = E_FAIL;
+    if (t.Start() != 0)
+    {
+      cc2.LastUse = 0;
+      break;
+    }
+    threadClusters[numThreads++] = &cc2;
+  }
+  #endif
+
+  const HRESULT res = _unpacker.Unpack(
+      buf + items[0].OffsetInSector,
+      items[0].Size - items[0].OffsetInSector,
+      cc.Data, clusterSize);
+  if (res == S_OK)
+  {
+    cc.Cluster = cluster;
+    ccRes = &cc;
+  }
+  else
+    cc.LastUse = 0;
+  
+  #ifndef Z7_ST
+  for (unsigned i = 0; i < numThreads; i++)
+  {
+    CUnpackThread &t = _threads[i];
+    CCacheCluster &cc2 = *threadClusters[i];
+    t.WaitExecuteFinish();
+    if (t.Result == S_OK)
+      cc2.Cluster = items[i + 1].Cluster;
+    else
+      cc2.LastUse = 0;
+  }
+  #endif
+
+  return res;
+}
+// **************** NanaZip Modification End ****************
+
+
 static const Byte kProps[] =
 {
   kpidSize,
@@ -659,7 +984,10 @@ Z7_COM7F_IMF(CHandler::Close())
   // _cacheCompressed.Free();
   _phySize = 0;
 
-  _cacheCluster = (UInt64)(Int64)-1;
+  // **************** NanaZip Modification Start ****************
+  // _cacheCluster = (UInt64)(Int64)-1;
+  ClearCache();
+  // **************** NanaZip Modification End ****************
   _comprPos = 0;
   _comprSize = 0;
 
@@ -687,13 +1015,28 @@ Z7_COM7F_IMF(CHandler::GetStream(UInt32 /* index */, ISequentialInStream **strea
   {
     if (_version <= 1 || _compressionType)
       return S_FALSE;
-    _bufInStream.Create_if_Empty();
-    _bufOutStream.Create_if_Empty();
-    _deflateDecoder.Create_if_Empty();
-    _deflateDecoder->Set_NeedFinishInput(true);
+    // **************** NanaZip Modification Start ****************
+    const unsigned numReadAheadClusters = GetNumReadAheadClusters();
+    UInt64 numCacheClusters = _cacheSize >> _clusterBits;
+    if (numCacheClusters > kNumCacheClustersMax)
+      numCacheClusters = kNumCacheClustersMax;
+    // read-ahead clusters must not replace each other in cache
+    if (numCacheClusters < numReadAheadClusters * 2)
+      numCacheClusters = numReadAheadClusters * 2;
+    if (_numCacheClustersMax != (unsigned)numCacheClusters)
+    {
+      ClearCache();
+      _numCacheClustersMax = (unsigned)numCacheClusters;
+    }
     const size_t clusterSize = (size_t)1 << _clusterBits;
-    _cache.AllocAtLeast(clusterSize);
-    _cacheCompressed.AllocAtLeast(clusterSize * 2);
+    const size_t comprSize = clusterSize * 2 * numReadAheadClusters;
+    if (_cacheCompressed.Size() < comprSize)
+    {
+      _comprPos = 0;
+      _comprSize = 0;
+      _cacheCompressed.Alloc(comprSize);
+    }
+    // **************** NanaZip Modification End ****************
   }
   CMyComPtr<ISequentialInStream> streamTemp = this;
   RINOK(InitAndSeek())
@@ -703,6 +1046,38 @@ Z7_COM7F_IMF(CHandler::GetStream(UInt32 /* index */, ISequentialInStream **strea
 }
 
 
+// **************** NanaZip Modification Start ****************
+Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVARIANT *values, UInt32 numProps))
+{
+  InitProps();
+
+  for (UInt32 i = 0; i < numProps; i++)
+  {
+    const UString name = names[i];
+    const PROPVARIANT &prop = values[i];
+
+    if (name.IsPrefixedBy_Ascii_NoCase("mt"))
+    {
+      RINOK(ParseMtProp(name.Ptr(2), prop, NSystem::GetNumberOfProcessors(), _numThreads))
+    }
+    else if (name.IsPrefixedBy_Ascii_NoCase("cache"))
+    {
+      size_t ramSize = (size_t)sizeof(size_t) << 28;
+      NSystem::GetRamSize(ramSize);
+      if (!ParseSizeString(name.Ptr(5), prop, ramSize, _cacheSize))
+        return E_INVALIDARG;
+    }
+    else if (name.IsPrefixedBy_Ascii_NoCase("memuse"))
+    {
+    }
+    else
+      return E_INVALIDARG;
+  }
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
+
+
 REGISTER_ARC_I(
   "QCOW", "qcow qcow2 qcow2c", NULL, 0xCA,
   k_Signature,
@@ -18,14 +18,25 @@
 #include "../../Common/UTFConvert.h"
 
 #include "../../Windows/PropVariantUtils.h"
+// **************** NanaZip Modification Start ****************
+#include "../../Windows/System.h"
+// **************** NanaZip Modification End ****************
 #include "../../Windows/TimeUtils.h"
 
 #include "../Common/CWrappers.h"
 #include "../Common/LimitedStreams.h"
+// **************** NanaZip Modification Start ****************
+#include "../Common/MethodProps.h"
+// **************** NanaZip Modification End ****************
 #include "../Common/ProgressUtils.h"
 #include "../Common/RegisterArc.h"
 #include "../Common/StreamObjects.h"
 #include "../Common/StreamUtils.h"
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../Common/VirtThread.h"
+#endif
+// **************** NanaZip Modification End ****************
 
 #include "../Compress/CopyCoder.h"
 #include "../Compress/ZlibDecoder.h"
@@ -845,10 +856,101 @@ struct CFrag
   UInt32 Size;
 };
 
+// **************** NanaZip Modification Start ****************
+/* CBlockDecoder decodes one data block or fragment block
+   that was already read to memory.
+   Each read-ahead thread uses its own CBlockDecoder. */
 
-Z7_CLASS_IMP_CHandler_IInArchive_1(
-  IInArchiveGetStream
+class CBlockDecoder
+{
+  Z7_CLASS_NO_COPY(CBlockDecoder)
+
+  CMyComPtr2<ICompressCoder, NCompress::NZlib::CDecoder> _zlibDecoder;
+  NCompress::NZSTD::CDecoder *_zstdDecoderSpec;
+  CMyComPtr<ICompressCoder> _zstdDecoder;
+  CXzUnpacker _xz;
+public:
+  CBlockDecoder(): _zstdDecoderSpec(NULL)
+  {
+    XzUnpacker_Construct(&_xz, &g_Alloc);
+  }
+  ~CBlockDecoder()
+  {
+    XzUnpacker_Free(&_xz);
+  }
+
+  // outSizeMax is also used as dictionary size for LZMA stream without props
+  HRESULT Decode(UInt32 method, bool noPropsLZMA,
+      const Byte *src, UInt32 srcSize,
+      Byte *dest, UInt32 outSizeMax, UInt32 &destSize);
+};
+
+#ifndef Z7_ST
+
+class CBlockDecoderThread Z7_final: public CVirtThread
+{
+public:
+  CBlockDecoder Decoder;
+  
+  UInt32 Method;
+  bool NoPropsLZMA;
+  const Byte *Src;
+  UInt32 SrcSize;
+  Byte *Dest;
+  UInt32 OutSizeMax;
+  
+  UInt32 DestSize;
+  HRESULT Result;
+
+  ~CBlockDecoderThread() Z7_DESTRUCTOR_override
+  {
+    /* WaitThreadFinish() will be called in ~CVirtThread().
+       But we need WaitThreadFinish() call before
+       destructors of this class members.
+    */
+    CVirtThread::WaitThreadFinish();
+  }
+private:
+  virtual void Execute() Z7_override;
+};
+
+void CBlockDecoderThread::Execute()
+{
+  try
+  {
+    Result = Decoder.Decode(Method, NoPropsLZMA, Src, SrcSize, Dest, OutSizeMax, DestSize);
+  }
+  catch(...)
+  {
+    Result = E_FAIL;
+  }
+}
+
+#endif
+
+struct CCacheBlock
+{
+  UInt64 StartPos;
+  UInt32 PackSize; // (PackSize == 0) means that there is no valid data in Data
+  UInt32 UnpackSize;
+  UInt64 LastUse;
+  CByteBuffer Data;
+};
+
+static const unsigned kNumThreadsMax = 32;
+static const unsigned kCacheSizeLog = 24;
+static const unsigned kNumCacheBlocksMin = 8;
+static const unsigned kNumCacheBlocksMax = 64;
+
+
+// Z7_CLASS_IMP_CHandler_IInArchive_1(
+//   IInArchiveGetStream
+// )
+Z7_CLASS_IMP_CHandler_IInArchive_2(
+  IInArchiveGetStream,
+  ISetProperties
 )
+// **************** NanaZip Modification End ****************
   bool _noPropsLZMA;
   bool _needCheckLzma;
 
@@ -872,37 +974,75 @@ Z7_CLASS_IMP_CHandler_IInArchive_1(
   CRecordVector<bool> _blockCompressed;
   CRecordVector<UInt64> _blockOffsets;
   
-  CByteBuffer _cachedBlock;
-  UInt64 _cachedBlockStartPos;
-  UInt32 _cachedPackBlockSize;
-  UInt32 _cachedUnpackBlockSize;
+  // **************** NanaZip Modification Start ****************
+  /* LRU cache of unpacked data blocks and fragment blocks.
+     Metadata blocks are not cached here,
+     because inode and directory tables are unpacked at Open(). */
+  CObjectVector<CCacheBlock> _cache;
+  UInt64 _cacheUseCounter;
+  unsigned _numCacheBlocksMax;
+  UInt32 _numThreads;
+  CBlockDecoder _blockDecoder;
+  CByteBuffer _packBuffer;
+  #ifndef Z7_ST
+  CObjectVector<CBlockDecoderThread> _decoderThreads;
+  #endif
+  // **************** NanaZip Modification End ****************
 
   CMyComPtr2_Create<ISequentialInStream, CLimitedSequentialInStream> _limitedInStream;
-  CMyComPtr2_Create<ISequentialOutStream, CBufPtrSeqOutStream> _outStream;
   CMyComPtr2_Create<ISequentialOutStream, CDynBufSeqOutStream> _dynOutStream;
 
   // CMyComPtr2<ICompressCoder, NCompress::NLzma::CDecoder> _lzmaDecoder;
-  CMyComPtr2<ICompressCoder, NCompress::NZlib::CDecoder> _zlibDecoder;
+  // **************** NanaZip Modification Start ****************
+  // The decoders are in _blockDecoder.
+  // CMyComPtr2<ICompressCoder, NCompress::NZlib::CDecoder> _zlibDecoder;
+  // **************** NanaZip Modification End ****************
   
   // **************** 7-Zip ZS Modification Start ****************
-  NCompress::NZSTD::CDecoder* _zstdDecoderSpec;
-  CMyComPtr<ICompressCoder> _zstdDecoder;
+  // **************** NanaZip Modification Start ****************
+  // NCompress::NZSTD::CDecoder* _zstdDecoderSpec;
+  // CMyComPtr<ICompressCoder> _zstdDecoder;
+  // **************** NanaZip Modification End ****************
   // **************** 7-Zip ZS Modification End ****************
   
-  CXzUnpacker _xz;
+  // **************** NanaZip Modification Start ****************
+  // CXzUnpacker _xz;
+  // **************** NanaZip Modification End ****************
   // **************** 7-Zip ZS Modification Start ****************
   // CZstdDecHandle _zstd;
   // **************** 7-Zip ZS Modification End ****************
 
   CByteBuffer _inputBuffer;
 
+  // **************** NanaZip Modification Start ****************
   void ClearCache()
   {
-    _cachedBlockStartPos = 0;
-    _cachedPackBlockSize = 0;
-    _cachedUnpackBlockSize = 0;
+    _cache.Clear();
+    _cacheUseCounter = 0;
+  }
+
+  void InitProps()
+  {
+    _numThreads = NWindows::NSystem::GetNumberOfProcessors();
+  }
+
+  unsigned GetNumReadAheadBlocks() const
+  {
+    unsigned num = _numThreads;
+    if (num == 0)
+      num = 1;
+    if (num > kNumThreadsMax)
+      num = kNumThreadsMax;
+    return num;
   }
 
+  CCacheBlock *FindCacheBlock(UInt64 startPos, UInt32 packSize);
+  CCacheBlock &AllocCacheBlock();
+  UInt32 GetBlockMethod(const Byte *src);
+  HRESULT ReadBlocksToCache(unsigned blockIndex, unsigned numBlocks,
+      UInt64 startPos, UInt32 packSize, bool compressed);
+  // **************** NanaZip Modification End ****************
+
   HRESULT Seek2(UInt64 offset)
   {
     return InStream_SeekSet(_stream, offset);
@@ -925,7 +1065,9 @@ public:
   CHandler();
   ~CHandler()
   {
-    XzUnpacker_Free(&_xz);
+    // **************** NanaZip Modification Start ****************
+    // XzUnpacker_Free(&_xz);
+    // **************** NanaZip Modification End ****************
     // **************** 7-Zip ZS Modification Start ****************
     // if (_zstd)
     //   ZstdDec_Destroy(_zstd);
@@ -941,7 +1083,12 @@ public:
 CHandler::CHandler()
 // **************** 7-Zip ZS Modification End ****************
 {
-  XzUnpacker_Construct(&_xz, &g_Alloc);
+  // **************** NanaZip Modification Start ****************
+  // XzUnpacker_Construct(&_xz, &g_Alloc);
+  _numCacheBlocksMax = kNumCacheBlocksMin;
+  ClearCache();
+  InitProps();
+  // **************** NanaZip Modification End ****************
 }
 
 static const Byte kProps[] =
@@ -1152,236 +1299,147 @@ static HRESULT Lz4Decode(Byte *dest, SizeT *destLen, const Byte *src, SizeT *src
 }
 // **************** 7-Zip ZS Modification End ****************
 
-HRESULT CHandler::Decompress(ISequentialOutStream *outStream, Byte *outBuf, bool *outBufWasWritten, UInt32 *outBufWasWrittenSize, UInt32 inSize, UInt32 outSizeMax)
+// **************** NanaZip Modification Start ****************
+HRESULT CBlockDecoder::Decode(UInt32 method, bool noPropsLZMA,
+    const Byte *src, UInt32 srcSize,
+    Byte *dest, UInt32 outSizeMax, UInt32 &destSize)
 {
-  if (outBuf)
-  {
-    *outBufWasWritten = false;
-    *outBufWasWrittenSize = 0;
-  }
-  UInt32 method = _h.Method;
-  if (_h.SeveralMethods)
-  {
-    Byte b;
-    RINOK(ReadStream_FALSE(_stream, &b, 1))
-    RINOK(_stream->Seek(-1, STREAM_SEEK_CUR, NULL))
-    method = (b == 0x5D ? kMethod_LZMA : kMethod_ZLIB);
-  }
+  destSize = 0;
 
-  if (method == kMethod_ZLIB && _needCheckLzma)
+  if (method == kMethod_ZLIB || method == kMethod_ZSTD)
   {
-    Byte b;
-    RINOK(ReadStream_FALSE(_stream, &b, 1))
-    RINOK(_stream->Seek(-1, STREAM_SEEK_CUR, NULL))
-    if (b == 0)
+    CMyComPtr2_Create<ISequentialInStream, CBufInStream> inStream;
+    inStream->Init(src, srcSize);
+    CMyComPtr2_Create<ISequentialOutStream, CBufPtrSeqOutStream> outStream;
+    outStream->Init(dest, outSizeMax);
+    UInt64 inProcessed;
+    if (method == kMethod_ZLIB)
     {
-      _noPropsLZMA = true;
-      method = _h.Method = kMethod_LZMA;
+      _zlibDecoder.Create_if_Empty();
+      RINOK(_zlibDecoder.Interface()->Code(inStream, outStream, NULL, NULL, NULL))
+      inProcessed = _zlibDecoder->GetInputProcessedSize();
     }
-    _needCheckLzma = false;
+    else
+    {
+      if (!_zstdDecoder)
+      {
+        _zstdDecoderSpec = new NCompress::NZSTD::CDecoder();
+        _zstdDecoder = _zstdDecoderSpec;
+      }
+      RINOK(_zstdDecoder->Code(inStream, outStream, NULL, NULL, NULL))
+      inProcessed = _zstdDecoderSpec->GetInputProcessedSize();
+    }
+    if (inProcessed != srcSize)
+      return S_FALSE;
+    destSize = (UInt32)outStream->GetPos();
+    return S_OK;
   }
-  
-  if (method == kMethod_ZLIB)
+
+  SizeT destLen = outSizeMax, srcLen = srcSize;
+
+  if (method == kMethod_LZO)
   {
-    _zlibDecoder.Create_if_Empty();
-    RINOK(_zlibDecoder.Interface()->Code(_limitedInStream, outStream, NULL, NULL, NULL))
-    if (inSize != _zlibDecoder->GetInputProcessedSize())
-      return S_FALSE;
+    RINOK(LzoDecode(dest, &destLen, src, &srcLen))
   }
-  // **************** 7-Zip ZS Modification Start ****************
-  else if (method == kMethod_ZSTD)
+  else if (method == kMethod_LZ4)
   {
-    if (!_zstdDecoder)
-    {
-      _zstdDecoderSpec = new NCompress::NZSTD::CDecoder();
-      _zstdDecoder = _zstdDecoderSpec;
-    }
-    RINOK(_zstdDecoder->Code(_limitedInStream, outStream, NULL, NULL, NULL));
-    if (inSize != _zstdDecoderSpec->GetInputProcessedSize())
-      return S_FALSE;
+    RINOK(Lz4Decode(dest, &destLen, src, &srcLen))
   }
-  // **************** 7-Zip ZS Modification End ****************
-  /*
   else if (method == kMethod_LZMA)
   {
-    _lzmaDecoder.Create_if_Empty();
-    // _lzmaDecoder->FinishStream = true;
-    const UInt32 kPropsSize = LZMA_PROPS_SIZE + 8;
-    Byte props[kPropsSize];
-    UInt32 propsSize;
-    UInt64 outSize;
-    if (_noPropsLZMA)
+    Byte props[5];
+    if (noPropsLZMA)
     {
       props[0] = 0x5D;
-      SetUi32(&props[1], _h.BlockSize);
-      propsSize = 0;
-      outSize = outSizeMax;
+      SetUi32(&props[1], outSizeMax)
     }
     else
     {
-      RINOK(ReadStream_FALSE(_limitedInStream, props, kPropsSize));
-      propsSize = kPropsSize;
-      outSize = GetUi64(&props[LZMA_PROPS_SIZE]);
+      const UInt32 kPropsSize = LZMA_PROPS_SIZE + 8;
+      if (srcSize < kPropsSize)
+        return S_FALSE;
+      memcpy(props, src, LZMA_PROPS_SIZE);
+      const UInt64 outSize = GetUi64(src + LZMA_PROPS_SIZE);
       if (outSize > outSizeMax)
         return S_FALSE;
-    }
-    RINOK(_lzmaDecoderSpec->SetDecoderProperties2(props, LZMA_PROPS_SIZE));
-    RINOK(_lzmaDecoder->Code(_limitedInStream, outStream, NULL, &outSize, NULL));
-    if (inSize != propsSize + _lzmaDecoderSpec->GetInputProcessedSize())
+      destLen = (SizeT)outSize;
+      src += kPropsSize;
+      srcSize -= kPropsSize;
+      srcLen = srcSize;
+    }
+
+    ELzmaStatus status;
+    const SRes res = LzmaDecode(dest, &destLen,
+        src, &srcLen,
+        props, LZMA_PROPS_SIZE,
+        LZMA_FINISH_END,
+        &status, &g_Alloc);
+    if (res != 0)
+      return SResToHRESULT(res);
+    if (status != LZMA_STATUS_FINISHED_WITH_MARK
+        && status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK)
       return S_FALSE;
   }
-  */
   else
   {
-    if (_inputBuffer.Size() < inSize)
-      _inputBuffer.Alloc(inSize);
-    RINOK(ReadStream_FALSE(_stream, _inputBuffer, inSize))
-
-    Byte *dest = outBuf;
-    if (!outBuf)
-    {
-      dest = _dynOutStream->GetBufPtrForWriting(outSizeMax);
-      if (!dest)
-        return E_OUTOFMEMORY;
-    }
-    
-    SizeT destLen = outSizeMax, srcLen = inSize;
-
-    if (method == kMethod_LZO)
-    {
-      RINOK(LzoDecode(dest, &destLen, _inputBuffer, &srcLen))
-    }
-    // **************** 7-Zip ZS Modification Start ****************
-    else if (method == kMethod_LZ4)
-    {
-      RINOK(Lz4Decode(dest, &destLen, _inputBuffer, &srcLen));
-    }
-    // **************** 7-Zip ZS Modification End ****************
-    else if (method == kMethod_LZMA)
-    {
-      Byte props[5];
-      const Byte *src = _inputBuffer;
-
-      if (_noPropsLZMA)
-      {
-        props[0] = 0x5D;
-        SetUi32(&props[1], _h.BlockSize)
-      }
-      else
-      {
-        const UInt32 kPropsSize = LZMA_PROPS_SIZE + 8;
-        if (inSize < kPropsSize)
-          return S_FALSE;
-        memcpy(props, src, LZMA_PROPS_SIZE);
-        UInt64 outSize = GetUi64(src + LZMA_PROPS_SIZE);
-        if (outSize > outSizeMax)
-          return S_FALSE;
-        destLen = (SizeT)outSize;
-        src += kPropsSize;
-        inSize -= kPropsSize;
-        srcLen = inSize;
-      }
+    ECoderStatus status;
+    const SRes res = XzUnpacker_CodeFull(&_xz,
+        dest, &destLen,
+        src, &srcLen,
+        CODER_FINISH_END, &status);
+    if (res != 0)
+      return SResToHRESULT(res);
+    if (status != CODER_STATUS_NEEDS_MORE_INPUT || !XzUnpacker_IsStreamWasFinished(&_xz))
+      return S_FALSE;
+  }
 
-      ELzmaStatus status;
-      SRes res = LzmaDecode(dest, &destLen,
-          src, &srcLen,
-          props, LZMA_PROPS_SIZE,
-          LZMA_FINISH_END,
-          &status, &g_Alloc);
-      if (res != 0)
-        return SResToHRESULT(res);
-      if (status != LZMA_STATUS_FINISHED_WITH_MARK
-          && status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK)
-        return S_FALSE;
-    }
-    // **************** 7-Zip ZS Modification Start ****************
-#if 0 // ******** Annotated 7-Zip Mainline Source Code snippet Start ********
-    else if (method == kMethod_ZSTD)
-    {
-      const Byte *src = _inputBuffer;
+  if (srcLen != srcSize || destLen > outSizeMax)
+    return S_FALSE;
+  destSize = (UInt32)destLen;
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
 
-      if (!_zstd)
-      {
-        _zstd = ZstdDec_Create(&g_AlignedAlloc, &g_AlignedAlloc);
-        if (!_zstd)
-          return E_OUTOFMEMORY;
-      }
+HRESULT CHandler::Decompress(ISequentialOutStream *outStream, Byte *outBuf, bool *outBufWasWritten, UInt32 *outBufWasWrittenSize, UInt32 inSize, UInt32 outSizeMax)
+{
+  // **************** NanaZip Modification Start ****************
+  /* The block is read to memory and it's unpacked by the same
+     CBlockDecoder code that unpacks data blocks to cache. */
+  UNUSED_VAR(outStream)
+  if (outBuf)
+  {
+    *outBufWasWritten = false;
+    *outBufWasWrittenSize = 0;
+  }
+  if (inSize == 0)
+    return S_FALSE;
 
-      CZstdDecState state;
-      ZstdDecState_Clear(&state);
+  if (_inputBuffer.Size() < inSize)
+    _inputBuffer.Alloc(inSize);
+  RINOK(ReadStream_FALSE(_stream, _inputBuffer, inSize))
+  const UInt32 method = GetBlockMethod(_inputBuffer);
 
-      state.inBuf = src;
-      state.inLim = srcLen; //  + 1; for debug
-      // state.outStep = outSizeMax;
-      
-      state.outBuf_fromCaller = dest;
-      state.outBufSize_fromCaller = outSizeMax;
-      // state.mustBeFinished = True;
+  Byte *dest = outBuf;
+  if (!outBuf)
+  {
+    dest = _dynOutStream->GetBufPtrForWriting(outSizeMax);
+    if (!dest)
+      return E_OUTOFMEMORY;
+  }
 
-      ZstdDec_Init(_zstd);
-      SRes sres;
-      for (;;)
-      {
-        sres = ZstdDec_Decode(_zstd, &state);
-        if (sres != SZ_OK)
-          break;
-        if (state.inLim == state.inPos
-            && (state.status == ZSTD_STATUS_NEEDS_MORE_INPUT ||
-                state.status == ZSTD_STATUS_FINISHED_FRAME))
-          break;
-        // sres = sres;
-        // break; // for debug
-      }
+  UInt32 destLen;
+  RINOK(_blockDecoder.Decode(method, _noPropsLZMA, _inputBuffer, inSize,
+      dest, outSizeMax, destLen))
 
-      CZstdDecResInfo info;
-      // ZstdDecInfo_Clear(&stat);
-      // stat->InSize = state.inPos;
-      ZstdDec_GetResInfo(_zstd, &state, sres, &info);
-      sres = info.decode_SRes;
-      if (sres == SZ_OK)
-      {
-        if (state.status != ZSTD_STATUS_FINISHED_FRAME
-            // ||stat.UnexpededEnd
-            || info.extraSize != 0
-            || state.inLim != state.inPos)
-          sres = SZ_ERROR_DATA;
-      }
-      if (sres != SZ_OK)
-        return SResToHRESULT(sres);
-      if (state.winPos > outSizeMax)
-        return E_FAIL;
-      // memcpy(dest, state.dic, state.dicPos);
-      destLen = state.winPos;
-    }
-#endif // ******** Annotated 7-Zip Mainline Source Code snippet End ********
-    // **************** 7-Zip ZS Modification End ****************
-    else
-    {
-      ECoderStatus status;
-      const SRes res = XzUnpacker_CodeFull(&_xz,
-          dest, &destLen,
-          _inputBuffer, &srcLen,
-          CODER_FINISH_END, &status);
-      if (res != 0)
-        return SResToHRESULT(res);
-      if (status != CODER_STATUS_NEEDS_MORE_INPUT || !XzUnpacker_IsStreamWasFinished(&_xz))
-        return S_FALSE;
-    }
-    
-    if (inSize != srcLen)
-      return S_FALSE;
-    if (outBuf)
-    {
-      *outBufWasWritten = true;
-      // **************** 7-Zip ZS Modification Start ****************
-      // TODO: Decompress should validate destLen <= outSizeMax before storing outBufWasWrittenSize
-      // **************** 7-Zip ZS Modification End ****************
-      *outBufWasWrittenSize = (UInt32)destLen;
-    }
-    else
-      _dynOutStream->UpdateSize(destLen);
+  if (outBuf)
+  {
+    *outBufWasWritten = true;
+    *outBufWasWrittenSize = destLen;
   }
+  else
+    _dynOutStream->UpdateSize(destLen);
   return S_OK;
+  // **************** NanaZip Modification End ****************
 }
 
 // in  : packSize : allowed packSize limit
@@ -1906,8 +1964,10 @@ Z7_COM7F_IMF(CHandler::Close())
   _uids.Free();
   _gids.Free();
 
-  _cachedBlock.Free();
+  // **************** NanaZip Modification Start ****************
   ClearCache();
+  _packBuffer.Free();
+  // **************** NanaZip Modification End ****************
 
   return S_OK;
 }
@@ -2236,44 +2296,223 @@ HRESULT CHandler::ReadBlock(UInt64 blockIndex, Byte *dest, size_t blockSize)
     return S_OK;
   }
 
-  if (blockOffset != _cachedBlockStartPos ||
-      packBlockSize != _cachedPackBlockSize)
+  // **************** NanaZip Modification Start ****************
+  CCacheBlock *cb = FindCacheBlock(blockOffset, packBlockSize);
+  if (!cb)
   {
-    ClearCache();
-    RINOK(Seek2(blockOffset))
-    _limitedInStream->Init(packBlockSize);
-    
-    if (compressed)
-    {
-      _outStream->Init((Byte *)_cachedBlock, _h.BlockSize);
-      bool outBufWasWritten;
-      UInt32 outBufWasWrittenSize;
-      HRESULT res = Decompress(_outStream, _cachedBlock, &outBufWasWritten, &outBufWasWrittenSize, packBlockSize, _h.BlockSize);
-      RINOK(res)
-      if (outBufWasWritten)
-        _cachedUnpackBlockSize = outBufWasWrittenSize;
-      else
-        _cachedUnpackBlockSize = (UInt32)_outStream->GetPos();
-    }
-    else
+    unsigned numBlocks = 1;
+    if (blockIndex < _blockCompressed.Size())
     {
-      if (packBlockSize > _h.BlockSize)
-        return S_FALSE;
-      RINOK(ReadStream_FALSE(_limitedInStream, _cachedBlock, packBlockSize))
-      _cachedUnpackBlockSize = packBlockSize;
+      /* sequential read of file data: we also unpack next data blocks
+         of this file that are not in cache yet. */
+      const unsigned numBlocksMax = GetNumReadAheadBlocks();
+      for (unsigned i = (unsigned)blockIndex + 1;
+          i < _blockCompressed.Size() && numBlocks < numBlocksMax;
+          i++, numBlocks++)
+      {
+        const UInt32 size = (UInt32)(_blockOffsets[i + 1] - _blockOffsets[i]);
+        if (size == 0 || size > _h.BlockSize
+            || FindCacheBlock(node.StartBlock + _blockOffsets[i], size))
+          break;
+      }
     }
-    _cachedBlockStartPos = blockOffset;
-    _cachedPackBlockSize = packBlockSize;
+    RINOK(ReadBlocksToCache((unsigned)blockIndex, numBlocks, blockOffset, packBlockSize, compressed))
+    cb = FindCacheBlock(blockOffset, packBlockSize);
+    if (!cb)
+      return S_FALSE;
   }
 
-  if (_cachedUnpackBlockSize < offsetInBlock ||
-      _cachedUnpackBlockSize - offsetInBlock < blockSize)
+  if (cb->UnpackSize < offsetInBlock ||
+      cb->UnpackSize - offsetInBlock < blockSize)
     return S_FALSE;
   if (blockSize != 0)
-    memcpy(dest, _cachedBlock + offsetInBlock, blockSize);
+    memcpy(dest, cb->Data + offsetInBlock, blockSize);
   return S_OK;
 }
 
+CCacheBlock *CHandler::FindCacheBlock(UInt64 startPos, UInt32 packSize)
+{
+  FOR_VECTOR (i, _cache)
+  {
+    CCacheBlock &cb = _cache[i];
+    if (cb.StartPos == startPos && cb.PackSize == packSize)
+    {
+      cb.LastUse = ++_cacheUseCounter;
+      return &cb;
+    }
+  }
+  return NULL;
+}
+
+CCacheBlock &CHandler::AllocCacheBlock()
+{
+  CCacheBlock *cb;
+  if (_cache.Size() < _numCacheBlocksMax)
+  {
+    cb = &_cache.AddNew();
+    cb->Data.Alloc(_h.BlockSize);
+  }
+  else
+  {
+    // we replace least recently used block
+    cb = &_cache[0];
+    for (unsigned i = 1; i < _cache.Size(); i++)
+      if (_cache[i].LastUse < cb->LastUse)
+        cb = &_cache[i];
+  }
+  cb->StartPos = 0;
+  cb->PackSize = 0;
+  cb->UnpackSize = 0;
+  cb->LastUse = ++_cacheUseCounter;
+  return *cb;
+}
+
+UInt32 CHandler::GetBlockMethod(const Byte *src)
+{
+  UInt32 method = _h.Method;
+  if (_h.SeveralMethods)
+    method = (src[0] == 0x5D ? kMethod_LZMA : kMethod_ZLIB);
+  if (method == kMethod_ZLIB && _needCheckLzma)
+  {
+    if (src[0] == 0)
+    {
+      _noPropsLZMA = true;
+      method = _h.Method = kMethod_LZMA;
+    }
+    _needCheckLzma = false;
+  }
+  return method;
+}
+
+/*
+  ReadBlocksToCache() reads (numBlocks) adjacent blocks with one read call
+  and unpacks them to cache. The first block is unpacked in this thread,
+  and another blocks are unpacked in read-ahead threads.
+  (numBlocks > 1) is allowed only for data blocks of current node.
+  It returns error only for the first block.
+  If another block can't be unpacked, it's just not added to cache,
+  and the error will be reported, when that block is requested.
+*/
+
+HRESULT CHandler::ReadBlocksToCache(unsigned blockIndex, unsigned numBlocks,
+    UInt64 startPos, UInt32 packSize, bool compressed)
+{
+  if (!compressed && packSize > _h.BlockSize)
+    return S_FALSE;
+
+  #ifdef Z7_ST
+  numBlocks = 1;
+  #else
+  if (numBlocks > 1)
+  {
+    while (_decoderThreads.Size() < numBlocks - 1)
+    {
+      CBlockDecoderThread &t = _decoderThreads.AddNew();
+      if (t.Create() != 0)
+      {
+        _decoderThreads.DeleteBack();
+        break;
+      }
+    }
+    if (numBlocks > _decoderThreads.Size() + 1)
+      numBlocks = _decoderThreads.Size() + 1;
+  }
+  #endif
+
+  size_t totalPackSize = packSize;
+  if (numBlocks > 1)
+    totalPackSize = (size_t)(_blockOffsets[blockIndex + numBlocks] - _blockOffsets[blockIndex]);
+  if (_packBuffer.Size() < totalPackSize)
+    _packBuffer.Alloc(totalPackSize);
+  
+  RINOK(Seek2(startPos))
+  size_t processed = totalPackSize;
+  RINOK(ReadStream(_stream, _packBuffer, &processed))
+  if (processed < packSize)
+    return S_FALSE;
+
+  const Byte *src = _packBuffer;
+  CCacheBlock &cb = AllocCacheBlock();
+  
+  #ifndef Z7_ST
+  CCacheBlock *threadBlocks[kNumThreadsMax];
+  unsigned numThreads = 0;
+  {
+    const CNode &node = _nodes[_nodeIndex];
+    size_t pos = packSize;
+    for (unsigned i = 1; i < numBlocks; i++)
+    {
+      const unsigned k = blockIndex + i;
+      const UInt32 size = (UInt32)(_blockOffsets[k + 1] - _blockOffsets[k]);
+      if (processed - pos < size)
+        break;
+      const Byte *p = src + pos;
+      pos += size;
+      CCacheBlock &cb2 = AllocCacheBlock();
+      cb2.StartPos = node.StartBlock + _blockOffsets[k];
+      if (!_blockCompressed[k])
+      {
+        memcpy(cb2.Data, p, size);
+        cb2.UnpackSize = size;
+        cb2.PackSize = size;
+        continue;
+      }
+      CBlockDecoderThread &t = _decoderThreads[numThreads];
+      t.Method = GetBlockMethod(p);
+      t.NoPropsLZMA = _noPropsLZMA;
+      t.Src = p;
+      t.SrcSize = size;
+      t.Dest = cb2.Data;
+      t.OutSizeMax = _h.BlockSize;
+      t.Result = E_FAIL;
+      if (t.Start() != 0)
+      {
+        cb2.LastUse = 0;
+        break;
+      }
+      threadBlocks[numThreads++] = &cb2;
+    }
+  }
+  #endif
+
+  HRESULT res = S_OK;
+  cb.StartPos = startPos;
+  if (compressed)
+  {
+    const UInt32 method = GetBlockMethod(src);
+    res = _blockDecoder.Decode(method, _noPropsLZMA, src, packSize,
+        cb.Data, _h.BlockSize, cb.UnpackSize);
+  }
+  else
+  {
+    memcpy(cb.Data, src, packSize);
+    cb.UnpackSize = packSize;
+  }
+  if (res == S_OK)
+    cb.PackSize = packSize;
+  else
+    cb.LastUse = 0;
+
+  #ifndef Z7_ST
+  for (unsigned i = 0; i < numThreads; i++)
+  {
+    CBlockDecoderThread &t = _decoderThreads[i];
+    CCacheBlock &cb2 = *threadBlocks[i];
+    t.WaitExecuteFinish();
+    if (t.Result == S_OK)
+    {
+      cb2.UnpackSize = t.DestSize;
+      cb2.PackSize = t.SrcSize;
+    }
+    else
+      cb2.LastUse = 0;
+  }
+  #endif
+
+  return res;
+}
+// **************** NanaZip Modification End ****************
+
 Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testMode, IArchiveExtractCallback *extractCallback))
 {
@@ -2406,12 +2645,26 @@ Z7_COM7F_IMF(CHandler::GetStream(UInt32 index, ISequentialInStream **stream))
 
   _nodeIndex = item.Node;
 
-  size_t cacheSize = _h.BlockSize;
-  if (_cachedBlock.Size() != cacheSize)
+  // **************** NanaZip Modification Start ****************
   {
-    ClearCache();
-    _cachedBlock.Alloc(cacheSize);
+    unsigned numCacheBlocks = 1;
+    if (_h.BlockSizeLog < kCacheSizeLog)
+      numCacheBlocks <<= (kCacheSizeLog - _h.BlockSizeLog);
+    if (numCacheBlocks < kNumCacheBlocksMin)
+      numCacheBlocks = kNumCacheBlocksMin;
+    if (numCacheBlocks > kNumCacheBlocksMax)
+      numCacheBlocks = kNumCacheBlocksMax;
+    // read-ahead blocks must not replace each other in cache
+    const unsigned numReadAheadBlocks = GetNumReadAheadBlocks();
+    if (numCacheBlocks < numReadAheadBlocks * 2)
+      numCacheBlocks = numReadAheadBlocks * 2;
+    if (_numCacheBlocksMax != numCacheBlocks)
+    {
+      ClearCache();
+      _numCacheBlocksMax = numCacheBlocks;
+    }
   }
+  // **************** NanaZip Modification End ****************
 
   CSquashfsInStream *streamSpec = new CSquashfsInStream;
   CMyComPtr<IInStream> streamTemp = streamSpec;
@@ -2429,6 +2682,31 @@ Z7_COM7F_IMF(CHandler::GetStream(UInt32 index, ISequentialInStream **stream))
   COM_TRY_END
 }
 
+// **************** NanaZip Modification Start ****************
+Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVARIANT *values, UInt32 numProps))
+{
+  InitProps();
+
+  for (UInt32 i = 0; i < numProps; i++)
+  {
+    const UString name = names[i];
+    const PROPVARIANT &prop = values[i];
+
+    if (IsString1PrefixedByString2_NoCase_Ascii(name, "mt"))
+    {
+      const UInt32 numCPUs = NWindows::NSystem::GetNumberOfProcessors();
+      RINOK(ParseMtProp(name.Ptr(2), prop, numCPUs, _numThreads))
+    }
+    else if (IsString1PrefixedByString2_NoCase_Ascii(name, "memuse"))
+    {
+    }
+    else
+      return E_INVALIDARG;
+  }
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
+
 static const Byte k_Signature[] = {
     4, 'h', 's', 'q', 's',
     4, 's', 'q', 's', 'h',
@@ -1061,6 +1061,11 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   int prevSuccessStreamIndex = -1;
 
   CUnpacker unpacker;
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  unpacker.SetNumThreads(_props._numThreads, _props._memUsage_Decompress);
+  #endif
+  // **************** NanaZip Modification End ****************
 
   CMyComPtr2_Create<ICompressProgressInfo, CLocalProgress> lps;
   lps->Init(extractCallback, false);
@@ -1193,7 +1198,25 @@ Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVAR
       // some clients write 'x' property. So we support it
       UInt32 level = 0;
       RINOK(ParsePropToUInt32(name.Ptr(1), prop, level))
+      // **************** NanaZip Modification Start ****************
+      // the level is used for XPRESS compression
+      _level = level;
+      // **************** NanaZip Modification End ****************
+    }
+    // **************** NanaZip Modification Start ****************
+    else if (name.IsEqualTo("m") || name.IsEqualTo("0"))
+    {
+      if (prop.vt != VT_BSTR)
+        return E_INVALIDARG;
+      const UString m = prop.bstrVal;
+      if (m.IsEqualTo_Ascii_NoCase("xpress"))
+        _xpressMode = true;
+      else if (m.IsEqualTo_Ascii_NoCase("copy"))
+        _xpressMode = false;
+      else
+        return E_INVALIDARG;
     }
+    // **************** NanaZip Modification End ****************
     else if (name.IsEqualTo("is"))
     {
       RINOK(PROPVARIANT_to_bool(prop, _set_showImageNumber))
@@ -1205,12 +1228,15 @@ Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVAR
       RINOK(ParsePropToUInt32(L"", prop, image))
       _defaultImageNumber = (int)image;
     }
-    else if (name.IsPrefixedBy_Ascii_NoCase("mt"))
-    {
-    }
-    else if (name.IsPrefixedBy_Ascii_NoCase("memuse"))
+    // **************** NanaZip Modification Start ****************
+    else if (name.IsPrefixedBy_Ascii_NoCase("mt")
+        || name.IsPrefixedBy_Ascii_NoCase("memuse"))
     {
+      HRESULT hres;
+      _props.SetCommonProperty(name, prop, hres);
+      RINOK(hres)
     }
+    // **************** NanaZip Modification End ****************
     else if (name.IsPrefixedBy_Ascii_NoCase("crc"))
     {
       name.Delete(0, 3);
@@ -51,9 +51,19 @@ Z7_CLASS_IMP_CHandler_IInArchive_5(
   Int32 _firstVolumeIndex;
 
   CHandlerTimeOptions _timeOptions;
+  // **************** NanaZip Modification Start ****************
+  CCommonMethodProps _props;
+  bool _xpressMode;
+  UInt32 _level;
+  // **************** NanaZip Modification End ****************
 
   void InitDefaults()
   {
+    // **************** NanaZip Modification Start ****************
+    _props = CCommonMethodProps();
+    _xpressMode = false;
+    _level = 5;
+    // **************** NanaZip Modification End ****************
     _disable_Sha1Check = false;
     _set_use_ShowImageNumber = false;
     _set_showImageNumber = false;
@@ -16,6 +16,14 @@
 #include "../../Common/ProgressUtils.h"
 #include "../../Common/StreamUtils.h"
 #include "../../Common/UniqBlocks.h"
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../../Common/VirtThread.h"
+#endif
+
+#include "../../Compress/XpressDecoder.h"
+#include "../../Compress/XpressEncoder.h"
+// **************** NanaZip Modification End ****************
 
 #include "../../Crypto/RandGen.h"
 #include "../../Crypto/Sha1Cls.h"
@@ -686,6 +694,284 @@ void CHeader::SetDefaultFields(bool useLZX)
 }
 
 
+// **************** NanaZip Modification Start ****************
+/*
+CResourcePacker writes one data stream as compressed (XPRESS) resource:
+  the caller thread reads the chunks of stream (and the caller's stream
+  calculates SHA-1), the threads compress the chunks, and the caller
+  thread writes compressed chunks in the order of chunks.
+  The chunk table is reserved for (size) before the chunks, and it's
+  written after the chunks. If the stream is shorter than (size), the
+  smaller table is written to the end of reserved area, and the resource
+  starts after unused bytes.
+*/
+
+class CPackThread Z7_final
+  #ifndef Z7_ST
+    : public CVirtThread
+  #endif
+{
+public:
+  NCompress::NXpress::CEncoder Encoder;
+  CByteBuffer InBuf;
+  CByteBuffer OutBuf;
+  CByteBuffer CheckBuf;
+  size_t InSize;
+  size_t OutSize; // (OutSize == 0) means that the chunk is stored without compression
+  bool IsRunning;
+
+  CPackThread(): InSize(0), OutSize(0), IsRunning(false) {}
+  
+  bool Alloc(size_t chunkSize)
+  {
+    if (InBuf.Size() != chunkSize)
+    {
+      InBuf.Alloc(chunkSize);
+      OutBuf.Alloc(NCompress::NXpress::GetEncodeOutBufSize(chunkSize));
+      CheckBuf.Alloc(chunkSize + NCompress::NXpress::kAdditionalOutputBufSize);
+    }
+    return Encoder.Alloc();
+  }
+  
+  void Pack()
+  {
+    OutSize = Encoder.Encode(InBuf, InSize, OutBuf);
+    if (OutSize >= InSize)
+    {
+      OutSize = 0;
+      return;
+    }
+    // we decode the chunk back, and we store the chunk if the result differs
+    if (NCompress::NXpress::Decode_WithExceedWrite(OutBuf, OutSize, CheckBuf, InSize) != S_OK
+        || memcmp(CheckBuf, InBuf, InSize) != 0)
+      OutSize = 0;
+  }
+
+  #ifndef Z7_ST
+  ~CPackThread() Z7_DESTRUCTOR_override { CVirtThread::WaitThreadFinish(); }
+  void Execute() Z7_override { Pack(); }
+  #endif
+};
+
+
+class CResourcePacker
+{
+  CObjectVector<CPackThread> _threads;
+  CRecordVector<UInt32> _packSizes;
+
+  unsigned CreateThreads();
+public:
+  UInt32 NumThreads;
+  UInt32 Level;
+
+  UInt64 PackSize;    // the size of resource
+  UInt64 UnpackSize;
+  UInt64 WrittenSize; // (WrittenSize - PackSize) unused bytes before resource
+  
+  CResourcePacker(): NumThreads(1), Level(5), PackSize(0), UnpackSize(0), WrittenSize(0) {}
+
+  HRESULT Code(ISequentialInStream *inStream, UInt64 size, unsigned chunkSizeBits,
+      IOutStream *outStream, ICompressProgressInfo *progress);
+};
+
+
+static const unsigned kPackNumThreadsMax = 64;
+
+unsigned CResourcePacker::CreateThreads()
+{
+  UInt32 numThreads = NumThreads;
+  if (numThreads > kPackNumThreadsMax)
+    numThreads = kPackNumThreadsMax;
+  #ifndef Z7_ST
+  if (numThreads > 1)
+  {
+    while (_threads.Size() < numThreads)
+    {
+      CPackThread &t = _threads.AddNew();
+      if (t.Create() != 0)
+      {
+        _threads.DeleteBack();
+        break;
+      }
+    }
+    if (numThreads > _threads.Size())
+      numThreads = _threads.Size();
+  }
+  #endif
+  if (_threads.IsEmpty())
+    _threads.AddNew();
+  if (numThreads < 2)
+    return 1;
+  return numThreads;
+}
+
+
+HRESULT CResourcePacker::Code(ISequentialInStream *inStream, UInt64 size, unsigned chunkSizeBits,
+    IOutStream *outStream, ICompressProgressInfo *progress)
+{
+  PackSize = 0;
+  UnpackSize = 0;
+  WrittenSize = 0;
+  _packSizes.Clear();
+  
+  const size_t chunkSize = (size_t)1 << chunkSizeBits;
+  const UInt64 numChunks = (size + (chunkSize - 1)) >> chunkSizeBits;
+  if (numChunks == 0 || numChunks >= ((UInt32)1 << 31))
+    return E_INVALIDARG;
+  
+  const UInt64 tableSizeReserved = (numChunks - 1) << (size < ((UInt64)1 << 32) ? 2 : 3);
+  
+  UInt64 startPos;
+  RINOK(outStream->Seek(0, STREAM_SEEK_CUR, &startPos))
+  {
+    const size_t kZerosSize = 1 << 12;
+    Byte zeros[kZerosSize];
+    memset(zeros, 0, kZerosSize);
+    for (UInt64 rem = tableSizeReserved; rem != 0;)
+    {
+      size_t cur = kZerosSize;
+      if (cur > rem)
+        cur = (size_t)rem;
+      RINOK(WriteStream(outStream, zeros, cur))
+      rem -= cur;
+    }
+  }
+
+  const unsigned numThreads = CreateThreads();
+  // if (numThreads == 1), we compress the chunks in the caller thread
+  const bool useThreads = (numThreads > 1);
+  {
+    for (unsigned k = 0; k < numThreads; k++)
+    {
+      CPackThread &t = _threads[k];
+      t.Encoder.SetLevel(Level);
+      if (!t.Alloc(chunkSize))
+        return E_OUTOFMEMORY;
+    }
+  }
+
+  HRESULT res = S_OK;
+  UInt64 inProcessed = 0;
+  UInt64 outProcessed = 0;
+  UInt64 readProcessed = 0;
+  unsigned numStarted = 0;
+  bool readFinished = false;
+
+  for (unsigned i = 0;; i++)
+  {
+    while (!readFinished && numStarted < i + numThreads)
+    {
+      CPackThread &t = _threads[numStarted % numThreads];
+      size_t cur = chunkSize;
+      if (cur > size - readProcessed)
+        cur = (size_t)(size - readProcessed);
+      size_t processed = cur;
+      if (cur != 0)
+        res = ReadStream(inStream, t.InBuf, &processed);
+      if (res != S_OK || processed == 0)
+      {
+        readFinished = true;
+        break;
+      }
+      if (processed != cur)
+        readFinished = true;
+      readProcessed += processed;
+      t.InSize = processed;
+      numStarted++;
+      #ifndef Z7_ST
+      if (useThreads)
+      {
+        if (t.Start() != 0)
+          t.Pack();
+        else
+          t.IsRunning = true;
+      }
+      else
+      #endif
+        t.Pack();
+    }
+    
+    if (res != S_OK || i == numStarted)
+      break;
+
+    CPackThread &t = _threads[i % numThreads];
+    #ifndef Z7_ST
+    if (t.IsRunning)
+    {
+      t.WaitExecuteFinish();
+      t.IsRunning = false;
+    }
+    #endif
+    
+    const size_t packSize = (t.OutSize != 0 ? t.OutSize : t.InSize);
+    res = WriteStream(outStream, (t.OutSize != 0 ? t.OutBuf : t.InBuf), packSize);
+    if (res != S_OK)
+      break;
+    _packSizes.Add((UInt32)packSize);
+    inProcessed += t.InSize;
+    outProcessed += packSize;
+    
+    if (progress)
+    {
+      res = progress->SetRatioInfo(&inProcessed, &outProcessed);
+      if (res != S_OK)
+        break;
+    }
+  }
+
+  #ifndef Z7_ST
+  FOR_VECTOR (k, _threads)
+  {
+    CPackThread &t = _threads[k];
+    if (t.IsRunning)
+    {
+      t.WaitExecuteFinish();
+      t.IsRunning = false;
+    }
+  }
+  #else
+  UNUSED_VAR(useThreads)
+  #endif
+
+  RINOK(res)
+
+  if (inProcessed == 0)
+  {
+    RINOK(outStream->Seek((Int64)startPos, STREAM_SEEK_SET, NULL))
+    return outStream->SetSize(startPos);
+  }
+  
+  const unsigned entrySizeShifts = (inProcessed < ((UInt64)1 << 32) ? 2 : 3);
+  const size_t tableSize = (size_t)(_packSizes.Size() - 1) << entrySizeShifts;
+  CByteBuffer table(tableSize);
+  {
+    UInt64 offset = 0;
+    for (unsigned i = 0; i + 1 < _packSizes.Size(); i++)
+    {
+      offset += _packSizes[i];
+      Byte *p = table + ((size_t)i << entrySizeShifts);
+      if (entrySizeShifts == 2)
+      {
+        Set32(p, (UInt32)offset)
+      }
+      else
+      {
+        Set64(p, offset)
+      }
+    }
+  }
+
+  WrittenSize = tableSizeReserved + outProcessed;
+  PackSize = tableSize + outProcessed;
+  UnpackSize = inProcessed;
+  
+  RINOK(outStream->Seek((Int64)(startPos + tableSizeReserved - tableSize), STREAM_SEEK_SET, NULL))
+  RINOK(WriteStream(outStream, table, tableSize))
+  return outStream->Seek((Int64)(startPos + WrittenSize), STREAM_SEEK_SET, NULL);
+}
+// **************** NanaZip Modification End ****************
+
+
 static void AddTrees(CObjectVector<CDir> &trees, CObjectVector<CMetaItem> &metaItems, const CMetaItem &ri, int curTreeIndex)
 {
   while (curTreeIndex >= (int)trees.Size())
@@ -1376,6 +1662,24 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outSeqStream, UInt32 nu
     header.ChunkSizeBits = srcHeader.ChunkSizeBits;
   }
 
+  // **************** NanaZip Modification Start ****************
+  if (_xpressMode && !header.IsCompressed())
+  {
+    header.Flags |= NHeaderFlags::kCompression | NHeaderFlags::kXPRESS;
+    header.ChunkSize = kChunkSize;
+    header.ChunkSizeBits = kChunkSizeBits;
+  }
+  // new streams of LZX and LZMS archives are stored without compression
+  const bool useResourceCompression = _xpressMode
+      && header.GetMethod() == NMethod::kXPRESS
+      && header.ChunkSizeBits <= 16;
+  CResourcePacker packer;
+  #ifndef Z7_ST
+  packer.NumThreads = _props._numThreads;
+  #endif
+  packer.Level = _level;
+  // **************** NanaZip Modification End ****************
+
   CMyComPtr<IStreamSetRestriction> setRestriction;
   outSeqStream->QueryInterface(IID_IStreamSetRestriction, (void **)&setRestriction);
   if (setRestriction)
@@ -1703,10 +2007,26 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outSeqStream, UInt32 nu
           }
         }
         
+        // **************** NanaZip Modification Start ****************
+        bool isPacked = false;
+        // **************** NanaZip Modification End ****************
         if (needWritePass)
         {
-          RINOK(copyCoder.Interface()->Code(inShaStream, outStream, NULL, NULL, lps))
-          size = copyCoder->TotalSize;
+          // **************** NanaZip Modification Start ****************
+          // the size of seekable stream is known after SHA-1 pass,
+          // so we can reserve the chunk table for compressed resource.
+          if (useResourceCompression && inSeekStream && size != 0)
+          {
+            RINOK(packer.Code(inShaStream, size, header.ChunkSizeBits, outStream, lps))
+            size = packer.UnpackSize;
+            isPacked = true;
+          }
+          else
+          // **************** NanaZip Modification End ****************
+          {
+            RINOK(copyCoder.Interface()->Code(inShaStream, outStream, NULL, NULL, lps))
+            size = copyCoder->TotalSize;
+          }
         }
        
         if (size != 0)
@@ -1714,7 +2034,11 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outSeqStream, UInt32 nu
           if (needWritePass)
           {
             Byte hash[kHashSize];
-            const UInt64 packSize = offsetBlockSize + size;
+            // **************** NanaZip Modification Start ****************
+            // const UInt64 packSize = offsetBlockSize + size;
+            const UInt64 packSize = isPacked ? packer.PackSize : offsetBlockSize + size;
+            const UInt64 writtenSize = isPacked ? packer.WrittenSize : packSize;
+            // **************** NanaZip Modification End ****************
             inShaStream->Final(hash);
             
             index = AddUniqHash(streams.ConstData(), sortedHashes, hash, (int)streams.Size());
@@ -1722,7 +2046,10 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outSeqStream, UInt32 nu
             if (index != -1)
             {
               streams[index].RefCount++;
-              outStream->Seek(-(Int64)packSize, STREAM_SEEK_CUR, &curPos);
+              // **************** NanaZip Modification Start ****************
+              // outStream->Seek(-(Int64)packSize, STREAM_SEEK_CUR, &curPos);
+              outStream->Seek(-(Int64)writtenSize, STREAM_SEEK_CUR, &curPos);
+              // **************** NanaZip Modification End ****************
               outStream->SetSize(curPos);
             }
             else
@@ -1730,17 +2057,27 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outSeqStream, UInt32 nu
               index = (int)streams.Size();
               CStreamInfo s;
               s.Resource.PackSize = packSize;
-              s.Resource.Offset = curPos;
+              // **************** NanaZip Modification Start ****************
+              // s.Resource.Offset = curPos;
+              s.Resource.Offset = curPos + (writtenSize - packSize);
+              // **************** NanaZip Modification End ****************
               s.Resource.UnpackSize = size;
               s.Resource.Flags = 0;
               /*
               if (useResourceCompression)
               s.Resource.Flags = NResourceFlags::Compressed;
               */
+              // **************** NanaZip Modification Start ****************
+              if (isPacked)
+                s.Resource.Flags = NResourceFlags::kCompressed;
+              // **************** NanaZip Modification End ****************
               s.PartNumber = 1;
               s.RefCount = 1;
               memcpy(s.Hash, hash, kHashSize);
-              curPos += packSize;
+              // **************** NanaZip Modification Start ****************
+              // curPos += packSize;
+              curPos += writtenSize;
+              // **************** NanaZip Modification End ****************
               
               streams.Add(s);
             }
@@ -50,11 +50,8 @@ static bool inline GetLog_val_min_dest(const UInt32 val, unsigned i, unsigned &d
 }
 
 
-HRESULT CUnpacker::UnpackChunk(
-    ISequentialInStream *inStream,
-    unsigned method, unsigned chunkSizeBits,
-    size_t inSize, size_t outSize,
-    ISequentialOutStream *outStream)
+// **************** NanaZip Modification Start ****************
+HRESULT CChunkDecoder::Prepare(unsigned method, unsigned chunkSizeBits, size_t inSize, size_t outSize)
 {
   if (inSize == outSize)
   {
@@ -85,72 +82,287 @@ HRESULT CUnpacker::UnpackChunk(
     if (!unpackBuf.Data)
       return E_OUTOFMEMORY;
   }
-  
-  HRESULT res = S_FALSE;
-  size_t unpackedSize = 0;
-  
-  if (inSize == outSize)
-  {
-    unpackedSize = outSize;
-    res = ReadStream(inStream, unpackBuf.Data, &unpackedSize);
-    TotalPacked += unpackedSize;
-  }
-  else if (inSize < chunkSize)
+
+  _method = method;
+  _inSize = inSize;
+  _isCompressed = (inSize != outSize && inSize < chunkSize);
+  OutSize = outSize;
+  Res = S_FALSE;
+
+  if (_isCompressed)
   {
     const unsigned kAdditionalInputSize = 32;
     packBuf.EnsureCapacity(chunkSize + kAdditionalInputSize);
     if (!packBuf.Data)
       return E_OUTOFMEMORY;
-    
-    RINOK(ReadStream_FALSE(inStream, packBuf.Data, inSize))
-    memset(packBuf.Data + inSize, 0xff, kAdditionalInputSize);
-
-    TotalPacked += inSize;
-    
-    if (method == NMethod::kXPRESS)
-    {
-      res = NCompress::NXpress::Decode_WithExceedWrite(packBuf.Data, inSize, unpackBuf.Data, outSize);
-      if (res == S_OK)
-        unpackedSize = outSize;
-    }
-    else if (method == NMethod::kLZX)
+    if (method == NMethod::kLZX)
     {
-      res = lzxDecoder->Set_ExternalWindow_DictBits(unpackBuf.Data, chunkSizeBits);
-      if (res != S_OK)
+      if (lzxDecoder->Set_ExternalWindow_DictBits(unpackBuf.Data, chunkSizeBits) != S_OK)
         return E_NOTIMPL;
       lzxDecoder->Set_KeepHistoryForNext(false);
       lzxDecoder->Set_KeepHistory(false);
-      res = lzxDecoder->Code_WithExceedReadWrite(packBuf.Data, inSize, (UInt32)outSize);
-      unpackedSize = lzxDecoder->GetUnpackSize();
-      if (res == S_OK && !lzxDecoder->WasBlockFinished())
-        res = S_FALSE;
     }
-    else
+  }
+  return S_OK;
+}
+
+
+HRESULT CChunkDecoder::ReadInput(ISequentialInStream *inStream, UInt64 &totalPacked)
+{
+  if (_inSize == OutSize)
+  {
+    size_t unpackedSize = OutSize;
+    Res = ReadStream(inStream, unpackBuf.Data, &unpackedSize);
+    totalPacked += unpackedSize;
+    if (unpackedSize != OutSize)
     {
-      res = lzmsDecoder->Code(packBuf.Data, inSize, unpackBuf.Data, outSize);
-      unpackedSize = lzmsDecoder->GetUnpackSize();
+      if (Res == S_OK)
+        Res = S_FALSE;
+      memset(unpackBuf.Data + unpackedSize, 0, OutSize - unpackedSize);
     }
   }
+  else if (_isCompressed)
+  {
+    const unsigned kAdditionalInputSize = 32;
+    RINOK(ReadStream_FALSE(inStream, packBuf.Data, _inSize))
+    memset(packBuf.Data + _inSize, 0xff, kAdditionalInputSize);
+    totalPacked += _inSize;
+  }
+  return S_OK;
+}
+
+
+void CChunkDecoder::Decode()
+{
+  if (!_isCompressed)
+  {
+    if (_inSize != OutSize)
+    {
+      Res = S_FALSE;
+      memset(unpackBuf.Data, 0, OutSize);
+    }
+    return;
+  }
+
+  HRESULT res;
+  size_t unpackedSize = 0;
   
-  if (unpackedSize != outSize)
+  if (_method == NMethod::kXPRESS)
+  {
+    res = NCompress::NXpress::Decode_WithExceedWrite(packBuf.Data, _inSize, unpackBuf.Data, OutSize);
+    if (res == S_OK)
+      unpackedSize = OutSize;
+  }
+  else if (_method == NMethod::kLZX)
+  {
+    res = lzxDecoder->Code_WithExceedReadWrite(packBuf.Data, _inSize, (UInt32)OutSize);
+    unpackedSize = lzxDecoder->GetUnpackSize();
+    if (res == S_OK && !lzxDecoder->WasBlockFinished())
+      res = S_FALSE;
+  }
+  else
+  {
+    res = lzmsDecoder->Code(packBuf.Data, _inSize, unpackBuf.Data, OutSize);
+    unpackedSize = lzmsDecoder->GetUnpackSize();
+  }
+  
+  if (unpackedSize != OutSize)
   {
     if (res == S_OK)
       res = S_FALSE;
     
-    if (unpackedSize > outSize)
+    if (unpackedSize > OutSize)
       res = S_FALSE;
     else
-      memset(unpackBuf.Data + unpackedSize, 0, outSize - unpackedSize);
+      memset(unpackBuf.Data + unpackedSize, 0, OutSize - unpackedSize);
   }
+  Res = res;
+}
+
+
+HRESULT CUnpacker::UnpackChunk(
+    ISequentialInStream *inStream,
+    unsigned method, unsigned chunkSizeBits,
+    size_t inSize, size_t outSize,
+    ISequentialOutStream *outStream)
+{
+  RINOK(_decoder.Prepare(method, chunkSizeBits, inSize, outSize))
+  RINOK(_decoder.ReadInput(inStream, TotalPacked))
+  _decoder.Decode();
   
   if (outStream)
   {
-    RINOK(WriteStream(outStream, unpackBuf.Data, outSize))
+    RINOK(WriteStream(outStream, _decoder.unpackBuf.Data, outSize))
   }
   
+  return _decoder.Res;
+}
+
+
+#ifndef Z7_ST
+
+static const unsigned kMtNumThreadsMax = 64;
+
+unsigned CUnpacker::GetNumWorkers(unsigned chunkSizeBits, size_t numChunks)
+{
+  UInt64 numWorkers = _numThreads;
+  if (numWorkers > kMtNumThreadsMax)
+    numWorkers = kMtNumThreadsMax;
+  if (numWorkers > numChunks)
+    numWorkers = numChunks;
+  {
+    // each thread uses the buffers for packed and unpacked chunk.
+    // we use no more than half of memory limit for these buffers.
+    const UInt64 memPerThread = ((UInt64)2 << chunkSizeBits) + (1 << 16);
+    const UInt64 numWorkersMax = _memUsage / 2 / memPerThread;
+    if (numWorkers > numWorkersMax)
+      numWorkers = numWorkersMax;
+  }
+  if (numWorkers < 2)
+    return 0;
+  while (_threads.Size() < numWorkers)
+  {
+    CUnpackThread &t = _threads.AddNew();
+    if (t.Create() != 0)
+    {
+      _threads.DeleteBack();
+      break;
+    }
+  }
+  if (numWorkers > _threads.Size())
+    numWorkers = _threads.Size();
+  if (numWorkers < 2)
+    return 0;
+  return (unsigned)numWorkers;
+}
+
+
+HRESULT CUnpacker::UnpackChunks_Mt(
+    IInStream *inStream,
+    unsigned method, unsigned chunkSizeBits,
+    const CRecordVector<CChunkItem> &chunks,
+    unsigned numWorkers,
+    int solidIndex, size_t firstChunkIndex,
+    size_t offsetInChunk, UInt64 rem, UInt64 outProcessed,
+    ISequentialOutStream *outStream,
+    ICompressProgressInfo *progress)
+{
+  /* The thread (i % numWorkers) decodes the chunk (i).
+     The caller thread reads the packed data of next chunks,
+     while the threads decode previous chunks. */
+  
+  const unsigned numChunks = chunks.Size();
+  unsigned numStarted = 0;
+  bool readError = false;
+  UInt64 packProcessed = 0;
+  HRESULT res = S_OK;
+
+  for (unsigned i = 0; i < numChunks; i++)
+  {
+    while (!readError && numStarted < numChunks && numStarted < i + numWorkers)
+    {
+      CUnpackThread &t = _threads[numStarted % numWorkers];
+      const CChunkItem &item = chunks[numStarted];
+      numStarted++;
+      HRESULT readRes = InStream_SeekSet(inStream, item.Offset);
+      if (readRes == S_OK)
+        readRes = t.Decoder.Prepare(method, chunkSizeBits, item.PackSize, item.UnpackSize);
+      if (readRes == S_OK)
+        readRes = t.Decoder.ReadInput(inStream, TotalPacked);
+      t.ReadRes = readRes;
+      if (readRes != S_OK)
+      {
+        // we report that error, when we reach that chunk in the order of chunks
+        readError = true;
+        break;
+      }
+      const WRes wres = t.Start();
+      if (wres != 0)
+        t.Decoder.Decode();
+      else
+        t.IsRunning = true;
+    }
+
+    CUnpackThread &t = _threads[i % numWorkers];
+    if (t.IsRunning)
+    {
+      t.WaitExecuteFinish();
+      t.IsRunning = false;
+    }
+    if (t.ReadRes != S_OK)
+    {
+      res = t.ReadRes;
+      break;
+    }
+
+    CChunkDecoder &decoder = t.Decoder;
+    const Byte *data = decoder.unpackBuf.Data;
+    size_t cur = decoder.OutSize;
+
+    if (solidIndex >= 0)
+    {
+      // We ignore data errors in solid stream. SHA will show what files are bad.
+      if (decoder.Res != S_OK && decoder.Res != S_FALSE)
+      {
+        res = decoder.Res;
+        break;
+      }
+      // the last unpacked chunk is kept in (_decoder.unpackBuf) for next call
+      _decoder.unpackBuf.Swap(decoder.unpackBuf);
+      data = _decoder.unpackBuf.Data;
+      _solidIndex = solidIndex;
+      _unpackedChunkIndex = firstChunkIndex + i;
+      if (cur < offsetInChunk)
+      {
+        res = E_FAIL;
+        break;
+      }
+      data += offsetInChunk;
+      cur -= offsetInChunk;
+      if (cur > rem)
+        cur = (size_t)rem;
+      offsetInChunk = 0;
+    }
+
+    if (progress)
+    {
+      res = progress->SetRatioInfo(&packProcessed, &outProcessed);
+      if (res != S_OK)
+        break;
+    }
+    packProcessed += chunks[i].PackSize;
+    outProcessed += cur;
+
+    if (outStream)
+    {
+      res = WriteStream(outStream, data, cur);
+      if (res != S_OK)
+        break;
+    }
+    rem -= cur;
+
+    if (solidIndex < 0 && decoder.Res != S_OK)
+    {
+      res = decoder.Res;
+      break;
+    }
+  }
+
+  FOR_VECTOR (k, _threads)
+  {
+    CUnpackThread &t = _threads[k];
+    if (t.IsRunning)
+    {
+      t.WaitExecuteFinish();
+      t.IsRunning = false;
+    }
+  }
   return res;
 }
 
+#endif
+// **************** NanaZip Modification End ****************
+
 
 HRESULT CUnpacker::Unpack2(
     IInStream *inStream,
@@ -220,12 +432,51 @@ HRESULT CUnpacker::Unpack2(
       size_t cur = chunkSize - offsetInChunk;
       if (cur > rem)
         cur = (size_t)rem;
-      RINOK(WriteStream(outStream, unpackBuf.Data + offsetInChunk, cur))
+      // **************** NanaZip Modification Start ****************
+      // RINOK(WriteStream(outStream, unpackBuf.Data + offsetInChunk, cur))
+      RINOK(WriteStream(outStream, _decoder.unpackBuf.Data + offsetInChunk, cur))
+      // **************** NanaZip Modification End ****************
       outProcessed += cur;
       rem -= cur;
       offsetInChunk = 0;
       chunkIndex++;
     }
+
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    if (rem != 0 && _numThreads > 1)
+    {
+      const UInt64 numChunks64 = ((UInt64)offsetInChunk + rem + (chunkSize - 1)) >> chunkSizeBits;
+      const unsigned numWorkers = (numChunks64 > 1 && numChunks64 < ((UInt32)1 << 31)) ?
+          GetNumWorkers(chunkSizeBits, (size_t)numChunks64) : 0;
+      if (numWorkers != 0)
+      {
+        const size_t numChunks = (size_t)numChunks64;
+        const CResource &rs = db->DataStreams[ss.StreamIndex].Resource;
+        if (((UInt64)(chunkIndex + numChunks - 1) << chunkSizeBits) >= ss.UnpackSize)
+          return E_FAIL;
+        CRecordVector<CChunkItem> chunks;
+        chunks.ClearAndReserve((unsigned)numChunks);
+        for (size_t i = 0; i < numChunks; i++)
+        {
+          const size_t index = chunkIndex + i;
+          const UInt64 unpackRem = ss.UnpackSize - ((UInt64)index << chunkSizeBits);
+          CChunkItem item;
+          item.Offset = rs.Offset + ss.HeadersSize + ss.Chunks[index];
+          item.PackSize = (size_t)ss.GetChunkPackSize(index);
+          item.UnpackSize = chunkSize;
+          if (item.UnpackSize > unpackRem)
+            item.UnpackSize = (size_t)unpackRem;
+          chunks.AddInReserved(item);
+        }
+        _solidIndex = -1;
+        _unpackedChunkIndex = 0;
+        return UnpackChunks_Mt(inStream, (unsigned)ss.Method, chunkSizeBits, chunks, numWorkers,
+            resource.SolidIndex, chunkIndex, offsetInChunk, rem, outProcessed, outStream, progress);
+      }
+    }
+    #endif
+    // **************** NanaZip Modification End ****************
     
     for (;;)
     {
@@ -265,7 +516,10 @@ HRESULT CUnpacker::Unpack2(
       if (cur > rem)
         cur = (size_t)rem;
       
-      RINOK(WriteStream(outStream, unpackBuf.Data + offsetInChunk, cur))
+      // **************** NanaZip Modification Start ****************
+      // RINOK(WriteStream(outStream, unpackBuf.Data + offsetInChunk, cur))
+      RINOK(WriteStream(outStream, _decoder.unpackBuf.Data + offsetInChunk, cur))
+      // **************** NanaZip Modification End ****************
       
       if (progress)
       {
@@ -319,6 +573,51 @@ HRESULT CUnpacker::Unpack2(
   _solidIndex = -1;
   _unpackedChunkIndex = 0;
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (_numThreads > 1 && numChunks > 1 && numChunks < ((UInt32)1 << 31))
+  {
+    const unsigned numWorkers = GetNumWorkers(chunkSizeBits, numChunks);
+    if (numWorkers != 0)
+    {
+      CRecordVector<CChunkItem> chunks;
+      chunks.ClearAndReserve((unsigned)numChunks);
+      HRESULT tableRes = S_OK;
+      UInt64 offset = 0;
+      UInt64 outProcessed = 0;
+      for (size_t i = 0; i < numChunks; i++)
+      {
+        UInt64 nextOffset = packDataSize;
+        if (i + 1 < numChunks)
+        {
+          const Byte *p = (const Byte *)sizesBuf + (i << entrySizeShifts);
+          nextOffset = (entrySizeShifts == 2) ? Get32(p): Get64(p);
+        }
+        // the chunks before the error in chunk table are unpacked as in single-threaded code
+        if (nextOffset < offset || nextOffset - offset != (size_t)(nextOffset - offset))
+        {
+          tableRes = S_FALSE;
+          break;
+        }
+        CChunkItem item;
+        item.Offset = baseOffset + offset;
+        item.PackSize = (size_t)(nextOffset - offset);
+        item.UnpackSize = (size_t)1 << chunkSizeBits;
+        const UInt64 rem = unpackSize - outProcessed;
+        if (item.UnpackSize > rem)
+          item.UnpackSize = (size_t)rem;
+        chunks.AddInReserved(item);
+        outProcessed += item.UnpackSize;
+        offset = nextOffset;
+      }
+      RINOK(UnpackChunks_Mt(inStream, header.GetMethod(), chunkSizeBits, chunks, numWorkers,
+          -1, 0, 0, unpackSize, 0, outStream, progress))
+      return tableRes;
+    }
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
+
   UInt64 outProcessed = 0;
   UInt64 offset = 0;
   
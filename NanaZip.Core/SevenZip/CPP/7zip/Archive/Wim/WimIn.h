@@ -15,6 +15,12 @@
 #include "../../Compress/LzmsDecoder.h"
 #include "../../Compress/LzxDecoder.h"
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../../Common/VirtThread.h"
+#endif
+// **************** NanaZip Modification End ****************
+
 #include "../IArchive.h"
 
 namespace NArchive {
@@ -598,20 +604,97 @@ struct CMidBuf
   }
 
   ~CMidBuf() { ::z7_AlignedFree(Data); }
+
+  // **************** NanaZip Modification Start ****************
+  void Swap(CMidBuf &b)
+  {
+    Byte *data = Data; Data = b.Data; b.Data = data;
+    const size_t size = _size; _size = b._size; b._size = size;
+  }
+  // **************** NanaZip Modification End ****************
 };
 
 
-class CUnpacker
+// **************** NanaZip Modification Start ****************
+/*
+CChunkDecoder decodes one chunk of resource:
+  Prepare() and ReadInput() must be called in the thread that reads the archive.
+  Decode() doesn't use streams, so it can be called in another thread.
+*/
+
+class CChunkDecoder
 {
-  CMyComPtr2<ICompressCoder, NCompress::CCopyCoder> copyCoder;
   CMyUniquePtr<NCompress::NLzx::CDecoder> lzxDecoder;
   CMyUniquePtr<NCompress::NLzms::CDecoder> lzmsDecoder;
 
-  CByteBuffer sizesBuf;
-
+  unsigned _method;
+  size_t _inSize;
+  bool _isCompressed;
+public:
   CMidBuf packBuf;
   CMidBuf unpackBuf;
 
+  size_t OutSize;
+  HRESULT Res; // the result of Decode()
+
+  CChunkDecoder():
+      lzmsDecoder(NULL),
+      _method(0),
+      _inSize(0),
+      _isCompressed(false),
+      OutSize(0),
+      Res(S_OK)
+      {}
+
+  HRESULT Prepare(unsigned method, unsigned chunkSizeBits, size_t inSize, size_t outSize);
+  HRESULT ReadInput(ISequentialInStream *inStream, UInt64 &totalPacked);
+  // it writes (OutSize) bytes to (unpackBuf) even for data error
+  void Decode();
+};
+
+
+#ifndef Z7_ST
+
+class CUnpackThread Z7_final: public CVirtThread
+{
+public:
+  CChunkDecoder Decoder;
+  HRESULT ReadRes;
+  bool IsRunning;
+
+  CUnpackThread(): ReadRes(S_OK), IsRunning(false) {}
+  ~CUnpackThread() Z7_DESTRUCTOR_override { CVirtThread::WaitThreadFinish(); }
+  void Execute() Z7_override { Decoder.Decode(); }
+};
+
+#endif
+
+
+struct CChunkItem
+{
+  UInt64 Offset; // the position of packed chunk in archive stream
+  size_t PackSize;
+  size_t UnpackSize;
+};
+// **************** NanaZip Modification End ****************
+
+
+class CUnpacker
+{
+  CMyComPtr2<ICompressCoder, NCompress::CCopyCoder> copyCoder;
+  // **************** NanaZip Modification Start ****************
+  // CMyUniquePtr<NCompress::NLzx::CDecoder> lzxDecoder;
+  // CMyUniquePtr<NCompress::NLzms::CDecoder> lzmsDecoder;
+  // **************** NanaZip Modification End ****************
+
+  CByteBuffer sizesBuf;
+
+  // **************** NanaZip Modification Start ****************
+  // CMidBuf packBuf;
+  // CMidBuf unpackBuf;
+  CChunkDecoder _decoder;
+  // **************** NanaZip Modification End ****************
+
   // solid resource
   int _solidIndex;
   size_t _unpackedChunkIndex;
@@ -622,6 +705,30 @@ class CUnpacker
       size_t inSize, size_t outSize,
       ISequentialOutStream *outStream);
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  CObjectVector<CUnpackThread> _threads;
+  UInt32 _numThreads;
+  UInt64 _memUsage;
+
+  unsigned GetNumWorkers(unsigned chunkSizeBits, size_t numChunks);
+
+  /* it decodes the chunks in several threads and writes them in order of chunks.
+     if (solidIndex >= 0):
+       (offsetInChunk) bytes are skipped in first chunk, and only (rem) bytes are written,
+       data errors are ignored, as in single-threaded code. */
+  HRESULT UnpackChunks_Mt(
+      IInStream *inStream,
+      unsigned method, unsigned chunkSizeBits,
+      const CRecordVector<CChunkItem> &chunks,
+      unsigned numWorkers,
+      int solidIndex, size_t firstChunkIndex,
+      size_t offsetInChunk, UInt64 rem, UInt64 outProcessed,
+      ISequentialOutStream *outStream,
+      ICompressProgressInfo *progress);
+  #endif
+  // **************** NanaZip Modification End ****************
+
   HRESULT Unpack2(
       IInStream *inStream,
       const CResource &res,
@@ -634,12 +741,31 @@ public:
   UInt64 TotalPacked;
 
   CUnpacker():
-      lzmsDecoder(NULL),
+      // **************** NanaZip Modification Start ****************
+      // lzmsDecoder(NULL),
+      // **************** NanaZip Modification End ****************
       _solidIndex(-1),
       _unpackedChunkIndex(0),
+      // **************** NanaZip Modification Start ****************
+      #ifndef Z7_ST
+      _numThreads(1),
+      _memUsage(0),
+      #endif
+      // **************** NanaZip Modification End ****************
       TotalPacked(0)
       {}
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  // the chunks of one resource are decoded in several threads, if (numThreads > 1)
+  void SetNumThreads(UInt32 numThreads, UInt64 memUsage)
+  {
+    _numThreads = numThreads;
+    _memUsage = memUsage;
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
+
   HRESULT Unpack(
       IInStream *inStream,
       const CResource &res,
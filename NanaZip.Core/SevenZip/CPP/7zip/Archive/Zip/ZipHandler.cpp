@@ -16,6 +16,11 @@
 #include "../../Common/ProgressUtils.h"
 #include "../../Common/StreamObjects.h"
 #include "../../Common/StreamUtils.h"
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../../Common/VirtThread.h"
+#endif
+// **************** NanaZip Modification End ****************
 
 #include "../../Compress/CopyCoder.h"
 #ifndef Z7_ZIP_LZFSE_DISABLE
@@ -867,11 +872,19 @@ class CZipDecoder
   CObjectVector<CMethodItem> methodItems;
 
   CLzmaDecoder *lzmaDecoderSpec;
+  // **************** NanaZip Modification Start ****************
+  CMyComPtr<ISequentialInStream> _packStream;
+  // **************** NanaZip Modification End ****************
 public:
   CZipDecoder():
       lzmaDecoderSpec(NULL)
     {}
 
+  // **************** NanaZip Modification Start ****************
+  // if (packStream) is set, Decode() reads the packed data from that stream instead of archive
+  void SetPackStream(ISequentialInStream *packStream) { _packStream = packStream; }
+  // **************** NanaZip Modification End ****************
+
   HRESULT Decode(
     DECL_EXTERNAL_CODECS_LOC_VARS
     CInArchive &archive, const CItemEx &item,
@@ -1046,6 +1059,11 @@ HRESULT CZipDecoder::Decode(
         return S_OK;
       packSize -= NCrypto::NWzAes::kMacSize;
     }
+    // **************** NanaZip Modification Start ****************
+    if (_packStream)
+      packStream = _packStream;
+    else
+    // **************** NanaZip Modification End ****************
     RINOK(archive.GetItemStream(item, true, packStream))
     if (!packStream)
     {
@@ -1564,6 +1582,316 @@ HRESULT CZipDecoder::Decode(
   return S_OK;
 }
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+/*
+Multi-threaded extraction:
+  The main thread reads the local headers and the packed data of items,
+  and it calls all IArchiveExtractCallback methods in the order of items.
+  Small items that are not encrypted are decoded by threads
+  from memory buffers to memory buffers. Each thread decodes a batch
+  of consecutive items with its own decoder.
+  Other items (and the items that were not decoded by thread because of some error)
+  are decoded by the main thread as in single-threaded mode.
+*/
+
+static const unsigned kMtNumThreadsMax = 64;
+static const size_t kMtItemSizeMax = (size_t)1 << 26;
+static const size_t kMtBatchSize = (size_t)1 << 22;
+static const unsigned kMtBatchNumItemsMax = 1 << 10;
+
+struct CMtItem
+{
+  UInt32 Index;
+  bool IsLocalOffsetOK;
+  bool IsAvail;
+  bool HeadersError;
+  bool Decoded;       // the item is (or must be) decoded by thread
+  HRESULT LocalResult; // the result of Read_LocalItem_After_CdItem()
+  HRESULT Result;
+  Int32 OpRes;
+  size_t PackPos;
+  size_t UnpackPos;
+  size_t UnpackSize;
+  const Byte *UnpackData;
+  CItemEx Item;
+};
+
+
+class CExtractThread Z7_final: public CVirtThread
+{
+public:
+  CZipDecoder Decoder;
+  CObjectVector<CMtItem> Items;
+  CByteBuffer PackBuf;
+  CByteBuffer UnpackBuf;
+  size_t MemUsage;
+  bool IsStarted;
+  bool NeedStart;
+  CInArchive *Archive;
+  UInt64 MemLimit;
+  DECL_EXTERNAL_CODECS_LOC_VARS_DECL
+
+  CExtractThread(): MemUsage(0), IsStarted(false), NeedStart(false) {}
+  ~CExtractThread() Z7_DESTRUCTOR_override { CVirtThread::WaitThreadFinish(); }
+  void Execute() Z7_override;
+};
+
+
+void CExtractThread::Execute()
+{
+  CMyComPtr2_Create<ISequentialInStream, CBufInStream> packStream;
+  CMyComPtr2_Create<ISequentialOutStream, CBufPtrSeqOutStream> outStream;
+  Decoder.SetPackStream(packStream);
+  FOR_VECTOR (i, Items)
+  {
+    CMtItem &mi = Items[i];
+    if (!mi.Decoded)
+      continue;
+    mi.Result = E_FAIL;
+    try
+    {
+      packStream->Init(PackBuf + mi.PackPos, (size_t)mi.Item.PackSize);
+      // we reserve one additional byte to detect the data after the end
+      outStream->Init(UnpackBuf + mi.UnpackPos, (size_t)mi.Item.Size + 1);
+      mi.Result = Decoder.Decode(
+          EXTERNAL_CODECS_LOC_VARS
+          *Archive, mi.Item, outStream, NULL, NULL,
+          1, MemLimit,
+          mi.OpRes);
+      mi.UnpackSize = outStream->GetPos();
+      if (mi.UnpackSize > mi.Item.Size)
+        mi.Result = E_FAIL;
+    }
+    catch(...) { mi.Result = E_FAIL; }
+  }
+  Decoder.SetPackStream(NULL);
+}
+
+
+static void MtAllocBuf(CByteBuffer &buf, size_t size)
+{
+  // we don't keep big buffer after big item
+  if (buf.Size() < size || buf.Size() > MyMax(size, kMtBatchSize))
+    buf.Alloc(size);
+}
+
+
+class CMtExtract
+{
+  CInArchive *_archive;
+  const CObjectVector<CItemEx> *_items;
+  const UInt32 *_indices;
+  UInt32 _numItems;
+  UInt32 _nextItem;
+  unsigned _fillIndex;
+  unsigned _readIndex;
+  unsigned _readItem;
+  unsigned _numFilled;
+  size_t _memUsage;
+  size_t _memLimit;
+  size_t _itemSizeMax;
+
+  HRESULT FillThread(CExtractThread &t);
+  HRESULT Fill();
+public:
+  CObjectVector<CExtractThread> Threads;
+
+  void Create(CInArchive &archive, const CObjectVector<CItemEx> &items,
+      const UInt32 *indices, UInt32 numItems,
+      UInt32 numThreads, UInt64 memLimit
+      #ifdef Z7_EXTERNAL_CODECS
+      , const CExternalCodecs *externalCodecs
+      #endif
+      );
+  HRESULT GetNextItem(CMtItem *&mi);
+};
+
+
+void CMtExtract::Create(CInArchive &archive, const CObjectVector<CItemEx> &items,
+    const UInt32 *indices, UInt32 numItems,
+    UInt32 numThreads, UInt64 memLimit
+    #ifdef Z7_EXTERNAL_CODECS
+    , const CExternalCodecs *externalCodecs
+    #endif
+    )
+{
+  _archive = &archive;
+  _items = &items;
+  _indices = indices;
+  _numItems = numItems;
+  _nextItem = 0;
+  _fillIndex = 0;
+  _readIndex = 0;
+  _readItem = 0;
+  _numFilled = 0;
+  _memUsage = 0;
+
+  // the buffers of threads can use half of memory allowed for decompression
+  UInt64 limit = memLimit / 2;
+  if (limit > ((size_t)0 - 1) / 2)
+    limit = ((size_t)0 - 1) / 2;
+  _memLimit = (size_t)limit;
+  _itemSizeMax = kMtItemSizeMax;
+  if (_itemSizeMax > _memLimit)
+    _itemSizeMax = _memLimit;
+
+  if (numThreads > kMtNumThreadsMax)
+    numThreads = kMtNumThreadsMax;
+  for (UInt32 i = 0; i < numThreads; i++)
+  {
+    CExtractThread &t = Threads.AddNew();
+    t.Archive = &archive;
+    t.MemLimit = memLimit / numThreads;
+    #ifdef Z7_EXTERNAL_CODECS
+    t._externalCodecs = externalCodecs;
+    #endif
+    if (t.Create() != 0)
+    {
+      Threads.DeleteBack();
+      break;
+    }
+  }
+}
+
+
+HRESULT CMtExtract::FillThread(CExtractThread &t)
+{
+  t.Items.Clear();
+  t.NeedStart = false;
+  size_t packTotal = 0;
+  size_t unpackTotal = 0;
+
+  while (_nextItem < _numItems && t.Items.Size() < kMtBatchNumItemsMax)
+  {
+    const UInt32 index = _indices ? _indices[_nextItem] : _nextItem;
+    const CItemEx &item = (*_items)[index];
+
+    size_t need = 0;
+    if (item.PackSize < _itemSizeMax && item.Size < _itemSizeMax)
+      need = (size_t)item.PackSize + (size_t)item.Size + 1;
+    if (need > _itemSizeMax)
+      need = 0;
+    if (!t.Items.IsEmpty())
+    {
+      const size_t total = packTotal + unpackTotal;
+      if (total + need > kMtBatchSize || _memUsage + total + need > _memLimit)
+        break;
+    }
+    _nextItem++;
+
+    CMtItem &mi = t.Items.AddNew();
+    mi.Index = index;
+    mi.Item = item;
+    mi.IsAvail = true;
+    mi.HeadersError = false;
+    mi.Decoded = false;
+    mi.LocalResult = S_OK;
+    mi.IsLocalOffsetOK = _archive->IsLocalOffsetOK(mi.Item);
+    if (!mi.IsLocalOffsetOK)
+      continue;
+    if (!mi.Item.FromLocal)
+      mi.LocalResult = _archive->Read_LocalItem_After_CdItem(mi.Item, mi.IsAvail, mi.HeadersError);
+    if (mi.LocalResult != S_OK
+        || need == 0
+        || mi.Item.IsDir()
+        || mi.Item.IsEncrypted())
+      continue;
+    mi.Decoded = true;
+    mi.PackPos = packTotal;
+    mi.UnpackPos = unpackTotal;
+    packTotal += (size_t)mi.Item.PackSize;
+    unpackTotal += (size_t)mi.Item.Size + 1;
+  }
+
+  MtAllocBuf(t.PackBuf, packTotal);
+  MtAllocBuf(t.UnpackBuf, unpackTotal);
+  t.MemUsage = t.PackBuf.Size() + t.UnpackBuf.Size();
+
+  FOR_VECTOR (i, t.Items)
+  {
+    CMtItem &mi = t.Items[i];
+    if (!mi.Decoded)
+      continue;
+    // if there is some problem with reading, the main thread will decode that item
+    mi.Decoded = false;
+    CMyComPtr<ISequentialInStream> packStream;
+    if (_archive->GetItemStream(mi.Item, true, packStream) != S_OK || !packStream)
+      continue;
+    size_t size = (size_t)mi.Item.PackSize;
+    const HRESULT res = ReadStream(packStream, t.PackBuf + mi.PackPos, &size);
+    if (res != S_OK || size != mi.Item.PackSize)
+      continue;
+    mi.UnpackData = t.UnpackBuf + mi.UnpackPos;
+    mi.Decoded = true;
+    t.NeedStart = true;
+  }
+  return S_OK;
+}
+
+
+HRESULT CMtExtract::Fill()
+{
+  while (_numFilled < Threads.Size() && _nextItem < _numItems)
+  {
+    if (_numFilled != 0 && _memUsage >= _memLimit)
+      break;
+    CExtractThread &t = Threads[_fillIndex];
+    RINOK(FillThread(t))
+    _memUsage += t.MemUsage;
+    _numFilled++;
+    if (++_fillIndex == Threads.Size())
+      _fillIndex = 0;
+    if (t.NeedStart)
+    {
+      const WRes wres = t.Start();
+      if (wres != 0)
+        return HRESULT_FROM_WIN32(wres);
+      t.IsStarted = true;
+    }
+  }
+  return S_OK;
+}
+
+
+HRESULT CMtExtract::GetNextItem(CMtItem *&mi)
+{
+  mi = NULL;
+  for (;;)
+  {
+    if (_numFilled != 0)
+    {
+      CExtractThread &t = Threads[_readIndex];
+      if (_readItem < t.Items.Size())
+        break;
+      // all items of that thread were processed. So we can reuse the thread
+      _memUsage -= t.MemUsage;
+      _numFilled--;
+      _readItem = 0;
+      if (++_readIndex == Threads.Size())
+        _readIndex = 0;
+    }
+    RINOK(Fill())
+    if (_numFilled == 0)
+      return E_FAIL;
+  }
+  RINOK(Fill())
+  CExtractThread &t = Threads[_readIndex];
+  if (t.IsStarted)
+  {
+    t.IsStarted = false;
+    const WRes wres = t.WaitExecuteFinish();
+    if (wres != 0)
+      return HRESULT_FROM_WIN32(wres);
+  }
+  mi = &t.Items[_readItem++];
+  return S_OK;
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
 
 Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testMode, IArchiveExtractCallback *extractCallback))
@@ -1590,6 +1918,19 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   CMyComPtr2_Create<ICompressProgressInfo, CLocalProgress> lps;
   lps->Init(extractCallback, false);
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  CMtExtract mt;
+  if (_props._numThreads > 1 && numItems > 1)
+    mt.Create(m_Archive, m_Items, allFilesMode ? NULL : indices, numItems,
+        _props._numThreads, _props._memUsage_Decompress
+        #ifdef Z7_EXTERNAL_CODECS
+        , EXTERNAL_CODECS_VARS2
+        #endif
+        );
+  #endif
+  // **************** NanaZip Modification End ****************
+
   for (i = 0;; i++,
       lps->OutSize += cur_Unpacked,
       lps->InSize += cur_Packed)
@@ -1597,12 +1938,36 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     RINOK(lps->SetCur())
     if (i >= numItems)
       return S_OK;
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    CMtItem *mtItem = NULL;
+    if (!mt.Threads.IsEmpty())
+    {
+      RINOK(mt.GetNextItem(mtItem))
+    }
+    #endif
+    // **************** NanaZip Modification End ****************
     const UInt32 index = allFilesMode ? i : indices[i];
     CItemEx item = m_Items[index];
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    if (mtItem)
+      item = mtItem->Item;
+    #endif
+    // **************** NanaZip Modification End ****************
     cur_Unpacked = item.Size;
     cur_Packed = item.PackSize;
 
-    const bool isLocalOffsetOK = m_Archive.IsLocalOffsetOK(item);
+    // **************** NanaZip Modification Start ****************
+    // const bool isLocalOffsetOK = m_Archive.IsLocalOffsetOK(item);
+    bool isLocalOffsetOK;
+    #ifndef Z7_ST
+    if (mtItem)
+      isLocalOffsetOK = mtItem->IsLocalOffsetOK;
+    else
+    #endif
+      isLocalOffsetOK = m_Archive.IsLocalOffsetOK(item);
+    // **************** NanaZip Modification End ****************
     const bool skip = !isLocalOffsetOK && !item.IsDir();
     const Int32 askMode = skip ?
         NExtract::NAskMode::kSkip : testMode ?
@@ -1623,11 +1988,29 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     }
 
     bool headersError = false;
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    if (mtItem)
+      headersError = mtItem->HeadersError;
+    #endif
+    // **************** NanaZip Modification End ****************
     
     if (!item.FromLocal)
     {
       bool isAvail = true;
-      const HRESULT hres = m_Archive.Read_LocalItem_After_CdItem(item, isAvail, headersError);
+      // **************** NanaZip Modification Start ****************
+      // const HRESULT hres = m_Archive.Read_LocalItem_After_CdItem(item, isAvail, headersError);
+      HRESULT hres;
+      #ifndef Z7_ST
+      if (mtItem)
+      {
+        isAvail = mtItem->IsAvail;
+        hres = mtItem->LocalResult;
+      }
+      else
+      #endif
+        hres = m_Archive.Read_LocalItem_After_CdItem(item, isAvail, headersError);
+      // **************** NanaZip Modification End ****************
       if (hres == S_FALSE)
       {
         if (item.IsDir() || realOutStream || testMode)
@@ -1660,7 +2043,20 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
     RINOK(extractCallback->PrepareOperation(askMode))
 
-    const HRESULT hres = myDecoder.Decode(
+    // **************** NanaZip Modification Start ****************
+    HRESULT hres;
+    #ifndef Z7_ST
+    if (mtItem && mtItem->Decoded && mtItem->Result == S_OK)
+    {
+      opRes = mtItem->OpRes;
+      hres = S_OK;
+      if (realOutStream)
+        hres = WriteStream(realOutStream, mtItem->UnpackData, mtItem->UnpackSize);
+    }
+    else
+    #endif
+    // **************** NanaZip Modification End ****************
+    hres = myDecoder.Decode(
         EXTERNAL_CODECS_VARS
         m_Archive, item, realOutStream, extractCallback,
         lps,
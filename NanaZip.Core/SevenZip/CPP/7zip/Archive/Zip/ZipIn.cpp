@@ -161,6 +161,14 @@ struct CLocator
 
 void CInArchive::ClearRefs()
 {
+  // **************** NanaZip Modification Start ****************
+  if (_viewBuf)
+    InitBuf();
+  _viewRef.Release();
+  _view = NULL;
+  _viewSize = 0;
+  _viewStream = NULL;
+  // **************** NanaZip Modification End ****************
   StreamRef.Release();
   Stream = NULL;
   StartStream = NULL;
@@ -274,6 +282,96 @@ HRESULT CInArchive::AllocateBuffer(size_t size)
   return S_OK;
 }
 
+// **************** NanaZip Modification Start ****************
+
+// (k_View_BlockSize) must be larger than buffer size used in FindMarker()
+static const size_t k_View_BlockSize = (size_t)1 << 22;
+
+/* in mapped view mode (avail) can be large, but the search loops
+   must check the limits and report progress after each block */
+size_t CInArchive::GetAvail_Block() const
+{
+  const size_t avail = GetAvail();
+  return avail > k_View_BlockSize ? k_View_BlockSize : avail;
+}
+
+/* The access to mapped view raises EXCEPTION_IN_PAGE_ERROR, if the file data
+   can't be read (device error, or the volume was removed).
+   So the code that reads the view directly is called under SEH guard,
+   and such exception is converted to read error.
+   The code under guard must not use objects that require unwinding. */
+
+#if defined(_WIN32) && defined(_MSC_VER)
+#define Z7_ZIP_VIEW_SEH
+#endif
+
+#ifdef Z7_ZIP_VIEW_SEH
+
+static int View_ExceptionFilter(const EXCEPTION_POINTERS *ep, const Byte *view, size_t viewSize)
+{
+  const EXCEPTION_RECORD *r = ep->ExceptionRecord;
+  if (view
+      && r->ExceptionCode == EXCEPTION_IN_PAGE_ERROR
+      && r->NumberParameters >= 2)
+  {
+    // ExceptionInformation[1] is the address of inaccessible data
+    const Byte *p = (const Byte *)r->ExceptionInformation[1];
+    if (p >= view && (size_t)(p - view) < viewSize)
+      return EXCEPTION_EXECUTE_HANDLER;
+  }
+  return EXCEPTION_CONTINUE_SEARCH;
+}
+
+#define VIEW_TRY  __try
+#define VIEW_CATCH(ret) \
+  __except (View_ExceptionFilter(GetExceptionInformation(), _view, _viewSize)) \
+  { return ret; }
+
+static const HRESULT k_View_ReadError = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+
+#else
+
+static const HRESULT k_View_ReadError = E_FAIL;
+
+#endif
+
+bool CInArchive::CopyFromBuf(Byte *data, size_t size) const
+{
+ #ifdef Z7_ZIP_VIEW_SEH
+  if (_viewBuf)
+  {
+    VIEW_TRY
+    {
+      memcpy(data, _viewBuf + _bufPos, size);
+    }
+    VIEW_CATCH(false)
+    return true;
+  }
+ #endif
+  memcpy(data, GetBuf() + _bufPos, size);
+  return true;
+}
+
+/* View_Enter() switches the cache to mapped view at current virtual position,
+   if the view contains (minRequired) bytes from that position.
+   Otherwise it doesn't change the cache. */
+
+HRESULT CInArchive::View_Enter(size_t minRequired)
+{
+  if (!_view || _viewBuf || Stream != _viewStream)
+    return S_OK;
+  const UInt64 virtPos = GetVirtStreamPos();
+  if (virtPos >= _viewSize || minRequired > _viewSize - (size_t)virtPos)
+    return S_OK;
+  RINOK(Seek_SavePos(_viewSize))
+  _viewBuf = _view;
+  _bufPos = (size_t)virtPos;
+  _bufCached = _viewSize;
+  return S_OK;
+}
+
+// **************** NanaZip Modification End ****************
+
 // ---------- ReadFromCache ----------
 // reads from cache and from Stream
 // move to next volume can be allowed if (CanStartNewVol) and only before first byte reading
@@ -295,7 +393,13 @@ HRESULT CInArchive::ReadFromCache(Byte *data, unsigned size, unsigned &processed
       unsigned cur = size;
       if (cur > avail)
         cur = (unsigned)avail;
-      memcpy(data, (const Byte *)Buffer + _bufPos, cur);
+      // **************** NanaZip Modification Start ****************
+      if (!CopyFromBuf(data, cur))
+      {
+        result = k_View_ReadError;
+        break;
+      }
+      // **************** NanaZip Modification End ****************
 
       data += cur;
       size -= cur;
@@ -313,6 +417,13 @@ HRESULT CInArchive::ReadFromCache(Byte *data, unsigned size, unsigned &processed
 
     if (_inBufMode)
     {
+      // **************** NanaZip Modification Start ****************
+      result = View_Enter(1);
+      if (result != S_OK)
+        break;
+      if (_viewBuf)
+        continue;
+      // **************** NanaZip Modification End ****************
       UInt32 cur = 0;
       result = Stream->Read(Buffer, (UInt32)Buffer.Size(), &cur);
       _bufPos = 0;
@@ -614,7 +725,24 @@ returns:
   Error code: stream reading error.
 */
 
+// **************** NanaZip Modification Start ****************
 HRESULT CInArchive::FindMarker(const UInt64 *searchLimit)
+{
+ #ifdef Z7_ZIP_VIEW_SEH
+  VIEW_TRY
+  {
+    return FindMarker2(searchLimit);
+  }
+  VIEW_CATCH(k_View_ReadError)
+ #else
+  return FindMarker2(searchLimit);
+ #endif
+}
+
+// FindMarker2() is called under SEH guard. So it must not use objects that require unwinding.
+
+HRESULT CInArchive::FindMarker2(const UInt64 *searchLimit)
+// **************** NanaZip Modification End ****************
 {
   ArcInfo.MarkerPos = GetVirtStreamPos();
   ArcInfo.MarkerPos2 = ArcInfo.MarkerPos;
@@ -667,7 +795,9 @@ HRESULT CInArchive::FindMarker(const UInt64 *searchLimit)
   {
     RINOK(LookAhead(kBufSize))
     
-    const size_t avail = GetAvail();
+    // **************** NanaZip Modification Start ****************
+    const size_t avail = GetAvail_Block();
+    // **************** NanaZip Modification End ****************
     
     size_t limitPos;
     // (avail > kBufSize) is possible, if (Buffer.Size() > kBufSize)
@@ -715,7 +845,9 @@ HRESULT CInArchive::FindMarker(const UInt64 *searchLimit)
     if (limitPos == 0)
       break;
 
-    const Byte * const pStart = Buffer + _bufPos;
+    // **************** NanaZip Modification Start ****************
+    const Byte * const pStart = GetBuf() + _bufPos;
+    // **************** NanaZip Modification End ****************
     const Byte * p = pStart;
     const Byte * const limit = pStart + limitPos;
    
@@ -892,6 +1024,22 @@ HRESULT CInArchive::LookAhead(size_t minRequired)
 
     if (minRequired <= avail)
       return S_OK;
+
+    // **************** NanaZip Modification Start ****************
+    if (_viewBuf)
+    {
+      // the view doesn't contain required data. So we return to Buffer.
+      const UInt64 virtPos = GetVirtStreamPos();
+      InitBuf();
+      RINOK(Seek_SavePos(virtPos))
+    }
+    else
+    {
+      RINOK(View_Enter(minRequired))
+      if (_viewBuf)
+        continue;
+    }
+    // **************** NanaZip Modification End ****************
     
     if (_bufPos != 0)
     {
@@ -1459,7 +1607,24 @@ exceptions :
   CSystemException() : stream reading error
 */
 
+// **************** NanaZip Modification Start ****************
 HRESULT CInArchive::FindDescriptor(CItemEx &item, unsigned numFiles)
+{
+ #ifdef Z7_ZIP_VIEW_SEH
+  VIEW_TRY
+  {
+    return FindDescriptor2(item, numFiles);
+  }
+  VIEW_CATCH(k_View_ReadError)
+ #else
+  return FindDescriptor2(item, numFiles);
+ #endif
+}
+
+// FindDescriptor2() is called under SEH guard. So it must not use objects that require unwinding.
+
+HRESULT CInArchive::FindDescriptor2(CItemEx &item, unsigned numFiles)
+// **************** NanaZip Modification End ****************
 {
   // const size_t kBufSize = (size_t)1 << 5; // don't increase it too much. It reads data look ahead.
 
@@ -1486,7 +1651,9 @@ HRESULT CInArchive::FindDescriptor(CItemEx &item, unsigned numFiles)
     // size_t processedSize;
     CanStartNewVol = true;
     RINOK(LookAhead(descriptorSize4))
-    const size_t avail = GetAvail();
+    // **************** NanaZip Modification Start ****************
+    const size_t avail = GetAvail_Block();
+    // **************** NanaZip Modification End ****************
     
     if (avail < descriptorSize4)
     {
@@ -1500,7 +1667,9 @@ HRESULT CInArchive::FindDescriptor(CItemEx &item, unsigned numFiles)
       return S_OK;
     }
 
-    const Byte * const pStart = Buffer + _bufPos;
+    // **************** NanaZip Modification Start ****************
+    const Byte * const pStart = GetBuf() + _bufPos;
+    // **************** NanaZip Modification End ****************
     const Byte * p = pStart;
     const Byte * const limit = pStart + (avail - descriptorSize4);
     
@@ -3261,6 +3430,27 @@ HRESULT CInArchive::Open(IInStream *stream, const UInt64 *searchLimit,
   Callback = callback;
 
   DisableBufMode();
+
+  // **************** NanaZip Modification Start ****************
+  {
+    CMyComPtr<IStreamGetMappedView> getView;
+    stream->QueryInterface(IID_IStreamGetMappedView, (void **)&getView);
+    if (getView)
+    {
+      const Byte *view = NULL;
+      UInt64 viewSize = 0;
+      if (getView->GetMappedView(&view, &viewSize) == S_OK
+          && view
+          && viewSize == (size_t)viewSize)
+      {
+        _viewRef = getView;
+        _view = view;
+        _viewSize = (size_t)viewSize;
+        _viewStream = stream;
+      }
+    }
+  }
+  // **************** NanaZip Modification End ****************
   
   bool volWasRequested = false;
 
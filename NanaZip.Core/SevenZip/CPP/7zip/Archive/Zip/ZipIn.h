@@ -249,6 +249,24 @@ class CInArchive
   size_t _bufPos;
   size_t _bufCached;
 
+  // **************** NanaZip Modification Start ****************
+  /* if (StartStream) supports IStreamGetMappedView, we use the mapped view
+     of stream as cache instead of (Buffer). In that mode:
+       (_viewBuf == _view), (_bufCached == _viewSize), (_streamPos == _viewSize)
+     and (_bufPos) is the virtual position in stream.
+     So the headers are parsed directly from the mapping without Read() calls. */
+  const Byte *_viewBuf;
+  const Byte *_view;
+  size_t _viewSize;
+  IInStream *_viewStream;
+  CMyComPtr<IStreamGetMappedView> _viewRef;
+
+  const Byte *GetBuf() const { return _viewBuf ? _viewBuf : (const Byte *)Buffer; }
+  bool CopyFromBuf(Byte *data, size_t size) const;
+  size_t GetAvail_Block() const;
+  HRESULT View_Enter(size_t minRequired);
+  // **************** NanaZip Modification End ****************
+
   UInt64 _streamPos;
   UInt64 _cnt;
 
@@ -257,7 +275,9 @@ class CInArchive
 
   size_t GetAvail() const { return _bufCached - _bufPos; }
 
-  void InitBuf() { _bufPos = 0; _bufCached = 0; }
+  // **************** NanaZip Modification Start ****************
+  void InitBuf() { _bufPos = 0; _bufCached = 0; _viewBuf = NULL; }
+  // **************** NanaZip Modification End ****************
   void DisableBufMode() { InitBuf(); _inBufMode = false; }
 
   void SkipLookahed(size_t skip)
@@ -293,6 +313,9 @@ class CInArchive
   HRESULT ReadVols();
 
   HRESULT FindMarker(const UInt64 *searchLimit);
+  // **************** NanaZip Modification Start ****************
+  HRESULT FindMarker2(const UInt64 *searchLimit);
+  // **************** NanaZip Modification End ****************
   HRESULT IncreaseRealPosition(UInt64 addValue, bool &isFinished);
 
   HRESULT LookAhead(size_t minRequiredInBuffer);
@@ -314,6 +337,9 @@ class CInArchive
       UInt64 &unpackSize, UInt64 &packSize, CItem *cdItem);
   bool ReadLocalItem(CItemEx &item);
   HRESULT FindDescriptor(CItemEx &item, unsigned numFiles);
+  // **************** NanaZip Modification Start ****************
+  HRESULT FindDescriptor2(CItemEx &item, unsigned numFiles);
+  // **************** NanaZip Modification End ****************
   HRESULT ReadCdItem(CItemEx &item);
   HRESULT TryEcd64(UInt64 offset, CCdInfo &cdInfo);
   HRESULT FindCd(bool checkOffsetMode);
@@ -358,6 +384,12 @@ public:
   bool Disable_FindMarker;
  
   CInArchive():
+      // **************** NanaZip Modification Start ****************
+      _viewBuf(NULL),
+      _view(NULL),
+      _viewSize(0),
+      _viewStream(NULL),
+      // **************** NanaZip Modification End ****************
       IsArcOpen(false),
       Stream(NULL),
       StartStream(NULL),
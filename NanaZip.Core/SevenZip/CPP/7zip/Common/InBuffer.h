@@ -50,6 +50,11 @@ public:
 
   bool WasFinished() const { return _wasFinished; }
 
+  // **************** NanaZip Modification Start ****************
+  // it sets the position of current buffer in real stream after Init()
+  void Set_ProcessedSize_Base(UInt64 processedSize) { _processedSize = processedSize; }
+  // **************** NanaZip Modification End ****************
+
   void SetStream(ISequentialInStream *stream) { _stream = stream; }
   void ClearStreamPtr() { _stream = NULL; }
   
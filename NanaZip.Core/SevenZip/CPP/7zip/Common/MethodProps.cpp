@@ -594,8 +594,11 @@ static const CNameToPropID g_NameToPropID[] =
   { VT_UI4, "ldmslen" },
   { VT_UI4, "ldmblog" },
   { VT_UI4, "ldmhevery" },
-  { VT_BOOL, "max" }
+  { VT_BOOL, "max" },
   // **************** 7-Zip ZS Modification End ****************
+  // **************** NanaZip Modification Start ****************
+  { VT_BSTR, "dict" }
+  // **************** NanaZip Modification End ****************
 };
 
 /*
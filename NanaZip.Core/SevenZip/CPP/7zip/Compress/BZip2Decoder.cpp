@@ -24,6 +24,11 @@
 #include "../../../C/Alloc.h"
 
 #include "../Common/StreamUtils.h"
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../Common/VirtThread.h"
+#endif
+// **************** NanaZip Modification End ****************
 
 #include "BZip2Decoder.h"
 
@@ -809,6 +814,157 @@ Byte * CSpecState::Decode(Byte *data, size_t size) throw()
 }
 
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+// the maximum size of compressed block:
+// (kMaxHuffmanLen) bits for each symbol, and the block headers
+static const size_t kBlockPackSizeMax =
+    ((size_t)kNumSelectorsMax * kGroupSize * kMaxHuffmanLen >> 3) + ((size_t)1 << 16);
+
+static const size_t kMtOutBufSizeStart = (size_t)1 << 20;
+/* the output of RLE stage can be up to 50 times larger than block.
+   The thread doesn't decode the block that needs larger buffer,
+   and the sequential decoder decodes such block. */
+static const size_t kMtOutBufSizeMax = (size_t)1 << 23;
+
+static const UInt64 kBlockSigValue =
+    ((UInt64)kBlockSig0 << 40) | ((UInt64)kBlockSig1 << 32) | ((UInt32)kBlockSig2 << 24) |
+    ((UInt32)kBlockSig3 << 16) | ((UInt32)kBlockSig4 << 8) | kBlockSig5;
+
+class CMtBlockThread Z7_final: public CVirtThread
+{
+  bool Decode();
+public:
+  CBase Base;
+  UInt32 *Counters;
+  Byte *InBuf;
+  size_t InSize;
+  UInt64 StartBit;
+
+  bool Ok;
+  UInt64 EndBit;
+  CBlockProps Props;
+  UInt32 Crc;
+  UInt32 CalcedCrc;
+  Byte *OutBuf;
+  size_t OutBufSize;
+  size_t OutSize;
+
+  CMtBlockThread():
+      Counters(NULL),
+      InBuf(NULL),
+      Ok(false),
+      OutBuf(NULL),
+      OutBufSize(0),
+      OutSize(0)
+      {}
+  ~CMtBlockThread() Z7_DESTRUCTOR_override
+  {
+    CVirtThread::WaitThreadFinish();
+    BigFree(Counters);
+    MidFree(InBuf);
+    MidFree(OutBuf);
+  }
+  bool Alloc();
+  void Execute() Z7_override { Ok = Decode(); }
+};
+
+
+bool CMtBlockThread::Alloc()
+{
+  if (!Counters)
+  {
+    const size_t size = (256 + kBlockSizeMax) * sizeof(UInt32) + kBlockSizeMax + 256;
+    Counters = (UInt32 *)::BigAlloc(size);
+    if (!Counters)
+      return false;
+    Base.Counters = Counters;
+  }
+  if (!InBuf)
+  {
+    InBuf = (Byte *)MidAlloc(kBlockPackSizeMax);
+    if (!InBuf)
+      return false;
+  }
+  if (!OutBuf)
+  {
+    OutBuf = (Byte *)MidAlloc(kMtOutBufSizeStart);
+    if (!OutBuf)
+      return false;
+    OutBufSize = kMtOutBufSizeStart;
+  }
+  return true;
+}
+
+
+bool CMtBlockThread::Decode()
+{
+  const Byte *p = InBuf;
+  Base.InitBitDecoder();
+  {
+    const unsigned numBits = (unsigned)StartBit & 7;
+    if (numBits != 0)
+    {
+      Base._value = (UInt32)*p++ << (24 + numBits);
+      Base._numBits = 8 - numBits;
+    }
+  }
+  Base._buf = p;
+  Base._lim = InBuf + InSize;
+
+  Base.state = STATE_BLOCK_SIGNATURE;
+  Base.state2 = 0;
+  Base.IsBz = true;
+  // the caller checks the block size for (blockSizeMax) of real stream
+  Base.blockSizeMax = kBlockSizeMax;
+  
+  if (Base.ReadBlockSignature2() != SZ_OK || Base.state != STATE_BLOCK_START)
+    return false;
+  Crc = Base.crc;
+  
+  Base.Props.randMode = 1;
+  if (Base.ReadBlock2() != SZ_OK || Base.state != STATE_BLOCK_SIGNATURE)
+    return false;
+  Props = Base.Props;
+  EndBit = (((StartBit >> 3) + (size_t)(Base._buf - InBuf)) << 3) - Base._numBits;
+
+  DecodeBlock1(Counters, Props.blockSize);
+
+  CSpecState block;
+  block._blockSize = Props.blockSize;
+  block._tt = Counters + 256;
+  block.Init(Props.origPtr, Props.randMode);
+
+  OutSize = 0;
+  for (;;)
+  {
+    if (OutSize == OutBufSize)
+    {
+      // the output of RLE stage can be larger than block
+      if (OutBufSize >= kMtOutBufSizeMax)
+        return false;
+      const size_t newSize = OutBufSize * 2;
+      Byte *newBuf = (Byte *)MidAlloc(newSize);
+      if (!newBuf)
+        return false;
+      memcpy(newBuf, OutBuf, OutSize);
+      MidFree(OutBuf);
+      OutBuf = newBuf;
+      OutBufSize = newSize;
+    }
+    OutSize = (size_t)(block.Decode(OutBuf + OutSize, OutBufSize - OutSize) - OutBuf);
+    if (block.Finished())
+      break;
+  }
+  CalcedCrc = block._crc.GetDigest();
+  return true;
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
+
 HRESULT CDecoder::Flush()
 {
   if (_writeRes == S_OK)
@@ -883,6 +1039,18 @@ CDecoder::CDecoder():
   #ifndef Z7_ST
   MtMode = false;
   NeedWaitScout = false;
+  // **************** NanaZip Modification Start ****************
+  _numThreads = 1;
+  _memUsage = (UInt64)(sizeof(size_t)) << 28;
+  _mtBlockMode = false;
+  _mtJobsStart = 0;
+  _mtJobsEnd = 0;
+  _mtBuf = NULL;
+  _mtBufSize = 0;
+  _mtBufOffset = 0;
+  _mtPos = 0;
+  _mtLim = 0;
+  // **************** NanaZip Modification End ****************
   // ScoutRes = S_OK;
   #endif
 }
@@ -909,6 +1077,12 @@ CDecoder::~CDecoder()
 
     // if (ScoutRes != S_OK) throw ScoutRes;
   }
+
+  // **************** NanaZip Modification Start ****************
+  MtWaitThreads();
+  _mtThreads.Clear();
+  MidFree(_mtBuf);
+  // **************** NanaZip Modification End ****************
   
   #endif
 
@@ -927,6 +1101,13 @@ HRESULT CDecoder::ReadInput()
   Base._buf = _inBuf;
   Base._lim = _inBuf;
   UInt32 size = 0;
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (_mtBlockMode)
+    _inputRes = MtRead(_inBuf, kInBufSize, size);
+  else
+  #endif
+  // **************** NanaZip Modification End ****************
   _inputRes = Base.InStream->Read(_inBuf, kInBufSize, &size);
   _inputFinished = (size == 0);
   Base._lim = _inBuf + size;
@@ -1302,7 +1483,27 @@ Z7_COM7F_IMF(CDecoder::Code(ISequentialInStream *inStream, ISequentialOutStream
   _outWritten = 0;
   _outPos = 0;
 
-  HRESULT res = DecodeStreams(progress);
+  // **************** NanaZip Modification Start ****************
+  // HRESULT res = DecodeStreams(progress);
+  HRESULT res;
+
+  #ifndef Z7_ST
+  _mtBlockMode = false;
+  _mtPos = 0;
+  _mtLim = 0;
+  if (MtMode && _numThreads > 2 && MtCreateThreads())
+  {
+    _mtBlockMode = true;
+    _mtBufOffset = 0;
+    _mtInputFinished = false;
+    _mtInputRes = S_OK;
+    res = DecodeStreams_Mt(progress);
+    MtWaitThreads();
+  }
+  else
+  #endif
+    res = DecodeStreams(progress);
+  // **************** NanaZip Modification End ****************
 
   Flush();
 
@@ -1350,6 +1551,20 @@ Z7_COM7F_IMF(CDecoder::ReadUnusedFromInBuf(void *data, UInt32 size, UInt32 *proc
       break;
     ((Byte *)data)[i] = (Byte)b;
   }
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  // the data that was read ahead for block-parallel mode
+  if (i < size && _mtBlockMode)
+  {
+    size_t rem = _mtLim - _mtPos;
+    if (rem > size - i)
+      rem = size - i;
+    memcpy((Byte *)data + i, _mtBuf + _mtPos, rem);
+    _mtPos += rem;
+    i += (UInt32)rem;
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
   if (processedSize)
     *processedSize = i;
   return S_OK;
@@ -1502,9 +1717,358 @@ void CDecoder::RunScout()
 }
 
 
+// **************** NanaZip Modification Start ****************
+bool CDecoder::MtCreateThreads()
+{
+  /* each thread uses the buffers for counters, input block and output data
+     (the output buffer can grow to (kMtOutBufSizeMax) for blocks with long runs,
+     and the old buffer is freed after copying to new buffer),
+     and the read-ahead buffer (_mtBuf) keeps one input block for each thread
+     and two additional blocks. */
+  const UInt64 kMemPerThread =
+      (UInt64)(256 + kBlockSizeMax) * sizeof(UInt32) + kBlockSizeMax + 256
+      + kBlockPackSizeMax * 2 + kMtOutBufSizeMax + kMtOutBufSizeMax / 2;
+  const UInt64 kMemBase = (UInt64)kBlockPackSizeMax * 2;
+  UInt64 numWorkers64 = _numThreads;
+  if (_memUsage <= kMemBase)
+    return false;
+  if (numWorkers64 > (_memUsage - kMemBase) / kMemPerThread)
+    numWorkers64 = (_memUsage - kMemBase) / kMemPerThread;
+  if (numWorkers64 < 2)
+    return false;
+  const unsigned numWorkers = (unsigned)numWorkers64;
+  
+  if (_mtThreads.Size() > numWorkers)
+    _mtThreads.Clear();
+  while (_mtThreads.Size() < numWorkers)
+  {
+    CMtBlockThread &t = _mtThreads.AddNew();
+    if (!t.Alloc() || t.Create() != 0)
+    {
+      _mtThreads.DeleteBack();
+      break;
+    }
+  }
+  if (_mtThreads.Size() < 2)
+    return false;
+
+  const size_t bufSize = ((size_t)_mtThreads.Size() + 2) * kBlockPackSizeMax;
+  if (!_mtBuf || _mtBufSize != bufSize)
+  {
+    MidFree(_mtBuf);
+    _mtBufSize = 0;
+    _mtBuf = (Byte *)MidAlloc(bufSize);
+    if (!_mtBuf)
+      return false;
+    _mtBufSize = bufSize;
+  }
+  return true;
+}
+
+
+void CDecoder::MtWaitThreads()
+{
+  for (; _mtJobsStart < _mtJobsEnd; _mtJobsStart++)
+    _mtThreads[(unsigned)(_mtJobsStart % _mtThreads.Size())].WaitExecuteFinish();
+}
+
+
+void CDecoder::MtReadAhead()
+{
+  if (_mtInputFinished || _mtInputRes != S_OK)
+    return;
+  {
+    // the data in (_inBuf) is kept in (_mtBuf) also for threads
+    const size_t keep = (size_t)(_inProcessed - _mtBufOffset);
+    if (keep != 0)
+    {
+      memmove(_mtBuf, _mtBuf + keep, _mtLim - keep);
+      _mtBufOffset += keep;
+      _mtPos -= keep;
+      _mtLim -= keep;
+    }
+  }
+  size_t size = _mtBufSize - _mtLim;
+  if (size == 0)
+    return;
+  _mtInputRes = ReadStream(Base.InStream, _mtBuf + _mtLim, &size);
+  _mtLim += size;
+  if (size == 0)
+    _mtInputFinished = true;
+}
+
+
+HRESULT CDecoder::MtRead(Byte *data, UInt32 size, UInt32 &processed)
+{
+  processed = 0;
+  if (_mtPos == _mtLim)
+    MtReadAhead();
+  size_t rem = _mtLim - _mtPos;
+  if (rem == 0)
+    return _mtInputRes;
+  if (rem > size)
+    rem = size;
+  memcpy(data, _mtBuf + _mtPos, rem);
+  _mtPos += rem;
+  processed = (UInt32)rem;
+  return S_OK;
+}
+
+
+void CDecoder::MtScan()
+{
+  if (_mtScanPos < _mtBufOffset)
+  {
+    _mtScanPos = _mtBufOffset;
+    _mtScanMin = _mtBufOffset << 3;
+    _mtScanValue = 0;
+  }
+  
+  /* the signature at any bit position covers bits [16, 24) of (v).
+     So we check full signature only for (8) possible values of that byte. */
+  Byte isSigByte[256];
+  memset(isSigByte, 0, sizeof(isSigByte));
+  {
+    for (unsigned k = 0; k < 8; k++)
+      isSigByte[(unsigned)(kBlockSigValue >> (16 - k)) & 0xFF] = 1;
+  }
+
+  const Byte *p = _mtBuf + (size_t)(_mtScanPos - _mtBufOffset);
+  const Byte *lim = _mtBuf + _mtLim;
+  UInt64 v = _mtScanValue;
+  
+  for (; p != lim; p++)
+  {
+    v = (v << 8) | *p;
+    if (!isSigByte[(unsigned)(v >> 16) & 0xFF])
+      continue;
+    for (unsigned k = 8; k != 0;)
+    {
+      k--;
+      if (((v >> k) & (((UInt64)1 << 48) - 1)) == kBlockSigValue)
+      {
+        const UInt64 endBit = ((_mtBufOffset + (size_t)(p - _mtBuf)) << 3) + 8 - k;
+        if (endBit >= 48 && endBit - 48 >= _mtScanMin)
+          _mtSigs.Add(endBit - 48);
+      }
+    }
+  }
+  
+  _mtScanValue = v;
+  _mtScanPos = _mtBufOffset + _mtLim;
+}
+
+
+void CDecoder::MtStartJobs(UInt64 bitPos)
+{
+  const unsigned numWorkers = _mtThreads.Size();
+  unsigned numSigs = 0;
+  
+  for (; numSigs < _mtSigs.Size(); numSigs++)
+  {
+    const UInt64 sigPos = _mtSigs[numSigs];
+    if (sigPos < bitPos)
+      continue;
+    if (_mtJobsEnd - _mtJobsStart >= numWorkers)
+      break;
+    const UInt64 pos = sigPos >> 3;
+    if (pos < _mtBufOffset)
+      continue;
+    size_t size = (size_t)(_mtBufOffset + _mtLim - pos);
+    if (size >= kBlockPackSizeMax)
+      size = kBlockPackSizeMax;
+    else if (!_mtInputFinished && _mtInputRes == S_OK)
+      break;
+    if (size == 0)
+      continue;
+    CMtBlockThread &t = _mtThreads[(unsigned)(_mtJobsEnd % numWorkers)];
+    memcpy(t.InBuf, _mtBuf + (size_t)(pos - _mtBufOffset), size);
+    t.InSize = size;
+    t.StartBit = sigPos;
+    if (t.Start() != 0)
+      break;
+    _mtJobsEnd++;
+  }
+  
+  _mtSigs.DeleteFrontal(numSigs);
+}
+
+
+CMtBlockThread *CDecoder::MtGetBlock(UInt64 bitPos)
+{
+  while (_mtJobsStart != _mtJobsEnd)
+  {
+    CMtBlockThread &t = _mtThreads[(unsigned)(_mtJobsStart % _mtThreads.Size())];
+    if (t.StartBit > bitPos)
+      break;
+    t.WaitExecuteFinish();
+    _mtJobsStart++;
+    // the results for signatures inside previous blocks are skipped
+    if (t.StartBit == bitPos)
+      return t.Ok ? &t : NULL;
+  }
+  return NULL;
+}
+
+
+HRESULT CDecoder::MtSkipInput(UInt64 bitPos)
+{
+  const UInt64 pos = bitPos >> 3;
+  if (pos < _inProcessed + (size_t)(Base._lim - _inBuf))
+    Base._buf = _inBuf + (size_t)(pos - _inProcessed);
+  else
+  {
+    if (pos > _mtBufOffset + _mtLim)
+      return E_FAIL;
+    _mtPos = (size_t)(pos - _mtBufOffset);
+    _inProcessed = pos;
+    Base._buf = _inBuf;
+    Base._lim = _inBuf;
+  }
+  Base.InitBitDecoder();
+  const unsigned numBits = (unsigned)bitPos & 7;
+  if (numBits != 0)
+  {
+    RINOK(ReadInput())
+    if (Base._buf == Base._lim)
+      return E_FAIL;
+    Base._value = (UInt32)*Base._buf++ << (24 + numBits);
+    Base._numBits = 8 - numBits;
+  }
+  return S_OK;
+}
+
+
+HRESULT CDecoder::DecodeStreams_Mt(ICompressProgressInfo *progress)
+{
+  MtWaitThreads();
+  _mtJobsStart = 0;
+  _mtJobsEnd = 0;
+  _mtSigs.Clear();
+  _mtScanPos = 0;
+  _mtScanMin = 0;
+  _mtScanValue = 0;
+
+  RINOK(StartRead())
+
+  UInt64 inPrev = 0;
+  UInt64 outPrev = 0;
+
+  /* we use same order of operations as in DecodeStreams():
+     the signature of next block is read before the data of current block is written. */
+
+  const CMtBlockThread *block = NULL;
+  CBlockProps props;
+  UInt32 crc = 0;
+
+  for (;;)
+  {
+    const UInt64 packPos = GetInputProcessedSize();
+    if (progress)
+    {
+      const UInt64 outCur = GetOutProcessedSize();
+      if (packPos - inPrev >= kProgressStep || outCur - outPrev >= kProgressStep)
+      {
+        RINOK(progress->SetRatioInfo(&packPos, &outCur))
+        inPrev = packPos;
+        outPrev = outCur;
+      }
+    }
+
+    if (Base.state != STATE_BLOCK_SIGNATURE)
+      return E_FAIL;
+
+    const UInt64 sigPos = GetInputBitPos();
+    bool wasFinished = false;
+    HRESULT nextRes = ReadBlockSignature();
+    const UInt32 nextCrc = Base.crc;
+
+    if (nextRes == S_OK && Base.state == STATE_STREAM_FINISHED)
+    {
+      wasFinished = true;
+      if (Base.DecodeAllStreams)
+      {
+        nextRes = StartRead();
+        if (Base.NeedMoreInput)
+        {
+          if (Base.state2 == 0)
+            Base.NeedMoreInput = false;
+          nextRes = S_OK;
+        }
+        else if (nextRes == S_OK)
+          wasFinished = false;
+      }
+    }
+
+    if (block)
+    {
+      RINOK(Flush())
+      _writeRes = WriteStream(_outStream, block->OutBuf, block->OutSize);
+      _outWritten += block->OutSize;
+      _outPosTotal += block->OutSize;
+      RINOK(_writeRes)
+      const UInt32 calcedCrc = block->CalcedCrc;
+      block = NULL;
+      if (calcedCrc != crc)
+      {
+        BlockCrcError = true;
+        return S_FALSE;
+      }
+    }
+    else if (props.blockSize != 0)
+    {
+      DecodeBlock1(_counters, props.blockSize);
+      RINOK(DecodeBlock(props))
+      if (!_blockFinished)
+        return nextRes;
+      props.blockSize = 0;
+      if (_calcedBlockCrc != crc)
+      {
+        BlockCrcError = true;
+        return S_FALSE;
+      }
+    }
+
+    if (wasFinished || nextRes != S_OK)
+      return nextRes;
+    if (Base.state != STATE_BLOCK_START)
+      continue;
+
+    crc = nextCrc;
+
+    if (_mtLim - _mtPos < _mtBufSize / 2)
+      MtReadAhead();
+    MtScan();
+    MtStartJobs(sigPos);
+    
+    const CMtBlockThread *t = MtGetBlock(sigPos);
+    
+    if (t
+        && t->Props.blockSize <= Base.blockSizeMax
+        && (!_outSizeDefined || t->OutSize <= _outSize - _outPosTotal))
+    {
+      RINOK(MtSkipInput(t->EndBit))
+      // it's same state as after ReadBlock2()
+      Base.state = STATE_BLOCK_SIGNATURE;
+      Base.state2 = 0;
+      block = t;
+      continue;
+    }
+
+    Base.Props.randMode = 1;
+    RINOK(ReadBlock())
+    props = Base.Props;
+  }
+}
+// **************** NanaZip Modification End ****************
+
+
 Z7_COM7F_IMF(CDecoder::SetNumberOfThreads(UInt32 numThreads))
 {
   MtMode = (numThreads > 1);
+  // **************** NanaZip Modification Start ****************
+  _numThreads = numThreads;
+  // **************** NanaZip Modification End ****************
 
   #ifndef BZIP2_BYTE_MODE
   MtMode = false;
@@ -1514,6 +2078,14 @@ Z7_COM7F_IMF(CDecoder::SetNumberOfThreads(UInt32 numThreads))
   return S_OK;
 }
 
+// **************** NanaZip Modification Start ****************
+Z7_COM7F_IMF(CDecoder::SetMemLimit(UInt64 memUsage))
+{
+  _memUsage = memUsage;
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
+
 #endif
 
 
@@ -1523,6 +2095,11 @@ Z7_COM7F_IMF(CDecoder::SetNumberOfThreads(UInt32 numThreads))
 
 Z7_COM7F_IMF(CDecoder::SetInStream(ISequentialInStream *inStream))
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  _mtBlockMode = false;
+  #endif
+  // **************** NanaZip Modification End ****************
   Base.InStreamRef = inStream;
   Base.InStream = inStream;
   return S_OK;
@@ -9,6 +9,9 @@
 // #define Z7_ST
 
 #ifndef Z7_ST
+// **************** NanaZip Modification Start ****************
+#include "../../Common/MyVector.h"
+// **************** NanaZip Modification End ****************
 #include "../../Windows/Synchronization.h"
 #include "../../Windows/Thread.h"
 #endif
@@ -193,6 +196,12 @@ public:
 
   
  
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+class CMtBlockThread;
+#endif
+// **************** NanaZip Modification End ****************
+
 class CDecoder:
   public ICompressCoder,
   public ICompressSetFinishMode,
@@ -205,6 +214,9 @@ class CDecoder:
 #endif
 #ifndef Z7_ST
   public ICompressSetCoderMt,
+  // **************** NanaZip Modification Start ****************
+  public ICompressSetMemLimit,
+  // **************** NanaZip Modification End ****************
 #endif
   public CMyUnknownImp
 {
@@ -219,6 +231,9 @@ class CDecoder:
 #endif
 #ifndef Z7_ST
   Z7_COM_QI_ENTRY(ICompressSetCoderMt)
+  // **************** NanaZip Modification Start ****************
+  Z7_COM_QI_ENTRY(ICompressSetMemLimit)
+  // **************** NanaZip Modification End ****************
 #endif
   Z7_COM_QI_END
   Z7_COM_ADDREF_RELEASE
@@ -235,6 +250,9 @@ class CDecoder:
 public:
 #ifndef Z7_ST
   Z7_IFACE_COM7_IMP(ICompressSetCoderMt)
+  // **************** NanaZip Modification Start ****************
+  Z7_IFACE_COM7_IMP(ICompressSetMemLimit)
+  // **************** NanaZip Modification End ****************
 #endif
 
 private:
@@ -313,6 +331,53 @@ public:
 
   HRESULT CreateThread();
 
+  // **************** NanaZip Modification Start ****************
+  /*
+  Block-parallel mode (numThreads > 2):
+    - the caller thread reads the input stream ahead to (_mtBuf),
+      and it searches the block signatures (48-bit, not byte aligned) there.
+    - the thread for each found signature decodes that block
+      (Huffman, BWT and RLE) to own output buffer.
+    - the sequential decoder in the caller thread uses the block decoded
+      by thread only if the start of that block is same as the current
+      position in sequential decoder. Otherwise (the signature that was found
+      inside the data of another block) it skips that result,
+      and it decodes the data sequentially.
+  So the output data and the processed sizes are same as in sequential decoding.
+  */
+
+  UInt32 _numThreads;
+  UInt64 _memUsage;
+  bool _mtBlockMode;
+
+  CObjectVector<CMtBlockThread> _mtThreads;
+  UInt64 _mtJobsStart; // index of first job that was not collected
+  UInt64 _mtJobsEnd;
+
+  Byte *_mtBuf;
+  size_t _mtBufSize;
+  UInt64 _mtBufOffset; // offset of (_mtBuf[0]) in input stream
+  size_t _mtPos;       // (_mtBuf) position of data that was not sent to (_inBuf)
+  size_t _mtLim;
+  bool _mtInputFinished;
+  HRESULT _mtInputRes;
+
+  UInt64 _mtScanPos;   // offset of next byte for block signature search
+  UInt64 _mtScanMin;   // minimal bit position of signature
+  UInt64 _mtScanValue;
+  CRecordVector<UInt64> _mtSigs; // bit positions of found block signatures
+
+  bool MtCreateThreads();
+  void MtWaitThreads();
+  void MtReadAhead();
+  HRESULT MtRead(Byte *data, UInt32 size, UInt32 &processed);
+  void MtScan();
+  void MtStartJobs(UInt64 bitPos);
+  CMtBlockThread *MtGetBlock(UInt64 bitPos);
+  HRESULT MtSkipInput(UInt64 bitPos);
+  HRESULT DecodeStreams_Mt(ICompressProgressInfo *progress);
+  // **************** NanaZip Modification End ****************
+
   #endif
 
   Byte *_inBuf;
@@ -344,6 +409,13 @@ public:
     return _inProcessed + (size_t)(Base._buf - _inBuf);
   }
 
+  // **************** NanaZip Modification Start ****************
+  UInt64 GetInputBitPos() const
+  {
+    return GetInputProcessedSize() * 8 - Base._numBits;
+  }
+  // **************** NanaZip Modification End ****************
+
   UInt64 GetInStreamSize() const
   {
     return _inProcessed + (size_t)(Base._buf - _inBuf) - (Base._numBits >> 3);
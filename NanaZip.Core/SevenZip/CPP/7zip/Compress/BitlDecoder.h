@@ -95,6 +95,10 @@ public:
   // the size of virtual data that was read from this object.
   UInt64 GetProcessedSize() const { return _stream.GetProcessedSize() - ((kNumBigValueBits - _bitPos) >> 3); }
 
+  // **************** NanaZip Modification Start ****************
+  void Set_ProcessedSize_Base(UInt64 processedSize) { _stream.Set_ProcessedSize_Base(processedSize); }
+  // **************** NanaZip Modification End ****************
+
   bool ThereAreDataInBitsBuffer() const { return this->_bitPos != kNumBigValueBits; }
   
   Z7_FORCE_INLINE
@@ -0,0 +1,185 @@
+﻿// DedupDecoder.cpp
+
+#include "StdAfx.h"
+
+#include <string.h>
+
+#include "../../../C/Alloc.h"
+
+#include "../Common/StreamUtils.h"
+
+#include "DedupDecoder.h"
+
+namespace NCompress {
+namespace NDedup {
+
+static const UInt32 kInBufSize = (UInt32)1 << 20;
+
+// we write data to output stream, when there are (kFlushSize) bytes in window.
+// (kFlushSize + kRecordSizeMax) must be smaller than minimal window size.
+static const size_t kFlushSize = (size_t)1 << 20;
+
+CDecoder::~CDecoder()
+{
+  ::BigFree(_win);
+}
+
+Z7_COM7F_IMF(CDecoder::SetDecoderProperties2(const Byte *props, UInt32 size))
+{
+  if (size != 1)
+    return E_NOTIMPL;
+  const unsigned windowLog = props[0];
+  if (windowLog < kWindowLogMin || windowLog > kWindowLogMax)
+    return E_NOTIMPL;
+  if (windowLog >= sizeof(size_t) * 8)
+    return E_OUTOFMEMORY;
+  _windowLog = windowLog;
+  return S_OK;
+}
+
+bool CDecoder::ReadNumber(Byte b, UInt64 &res)
+{
+  res = 0;
+  for (unsigned i = 0;; i++)
+  {
+    res |= (UInt64)(b & 0x7F) << (7 * i);
+    if ((b & 0x80) == 0)
+      return true;
+    if (i == 8)
+      return false;
+    if (!_inStream.ReadByte(b))
+      return false;
+  }
+}
+
+static HRESULT WriteWindow(ISequentialOutStream *outStream,
+    const Byte *win, size_t winSize, UInt64 from, UInt64 to)
+{
+  const size_t mask = winSize - 1;
+  while (from != to)
+  {
+    const size_t pos = (size_t)from & mask;
+    size_t cur = winSize - pos;
+    if (cur > to - from)
+      cur = (size_t)(to - from);
+    RINOK(WriteStream(outStream, win + pos, cur))
+    from += cur;
+  }
+  return S_OK;
+}
+
+HRESULT CDecoder::CodeReal(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+    const UInt64 *outSize, ICompressProgressInfo *progress)
+{
+  if (_windowLog == 0)
+    return E_INVALIDARG;
+  const size_t winSize = (size_t)1 << _windowLog;
+  if (!_win || _winSize != winSize)
+  {
+    ::BigFree(_win);
+    _winSize = 0;
+    _win = (Byte *)::BigAlloc(winSize);
+    if (!_win)
+      return E_OUTOFMEMORY;
+    _winSize = winSize;
+  }
+  if (!_inStream.Create(kInBufSize))
+    return E_OUTOFMEMORY;
+  _inStream.SetStream(inStream);
+  _inStream.Init();
+
+  const size_t mask = winSize - 1;
+  Byte * const win = _win;
+  UInt64 pos = 0;
+  UInt64 flushPos = 0;
+
+  for (;;)
+  {
+    if (outSize && pos == *outSize)
+      break;
+    Byte b;
+    if (!_inStream.ReadByte(b))
+      break;
+    UInt64 v;
+    if (!ReadNumber(b, v))
+      return S_FALSE;
+    const UInt64 len = v >> 1;
+    if (len == 0 || len > kRecordSizeMax)
+      return S_FALSE;
+    if (outSize && len > *outSize - pos)
+      return S_FALSE;
+
+    size_t rem = (size_t)len;
+    if (v & 1)
+    {
+      UInt64 dist;
+      if (!_inStream.ReadByte(b) || !ReadNumber(b, dist))
+        return S_FALSE;
+      if (dist == 0 || dist > pos || dist > winSize)
+        return S_FALSE;
+      size_t dest = (size_t)pos & mask;
+      size_t src = (size_t)(pos - dist) & mask;
+      do
+      {
+        // we copy no more than (dist) bytes at once, if source and dest overlap
+        size_t cur = rem;
+        if (cur > winSize - dest) cur = winSize - dest;
+        if (cur > winSize - src)  cur = winSize - src;
+        if (cur > dist)           cur = (size_t)dist;
+        memmove(win + dest, win + src, cur);
+        dest = (dest + cur) & mask;
+        src = (src + cur) & mask;
+        rem -= cur;
+      }
+      while (rem != 0);
+    }
+    else
+    {
+      size_t dest = (size_t)pos & mask;
+      do
+      {
+        size_t cur = rem;
+        if (cur > winSize - dest)
+          cur = winSize - dest;
+        if (_inStream.ReadBytes(win + dest, cur) != cur)
+          return S_FALSE;
+        dest = (dest + cur) & mask;
+        rem -= cur;
+      }
+      while (rem != 0);
+    }
+    pos += len;
+
+    if (pos - flushPos >= kFlushSize)
+    {
+      RINOK(WriteWindow(outStream, win, winSize, flushPos, pos))
+      flushPos = pos;
+      if (progress)
+      {
+        const UInt64 inSize = _inStream.GetProcessedSize();
+        RINOK(progress->SetRatioInfo(&inSize, &pos))
+      }
+    }
+  }
+
+  RINOK(WriteWindow(outStream, win, winSize, flushPos, pos))
+  if (outSize && pos != *outSize)
+    return S_FALSE;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CDecoder::Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+    const UInt64 * /* inSize */, const UInt64 *outSize, ICompressProgressInfo *progress))
+{
+  HRESULT res;
+  try
+  {
+    res = CodeReal(inStream, outStream, outSize, progress);
+  }
+  catch(const CInBufferException &e) { res = e.ErrorCode; }
+  catch(...) { res = S_FALSE; }
+  _inStream.ClearStreamPtr();
+  return res;
+}
+
+}}
@@ -0,0 +1,59 @@
+﻿// DedupDecoder.h
+
+#ifndef ZIP7_INC_COMPRESS_DEDUP_DECODER_H
+#define ZIP7_INC_COMPRESS_DEDUP_DECODER_H
+
+#include "../../Common/MyCom.h"
+
+#include "../ICoder.h"
+
+#include "../Common/InBuffer.h"
+
+namespace NCompress {
+namespace NDedup {
+
+/*
+Dedup coder removes repeated chunks of data.
+The encoder splits the data to content-defined chunks (FastCDC with
+Gear rolling hash), so the boundaries of chunks move with the data after
+insertions and deletions. Each chunk that is equal to some chunk in
+the window of previous data is replaced by reference to that chunk.
+The output of encoder is usually compressed by next coder (LZMA2 and so on).
+
+Properties (1 byte): windowLog. The window size is (1 << windowLog).
+
+Data stream is sequence of records:
+  NUMBER (len << 1) | isRef    : (1 <= len <= kRecordSizeMax)
+  if (isRef == 0): (len) bytes : literal data
+  if (isRef != 0): NUMBER dist : copy (len) bytes from (dist) bytes back
+                                 (1 <= dist <= windowSize)
+NUMBER is little-endian base-128 number (7 bits in byte,
+the high bit is set in all bytes except of last byte).
+The stream ends at the end of packed data.
+*/
+
+const unsigned kWindowLogMin = 22;
+const unsigned kWindowLogMax = 40;
+const UInt32 kRecordSizeMax = (UInt32)1 << 20;
+
+Z7_CLASS_IMP_COM_2(
+  CDecoder
+  , ICompressCoder
+  , ICompressSetDecoderProperties2
+)
+  Byte *_win;
+  size_t _winSize;
+  unsigned _windowLog;
+  CInBuffer _inStream;
+
+  bool ReadNumber(Byte b, UInt64 &res);
+  HRESULT CodeReal(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+      const UInt64 *outSize, ICompressProgressInfo *progress);
+public:
+  CDecoder(): _win(NULL), _winSize(0), _windowLog(0) {}
+  ~CDecoder();
+};
+
+}}
+
+#endif
@@ -0,0 +1,308 @@
+﻿// DedupEncoder.cpp
+
+#include "StdAfx.h"
+
+#include <string.h>
+
+#include "../../../C/7zCrc.h"
+#include "../../../C/Alloc.h"
+
+#include "../Common/StreamUtils.h"
+
+#include "DedupEncoder.h"
+
+namespace NCompress {
+namespace NDedup {
+
+static const UInt32 kChunkSizeMin = (UInt32)1 << 11;
+static const UInt32 kChunkSizeAvg = (UInt32)1 << 13;
+static const UInt32 kChunkSizeMax = (UInt32)1 << 16;
+
+static const size_t kReadSize = (size_t)1 << 22;
+static const UInt32 kOutBufSize = (UInt32)1 << 20;
+
+/* FastCDC normalized chunking:
+   we use harder mask (15 bits) before average chunk size
+   and easier mask (11 bits) after average chunk size.
+   The Gear hash is shifted left, so we check the high bits,
+   that depend on last 64 bytes. */
+static const UInt64 kMaskS = (((UInt64)1 << 15) - 1) << (64 - 15);
+static const UInt64 kMaskL = (((UInt64)1 << 11) - 1) << (64 - 11);
+
+static UInt64 g_Gear[256];
+
+static struct CGearTableInit
+{
+  CGearTableInit()
+  {
+    // SplitMix64 generator with fixed seed: the chunk boundaries must be same in all versions
+    UInt64 x = 0;
+    for (unsigned i = 0; i < 256; i++)
+    {
+      x += UINT64_CONST(0x9E3779B97F4A7C15);
+      UInt64 z = x;
+      z = (z ^ (z >> 30)) * UINT64_CONST(0xBF58476D1CE4E5B9);
+      z = (z ^ (z >> 27)) * UINT64_CONST(0x94D049BB133111EB);
+      g_Gear[i] = z ^ (z >> 31);
+    }
+  }
+} g_GearTableInit;
+
+static UInt32 GetChunkSize(const Byte *p, size_t size)
+{
+  if (size <= kChunkSizeMin)
+    return (UInt32)size;
+  size_t lim2 = kChunkSizeMax;
+  if (lim2 > size)
+    lim2 = size;
+  size_t lim1 = kChunkSizeAvg;
+  if (lim1 > lim2)
+    lim1 = lim2;
+  UInt64 h = 0;
+  size_t i = kChunkSizeMin;
+  for (; i < lim1; i++)
+  {
+    h = (h << 1) + g_Gear[p[i]];
+    if ((h & kMaskS) == 0)
+      return (UInt32)(i + 1);
+  }
+  for (; i < lim2; i++)
+  {
+    h = (h << 1) + g_Gear[p[i]];
+    if ((h & kMaskL) == 0)
+      return (UInt32)(i + 1);
+  }
+  return (UInt32)lim2;
+}
+
+// the table of chunk references has 4 items per average chunk in window.
+// The items are grouped to buckets of 2 items.
+static size_t GetNumRefs(size_t winSize) { return winSize / kChunkSizeAvg * 4; }
+
+unsigned CEncProps::GetWindowLog() const
+{
+  unsigned log = kWindowLogMin;
+  while (log < kWindowLogMax_Enc && ((UInt64)1 << log) < WindowSize)
+    log++;
+  // we don't need window that is larger than data
+  while (log > kWindowLogMin && ((UInt64)1 << (log - 1)) >= ReduceSize)
+    log--;
+  return log;
+}
+
+UInt64 GetEncoderMemUsage(UInt64 windowSize)
+{
+  CEncProps props;
+  props.WindowSize = windowSize;
+  const size_t winSize = (size_t)1 << props.GetWindowLog();
+  return (UInt64)winSize * 2
+      + GetNumRefs(winSize) * sizeof(CChunkRef)
+      + kOutBufSize;
+}
+
+CEncoder::~CEncoder()
+{
+  ::BigFree(_buf);
+  ::MidFree(_refs);
+}
+
+Z7_COM7F_IMF(CEncoder::SetCoderProperties(const PROPID *propIDs, const PROPVARIANT *coderProps, UInt32 numProps))
+{
+  CEncProps props;
+  for (UInt32 i = 0; i < numProps; i++)
+  {
+    const PROPVARIANT &prop = coderProps[i];
+    const PROPID propID = propIDs[i];
+    if (propID == NCoderPropID::kReduceSize)
+    {
+      if (prop.vt == VT_UI8)
+        props.ReduceSize = prop.uhVal.QuadPart;
+      continue;
+    }
+    if (propID > NCoderPropID::kReduceSize)
+      continue;
+    switch (propID)
+    {
+      case NCoderPropID::kDictionarySize:
+        if (prop.vt == VT_UI4)
+          props.WindowSize = prop.ulVal;
+        else if (prop.vt == VT_UI8)
+          props.WindowSize = prop.uhVal.QuadPart;
+        else
+          return E_INVALIDARG;
+        break;
+      case NCoderPropID::kNumThreads: break;
+      case NCoderPropID::kLevel: break;
+      default: return E_INVALIDARG;
+    }
+  }
+  _props = props;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CEncoder::WriteCoderProperties(ISequentialOutStream *outStream))
+{
+  const Byte prop = (Byte)_props.GetWindowLog();
+  return WriteStream(outStream, &prop, 1);
+}
+
+void CEncoder::WriteNumber(UInt64 v)
+{
+  for (; v >= 0x80; v >>= 7)
+    _outStream.WriteByte((Byte)(v | 0x80));
+  _outStream.WriteByte((Byte)v);
+}
+
+void CEncoder::FlushRecord(const Byte *buf, UInt64 bufPos)
+{
+  if (_recSize == 0)
+    return;
+  WriteNumber(((UInt64)_recSize << 1) | (_recDist != 0 ? 1 : 0));
+  if (_recDist != 0)
+    WriteNumber(_recDist);
+  else
+    _outStream.WriteBytes(buf + (size_t)(_recPos - bufPos), _recSize);
+  _recSize = 0;
+}
+
+// (dist == 0) means literal chunk
+void CEncoder::AddChunk(const Byte *buf, UInt64 bufPos, UInt64 pos, UInt32 size, UInt64 dist)
+{
+  if (_recSize != 0)
+  {
+    // the chunks are contiguous, so we can extend the record with same (dist)
+    if (_recDist == dist && _recSize + size <= kRecordSizeMax)
+    {
+      _recSize += size;
+      return;
+    }
+    FlushRecord(buf, bufPos);
+  }
+  _recPos = pos;
+  _recDist = dist;
+  _recSize = size;
+}
+
+HRESULT CEncoder::CodeReal(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+    ICompressProgressInfo *progress)
+{
+  const size_t winSize = (size_t)1 << _props.GetWindowLog();
+  // we keep (winSize) bytes of previous data for references and we read new data to another half
+  const size_t bufSize = winSize * 2;
+  if (!_buf || _bufSize != bufSize)
+  {
+    ::BigFree(_buf);
+    _bufSize = 0;
+    _buf = (Byte *)::BigAlloc(bufSize);
+    if (!_buf)
+      return E_OUTOFMEMORY;
+    _bufSize = bufSize;
+  }
+  const size_t numRefs = GetNumRefs(winSize);
+  if (!_refs || _numRefs != numRefs)
+  {
+    ::MidFree(_refs);
+    _numRefs = 0;
+    _refs = (CChunkRef *)::MidAlloc(numRefs * sizeof(CChunkRef));
+    if (!_refs)
+      return E_OUTOFMEMORY;
+    _numRefs = numRefs;
+  }
+  // (Size == 0) means empty item
+  memset(_refs, 0, numRefs * sizeof(CChunkRef));
+
+  if (!_outStream.Create(kOutBufSize))
+    return E_OUTOFMEMORY;
+  _outStream.SetStream(outStream);
+  _outStream.Init();
+  _recSize = 0;
+
+  Byte * const buf = _buf;
+  UInt64 bufPos = 0; // the position of buf[0] in stream
+  size_t bufEnd = 0;
+  size_t cur = 0;
+  bool finished = false;
+
+  for (;;)
+  {
+    if (!finished && bufEnd - cur < kChunkSizeMax)
+    {
+      if (bufEnd == bufSize)
+      {
+        // (cur > winSize) here
+        FlushRecord(buf, bufPos);
+        const size_t move = cur - winSize;
+        memmove(buf, buf + move, bufEnd - move);
+        bufPos += move;
+        bufEnd -= move;
+        cur -= move;
+      }
+      size_t size = bufSize - bufEnd;
+      if (size > kReadSize)
+        size = kReadSize;
+      const size_t requested = size;
+      RINOK(ReadStream(inStream, buf + bufEnd, &size))
+      bufEnd += size;
+      if (size != requested)
+        finished = true;
+      if (progress)
+      {
+        const UInt64 inSize = bufPos + bufEnd;
+        const UInt64 outSize = _outStream.GetProcessedSize();
+        RINOK(progress->SetRatioInfo(&inSize, &outSize))
+      }
+      continue;
+    }
+
+    if (cur == bufEnd)
+      break;
+
+    const Byte *p = buf + cur;
+    const UInt32 size = GetChunkSize(p, bufEnd - cur);
+    const UInt32 crc = CrcCalc(p, size);
+    const UInt64 pos = bufPos + cur;
+    CChunkRef *refs = _refs + (((crc ^ (size * (UInt32)0x9E3779B1)) & ((numRefs >> 1) - 1)) << 1);
+    UInt64 dist = 0;
+    unsigned i;
+    for (i = 0; i < 2; i++)
+    {
+      const CChunkRef &ref = refs[i];
+      if (ref.Size == size
+          && ref.Crc == crc
+          && pos - ref.Pos <= winSize
+          && memcmp(buf + (size_t)(ref.Pos - bufPos), p, size) == 0)
+      {
+        dist = pos - ref.Pos;
+        break;
+      }
+    }
+    // we replace the found item or the oldest item in bucket
+    if (i == 2)
+      i = (refs[0].Pos <= refs[1].Pos) ? 0 : 1;
+    CChunkRef &ref = refs[i];
+    ref.Pos = pos;
+    ref.Crc = crc;
+    ref.Size = size;
+    AddChunk(buf, bufPos, pos, size, dist);
+    cur += size;
+  }
+
+  FlushRecord(buf, bufPos);
+  return _outStream.Flush();
+}
+
+Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+    const UInt64 * /* inSize */, const UInt64 * /* outSize */, ICompressProgressInfo *progress))
+{
+  HRESULT res;
+  try
+  {
+    res = CodeReal(inStream, outStream, progress);
+  }
+  catch(const COutBufferException &e) { res = e.ErrorCode; }
+  catch(...) { res = E_FAIL; }
+  _outStream.SetStream(NULL);
+  return res;
+}
+
+}}
@@ -0,0 +1,76 @@
+﻿// DedupEncoder.h
+
+#ifndef ZIP7_INC_COMPRESS_DEDUP_ENCODER_H
+#define ZIP7_INC_COMPRESS_DEDUP_ENCODER_H
+
+#include "../../Common/MyCom.h"
+
+#include "../ICoder.h"
+
+#include "../Common/OutBuffer.h"
+
+// the constants of Dedup stream format
+#include "DedupDecoder.h"
+
+namespace NCompress {
+namespace NDedup {
+
+const UInt64 kWindowSizeDefault = (UInt64)1 << 26;
+
+// maximum window for encoder, the encoder uses (2 * windowSize) buffer.
+const unsigned kWindowLogMax_Enc = (sizeof(size_t) > 4 ? 32 : 29);
+
+/* it returns the memory usage of encoder for (windowSize) that was
+   passed to kDictionarySize property. */
+UInt64 GetEncoderMemUsage(UInt64 windowSize);
+
+struct CEncProps
+{
+  UInt64 WindowSize;
+  UInt64 ReduceSize;
+
+  CEncProps():
+      WindowSize(kWindowSizeDefault),
+      ReduceSize((UInt64)(Int64)-1)
+      {}
+  unsigned GetWindowLog() const;
+};
+
+struct CChunkRef
+{
+  UInt64 Pos;
+  UInt32 Crc;
+  UInt32 Size;
+};
+
+Z7_CLASS_IMP_COM_3(
+  CEncoder
+  , ICompressCoder
+  , ICompressSetCoderProperties
+  , ICompressWriteCoderProperties
+)
+  Byte *_buf;
+  size_t _bufSize;
+  CChunkRef *_refs;
+  size_t _numRefs;
+  COutBuffer _outStream;
+  CEncProps _props;
+
+  // the record that was not written still
+  UInt64 _recPos;
+  UInt64 _recDist;
+  UInt32 _recSize;
+
+  void WriteNumber(UInt64 v);
+  void FlushRecord(const Byte *buf, UInt64 bufPos);
+  void AddChunk(const Byte *buf, UInt64 bufPos, UInt64 pos, UInt32 size, UInt64 dist);
+  HRESULT CodeReal(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+      ICompressProgressInfo *progress);
+public:
+  CEncoder(): _buf(NULL), _bufSize(0), _refs(NULL), _numRefs(0) {}
+  ~CEncoder();
+};
+
+}}
+
+#endif
@@ -0,0 +1,22 @@
+﻿// DedupRegister.cpp
+
+#include "StdAfx.h"
+
+#include "../Common/RegisterCodec.h"
+
+#include "DedupDecoder.h"
+
+#ifndef Z7_EXTRACT_ONLY
+#include "DedupEncoder.h"
+#endif
+
+namespace NCompress {
+namespace NDedup {
+
+REGISTER_CODEC_E(Dedup,
+    CDecoder(),
+    CEncoder(),
+    0x4F71201,
+    "Dedup")
+
+}}
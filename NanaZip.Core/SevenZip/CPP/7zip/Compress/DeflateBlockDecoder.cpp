@@ -0,0 +1,104 @@
+﻿// DeflateBlockDecoder.cpp
+
+#include "StdAfx.h"
+
+#include "DeflateBlockDecoder.h"
+
+namespace NCompress {
+namespace NDeflate {
+namespace NDecoder {
+
+void CBlockBitReader::Refill_Slow()
+{
+  while (_numBits <= 56)
+  {
+    if (_cur == _lim)
+      if (_numExtraBytes != 0 || !SetChunk(_chunkIndex + 1, 0))
+      {
+        if (++_numExtraBytes > 16)
+          Overrun = true;
+        _numBits += 8;
+        continue;
+      }
+    _value |= (UInt64)*_cur++ << _numBits;
+    _numBits += 8;
+  }
+}
+
+
+bool CBlockDecoder::ReadTables(CBlockBitReader &r, bool strict)
+{
+  r.Refill();
+  const unsigned numLitLenLevels = r.ReadBits(kNumLenCodesFieldSize) + kNumLitLenCodesMin;
+  const unsigned numDistLevels = r.ReadBits(kNumDistCodesFieldSize) + kNumDistCodesMin;
+  const unsigned numLevelCodes = r.ReadBits(kNumLevelCodesFieldSize) + kNumLevelCodesMin;
+
+  if (numDistLevels > kDistTableSize32)
+    return false;
+  if (strict && numLitLenLevels > kMainTableSize)
+    return false;
+
+  Byte levelLevels[kLevelTableSize];
+  memset(levelLevels, 0, sizeof(levelLevels));
+  unsigned i;
+  for (i = 0; i < numLevelCodes; i++)
+  {
+    r.Refill();
+    levelLevels[kCodeLengthAlphabetOrder[i]] = (Byte)r.ReadBits(kLevelFieldSize);
+  }
+  if (!_levelDecoder.Build(levelLevels, kLevelTableSize, strict))
+    return false;
+
+  Byte levels[kFixedMainTableSize + kFixedDistTableSize];
+  const unsigned numSymbols = numLitLenLevels + numDistLevels;
+  i = 0;
+  do
+  {
+    r.Refill();
+    const int sym = _levelDecoder.Decode(r);
+    if (sym < 0)
+      return false;
+    if ((unsigned)sym < kTableDirectLevels)
+      levels[i++] = (Byte)sym;
+    else
+    {
+      unsigned num;
+      unsigned numBits;
+      Byte symbol;
+      if ((unsigned)sym == kTableLevelRepNumber)
+      {
+        if (i == 0)
+          return false;
+        numBits = 2;
+        num = 0;
+        symbol = levels[(size_t)i - 1];
+      }
+      else
+      {
+        const unsigned s = ((unsigned)sym - kTableLevel0Number) << 2;
+        numBits = 3 + s;
+        num = s << 1;
+        symbol = 0;
+      }
+      num += i + 3 + r.ReadBits(numBits);
+      if (num > numSymbols)
+        return false;
+      do
+        levels[i++] = symbol;
+      while (i < num);
+    }
+  }
+  while (i < numSymbols);
+
+  CLevels lev;
+  lev.SubClear();
+  memcpy(lev.litLenLevels, levels, numLitLenLevels);
+  memcpy(lev.distLevels, levels + numLitLenLevels, numDistLevels);
+
+  if (strict && lev.litLenLevels[kSymbolEndOfBlock] == 0)
+    return false;
+  return _mainDecoder.Build(lev.litLenLevels, kFixedMainTableSize, strict)
+      && _distDecoder.Build(lev.distLevels, kFixedDistTableSize, strict);
+}
+
+}}}
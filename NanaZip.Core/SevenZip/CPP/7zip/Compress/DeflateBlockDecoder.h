@@ -0,0 +1,337 @@
+﻿// DeflateBlockDecoder.h
+
+#ifndef ZIP7_INC_DEFLATE_BLOCK_DECODER_H
+#define ZIP7_INC_DEFLATE_BLOCK_DECODER_H
+
+#include <string.h>
+
+#include "../../../C/Alloc.h"
+#include "../../../C/CpuArch.h"
+
+#include "../../Common/MyTypes.h"
+
+#include "DeflateConst.h"
+
+namespace NCompress {
+namespace NDeflate {
+namespace NDecoder {
+
+/*
+The classes in this file decode Deflate stream block by block from
+the data that was read to memory in chunks. The caller provides the sink
+that receives decoded bytes, so the caller can stop at any block and
+it can start decoding from any known bit position of the start of block.
+These classes are used by multithreaded decoder (CMtDecoder) and
+by the random-access stream of gzip handler.
+*/
+
+static const unsigned kBlockNumTableBits = 10;
+
+struct CInChunk
+{
+  Byte *Data;
+  size_t Size;
+  UInt64 Offset;  // the offset of chunk in input stream
+
+  Z7_CLASS_NO_COPY(CInChunk)
+public:
+  CInChunk(): Data(NULL), Size(0), Offset(0) {}
+  ~CInChunk() { ::MidFree(Data); }
+};
+
+
+class CInChunkSource
+{
+public:
+  // it returns NULL, if there is no such chunk
+  virtual const CInChunk *GetChunk(UInt64 index) = 0;
+};
+
+
+/* CBlockBitReader reads the bits from the sequence of chunks.
+   After the end of last chunk it returns zero bits, and it counts these extra bytes. */
+
+class CBlockBitReader
+{
+  const Byte *_cur;
+  const Byte *_lim;
+  UInt64 _value;
+  unsigned _numBits;
+  unsigned _numExtraBytes;
+  UInt64 _limPos;
+  UInt64 _chunkIndex;
+  CInChunkSource *_source;
+
+  bool SetChunk(UInt64 index, size_t offset)
+  {
+    const CInChunk *c = _source->GetChunk(index);
+    if (!c || offset > c->Size)
+      return false;
+    _chunkIndex = index;
+    _cur = c->Data + offset;
+    _lim = c->Data + c->Size;
+    _limPos = c->Offset + c->Size;
+    return true;
+  }
+
+  void Refill_Slow();
+public:
+  // too many extra bytes were read after the end of last chunk
+  bool Overrun;
+
+  bool Init(CInChunkSource *source, UInt64 chunkIndex, UInt64 bitPos)
+  {
+    _source = source;
+    _value = 0;
+    _numBits = 0;
+    _numExtraBytes = 0;
+    Overrun = false;
+    const CInChunk *c = source->GetChunk(chunkIndex);
+    if (!c || (bitPos >> 3) < c->Offset)
+      return false;
+    if (!SetChunk(chunkIndex, (size_t)((bitPos >> 3) - c->Offset)))
+      return false;
+    Refill();
+    Skip((unsigned)bitPos & 7);
+    return true;
+  }
+
+  // the position of next bit in input stream
+  UInt64 GetBitPos() const
+  {
+    return ((_limPos - (size_t)(_lim - _cur) + _numExtraBytes) << 3) - _numBits;
+  }
+
+  bool ExtraBitsWereRead() const { return (_numExtraBytes << 3) > _numBits; }
+
+  Z7_FORCE_INLINE
+  void Refill()
+  {
+    if ((size_t)(_lim - _cur) >= 8)
+    {
+      _value |= GetUi64(_cur) << _numBits;
+      _cur += (63 - _numBits) >> 3;
+      _numBits |= 56;
+    }
+    else
+      Refill_Slow();
+  }
+
+  // (numBits <= 16), and Refill() must be called before
+  UInt32 GetBits(unsigned numBits) const { return (UInt32)_value & (((UInt32)1 << numBits) - 1); }
+  void Skip(unsigned numBits) { _value >>= numBits; _numBits -= numBits; }
+  UInt32 ReadBits(unsigned numBits)
+  {
+    const UInt32 v = GetBits(numBits);
+    Skip(numBits);
+    return v;
+  }
+  void AlignToByte() { Skip(_numBits & 7); }
+};
+
+
+template <unsigned kNumSymbolsMax>
+class CBlockHuffman
+{
+  UInt16 _table[1 << kBlockNumTableBits];
+  UInt32 _first[kNumHuffmanBits + 1];
+  UInt32 _counts[kNumHuffmanBits + 1];
+  UInt32 _offsets[kNumHuffmanBits + 1];
+  UInt16 _symbols[kNumSymbolsMax];
+
+  int DecodeLong(CBlockBitReader &r) const
+  {
+    const UInt32 v = r.GetBits(kNumHuffmanBits);
+    UInt32 code = 0;
+    for (unsigned len = 1; len <= kNumHuffmanBits; len++)
+    {
+      code |= (v >> (len - 1)) & 1;
+      const UInt32 d = code - _first[len];
+      if (d < _counts[len])
+      {
+        r.Skip(len);
+        return _symbols[_offsets[len] + d];
+      }
+      code <<= 1;
+    }
+    return -1;
+  }
+
+public:
+  /* incomplete code is allowed as in CCoder.
+     if (strict), the code must be complete, or it must contain only one code of 1 bit. */
+  bool Build(const Byte *lens, unsigned numSymbols, bool strict)
+  {
+    unsigned counts[kNumHuffmanBits + 1];
+    UInt32 next[kNumHuffmanBits + 1];
+    unsigned i;
+    for (i = 0; i <= kNumHuffmanBits; i++)
+      counts[i] = 0;
+    for (i = 0; i < numSymbols; i++)
+      counts[lens[i]]++;
+    counts[0] = 0;
+
+    UInt32 code = 0;
+    UInt32 space = 0;
+    unsigned numCodes = 0;
+    for (i = 1; i <= kNumHuffmanBits; i++)
+    {
+      code = (code + counts[i - 1]) << 1;
+      _first[i] = code;
+      next[i] = code;
+      _counts[i] = counts[i];
+      _offsets[i] = numCodes;
+      numCodes += counts[i];
+      space += (UInt32)counts[i] << (kNumHuffmanBits - i);
+    }
+
+    if (space > ((UInt32)1 << kNumHuffmanBits))
+      return false;
+    if (strict && space != ((UInt32)1 << kNumHuffmanBits))
+      if (numCodes > 1 || (numCodes == 1 && counts[1] != 1))
+        return false;
+
+    memset(_table, 0, sizeof(_table));
+    for (i = 0; i < numSymbols; i++)
+    {
+      const unsigned len = lens[i];
+      if (len == 0)
+        continue;
+      const UInt32 c = next[len]++;
+      _symbols[_offsets[len] + (c - _first[len])] = (UInt16)i;
+      if (len <= kBlockNumTableBits)
+      {
+        UInt32 rev = 0;
+        for (unsigned k = 0; k < len; k++)
+          rev |= ((c >> k) & 1) << (len - 1 - k);
+        const UInt16 e = (UInt16)((i << 4) | len);
+        for (; rev < ((UInt32)1 << kBlockNumTableBits); rev += (UInt32)1 << len)
+          _table[rev] = e;
+      }
+    }
+    return true;
+  }
+
+  // Refill() must be called before. It returns (-1) for unused code.
+  Z7_FORCE_INLINE
+  int Decode(CBlockBitReader &r) const
+  {
+    const unsigned e = _table[r.GetBits(kBlockNumTableBits)];
+    if (e != 0)
+    {
+      r.Skip(e & 0xF);
+      return (int)(e >> 4);
+    }
+    return DecodeLong(r);
+  }
+};
+
+
+enum
+{
+  k_Block_OK,
+  k_Block_Error,
+  k_Block_Stop  // the sink doesn't accept more data
+};
+
+
+class CBlockDecoder
+{
+  CBlockHuffman<kFixedMainTableSize> _mainDecoder;
+  CBlockHuffman<kFixedDistTableSize> _distDecoder;
+  CBlockHuffman<kLevelTableSize> _levelDecoder;
+  bool _fixedTablesWereBuilt;
+
+  bool ReadTables(CBlockBitReader &r, bool strict);
+public:
+  bool IsFinal;
+
+  CBlockDecoder(): _fixedTablesWereBuilt(false), IsFinal(false) {}
+
+  /* it decodes one block.
+     if (strict), it accepts only dynamic Huffman block with complete codes.
+     It's used to check the possible start of block. */
+  template <class TSink>
+  int DecodeBlock(CBlockBitReader &r, TSink &sink, bool strict);
+};
+
+
+template <class TSink>
+int CBlockDecoder::DecodeBlock(CBlockBitReader &r, TSink &sink, bool strict)
+{
+  r.Refill();
+  IsFinal = (r.ReadBits(kFinalBlockFieldSize) == NFinalBlockField::kFinalBlock);
+  const UInt32 blockType = r.ReadBits(kBlockTypeFieldSize);
+
+  if (blockType == NBlockType::kStored)
+  {
+    if (strict)
+      return k_Block_Error;
+    r.AlignToByte();
+    r.Refill();
+    const UInt32 size = r.ReadBits(16);
+    if (size != (~r.ReadBits(16) & 0xFFFF))
+      return k_Block_Error;
+    for (UInt32 i = 0; i < size; i++)
+    {
+      r.Refill();
+      if (r.Overrun)
+        return k_Block_Error;
+      if (!sink.PutByte(r.ReadBits(8)))
+        return k_Block_Stop;
+    }
+    return k_Block_OK;
+  }
+
+  if (blockType == NBlockType::kFixedHuffman)
+  {
+    if (strict)
+      return k_Block_Error;
+    if (!_fixedTablesWereBuilt)
+    {
+      CLevels lev;
+      lev.SetFixedLevels();
+      _mainDecoder.Build(lev.litLenLevels, kFixedMainTableSize, false);
+      _distDecoder.Build(lev.distLevels, kFixedDistTableSize, false);
+      _fixedTablesWereBuilt = true;
+    }
+  }
+  else
+  {
+    _fixedTablesWereBuilt = false;
+    if (blockType != NBlockType::kDynamicHuffman)
+      return k_Block_Error;
+    if (!ReadTables(r, strict))
+      return k_Block_Error;
+  }
+
+  for (;;)
+  {
+    r.Refill();
+    if (r.Overrun)
+      return k_Block_Error;
+    int sym = _mainDecoder.Decode(r);
+    if ((unsigned)sym < 0x100)
+    {
+      if (!sink.PutByte((unsigned)sym))
+        return k_Block_Stop;
+      continue;
+    }
+    if (sym < 0)
+      return k_Block_Error;
+    if ((unsigned)sym == kSymbolEndOfBlock)
+      return k_Block_OK;
+    sym -= (int)kSymbolMatch;
+    const unsigned len = kLenStart32[sym] + kMatchMinLen + r.ReadBits(kLenDirectBits32[sym]);
+    const int distSym = _distDecoder.Decode(r);
+    if (distSym < 0)
+      return k_Block_Error;
+    const UInt32 dist = kDistStart[distSym] + r.ReadBits(kDistDirectBits[distSym]) + 1;
+    if (!sink.CopyMatch(dist, len))
+      return sink.DistError ? k_Block_Error : k_Block_Stop;
+  }
+}
+
+}}}
+
+#endif
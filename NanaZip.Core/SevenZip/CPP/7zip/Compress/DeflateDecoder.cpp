@@ -9,6 +9,13 @@ namespace NDeflate {
 namespace NDecoder {
 
 CCoder::CCoder(bool deflate64Mode):
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    _numThreads(1),
+    _memUsage((UInt64)(sizeof(size_t)) << 28),
+    _mtMode(false),
+    #endif
+    // **************** NanaZip Modification End ****************
     _deflateNSIS(false),
     _deflate64Mode(deflate64Mode),
     _keepHistory(false),
@@ -161,6 +168,15 @@ HRESULT CCoder::InitInStream(bool needInit)
   return S_OK;
 }
 
+// **************** NanaZip Modification Start ****************
+HRESULT CCoder::InitInStream_AtPos(UInt64 streamPos)
+{
+  RINOK(InitInStream(true))
+  m_InBitStream.Set_ProcessedSize_Base(streamPos);
+  return S_OK;
+}
+// **************** NanaZip Modification End ****************
+
 
 HRESULT CCoder::CodeSpec(UInt32 curSize, bool finishInputStream, UInt32 inputProgressLimit)
 {
@@ -425,11 +441,30 @@ HRESULT CCoder::CodeReal(ISequentialOutStream *outStream, ICompressProgressInfo
 }
 
 
+// **************** NanaZip Modification Start ****************
 Z7_COM7F_IMF(CCoder::Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
-    const UInt64 * /* inSize */, const UInt64 *outSize, ICompressProgressInfo *progress))
+    const UInt64 *inSize, const UInt64 *outSize, ICompressProgressInfo *progress))
+// **************** NanaZip Modification End ****************
 {
   SetInStream(inStream);
   SetOutStreamSize(outSize);
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  /* CMtDecoder doesn't support Deflate64, NSIS and the history from previous stream.
+     And it's not effective for small streams. */
+  if (_numThreads > 1 && !_deflate64Mode && !_deflateNSIS && !_keepHistory
+      && inSize && *inSize >= kMtStreamSizeMin)
+  {
+    _mtMode = true;
+    const HRESULT res = _mtDecoder.Code(inStream, outStream, outSize, _needFinishInput,
+        progress, _numThreads, _memUsage);
+    ReleaseInStream();
+    return res;
+  }
+  #else
+  UNUSED_VAR(inSize)
+  #endif
+  // **************** NanaZip Modification End ****************
   const HRESULT res = CodeReal(outStream, progress);
   ReleaseInStream();
   /*
@@ -450,6 +485,15 @@ Z7_COM7F_IMF(CCoder::SetFinishMode(UInt32 finishMode))
 
 Z7_COM7F_IMF(CCoder::GetInStreamProcessedSize(UInt64 *value))
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (_mtMode)
+  {
+    *value = _mtDecoder.InSize;
+    return S_OK;
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
   *value = m_InBitStream.GetStreamSize();
   return S_OK;
 }
@@ -457,6 +501,17 @@ Z7_COM7F_IMF(CCoder::GetInStreamProcessedSize(UInt64 *value))
 
 Z7_COM7F_IMF(CCoder::ReadUnusedFromInBuf(void *data, UInt32 size, UInt32 *processedSize))
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (_mtMode)
+  {
+    const UInt32 processed = _mtDecoder.ReadUnused(data, size);
+    if (processedSize)
+      *processedSize = processed;
+    return S_OK;
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
   AlignToByte();
   UInt32 i = 0;
   {
@@ -512,6 +567,11 @@ Z7_COM7F_IMF(CCoder::SetOutStreamSize(const UInt64 *outSize))
   m_InBitStream.Init();
   _needInitInStream = true;
   SetOutStreamSizeResume(outSize);
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  _mtMode = false;
+  #endif
+  // **************** NanaZip Modification End ****************
   return S_OK;
 }
 
@@ -563,4 +623,23 @@ HRESULT CCoder::CodeResume(ISequentialOutStream *outStream, const UInt64 *outSiz
   return CodeReal(outStream, progress);
 }
 
+
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+Z7_COM7F_IMF(CCoder::SetNumberOfThreads(UInt32 numThreads))
+{
+  _numThreads = numThreads > 1 ? numThreads : 1;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CCoder::SetMemLimit(UInt64 memUsage))
+{
+  _memUsage = memUsage;
+  return S_OK;
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
 }}}
@@ -14,6 +14,12 @@
 #include "HuffmanDecoder.h"
 #include "LzOutWindow.h"
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "DeflateMtDecoder.h"
+#endif
+// **************** NanaZip Modification End ****************
+
 namespace NCompress {
 namespace NDeflate {
 namespace NDecoder {
@@ -34,6 +40,12 @@ class CCoder:
 #ifndef Z7_NO_READ_FROM_CODER
   public ISequentialInStream,
 #endif
+  // **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+  public ICompressSetCoderMt,
+  public ICompressSetMemLimit,
+#endif
+  // **************** NanaZip Modification End ****************
   public CMyUnknownImp
 {
   Z7_COM_QI_BEGIN2(ICompressCoder)
@@ -45,6 +57,12 @@ class CCoder:
 #ifndef Z7_NO_READ_FROM_CODER
   Z7_COM_QI_ENTRY(ISequentialInStream)
 #endif
+  // **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+  Z7_COM_QI_ENTRY(ICompressSetCoderMt)
+  Z7_COM_QI_ENTRY(ICompressSetMemLimit)
+#endif
+  // **************** NanaZip Modification End ****************
   Z7_COM_QI_END
   Z7_COM_ADDREF_RELEASE
 
@@ -59,6 +77,18 @@ private:
 #ifndef Z7_NO_READ_FROM_CODER
   Z7_IFACE_COM7_IMP(ISequentialInStream)
 #endif
+  // **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+  Z7_IFACE_COM7_IMP(ICompressSetCoderMt)
+  Z7_IFACE_COM7_IMP(ICompressSetMemLimit)
+
+  UInt32 _numThreads;
+  UInt64 _memUsage;
+  // Code() used CMtDecoder for the stream
+  bool _mtMode;
+  CMtDecoder _mtDecoder;
+#endif
+  // **************** NanaZip Modification End ****************
 
   CLzOutWindow m_OutWindowStream;
   NBitl::CDecoder<CInBuffer> m_InBitStream;
@@ -129,6 +159,10 @@ public:
 public:
   HRESULT CodeResume(ISequentialOutStream *outStream, const UInt64 *outSize, ICompressProgressInfo *progress);
   HRESULT InitInStream(bool needInit);
+  // **************** NanaZip Modification Start ****************
+  // it initializes the input stream, that is positioned at (streamPos) in virtual input stream
+  HRESULT InitInStream_AtPos(UInt64 streamPos);
+  // **************** NanaZip Modification End ****************
 
   void AlignToByte() { m_InBitStream.AlignToByte(); }
   Byte ReadAlignedByte();
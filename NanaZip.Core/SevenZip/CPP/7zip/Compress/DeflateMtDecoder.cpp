@@ -0,0 +1,791 @@
+﻿// DeflateMtDecoder.cpp
+
+#include "StdAfx.h"
+
+#ifndef Z7_ST
+
+#include <string.h>
+
+#include "../../../C/Alloc.h"
+#include "../../../C/CpuArch.h"
+
+#include "../../Common/MyBuffer.h"
+
+#include "../Common/StreamUtils.h"
+#include "../Common/VirtThread.h"
+
+#include "DeflateBlockDecoder.h"
+#include "DeflateMtDecoder.h"
+
+namespace NCompress {
+namespace NDeflate {
+namespace NDecoder {
+
+static const unsigned kMtNumThreadsMax = 64;
+static const size_t kMtChunkSize = (size_t)1 << 22;
+static const size_t kMtWindowSize = kHistorySize32;
+// the maximum number of symbols that one thread can decode for one chunk
+static const size_t kMtNumSymbolsMax = (size_t)1 << 25;
+static const size_t kMtNumSymbolsInit = kMtChunkSize * 4;
+static const size_t kMtOutBufSize = (size_t)1 << 20;
+// the thread searches the start of block only in first bytes of chunk
+static const size_t kMtSearchSize = (size_t)1 << 20;
+
+static const UInt64 kMtNoJob = (UInt64)(Int64)-1;
+
+
+/* CMtSymbolSink is used by threads.
+   The symbols (0 - 0xFF) are bytes.
+   The symbols (0x100 + i) are references to byte (i) in unknown window
+   of (kMtWindowSize) bytes before the start of data. */
+
+class CMtSymbolSink
+{
+  bool Grow(size_t size)
+  {
+    const size_t limMax = kMtWindowSize + kMtNumSymbolsMax;
+    size_t newLim = Lim * 2;
+    if (newLim < kMtWindowSize + kMtNumSymbolsInit)
+      newLim = kMtWindowSize + kMtNumSymbolsInit;
+    if (newLim > limMax)
+      newLim = limMax;
+    if (newLim - Pos < size)
+      return false;
+    UInt16 *newBuf = (UInt16 *)::MidAlloc(newLim * sizeof(UInt16));
+    if (!newBuf)
+      return false;
+    if (Buf)
+      memcpy(newBuf, Buf, Pos * sizeof(UInt16));
+    ::MidFree(Buf);
+    Buf = newBuf;
+    Lim = newLim;
+    return true;
+  }
+
+  Z7_CLASS_NO_COPY(CMtSymbolSink)
+public:
+  UInt16 *Buf;
+  size_t Pos;
+  size_t Lim;
+  bool DistError;
+
+  CMtSymbolSink(): Buf(NULL), Pos(0), Lim(0), DistError(false) {}
+  ~CMtSymbolSink() { ::MidFree(Buf); }
+
+  bool Init()
+  {
+    DistError = false;
+    if (!Buf)
+    {
+      if (!Grow(kMtWindowSize))
+        return false;
+      // the window part of buffer is never changed later
+      for (size_t i = 0; i < kMtWindowSize; i++)
+        Buf[i] = (UInt16)(0x100 + i);
+    }
+    Pos = kMtWindowSize;
+    return true;
+  }
+
+  Z7_FORCE_INLINE
+  bool PutByte(unsigned b)
+  {
+    if (Pos == Lim && !Grow(1))
+      return false;
+    Buf[Pos++] = (UInt16)b;
+    return true;
+  }
+
+  Z7_FORCE_INLINE
+  bool CopyMatch(UInt32 dist, unsigned len)
+  {
+    // (Pos >= kMtWindowSize) here
+    if (dist > kMtWindowSize)
+    {
+      DistError = true;
+      return false;
+    }
+    if (Lim - Pos < len && !Grow(len))
+      return false;
+    UInt16 *dest = Buf + Pos;
+    const UInt16 *src = dest - dist;
+    Pos += len;
+    do
+      *dest++ = *src++;
+    while (--len);
+    return true;
+  }
+};
+
+
+/* CMtByteSink is used by the caller thread.
+   It keeps (kMtWindowSize) bytes of history in buffer after each flush. */
+
+class CMtByteSink
+{
+  Byte *_buf;
+  size_t _flushedPos;
+  size_t _bufLim;
+  UInt64 _limit;
+  ISequentialOutStream *_stream;
+
+  void SetLim()
+  {
+    Lim = _bufLim;
+    const UInt64 rem = _limit - WrittenSize;
+    if (rem < Lim - _flushedPos)
+      Lim = _flushedPos + (size_t)rem;
+  }
+
+  Z7_CLASS_NO_COPY(CMtByteSink)
+public:
+  size_t Pos;
+  size_t Lim;
+  UInt64 WrittenSize;
+  HRESULT WriteRes;
+  bool LimitReached;
+  bool DistError;
+
+  CMtByteSink(): _buf(NULL) {}
+  ~CMtByteSink() { ::MidFree(_buf); }
+
+  bool Alloc()
+  {
+    if (!_buf)
+      _buf = (Byte *)::MidAlloc(kMtWindowSize + kMtOutBufSize);
+    return _buf != NULL;
+  }
+
+  void Init(ISequentialOutStream *stream, UInt64 limit)
+  {
+    _stream = stream;
+    _limit = limit;
+    _bufLim = kMtWindowSize + kMtOutBufSize;
+    _flushedPos = 0;
+    Pos = 0;
+    WrittenSize = 0;
+    WriteRes = S_OK;
+    LimitReached = false;
+    DistError = false;
+    SetLim();
+  }
+
+  UInt64 GetProcessed() const { return WrittenSize + (Pos - _flushedPos); }
+
+  bool Flush()
+  {
+    if (WriteRes != S_OK)
+      return false;
+    const size_t size = Pos - _flushedPos;
+    if (size != 0)
+    {
+      WriteRes = WriteStream(_stream, _buf + _flushedPos, size);
+      if (WriteRes != S_OK)
+        return false;
+      WrittenSize += size;
+    }
+    size_t keep = Pos;
+    if (keep > kMtWindowSize)
+      keep = kMtWindowSize;
+    memmove(_buf, _buf + Pos - keep, keep);
+    Pos = keep;
+    _flushedPos = keep;
+    SetLim();
+    if (Pos == Lim)
+    {
+      LimitReached = true;
+      return false;
+    }
+    return true;
+  }
+
+  Z7_FORCE_INLINE
+  bool PutByte(unsigned b)
+  {
+    if (Pos == Lim && !Flush())
+      return false;
+    _buf[Pos++] = (Byte)b;
+    return true;
+  }
+
+  bool CopyMatch(UInt32 dist, unsigned len)
+  {
+    if (dist > Pos || dist > kMtWindowSize)
+    {
+      DistError = true;
+      return false;
+    }
+    do
+    {
+      if (Pos == Lim && !Flush())
+        return false;
+      _buf[Pos] = _buf[Pos - dist];
+      Pos++;
+    }
+    while (--len);
+    return true;
+  }
+
+  // it copies the history before current position to (window) of (kMtWindowSize) bytes
+  size_t GetWindow(Byte *window) const
+  {
+    size_t avail = Pos;
+    if (avail > kMtWindowSize)
+      avail = kMtWindowSize;
+    memcpy(window + kMtWindowSize - avail, _buf + Pos - avail, avail);
+    return avail;
+  }
+
+  bool WriteSymbols(const UInt16 *src, size_t size, const Byte *window)
+  {
+    while (size != 0)
+    {
+      if (Pos == Lim && !Flush())
+        return false;
+      size_t cur = Lim - Pos;
+      if (cur > size)
+        cur = size;
+      Byte *dest = _buf + Pos;
+      for (size_t i = 0; i < cur; i++)
+      {
+        const unsigned v = src[i];
+        dest[i] = (Byte)(v < 0x100 ? v : window[v - 0x100]);
+      }
+      Pos += cur;
+      src += cur;
+      size -= cur;
+    }
+    return true;
+  }
+};
+
+
+class CMtDecoderThread Z7_final: public CVirtThread, public CInChunkSource
+{
+  int DecodeFrom(UInt64 bitPos, bool strict);
+public:
+  const CInChunk *Chunks[2];
+  UInt64 ChunkIndex;
+  UInt64 JobIndex;  // (kMtNoJob), if the thread is not used for any chunk
+  bool IsRunning;
+
+  bool Found;
+  bool IsFinal;
+  UInt64 StartBit;
+  UInt64 EndBit;
+  size_t NumSymbols;
+
+  CBlockDecoder Inflater;
+  CMtSymbolSink Sink;
+
+  CMtDecoderThread(): JobIndex(kMtNoJob), IsRunning(false) {}
+  ~CMtDecoderThread() Z7_DESTRUCTOR_override { CVirtThread::WaitThreadFinish(); }
+  void Execute() Z7_override;
+  const CInChunk *GetChunk(UInt64 index) Z7_override
+  {
+    if (index == ChunkIndex)
+      return Chunks[0];
+    if (index == ChunkIndex + 1)
+      return Chunks[1];
+    return NULL;
+  }
+};
+
+
+enum
+{
+  k_Start_Found,
+  k_Start_NotFound,
+  k_Start_Stop  // there is no sense to search next positions
+};
+
+int CMtDecoderThread::DecodeFrom(UInt64 bitPos, bool strict)
+{
+  CBlockBitReader r;
+  if (!r.Init(this, ChunkIndex, bitPos) || !Sink.Init())
+    return k_Start_Stop;
+  const UInt64 regionEnd = (Chunks[0]->Offset + Chunks[0]->Size) << 3;
+  bool wasBlock = false;
+  int res;
+  for (;;)
+  {
+    res = Inflater.DecodeBlock(r, Sink, strict && !wasBlock);
+    if (res == k_Block_OK && r.ExtraBitsWereRead())
+      res = k_Block_Stop;
+    if (res != k_Block_OK)
+      break;
+    wasBlock = true;
+    EndBit = r.GetBitPos();
+    NumSymbols = Sink.Pos - kMtWindowSize;
+    IsFinal = Inflater.IsFinal;
+    if (IsFinal || EndBit >= regionEnd)
+      break;
+  }
+  if (!wasBlock)
+    return res == k_Block_Stop ? k_Start_Stop : k_Start_NotFound;
+  // the data error after some blocks is possible only for false start position
+  if (res == k_Block_Error && strict)
+    return k_Start_NotFound;
+  StartBit = bitPos;
+  Found = true;
+  return k_Start_Found;
+}
+
+
+void CMtDecoderThread::Execute()
+{
+  Found = false;
+  IsFinal = false;
+  const CInChunk &c = *Chunks[0];
+  const UInt64 startBit = c.Offset << 3;
+  if (ChunkIndex == 0)
+  {
+    DecodeFrom(startBit, false);
+    return;
+  }
+  const UInt64 endBit = (c.Offset + (c.Size < kMtSearchSize ? c.Size : kMtSearchSize)) << 3;
+  for (UInt64 bitPos = startBit; bitPos < endBit; bitPos++)
+  {
+    /* quick check of block header: (BTYPE == 2), (HLIT <= 29), (HDIST <= 29),
+       and the code for code lengths must be complete */
+    const size_t offset = (size_t)((bitPos >> 3) - c.Offset);
+    Byte buf[12];
+    for (unsigned i = 0; i < sizeof(buf); i++)
+    {
+      Byte b = 0;
+      if (offset + i < c.Size)
+        b = c.Data[offset + i];
+      else if (Chunks[1] && offset + i - c.Size < Chunks[1]->Size)
+        b = Chunks[1]->Data[offset + i - c.Size];
+      buf[i] = b;
+    }
+    const unsigned shift = (unsigned)bitPos & 7;
+    const UInt64 v = GetUi64(buf) >> shift;
+    if (((v >> 1) & 3) != NBlockType::kDynamicHuffman
+        || ((v >> 3) & 0x1F) > 29
+        || ((v >> 8) & 0x1F) > 29)
+      continue;
+    {
+      const unsigned numLevelCodes = (unsigned)((v >> 13) & 0xF) + kNumLevelCodesMin;
+      // the code lengths (19 * 3 bits) follow the header (17 bits)
+      const UInt64 v2 = (v >> 17) | ((UInt64)GetUi32(buf + 8) << (64 - 17 - shift));
+      UInt32 space = 0;
+      unsigned numCodes = 0;
+      for (unsigned i = 0; i < numLevelCodes; i++)
+      {
+        const unsigned len = (unsigned)(v2 >> (i * 3)) & 7;
+        if (len != 0)
+        {
+          space += (UInt32)1 << (7 - len);
+          numCodes++;
+        }
+      }
+      if (space != (1 << 7) && (numCodes != 1 || space != (1 << 6)))
+        continue;
+    }
+    const int res = DecodeFrom(bitPos, true);
+    if (res != k_Start_NotFound)
+      return;
+  }
+}
+
+
+class CInChunkReader Z7_final: public CInChunkSource
+{
+  CMtDecoder *_decoder;
+public:
+  CInChunkReader(CMtDecoder *decoder): _decoder(decoder) {}
+  const CInChunk *GetChunk(UInt64 index) Z7_override
+  {
+    CMtDecoder &d = *_decoder;
+    if (index < d._chunksBase)
+      return NULL;
+    while (index >= d._chunksBase + d._chunks.Size() && !d._inputFinished)
+      d.ReadChunk();
+    if (index >= d._chunksBase + d._chunks.Size())
+      return NULL;
+    return d._chunks[(unsigned)(index - d._chunksBase)];
+  }
+};
+
+
+CMtDecoder::CMtDecoder():
+    _chunksBase(0),
+    _numChunksRead(0),
+    _numWorkers(0),
+    _inStream(NULL),
+    _readRes(S_OK),
+    _inputFinished(false),
+    _unusedPos(0),
+    InSize(0),
+    InputEofError(false)
+    {}
+
+CMtDecoder::~CMtDecoder()
+{
+  CollectAllThreads();
+  FreeChunks();
+  FOR_VECTOR (i, _freeChunks)
+    delete _freeChunks[i];
+}
+
+
+void CMtDecoder::FreeChunks()
+{
+  FOR_VECTOR (i, _chunks)
+    _freeChunks.Add(_chunks[i]);
+  _chunks.Clear();
+}
+
+
+void CMtDecoder::ReleaseChunk(CInChunk *chunk)
+{
+  // we don't keep many free chunks
+  if (_freeChunks.Size() > _numWorkers + 2)
+    delete chunk;
+  else
+    _freeChunks.Add(chunk);
+}
+
+
+void CMtDecoder::ReadChunk()
+{
+  CInChunk *c;
+  if (_freeChunks.IsEmpty())
+  {
+    c = new CInChunk;
+    c->Data = (Byte *)::MidAlloc(kMtChunkSize);
+    if (!c->Data)
+    {
+      delete c;
+      _readRes = E_OUTOFMEMORY;
+      _inputFinished = true;
+      return;
+    }
+  }
+  else
+  {
+    c = _freeChunks.Back();
+    _freeChunks.DeleteBack();
+  }
+
+  size_t size = kMtChunkSize;
+  const HRESULT res = ReadStream(_inStream, c->Data, &size);
+  if (res != S_OK)
+  {
+    _freeChunks.Add(c);
+    _readRes = res;
+    _inputFinished = true;
+    return;
+  }
+  if (size != kMtChunkSize)
+    _inputFinished = true;
+  if (size == 0)
+    _freeChunks.Add(c);
+  else
+  {
+    c->Size = size;
+    c->Offset = _numChunksRead * kMtChunkSize;
+    _numChunksRead++;
+    _chunks.Add(c);
+  }
+
+  // the thread for chunk can be started, when next chunk is available
+  if (size != 0 && _numChunksRead >= 2)
+    StartThread(_numChunksRead - 2);
+  if (_inputFinished && _numChunksRead != 0)
+    StartThread(_numChunksRead - 1);
+}
+
+
+void CMtDecoder::StartThread(UInt64 chunkIndex)
+{
+  if (chunkIndex < _chunksBase || chunkIndex >= _numChunksRead)
+    return;
+  CMtDecoderThread &t = _threads[(unsigned)(chunkIndex % _numWorkers)];
+  // the thread is used for previous chunk that is not processed still
+  if (t.JobIndex != kMtNoJob)
+    return;
+  const unsigned index = (unsigned)(chunkIndex - _chunksBase);
+  t.Chunks[0] = _chunks[index];
+  t.Chunks[1] = (index + 1 < _chunks.Size()) ? _chunks[index + 1] : NULL;
+  t.ChunkIndex = chunkIndex;
+  if (t.Start() != 0)
+    return;
+  t.JobIndex = chunkIndex;
+  t.IsRunning = true;
+}
+
+
+void CMtDecoder::CollectThread(UInt64 chunkIndex)
+{
+  CMtDecoderThread &t = _threads[(unsigned)(chunkIndex % _numWorkers)];
+  if (t.JobIndex != chunkIndex)
+    return;
+  if (t.IsRunning)
+  {
+    t.WaitExecuteFinish();
+    t.IsRunning = false;
+  }
+  t.JobIndex = kMtNoJob;
+}
+
+
+void CMtDecoder::CollectAllThreads()
+{
+  FOR_VECTOR (i, _threads)
+  {
+    CMtDecoderThread &t = _threads[i];
+    if (t.IsRunning)
+    {
+      t.WaitExecuteFinish();
+      t.IsRunning = false;
+    }
+    t.JobIndex = kMtNoJob;
+  }
+}
+
+
+HRESULT CMtDecoder::Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+    const UInt64 *outSize, bool finishMode,
+    ICompressProgressInfo *progress,
+    UInt32 numThreads, UInt64 memUsage)
+{
+  InSize = 0;
+  InputEofError = false;
+  _unusedPos = 0;
+  FreeChunks();
+  _inStream = inStream;
+  _readRes = S_OK;
+  _inputFinished = false;
+  _chunksBase = 0;
+  _numChunksRead = 0;
+
+  {
+    // each thread uses the buffer for symbols and two chunks of input data
+    const UInt64 kMemPerThread = (UInt64)kMtNumSymbolsMax * 2 + kMtChunkSize * 3;
+    UInt64 numWorkers = numThreads;
+    if (numWorkers > kMtNumThreadsMax)
+      numWorkers = kMtNumThreadsMax;
+    if (numWorkers > memUsage / kMemPerThread)
+      numWorkers = memUsage / kMemPerThread;
+    if (numWorkers == 0)
+      numWorkers = 1;
+    while (_threads.Size() < numWorkers)
+    {
+      CMtDecoderThread &t = _threads.AddNew();
+      const WRes wres = t.Create();
+      if (wres != 0)
+      {
+        _threads.DeleteBack();
+        if (_threads.IsEmpty())
+          return HRESULT_FROM_WIN32(wres);
+        break;
+      }
+    }
+    if (numWorkers > _threads.Size())
+      numWorkers = _threads.Size();
+    _numWorkers = numWorkers;
+  }
+
+  CMtByteSink sink;
+  if (!sink.Alloc())
+    return E_OUTOFMEMORY;
+  sink.Init(outStream, outSize ? *outSize : (UInt64)(Int64)-1);
+
+  CBlockDecoder inflater;
+  CByteBuffer window(kMtWindowSize);
+  CInChunkReader reader(this);
+
+  HRESULT res = S_OK;
+  UInt64 pos = 0;  // the bit position of next block
+  UInt64 chunkIndex = 0;
+  bool streamFinished = false;
+
+  for (;;)
+  {
+    // we look for the chunk that contains (pos)
+    for (;;)
+    {
+      const CInChunk *c = reader.GetChunk(chunkIndex);
+      if (!c || (pos >> 3) < c->Offset + c->Size)
+        break;
+      if (!reader.GetChunk(chunkIndex + 1))
+        break;
+      chunkIndex++;
+    }
+
+    while (_chunksBase < chunkIndex)
+    {
+      CollectThread(_chunksBase);
+      ReleaseChunk(_chunks[0]);
+      _chunks.Delete(0);
+      _chunksBase++;
+    }
+
+    // we read next chunks for threads
+    while (!_inputFinished && _numChunksRead <= chunkIndex + _numWorkers)
+      ReadChunk();
+    {
+      UInt64 last = _numChunksRead;
+      if (!_inputFinished && last != 0)
+        last--;
+      for (UInt64 k = chunkIndex; k < last; k++)
+        StartThread(k);
+    }
+
+    const CMtDecoderThread *t = NULL;
+    {
+      CMtDecoderThread &t2 = _threads[(unsigned)(chunkIndex % _numWorkers)];
+      if (t2.JobIndex == chunkIndex)
+      {
+        if (t2.IsRunning)
+        {
+          t2.WaitExecuteFinish();
+          t2.IsRunning = false;
+        }
+        if (t2.Found)
+          t = &t2;
+      }
+    }
+
+    bool finished = false;
+    bool wasUsed = false;
+
+    if (t && t->StartBit == pos)
+    {
+      const UInt16 *symbols = t->Sink.Buf + kMtWindowSize;
+      const size_t avail = sink.GetWindow(window);
+      bool isOK = true;
+      if (avail != kMtWindowSize)
+      {
+        // the references before the start of stream are not allowed
+        const unsigned minSymbol = (unsigned)(0x100 + kMtWindowSize - avail);
+        for (size_t i = 0; i < t->NumSymbols; i++)
+        {
+          const unsigned v = symbols[i];
+          if (v >= 0x100 && v < minSymbol)
+          {
+            isOK = false;
+            break;
+          }
+        }
+      }
+      if (isOK)
+      {
+        wasUsed = true;
+        if (!sink.WriteSymbols(symbols, t->NumSymbols, window))
+          finished = true;
+        else
+        {
+          pos = t->EndBit;
+          finished = streamFinished = t->IsFinal;
+        }
+      }
+    }
+
+    if (!wasUsed)
+    {
+      // sequential decoding
+      const UInt64 target = (t && t->StartBit > pos) ? t->StartBit : (UInt64)(Int64)-1;
+      const CInChunk *c = reader.GetChunk(chunkIndex);
+      CBlockBitReader br;
+      if (!c || !br.Init(&reader, chunkIndex, pos))
+      {
+        InputEofError = true;
+        res = S_FALSE;
+        break;
+      }
+      const UInt64 regionEnd = (c->Offset + c->Size) << 3;
+      for (;;)
+      {
+        const int blockRes = inflater.DecodeBlock(br, sink, false);
+        if (br.ExtraBitsWereRead())
+        {
+          InputEofError = true;
+          res = S_FALSE;
+          break;
+        }
+        if (blockRes == k_Block_Stop)
+        {
+          finished = true;
+          break;
+        }
+        if (blockRes != k_Block_OK)
+        {
+          res = S_FALSE;
+          break;
+        }
+        pos = br.GetBitPos();
+        if (inflater.IsFinal)
+        {
+          finished = streamFinished = true;
+          break;
+        }
+        if (pos == target || pos >= regionEnd)
+          break;
+      }
+      if (res != S_OK)
+        break;
+    }
+
+    if (finished)
+      break;
+
+    if (progress)
+    {
+      const UInt64 inSize = pos >> 3;
+      const UInt64 outSize2 = sink.GetProcessed();
+      res = progress->SetRatioInfo(&inSize, &outSize2);
+      if (res != S_OK)
+        break;
+    }
+  }
+
+  CollectAllThreads();
+
+  if (sink.WriteRes == S_OK && !sink.LimitReached)
+    sink.Flush();
+  if (sink.WriteRes != S_OK)
+    return sink.WriteRes;
+  if (_readRes != S_OK)
+    return _readRes;
+
+  InSize = (pos + 7) >> 3;
+  if (InputEofError)
+    InSize = _numChunksRead == 0 ? 0 :
+        _chunks.Back()->Offset + _chunks.Back()->Size;
+  _unusedPos = InSize;
+
+  if (res == S_OK && sink.DistError)
+    res = S_FALSE;
+  if (res == S_OK && finishMode && outSize && !streamFinished)
+    res = S_FALSE;
+  return res;
+}
+
+
+UInt32 CMtDecoder::ReadUnused(void *data, UInt32 size)
+{
+  UInt32 processed = 0;
+  FOR_VECTOR (i, _chunks)
+  {
+    if (processed == size)
+      break;
+    const CInChunk &c = *_chunks[i];
+    if (_unusedPos < c.Offset || _unusedPos >= c.Offset + c.Size)
+      continue;
+    const size_t offset = (size_t)(_unusedPos - c.Offset);
+    size_t cur = c.Size - offset;
+    if (cur > size - processed)
+      cur = size - processed;
+    memcpy((Byte *)data + processed, c.Data + offset, cur);
+    processed += (UInt32)cur;
+    _unusedPos += cur;
+  }
+  return processed;
+}
+
+}}}
+
+#endif
@@ -0,0 +1,90 @@
+﻿// DeflateMtDecoder.h
+
+#ifndef ZIP7_INC_DEFLATE_MT_DECODER_H
+#define ZIP7_INC_DEFLATE_MT_DECODER_H
+
+#ifndef Z7_ST
+
+#include "../../Common/MyCom.h"
+#include "../../Common/MyVector.h"
+
+#include "../ICoder.h"
+
+namespace NCompress {
+namespace NDeflate {
+namespace NDecoder {
+
+/*
+CMtDecoder decodes one Deflate stream in several threads:
+  - the caller thread reads the input stream in big chunks.
+  - the thread for each chunk searches the start of Huffman block in
+    that chunk, and it decodes the blocks from that position with
+    unknown history window. The references to unknown window are
+    stored as special symbols.
+  - the caller thread checks that the start position found by thread
+    is same as the end position of previous data, it replaces the
+    references to unknown window by real bytes, and it writes the data
+    to output stream in the order of chunks.
+  - if the start of block was not found, or if it doesn't match the end
+    of previous data, the caller thread decodes that part of stream
+    sequentially.
+So the output data and the end position of stream are same as in
+sequential decoding.
+*/
+
+// CMtDecoder is not effective for smaller streams
+const UInt32 kMtStreamSizeMin = (UInt32)1 << 23;
+
+struct CInChunk;
+class CMtDecoderThread;
+
+class CMtDecoder
+{
+  CObjectVector<CMtDecoderThread> _threads;
+  CRecordVector<CInChunk *> _chunks;
+  CRecordVector<CInChunk *> _freeChunks;
+  UInt64 _chunksBase;    // the index of (_chunks[0])
+  UInt64 _numChunksRead;
+  UInt64 _numWorkers;
+
+  ISequentialInStream *_inStream;
+  HRESULT _readRes;
+  bool _inputFinished;
+
+  UInt64 _unusedPos;
+
+  void FreeChunks();
+  void ReleaseChunk(CInChunk *chunk);
+  void ReadChunk();
+  void StartThread(UInt64 chunkIndex);
+  void CollectThread(UInt64 chunkIndex);
+  void CollectAllThreads();
+
+  friend class CInChunkReader;
+public:
+  // the size of Deflate stream in input stream (the last byte can be partially used)
+  UInt64 InSize;
+  bool InputEofError;
+
+  CMtDecoder();
+  ~CMtDecoder();
+
+  /* it decodes Deflate stream from current position of (inStream).
+     if (outSize) is defined, it writes no more than (*outSize) bytes:
+       if (finishMode), the end of stream must be reached after (*outSize) bytes.
+       if (!finishMode), it stops after (*outSize) bytes.
+     It returns S_FALSE for data error. */
+  HRESULT Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+      const UInt64 *outSize, bool finishMode,
+      ICompressProgressInfo *progress,
+      UInt32 numThreads, UInt64 memUsage);
+
+  // it reads the data that was read from input stream after the end of Deflate stream
+  UInt32 ReadUnused(void *data, UInt32 size);
+};
+
+}}}
+
+#endif
+
+#endif
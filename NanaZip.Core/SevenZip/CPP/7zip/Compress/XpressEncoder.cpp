@@ -0,0 +1,291 @@
+﻿// XpressEncoder.cpp
+
+#include "StdAfx.h"
+
+#include <string.h>
+
+#include "../../../C/Alloc.h"
+#include "../../../C/CpuArch.h"
+#include "../../../C/HuffEnc.h"
+
+#include "XpressEncoder.h"
+
+namespace NCompress {
+namespace NXpress {
+
+static const unsigned kNumHuffBits = 15;
+static const unsigned kNumLenBits = 4;
+static const unsigned kLenMask = (1 << kNumLenBits) - 1;
+static const unsigned kNumPosSlots = 16;
+static const unsigned kNumSyms = 256 + (kNumPosSlots << kNumLenBits);
+static const unsigned kSymEnd = 256;
+
+static const unsigned kMatchMinLen = 3;
+static const UInt32 kMatchMaxLen = kMatchMinLen + 0xFFFF;
+
+static const unsigned kNumHashBits = 15;
+static const UInt32 kHashSize = (UInt32)1 << kNumHashBits;
+
+/* (_items) format:
+     literal : (byte << 16)
+     match   : ((len - kMatchMinLen) << 16) | dist, where (dist != 0) */
+
+static inline unsigned GetHighBitPos(UInt32 v)
+{
+  unsigned i = 0;
+  while (v >>= 1)
+    i++;
+  return i;
+}
+
+#define HASH_CALC(p) \
+    ((((UInt32)(p)[0] | ((UInt32)(p)[1] << 8) | ((UInt32)(p)[2] << 16)) * 0x9E3779B1) >> (32 - kNumHashBits))
+
+
+CEncoder::CEncoder():
+    _hash(NULL),
+    _son(NULL),
+    _items(NULL)
+{
+  SetLevel(5);
+}
+
+CEncoder::~CEncoder()
+{
+  MyFree(_hash);
+  MyFree(_son);
+  MyFree(_items);
+}
+
+
+void CEncoder::SetLevel(unsigned level)
+{
+  if (level < 1) level = 1;
+  if (level > 9) level = 9;
+  _cutValue = (UInt32)1 << (level + 1);
+  _niceLen = (level < 5 ? 32 : (level < 8 ? 64 : 258));
+  _lazy = (level >= 3);
+}
+
+
+bool CEncoder::Alloc()
+{
+  if (!_hash)
+    _hash = (UInt32 *)MyAlloc(kHashSize * sizeof(UInt32));
+  if (!_son)
+    _son = (UInt32 *)MyAlloc(kEncodeBlockSizeMax * sizeof(UInt32));
+  if (!_items)
+    _items = (UInt32 *)MyAlloc(kEncodeBlockSizeMax * sizeof(UInt32));
+  return _hash && _son && _items;
+}
+
+
+// the positions in hash chains are stored as (pos + 1), and 0 is empty item
+
+void CEncoder::Insert(const Byte *in, UInt32 pos, UInt32 size)
+{
+  if (pos + kMatchMinLen > size)
+    return;
+  const UInt32 h = HASH_CALC(in + pos);
+  _son[pos] = _hash[h];
+  _hash[h] = pos + 1;
+}
+
+
+UInt32 CEncoder::FindAndInsert(const Byte *in, UInt32 pos, UInt32 size, UInt32 &dist)
+{
+  if (pos + kMatchMinLen > size)
+    return 0;
+  const UInt32 h = HASH_CALC(in + pos);
+  UInt32 cur = _hash[h];
+  _son[pos] = cur;
+  _hash[h] = pos + 1;
+
+  UInt32 maxLen = size - pos;
+  if (maxLen > kMatchMaxLen)
+    maxLen = kMatchMaxLen;
+  UInt32 niceLen = _niceLen;
+  if (niceLen > maxLen)
+    niceLen = maxLen;
+  
+  const Byte *p = in + pos;
+  UInt32 bestLen = kMatchMinLen - 1;
+  
+  for (UInt32 cutValue = _cutValue; cur != 0 && cutValue != 0; cutValue--)
+  {
+    const UInt32 c = cur - 1;
+    cur = _son[c];
+    const Byte *s = in + c;
+    if (s[bestLen] != p[bestLen] || s[0] != p[0] || s[1] != p[1])
+      continue;
+    UInt32 len = 2;
+    while (len < maxLen && s[len] == p[len])
+      len++;
+    if (len > bestLen)
+    {
+      bestLen = len;
+      dist = pos - c;
+      if (len >= niceLen)
+        break;
+    }
+  }
+  return (bestLen >= kMatchMinLen) ? bestLen : 0;
+}
+
+
+/* The bits are written in 16-bit little-endian words, and the highest bit
+   is the first. The extra bytes for long matches are written to byte stream
+   between these 16-bit words at the position where the decoder reads them:
+   so we keep the positions of two next 16-bit words. */
+
+struct CBitWriter
+{
+  UInt32 _bitBuf;
+  unsigned _bitCount;
+  Byte *_nextBits;
+  Byte *_nextBits2;
+  Byte *_nextByte;
+
+  void Init(Byte *p)
+  {
+    _bitBuf = 0;
+    _bitCount = 0;
+    _nextBits = p;
+    _nextBits2 = p + 2;
+    _nextByte = p + 4;
+  }
+
+  void WriteBits(UInt32 val, unsigned numBits)
+  {
+    _bitBuf = (_bitBuf << numBits) | val;
+    _bitCount += numBits;
+    if (_bitCount > 16)
+    {
+      _bitCount -= 16;
+      SetUi16(_nextBits, (UInt16)(_bitBuf >> _bitCount))
+      _nextBits = _nextBits2;
+      _nextBits2 = _nextByte;
+      _nextByte += 2;
+    }
+  }
+
+  void WriteByte(unsigned b) { *_nextByte++ = (Byte)b; }
+  
+  void WriteUInt16(UInt32 v)
+  {
+    SetUi16(_nextByte, (UInt16)v)
+    _nextByte += 2;
+  }
+
+  Byte *Flush()
+  {
+    SetUi16(_nextBits, (UInt16)(_bitBuf << (16 - _bitCount)))
+    SetUi16(_nextBits2, 0)
+    return _nextByte;
+  }
+};
+
+
+size_t CEncoder::Encode(const Byte *in, size_t inSize, Byte *out)
+{
+  const UInt32 size = (UInt32)inSize;
+  UInt32 freqs[kNumSyms];
+  memset(freqs, 0, sizeof(freqs));
+  memset(_hash, 0, kHashSize * sizeof(UInt32));
+
+  UInt32 numItems = 0;
+  {
+    UInt32 pos = 0;
+    UInt32 len = 0;
+    UInt32 dist = 0;
+    bool haveMatch = false;
+    
+    while (pos < size)
+    {
+      if (!haveMatch)
+        len = FindAndInsert(in, pos, size, dist);
+      haveMatch = false;
+      
+      if (len == 0)
+      {
+        const unsigned b = in[pos++];
+        freqs[b]++;
+        _items[numItems++] = (UInt32)b << 16;
+        continue;
+      }
+      
+      UInt32 next = pos + 1;
+      if (_lazy && len < _niceLen)
+      {
+        UInt32 dist2 = 0;
+        const UInt32 len2 = FindAndInsert(in, next, size, dist2);
+        next++;
+        if (len2 > len)
+        {
+          const unsigned b = in[pos++];
+          freqs[b]++;
+          _items[numItems++] = (UInt32)b << 16;
+          len = len2;
+          dist = dist2;
+          haveMatch = true;
+          continue;
+        }
+      }
+      
+      {
+        const UInt32 lenCode = len - kMatchMinLen;
+        const unsigned distBits = GetHighBitPos(dist);
+        freqs[256 + (distBits << kNumLenBits) + (lenCode < kLenMask ? lenCode : kLenMask)]++;
+        _items[numItems++] = (lenCode << 16) | dist;
+      }
+      
+      const UInt32 end = pos + len;
+      for (; next < end; next++)
+        Insert(in, next, size);
+      pos = end;
+    }
+  }
+  
+  freqs[kSymEnd]++;
+  
+  UInt32 codes[kNumSyms];
+  Byte lens[kNumSyms];
+  Huffman_Generate(freqs, codes, lens, kNumSyms, kNumHuffBits);
+  
+  for (unsigned i = 0; i < kNumSyms / 2; i++)
+    out[i] = (Byte)(lens[(size_t)i * 2] | (lens[(size_t)i * 2 + 1] << 4));
+  
+  CBitWriter bw;
+  bw.Init(out + kNumSyms / 2);
+  
+  for (UInt32 i = 0; i < numItems; i++)
+  {
+    const UInt32 item = _items[i];
+    const UInt32 dist = item & 0xFFFF;
+    UInt32 lenCode = item >> 16;
+    if (dist == 0)
+    {
+      bw.WriteBits(codes[lenCode], lens[lenCode]);
+      continue;
+    }
+    const unsigned distBits = GetHighBitPos(dist);
+    const unsigned sym = 256 + (distBits << kNumLenBits) + (lenCode < kLenMask ? lenCode : kLenMask);
+    bw.WriteBits(codes[sym], lens[sym]);
+    if (lenCode >= kLenMask)
+    {
+      if (lenCode - kLenMask < 0xFF)
+        bw.WriteByte(lenCode - kLenMask);
+      else
+      {
+        bw.WriteByte(0xFF);
+        bw.WriteUInt16(lenCode);
+      }
+    }
+    bw.WriteBits(dist - ((UInt32)1 << distBits), distBits);
+  }
+  
+  bw.WriteBits(codes[kSymEnd], lens[kSymEnd]);
+  return (size_t)(bw.Flush() - out);
+}
+
+}}
@@ -0,0 +1,49 @@
+﻿// XpressEncoder.h
+
+#ifndef ZIP7_INC_XPRESS_ENCODER_H
+#define ZIP7_INC_XPRESS_ENCODER_H
+
+#include "../../Common/MyTypes.h"
+
+namespace NCompress {
+namespace NXpress {
+
+/*
+CEncoder encodes one independent block (chunk) of data in
+XPRESS Huffman format (as used in WIM archives).
+The data of block can be decoded with Decode_WithExceedWrite().
+*/
+
+const UInt32 kEncodeBlockSizeMax = (UInt32)1 << 16;
+
+// (out) buffer for Encode() must have this size:
+inline size_t GetEncodeOutBufSize(size_t inSize) { return 256 + inSize * 2 + 16; }
+
+class CEncoder
+{
+  UInt32 *_hash;
+  UInt32 *_son;
+  UInt32 *_items;
+  
+  UInt32 _cutValue;
+  UInt32 _niceLen;
+  bool _lazy;
+  
+  UInt32 FindAndInsert(const Byte *in, UInt32 pos, UInt32 size, UInt32 &dist);
+  void Insert(const Byte *in, UInt32 pos, UInt32 size);
+public:
+  CEncoder();
+  ~CEncoder();
+  
+  // level: [1, 9]
+  void SetLevel(unsigned level);
+  bool Alloc();
+  
+  /* (inSize <= kEncodeBlockSizeMax)
+     it returns the size of encoded data in (out) buffer. */
+  size_t Encode(const Byte *in, size_t inSize, Byte *out);
+};
+
+}}
+
+#endif
@@ -206,5 +206,25 @@ inputs:
 
 Z7_IFACE_CONSTR_STREAM(IStreamSetRestriction, 0x10)
 
+// **************** NanaZip Modification Start ****************
+/*
+IStreamGetMappedView::GetMappedView(const Byte **data, UInt64 *size)
+  It returns read-only view of stream data [0, size) mapped to memory.
+  So the caller can parse the data directly without Read() calls.
+  The view is valid while the stream object is alive.
+  The stream can be larger than (size), if file was changed after mapping.
+  The access to the view can raise EXCEPTION_IN_PAGE_ERROR,
+  if the file data can't be read. The caller must handle it.
+ returns:
+  - S_OK    : (*data) points to the view.
+  - S_FALSE : the stream is not mapped to memory, (*data) is NULL.
+*/
+
+#define Z7_IFACEM_IStreamGetMappedView(x) \
+  x(GetMappedView(const Byte **data, UInt64 *size)) \
+
+Z7_IFACE_CONSTR_STREAM(IStreamGetMappedView, 0x20)
+// **************** NanaZip Modification End ****************
+
 Z7_PURE_INTERFACES_END
 #endif
@@ -231,6 +231,11 @@ public:
         _In_ UINT32 NumProps) = 0;
 };
 
+typedef enum _SEVENZIP_CODER_PROPERTY_TYPE
+{
+    SevenZipCoderNumThreads = 13, // VT_UI4
+} SEVENZIP_CODER_PROPERTY_TYPE, *PSEVENZIP_CODER_PROPERTY_TYPE;
+
 MIDL_INTERFACE("23170F69-40C1-278A-0000-000400220000")
 ICompressSetDecoderProperties2 : public IUnknown
 {
@@ -11,6 +11,9 @@
 #include "../../Common/MyString.h"
 
 #include "../../Windows/FileIO.h"
+// **************** NanaZip Modification Start ****************
+#include "../../Windows/FileMapping.h"
+// **************** NanaZip Modification End ****************
 
 #include "../IStream.h"
 
@@ -30,9 +33,17 @@ class CInFileStream:
   public IStreamGetProps,
   public IStreamGetProps2,
   public IStreamGetProp,
+  // **************** NanaZip Modification Start ****************
+  public IStreamGetMappedView,
+  // **************** NanaZip Modification End ****************
   public CMyUnknownImp
 {
   NWindows::NFile::NIO::CInFile File;
+  // **************** NanaZip Modification Start ****************
+  // if (_view) is mapped, Read() and Seek() work with (_view) instead of (File)
+  NWindows::NFile::NIO::CInFileView _view;
+  UInt64 _viewPos;
+  // **************** NanaZip Modification End ****************
 public:
 
   #ifdef USE_WIN_FILE
@@ -81,20 +92,40 @@ public:
   bool Open(CFSTR fileName)
   {
     _info_WasLoaded = false;
+    // **************** NanaZip Modification Start ****************
+    _view.Close();
+    // **************** NanaZip Modification End ****************
     return File.Open(fileName);
   }
 
   bool OpenShared(CFSTR fileName, bool shareForWrite)
   {
     _info_WasLoaded = false;
+    // **************** NanaZip Modification Start ****************
+    _view.Close();
+    // **************** NanaZip Modification End ****************
     return File.OpenShared(fileName, shareForWrite);
   }
 
+  // **************** NanaZip Modification Start ****************
+  /*
+  MapView() maps the opened file to memory, if the size of file is in
+  [minSize, maxSize] range. It must be called after Open(),
+  while the stream is at position 0. If the function returns false,
+  the stream continues to work with usual file reading.
+  */
+  bool MapView(UInt64 minSize, UInt64 maxSize);
+  bool IsMapped() const { return _view.IsMapped(); }
+  // **************** NanaZip Modification End ****************
+
   MY_QUERYINTERFACE_BEGIN2(IInStream)
   MY_QUERYINTERFACE_ENTRY(IStreamGetSize)
   MY_QUERYINTERFACE_ENTRY(IStreamGetProps)
   MY_QUERYINTERFACE_ENTRY(IStreamGetProps2)
   MY_QUERYINTERFACE_ENTRY(IStreamGetProp)
+  // **************** NanaZip Modification Start ****************
+  MY_QUERYINTERFACE_ENTRY(IStreamGetMappedView)
+  // **************** NanaZip Modification End ****************
   MY_QUERYINTERFACE_END
   MY_ADDREF_RELEASE
 
@@ -106,6 +137,9 @@ public:
   STDMETHOD(GetProps2)(CStreamFileProps *props);
   STDMETHOD(GetProperty)(PROPID propID, PROPVARIANT *value);
   STDMETHOD(ReloadProps)();
+  // **************** NanaZip Modification Start ****************
+  STDMETHOD(GetMappedView)(const Byte **data, UInt64 *size);
+  // **************** NanaZip Modification End ****************
 };
 
 class CStdInFileStream:
@@ -140,4 +140,23 @@ STREAM_INTERFACE(IStreamGetProp, 0x0a)
   STDMETHOD(ReloadProps)() PURE;
 };
 
+// **************** NanaZip Modification Start ****************
+/*
+IStreamGetMappedView::GetMappedView(const Byte **data, UInt64 *size)
+  It returns read-only view of stream data [0, size) mapped to memory.
+  So the caller can parse the data directly without Read() calls.
+  The view is valid while the stream object is alive.
+  The access to the view can raise EXCEPTION_IN_PAGE_ERROR,
+  if the file data can't be read. The caller must handle it.
+ returns:
+  - S_OK    : (*data) points to the view.
+  - S_FALSE : the stream is not mapped to memory, (*data) is NULL.
+*/
+
+STREAM_INTERFACE(IStreamGetMappedView, 0x20)
+{
+  STDMETHOD(GetMappedView)(const Byte **data, UInt64 *size) PURE;
+};
+// **************** NanaZip Modification End ****************
+
 #endif
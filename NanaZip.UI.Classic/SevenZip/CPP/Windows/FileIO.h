@@ -340,6 +340,9 @@ public:
   off_t seekToCur() const throw();
   // bool SeekToBegin() throw();
   int my_fstat(struct stat *st) const  { return fstat(_handle, st); }
+  // **************** NanaZip Modification Start ****************
+  int GetHandle() const { return _handle; }
+  // **************** NanaZip Modification End ****************
   /*
   int my_ioctl_BLKGETSIZE64(unsigned long long *val);
   int GetDeviceSize_InBytes(UInt64 &size);
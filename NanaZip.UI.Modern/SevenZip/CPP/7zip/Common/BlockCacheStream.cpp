@@ -0,0 +1,251 @@
+﻿// BlockCacheStream.cpp
+
+#include "StdAfx.h"
+
+#include <string.h>
+
+#include "StreamUtils.h"
+
+#include "BlockCacheStream.h"
+
+using namespace NWindows;
+using namespace NSynchronization;
+
+static const unsigned kNumBlocksMax = (unsigned)1 << 16;
+
+void CBlockCache::Init(unsigned blockSizeLog, UInt64 cacheSize)
+{
+  _blockSizeLog = blockSizeLog;
+  UInt64 numBlocks = cacheSize >> blockSizeLog;
+  if (numBlocks == 0)
+    numBlocks = 1;
+  if (numBlocks > kNumBlocksMax)
+    numBlocks = kNumBlocksMax;
+  _numBlocksMax = (unsigned)numBlocks;
+  _blocks.ClearAndReserve(_numBlocksMax);
+  _bufs.Clear();
+  unsigned hashSize = 1;
+  while (hashSize < _numBlocksMax * 2)
+    hashSize <<= 1;
+  _hash.ClearAndSetSize(hashSize);
+  for (unsigned i = 0; i < hashSize; i++)
+    _hash[i] = -1;
+  _useCounter = 0;
+  _numHits = 0;
+  _numMisses = 0;
+}
+
+
+UInt32 CBlockCache::AddStream()
+{
+  CCriticalSectionLock lock(_cs);
+  return ++_numStreams;
+}
+
+
+int CBlockCache::FindBlock(UInt32 streamId, UInt64 blockIndex) const
+{
+  for (int i = _hash[GetHashIndex(streamId, blockIndex)]; i >= 0;)
+  {
+    const CBlock &b = _blocks[(unsigned)i];
+    if (b.BlockIndex == blockIndex && b.StreamId == streamId)
+      return i;
+    i = b.Next;
+  }
+  return -1;
+}
+
+
+unsigned CBlockCache::AllocBlock(UInt32 streamId, UInt64 blockIndex)
+{
+  unsigned index;
+  if (_blocks.Size() < _numBlocksMax)
+  {
+    index = _blocks.Size();
+    _blocks.AddInReserved(CBlock());
+    _bufs.AddNew().Alloc((size_t)1 << _blockSizeLog);
+  }
+  else
+  {
+    // we replace the least recently used block
+    index = 0;
+    for (unsigned i = 1; i < _blocks.Size(); i++)
+      if (_blocks[i].LastUse < _blocks[index].LastUse)
+        index = i;
+    const CBlock &old = _blocks[index];
+    int *link = &_hash[GetHashIndex(old.StreamId, old.BlockIndex)];
+    while (*link != (int)index)
+      link = &_blocks[(unsigned)*link].Next;
+    *link = old.Next;
+  }
+  CBlock &b = _blocks[index];
+  b.StreamId = streamId;
+  b.BlockIndex = blockIndex;
+  b.Size = 0;
+  int &head = _hash[GetHashIndex(streamId, blockIndex)];
+  b.Next = head;
+  head = (int)index;
+  return index;
+}
+
+
+Int64 CBlockCache::ReadBlock(UInt32 streamId, UInt64 blockIndex, size_t offset, void *data, size_t size)
+{
+  CCriticalSectionLock lock(_cs);
+  const int index = FindBlock(streamId, blockIndex);
+  if (index < 0)
+  {
+    _numMisses++;
+    return -1;
+  }
+  _numHits++;
+  CBlock &b = _blocks[(unsigned)index];
+  b.LastUse = ++_useCounter;
+  if (offset >= b.Size)
+    return 0;
+  const size_t rem = b.Size - offset;
+  if (size > rem)
+    size = rem;
+  memcpy(data, _bufs[(unsigned)index] + offset, size);
+  return (Int64)size;
+}
+
+
+void CBlockCache::AddBlock(UInt32 streamId, UInt64 blockIndex, const Byte *data, size_t size)
+{
+  CCriticalSectionLock lock(_cs);
+  int index = FindBlock(streamId, blockIndex);
+  if (index < 0)
+    index = (int)AllocBlock(streamId, blockIndex);
+  CBlock &b = _blocks[(unsigned)index];
+  b.LastUse = ++_useCounter;
+  b.Size = (UInt32)size;
+  memcpy(_bufs[(unsigned)index], data, size);
+}
+
+
+void CBlockCache::GetStat(UInt64 &numHits, UInt64 &numMisses)
+{
+  CCriticalSectionLock lock(_cs);
+  numHits = _numHits;
+  numMisses = _numMisses;
+}
+
+
+
+HRESULT CBlockCacheInStream::Init(IInStream *stream, CBlockCache *cache)
+{
+  _stream = stream;
+  _cacheSpec = cache;
+  _cache = cache;
+  _streamId = cache->AddStream();
+  _buf.Alloc((size_t)1 << cache->GetBlockSizeLog());
+  _pos = 0;
+  return stream->Seek(0, STREAM_SEEK_END, &_size);
+}
+
+
+HRESULT CBlockCacheInStream::ReadAt_Locked(UInt64 pos, void *data, UInt32 size, UInt32 *processedSize)
+{
+  if (processedSize)
+    *processedSize = 0;
+  if (size == 0 || pos >= _size)
+    return S_OK;
+  {
+    const UInt64 rem = _size - pos;
+    if (size > rem)
+      size = (UInt32)rem;
+  }
+
+  const unsigned blockSizeLog = _cacheSpec->GetBlockSizeLog();
+  const size_t blockSize = (size_t)1 << blockSizeLog;
+
+  while (size != 0)
+  {
+    const UInt64 blockIndex = pos >> blockSizeLog;
+    const size_t offset = (size_t)pos & (blockSize - 1);
+    size_t cur = blockSize - offset;
+    if (cur > size)
+      cur = size;
+
+    if (offset == 0 && size >= blockSize)
+    {
+      /* the reads of whole blocks are passed to (_stream) directly.
+         Such data is usually read only once, so it's not copied to cache. */
+      cur = (size_t)size & ~(blockSize - 1);
+      RINOK(_stream->Seek((Int64)pos, STREAM_SEEK_SET, NULL));
+      RINOK(ReadStream(_stream, data, &cur));
+    }
+    else
+    {
+      const Int64 res = _cacheSpec->ReadBlock(_streamId, blockIndex, offset, data, cur);
+      if (res >= 0)
+        cur = (size_t)res;
+      else
+      {
+        const UInt64 blockPos = blockIndex << blockSizeLog;
+        size_t blockRem = blockSize;
+        if (blockRem > _size - blockPos)
+          blockRem = (size_t)(_size - blockPos);
+        RINOK(_stream->Seek((Int64)blockPos, STREAM_SEEK_SET, NULL));
+        RINOK(ReadStream(_stream, _buf, &blockRem));
+        _cacheSpec->AddBlock(_streamId, blockIndex, _buf, blockRem);
+        if (offset >= blockRem)
+          cur = 0;
+        else
+        {
+          if (cur > blockRem - offset)
+            cur = blockRem - offset;
+          memcpy(data, _buf + offset, cur);
+        }
+      }
+    }
+
+    if (cur == 0)
+      break;
+    if (processedSize)
+      *processedSize += (UInt32)cur;
+    data = (void *)((Byte *)data + cur);
+    pos += cur;
+    size -= (UInt32)cur;
+  }
+  return S_OK;
+}
+
+
+HRESULT CBlockCacheInStream::ReadAt(UInt64 pos, void *data, UInt32 size, UInt32 *processedSize)
+{
+  CCriticalSectionLock lock(_cs);
+  return ReadAt_Locked(pos, data, size, processedSize);
+}
+
+
+STDMETHODIMP CBlockCacheInStream::Read(void *data, UInt32 size, UInt32 *processedSize)
+{
+  CCriticalSectionLock lock(_cs);
+  UInt32 processed = 0;
+  const HRESULT res = ReadAt_Locked(_pos, data, size, &processed);
+  _pos += processed;
+  if (processedSize)
+    *processedSize = processed;
+  return res;
+}
+
+
+STDMETHODIMP CBlockCacheInStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition)
+{
+  CCriticalSectionLock lock(_cs);
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _pos; break;
+    case STREAM_SEEK_END: offset += _size; break;
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _pos = (UInt64)offset;
+  if (newPosition)
+    *newPosition = (UInt64)offset;
+  return S_OK;
+}
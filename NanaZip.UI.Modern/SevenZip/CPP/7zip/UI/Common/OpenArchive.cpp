@@ -18,6 +18,9 @@
 #include "../../../Common/Wildcard.h"
 
 #include "../../../Windows/FileDir.h"
+// **************** NanaZip Modification Start ****************
+#include "../../../Windows/FileName.h"
+// **************** NanaZip Modification End ****************
 
 #include "../../Common/FileStreams.h"
 #include "../../Common/LimitedStreams.h"
@@ -3087,6 +3090,45 @@ HRESULT CArc::OpenStream(const COpenOptions &op)
 
 #endif
 
+// **************** NanaZip Modification Start ****************
+/*
+We map the archive file to memory, if it's local file.
+The handlers can read the headers directly from the mapping
+via IStreamGetMappedView, and usual Read() calls are served
+from the mapping without system calls.
+The files on network and removable drives are not mapped,
+because the access to mapping raises exception, if the drive is lost.
+The handlers that read the mapping directly must catch such exception.
+*/
+static const UInt64 k_MapView_MinSize = (UInt64)1 << 16;
+static const UInt64 k_MapView_MaxSize = (UInt64)1 << (sizeof(size_t) > 4 ? 40 : 28);
+
+static bool IsMapView_Allowed(const UString &path)
+{
+ #ifdef _WIN32
+  #ifdef UNDER_CE
+  UNUSED_VAR(path)
+  return false;
+  #else
+  FString fullPath;
+  if (!NFile::NName::GetFullPath(us2fs(path), fullPath))
+    return false;
+  /* the folder on fixed drive can be mount point of another volume.
+     So we check the type of volume that contains the file */
+  const UString fullPathU = fs2us(fullPath);
+  WCHAR root[MAX_PATH + 1];
+  if (!::GetVolumePathNameW(fullPathU, root, MAX_PATH + 1))
+    return false;
+  return ::GetDriveTypeW(root) == DRIVE_FIXED;
+  #endif
+ #else
+  // CInFileStream::MapView() maps only regular files
+  UNUSED_VAR(path)
+  return true;
+ #endif
+}
+// **************** NanaZip Modification End ****************
+
 HRESULT CArc::OpenStreamOrFile(COpenOptions &op)
 {
   CMyComPtr<IInStream> fileStream;
@@ -3105,6 +3147,10 @@ HRESULT CArc::OpenStreamOrFile(COpenOptions &op)
     Path = filePath;
     if (!fileStreamSpec->Open(us2fs(Path)))
       return GetLastError_noZero_HRESULT();
+    // **************** NanaZip Modification Start ****************
+    if (IsMapView_Allowed(Path))
+      fileStreamSpec->MapView(k_MapView_MinSize, k_MapView_MaxSize);
+    // **************** NanaZip Modification End ****************
     op.stream = fileStream;
     #ifdef _SFX
     IgnoreSplit = true;
@@ -3202,6 +3248,10 @@ void CArchiveLink::Release()
   NonOpen_ArcPath.Empty();
   while (!Arcs.IsEmpty())
     Arcs.DeleteBack();
+  // **************** NanaZip Modification Start ****************
+  BlockCache.Release();
+  BlockCacheSpec = NULL;
+  // **************** NanaZip Modification End ****************
 }
 
 /*
@@ -3233,6 +3283,28 @@ void CArchiveLink::Set_ErrorsText()
 }
 */
 
+// **************** NanaZip Modification Start ****************
+#ifndef _SFX
+static const unsigned kBlockCache_BlockSizeLog = 16;
+static const UInt64 kBlockCache_Size = (UInt64)1 << 25;
+
+// the handlers of disk images and partition tables
+// that give random access stream for nested archive
+static const char * const k_BlockCache_Formats[] =
+{
+    "vhd"
+  , "vhdx"
+  , "vmdk"
+  , "vdi"
+  , "qcow"
+  , "dmg"
+  , "mbr"
+  , "gpt"
+  , "apm"
+};
+#endif
+// **************** NanaZip Modification End ****************
+
 HRESULT CArchiveLink::Open(COpenOptions &op)
 {
   Release();
@@ -3345,6 +3417,29 @@ HRESULT CArchiveLink::Open(COpenOptions &op)
     if (subSeqStream.QueryInterface(IID_IInStream, &subStream) != S_OK || !subStream)
       break;
 
+    // **************** NanaZip Modification Start ****************
+    /* the handler of nested archive usually reads small records at random
+       positions, and each such read goes through all the outer levels.
+       So we read the data of the outer image levels via the shared block cache. */
+    #ifndef _SFX
+    if (arc.FormatIndex >= 0
+        && IsNameFromList(op.codecs->Formats[(unsigned)arc.FormatIndex].Name,
+            k_BlockCache_Formats, ARRAY_SIZE(k_BlockCache_Formats)))
+    {
+      if (!BlockCache)
+      {
+        BlockCacheSpec = new CBlockCache;
+        BlockCache = BlockCacheSpec;
+        BlockCacheSpec->Init(kBlockCache_BlockSizeLog, kBlockCache_Size);
+      }
+      CBlockCacheInStream *cacheStreamSpec = new CBlockCacheInStream;
+      CMyComPtr<IInStream> cacheStream = cacheStreamSpec;
+      RINOK(cacheStreamSpec->Init(subStream, BlockCacheSpec));
+      subStream = cacheStream;
+    }
+    #endif
+    // **************** NanaZip Modification End ****************
+
     CArc arc2;
     RINOK(arc.GetItem_Path(mainSubfile, arc2.Path));
 
@@ -5,6 +5,10 @@
 
 #include "../../../Windows/PropVariant.h"
 
+// **************** NanaZip Modification Start ****************
+#include "../../Common/BlockCacheStream.h"
+// **************** NanaZip Modification End ****************
+
 #include "ArchiveOpenCallback.h"
 #include "LoadCodecs.h"
 #include "Property.h"
@@ -405,6 +409,13 @@ struct CArchiveLink
 
   CArcErrorInfo NonOpen_ErrorInfo;
 
+  // **************** NanaZip Modification Start ****************
+  /* the block cache shared by the streams of nested archives
+     (VHDX -> GPT -> NTFS). It's created only if there is nested archive. */
+  CBlockCache *BlockCacheSpec;
+  CMyComPtr<IUnknown> BlockCache;
+  // **************** NanaZip Modification End ****************
+
   // UString ErrorsText;
   // void Set_ErrorsText();
 
@@ -412,6 +423,9 @@ struct CArchiveLink
       VolumesSize(0),
       IsOpen(false),
       PasswordWasAsked(false)
+      // **************** NanaZip Modification Start ****************
+      , BlockCacheSpec(NULL)
+      // **************** NanaZip Modification End ****************
       {}
 
   void KeepModeForNextOpen();
@@ -0,0 +1,105 @@
+﻿// BlockCacheStream.h
+
+#ifndef ZIP7_INC_BLOCK_CACHE_STREAM_H
+#define ZIP7_INC_BLOCK_CACHE_STREAM_H
+
+#include "../../Common/MyBuffer.h"
+#include "../../Common/MyCom.h"
+#include "../../Common/MyVector.h"
+
+#include "../../Windows/Synchronization.h"
+
+#include "../IStream.h"
+
+/*
+CBlockCache is size-bounded LRU cache of fixed-size blocks.
+One CBlockCache object can be shared by several CBlockCacheInStream objects.
+Each stream uses its own (streamId) for the blocks in the cache.
+Memory for blocks is allocated only when a block is used for first time.
+All public methods are thread-safe.
+The cache doesn't call any stream while it holds its lock, so
+a stream that reads from another stream that uses the same cache is allowed.
+*/
+
+Z7_CLASS_IMP_COM_0(
+  CBlockCache
+)
+  struct CBlock
+  {
+    UInt64 BlockIndex;
+    UInt64 LastUse;
+    UInt32 StreamId;
+    UInt32 Size;
+    int Next;
+  };
+
+  NWindows::NSynchronization::CCriticalSection _cs;
+  CRecordVector<CBlock> _blocks;
+  CObjectVector<CByteBuffer> _bufs;
+  CRecordVector<int> _hash;
+  unsigned _blockSizeLog;
+  unsigned _numBlocksMax;
+  UInt32 _numStreams;
+  UInt64 _useCounter;
+  UInt64 _numHits;
+  UInt64 _numMisses;
+
+  unsigned GetHashIndex(UInt32 streamId, UInt64 blockIndex) const
+  {
+    const UInt64 v = (blockIndex ^ ((UInt64)streamId << 40)) * 0x9E3779B97F4A7C15;
+    return (unsigned)(v >> 32) & (_hash.Size() - 1);
+  }
+  int FindBlock(UInt32 streamId, UInt64 blockIndex) const;
+  unsigned AllocBlock(UInt32 streamId, UInt64 blockIndex);
+public:
+  CBlockCache():
+      _blockSizeLog(0),
+      _numBlocksMax(0),
+      _numStreams(0),
+      _useCounter(0),
+      _numHits(0),
+      _numMisses(0)
+      {}
+
+  // it must be called before any other call
+  void Init(unsigned blockSizeLog, UInt64 cacheSize);
+
+  unsigned GetBlockSizeLog() const { return _blockSizeLog; }
+  UInt32 AddStream();
+
+  // returns the number of bytes copied from the cached block, or (-1), if there is no such block.
+  Int64 ReadBlock(UInt32 streamId, UInt64 blockIndex, size_t offset, void *data, size_t size);
+  void AddBlock(UInt32 streamId, UInt64 blockIndex, const Byte *data, size_t size);
+
+  void GetStat(UInt64 &numHits, UInt64 &numMisses);
+};
+
+
+/*
+CBlockCacheInStream reads (_stream) through (CBlockCache).
+The data of (_stream) must not be changed while CBlockCacheInStream is used.
+Read() and Seek() calls are serialized. ReadAt() doesn't change the position,
+so it can be called from several threads.
+The reads of whole aligned blocks bypass the cache.
+*/
+
+Z7_CLASS_IMP_IInStream(
+  CBlockCacheInStream
+)
+  NWindows::NSynchronization::CCriticalSection _cs;
+  CMyComPtr<IInStream> _stream;
+  CBlockCache *_cacheSpec;
+  CMyComPtr<IUnknown> _cache;
+  CByteBuffer _buf;
+  UInt64 _size;
+  UInt64 _pos;
+  UInt32 _streamId;
+
+  HRESULT ReadAt_Locked(UInt64 pos, void *data, UInt32 size, UInt32 *processedSize);
+public:
+  CBlockCacheInStream(): _cacheSpec(NULL), _size(0), _pos(0), _streamId(0) {}
+  HRESULT Init(IInStream *stream, CBlockCache *cache);
+  HRESULT ReadAt(UInt64 pos, void *data, UInt32 size, UInt32 *processedSize);
+};
+
+#endif
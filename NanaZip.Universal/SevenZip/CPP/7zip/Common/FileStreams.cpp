@@ -66,6 +66,9 @@ static const UInt32 kClusterSize = 1 << 18;
 #endif
 
 CInFileStream::CInFileStream():
+  // **************** NanaZip Modification Start ****************
+  _viewPos(0),
+  // **************** NanaZip Modification End ****************
  #ifdef Z7_DEVICE_FILE
   VirtPos(0),
   PhyPos(0),
@@ -95,10 +98,90 @@ CInFileStream::~CInFileStream()
     Callback->InFileStream_On_Destroy(this, CallbackRef);
 }
 
+// **************** NanaZip Modification Start ****************
+#if defined(_WIN32) && defined(_MSC_VER)
+/* the access to mapped view raises EXCEPTION_IN_PAGE_ERROR,
+   if the file data can't be read (network error, or file was truncated) */
+static bool CopyFromView(void *dest, const Byte *src, size_t size) throw()
+{
+  __try
+  {
+    memcpy(dest, src, size);
+  }
+  __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+      EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+  {
+    return false;
+  }
+  return true;
+}
+#else
+static inline bool CopyFromView(void *dest, const Byte *src, size_t size) throw()
+{
+  memcpy(dest, src, size);
+  return true;
+}
+#endif
+
+bool CInFileStream::MapView(UInt64 minSize, UInt64 maxSize)
+{
+  _view.Close();
+  _viewPos = 0;
+ #ifdef Z7_DEVICE_FILE
+  if (File.IsDeviceFile)
+    return false;
+ #endif
+ #ifndef _WIN32
+  struct stat st;
+  if (File.my_fstat(&st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+ #endif
+  UInt64 size;
+  if (!File.GetLength(size) || size < minSize || size > maxSize)
+    return false;
+  return _view.Map(File, size);
+}
+
+Z7_COM7F_IMF(CInFileStream::GetMappedView(const Byte **data, UInt64 *size))
+{
+  *data = _view.GetData();
+  *size = _view.GetSize();
+  return _view.IsMapped() ? S_OK : S_FALSE;
+}
+// **************** NanaZip Modification End ****************
+
 Z7_COM7F_IMF(CInFileStream::Read(void *data, UInt32 size, UInt32 *processedSize))
 {
   // printf("\nCInFileStream::Read size=%d, VirtPos=%8d\n", (unsigned)size, (int)VirtPos);
 
+  // **************** NanaZip Modification Start ****************
+  if (_view.IsMapped())
+  {
+    if (processedSize)
+      *processedSize = 0;
+    const size_t viewSize = _view.GetSize();
+    if (_viewPos >= viewSize)
+      return S_OK;
+    const size_t rem = viewSize - (size_t)_viewPos;
+    if (size > rem)
+      size = (UInt32)rem;
+    if (!CopyFromView(data, _view.GetData() + (size_t)_viewPos, size))
+    {
+     #ifdef _WIN32
+      if (Callback)
+        return Callback->InFileStream_On_Error(CallbackRef, ERROR_READ_FAULT);
+      return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+     #else
+      return E_FAIL;
+     #endif
+    }
+    _viewPos += size;
+    if (processedSize)
+      *processedSize = size;
+    return S_OK;
+  }
+  // **************** NanaZip Modification End ****************
+
   #ifdef Z7_FILE_STREAMS_USE_WIN_FILE
   
   #ifdef Z7_DEVICE_FILE
@@ -360,6 +443,25 @@ Z7_COM7F_IMF(CInFileStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPos
   if (seekOrigin >= 3)
     return STG_E_INVALIDFUNCTION;
 
+  // **************** NanaZip Modification Start ****************
+  if (_view.IsMapped())
+  {
+    switch (seekOrigin)
+    {
+      case STREAM_SEEK_SET: break;
+      case STREAM_SEEK_CUR: offset += (Int64)_viewPos; break;
+      case STREAM_SEEK_END: offset += (Int64)_view.GetSize(); break;
+      default: return STG_E_INVALIDFUNCTION;
+    }
+    if (offset < 0)
+      return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+    _viewPos = (UInt64)offset;
+    if (newPosition)
+      *newPosition = (UInt64)offset;
+    return S_OK;
+  }
+  // **************** NanaZip Modification End ****************
+
   #ifdef Z7_FILE_STREAMS_USE_WIN_FILE
 
   #ifdef Z7_DEVICE_FILE
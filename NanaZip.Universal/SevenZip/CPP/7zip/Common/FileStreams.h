@@ -11,6 +11,9 @@
 #include "../../Common/MyString.h"
 
 #include "../../Windows/FileIO.h"
+// **************** NanaZip Modification Start ****************
+#include "../../Windows/FileMapping.h"
+// **************** NanaZip Modification End ****************
 
 #include "../IStream.h"
 
@@ -44,15 +47,21 @@ Z7_class_final(CInFileStream) :
   public IStreamGetProps,
   public IStreamGetProps2,
   public IStreamGetProp,
+  // **************** NanaZip Modification Start ****************
+  public IStreamGetMappedView,
+  // **************** NanaZip Modification End ****************
   public CMyUnknownImp
 {
-  Z7_COM_UNKNOWN_IMP_6(
+  // **************** NanaZip Modification Start ****************
+  Z7_COM_UNKNOWN_IMP_7(
       IInStream,
       ISequentialInStream,
       IStreamGetSize,
       IStreamGetProps,
       IStreamGetProps2,
-      IStreamGetProp)
+      IStreamGetProp,
+      IStreamGetMappedView)
+  // **************** NanaZip Modification End ****************
 
   Z7_IFACE_COM7_IMP(ISequentialInStream)
   Z7_IFACE_COM7_IMP(IInStream)
@@ -63,9 +72,17 @@ private:
 public:
   Z7_IFACE_COM7_IMP(IStreamGetProps2)
   Z7_IFACE_COM7_IMP(IStreamGetProp)
+  // **************** NanaZip Modification Start ****************
+  Z7_IFACE_COM7_IMP(IStreamGetMappedView)
+  // **************** NanaZip Modification End ****************
 
 private:
   NWindows::NFile::NIO::CInFile File;
+  // **************** NanaZip Modification Start ****************
+  // if (_view) is mapped, Read() and Seek() work with (_view) instead of (File)
+  NWindows::NFile::NIO::CInFileView _view;
+  UInt64 _viewPos;
+  // **************** NanaZip Modification End ****************
 public:
 
   #ifdef Z7_FILE_STREAMS_USE_WIN_FILE
@@ -117,14 +134,31 @@ public:
   bool Open(CFSTR fileName)
   {
     _info_WasLoaded = false;
+    // **************** NanaZip Modification Start ****************
+    _view.Close();
+    // **************** NanaZip Modification End ****************
     return File.Open(fileName);
   }
   
   bool OpenShared(CFSTR fileName, bool shareForWrite)
   {
     _info_WasLoaded = false;
+    // **************** NanaZip Modification Start ****************
+    _view.Close();
+    // **************** NanaZip Modification End ****************
     return File.OpenShared(fileName, shareForWrite);
   }
+
+  // **************** NanaZip Modification Start ****************
+  /*
+  MapView() maps the opened file to memory, if the size of file is in
+  [minSize, maxSize] range. It must be called after Open(),
+  while the stream is at position 0. If the function returns false,
+  the stream continues to work with usual file reading.
+  */
+  bool MapView(UInt64 minSize, UInt64 maxSize);
+  bool IsMapped() const { return _view.IsMapped(); }
+  // **************** NanaZip Modification End ****************
 };
 
 // bool CreateStdInStream(CMyComPtr<ISequentialInStream> &str);
@@ -183,6 +183,9 @@ namespace NCoderPropID
     kLdmHashRateLog,    // VT_UI4 The default value is wlog - ldmhlog.
     kAdvMax,            // VT_BOOL 1=ZSTD --max (advanced max compression)
     // **************** 7-Zip ZS Modification End ****************
+    // **************** NanaZip Modification Start ****************
+    kDictionary,        // VT_BSTR path of the zstd dictionary file (zstd -D)
+    // **************** NanaZip Modification End ****************
     k_NUM_DEFINED
   };
 }
@@ -211,6 +211,9 @@ enum Enum
 
   // **************** NanaZip Modification Start ****************
   kOpenFolder,
+  kListCacheDir,
+  kWriteThreads,
+  kScanThreads,
   // **************** NanaZip Modification End ****************
 
   kDeleteAfterCompressing,
@@ -370,6 +373,9 @@ static const CSwitchForm kSwitchForms[] =
   
   // **************** NanaZip Modification Start ****************
   { "sre", SWFRM_MINUS },
+  { "slc", SWFRM_STRING_SINGL(1) },
+  { "swt", SWFRM_STRING_SINGL(1) },
+  { "sdt", SWFRM_STRING_SINGL(1) },
   // **************** NanaZip Modification End ****************
   
   { "sdel", SWFRM_SIMPLE },
@@ -1402,6 +1408,30 @@ static void SetBoolPair(NCommandLineParser::CParser &parser, unsigned switchID,
 }
 
 
+// **************** NanaZip Modification Start ****************
+// -sdt{N} : the number of threads that read directories while scanning
+static UInt32 GetNumScanThreads(const NCommandLineParser::CParser &parser)
+{
+  if (!parser[NKey::kScanThreads].ThereIs)
+    return 0;
+  const UString &s = parser[NKey::kScanThreads].PostStrings[0];
+  UInt32 v;
+  if (!StringToUInt32(s, v))
+    throw CArcCmdLineException("Unsupported switch postfix -sdt", s);
+  return v;
+}
+
+// "mt", "mt4", "mt=4" and "mt=off" set the number of threads, but "mtc", "mtm", "mta" are other properties
+static bool IsNumThreadsPropName(const UString &name)
+{
+  if (!name.IsPrefixedBy_Ascii_NoCase("mt"))
+    return false;
+  const wchar_t c = name.Ptr()[2];
+  return c == 0 || c == '=' || (c >= '0' && c <= '9');
+}
+// **************** NanaZip Modification End ****************
+
+
 static bool ParseSizeString(const wchar_t *s, UInt64 &res)
 {
   const wchar_t *end;
@@ -1493,6 +1523,8 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
     options.OpenFolder.Def = true;
     options.OpenFolder.Val = !parser[NKey::kOpenFolder].WithMinus;
   }
+  if (parser[NKey::kListCacheDir].ThereIs)
+    options.ListCacheDir = us2fs(parser[NKey::kListCacheDir].PostStrings[0]);
   // **************** NanaZip Modification End ****************
   
   NWildcard::ECensorPathMode censorPathMode = NWildcard::k_RelatPath;
@@ -1783,6 +1815,17 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
         eo.OverwriteMode = NExtract::NOverwriteMode::kOverwrite;
         eo.OverwriteMode_Force = true;
       }
+
+      // **************** NanaZip Modification Start ****************
+      if (parser[NKey::kWriteThreads].ThereIs)
+      {
+        const UString &s = parser[NKey::kWriteThreads].PostStrings[0];
+        UInt32 v;
+        if (!StringToUInt32(s, v))
+          throw CArcCmdLineException("Unsupported switch postfix -swt", s);
+        eo.NumWriteThreads = v;
+      }
+      // **************** NanaZip Modification End ****************
     }
 
     eo.PathMode = options.Command.GetPathMode();
@@ -1814,6 +1857,9 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
       updateOptions.OpenShareForWrite = true;
     if (parser[NKey::kStopAfterOpenError].ThereIs)
       updateOptions.StopAfterOpenError = true;
+    // **************** NanaZip Modification Start ****************
+    updateOptions.NumScanThreads = GetNumScanThreads(parser);
+    // **************** NanaZip Modification End ****************
 
     updateOptions.PathMode = censorPathMode;
 
@@ -1892,6 +1938,24 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
     hashOptions.StdInMode = options.StdInMode;
     hashOptions.AltStreamsMode = options.AltStreams.Val;
     hashOptions.SymLinks = options.SymLinks;
+    // **************** NanaZip Modification Start ****************
+    hashOptions.NumScanThreads = GetNumScanThreads(parser);
+    FOR_VECTOR (k, options.Properties)
+    {
+      const CProperty &prop = options.Properties[k];
+      if (!IsNumThreadsPropName(prop.Name))
+        continue;
+      NCOM::CPropVariant propVariant;
+      if (!prop.Value.IsEmpty())
+        propVariant = prop.Value;
+      UInt32 numThreads;
+      if (ParseMtProp(prop.Name.Ptr(2), propVariant,
+          NSystem::GetNumberOfProcessors(), numThreads) != S_OK)
+        throw CArcCmdLineException("Unsupported switch postfix -mmt", prop.Name);
+      // 0 means single-threaded mode for -mmt=off
+      hashOptions.NumThreads = (numThreads == 0 ? 1 : numThreads);
+    }
+    // **************** NanaZip Modification End ****************
   }
   else if (options.Command.CommandType == NCommandType::kInfo)
   {
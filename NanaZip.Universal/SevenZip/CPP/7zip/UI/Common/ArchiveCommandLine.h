@@ -110,6 +110,9 @@ struct CArcCmdLineOptions
   UStringVector ExcludedArcTypes;
   // **************** NanaZip Modification Start ****************
   CBoolPair OpenFolder;
+  // the directory for archive list cache of l (List) command.
+  // Empty string disables list cache.
+  FString ListCacheDir;
   // **************** NanaZip Modification End ****************
   
   unsigned Number_for_Out;
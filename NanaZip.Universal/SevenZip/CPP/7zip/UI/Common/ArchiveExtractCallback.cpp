@@ -22,6 +22,9 @@
 #include "../../../Windows/FileName.h"
 #include "../../../Windows/PropVariant.h"
 #include "../../../Windows/PropVariantConv.h"
+// **************** NanaZip Modification Start ****************
+#include "../../../Windows/System.h"
+// **************** NanaZip Modification End ****************
 
 #if defined(_WIN32) && !defined(UNDER_CE)  && !defined(Z7_SFX)
 #define Z7_USE_SECURITY_CODE
@@ -51,6 +54,12 @@ static const char * const kCantOpenOutFile = "Cannot open output file";
 static const char * const kCantOpenInFile = "Cannot open input file";
 #endif
 static const char * const kCantSetFileLen = "Cannot set length for output file";
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+static const UInt32 k_AsyncWrite_MaxThreads = 8;
+static const UInt64 k_AsyncWrite_MaxFileSize = (UInt64)1 << 20;
+#endif
+// **************** NanaZip Modification End ****************
 #ifdef SUPPORT_LINKS
 static const char * const kCantCreateHardLink = "Cannot create hard link";
 static const char * const kCantCreateSymLink = "Cannot create symbolic link";
@@ -309,6 +318,12 @@ CArchiveExtractCallback::CArchiveExtractCallback():
     _arc(NULL),
     _multiArchives(false)
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  _numWriteThreads = 0;
+  _asyncWriter_WasFailed = false;
+  #endif
+  // **************** NanaZip Modification End ****************
   #ifdef Z7_USE_SECURITY_CODE
   _saclEnabled = InitLocalPrivileges();
   #endif
@@ -335,6 +350,11 @@ void CArchiveExtractCallback::Init(
   ClearExtractedDirsInfo();
   _outFileStream.Release();
   _bufPtrSeqOutStream.Release();
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  _asyncBufStream.Release();
+  #endif
+  // **************** NanaZip Modification End ****************
   
 #ifdef SUPPORT_LINKS
   _hardLinks.Clear();
@@ -1372,7 +1392,14 @@ HRESULT CArchiveExtractCallback::GetExtractStream(CMyComPtr<ISequentialOutStream
   {
     _diskFilePath = fullProcessedPath;
     if (isAnti)
+    {
+      // **************** NanaZip Modification Start ****************
+      #ifndef Z7_ST
+      RINOK(Async_Flush())
+      #endif
+      // **************** NanaZip Modification End ****************
       RemoveDir(_diskFilePath);
+    }
     #ifdef SUPPORT_LINKS
     if (_link.LinkPath.IsEmpty())
     #endif
@@ -1384,6 +1411,15 @@ HRESULT CArchiveExtractCallback::GetExtractStream(CMyComPtr<ISequentialOutStream
   }
   else if (!_isSplit)
   {
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    // the archive can contain several items with same path
+    if (_asyncWriter.IsCreated() && _asyncWriter.IsPendingPath(fullProcessedPath))
+    {
+      RINOK(Async_Flush())
+    }
+    #endif
+    // **************** NanaZip Modification End ****************
     RINOK(CheckExistFile(fullProcessedPath, needExit))
     if (needExit)
       return S_OK;
@@ -1410,6 +1446,11 @@ HRESULT CArchiveExtractCallback::GetExtractStream(CMyComPtr<ISequentialOutStream
   {
     #ifndef UNDER_CE
     {
+      // **************** NanaZip Modification Start ****************
+      #ifndef Z7_ST
+      RINOK(Async_Flush())
+      #endif
+      // **************** NanaZip Modification End ****************
       bool linkWasSet = false;
       RINOK(SetLink(fullProcessedPath, _link, linkWasSet))
 /*
@@ -1446,6 +1487,11 @@ HRESULT CArchiveExtractCallback::GetExtractStream(CMyComPtr<ISequentialOutStream
           hl = fullProcessedPath;
         else
         {
+          // **************** NanaZip Modification Start ****************
+          #ifndef Z7_ST
+          RINOK(Async_Flush())
+          #endif
+          // **************** NanaZip Modification End ****************
           bool link_was_Created = false;
           RINOK(CreateHardLink2(fullProcessedPath, hl, link_was_Created))
           if (!link_was_Created)
@@ -1467,6 +1513,40 @@ HRESULT CArchiveExtractCallback::GetExtractStream(CMyComPtr<ISequentialOutStream
   #endif // SUPPORT_LINKS
 
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (Async_IsPossible())
+  {
+    if (!_asyncWriter.IsCreated())
+    {
+      UInt32 numThreads = _numWriteThreads;
+      if (numThreads == 0)
+      {
+        numThreads = NSystem::GetNumberOfProcessors();
+        if (numThreads > k_AsyncWrite_MaxThreads)
+          numThreads = k_AsyncWrite_MaxThreads;
+      }
+      if (_asyncWriter.Create(numThreads) != S_OK)
+        _asyncWriter_WasFailed = true;
+    }
+    if (_asyncWriter.IsCreated())
+    {
+      _needSetAttrib = true;
+      _asyncBufStreamSpec = new CDynBufSeqOutStream;
+      _asyncBufStream = _asyncBufStreamSpec;
+      outStreamLoc = _asyncBufStream;
+      needExit = false;
+      return S_OK;
+    }
+  }
+  // alternate stream can be written only after its base file
+  if (_item.IsAltStream)
+  {
+    RINOK(Async_Flush())
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
+
   // ---------- CREATE WRITE FILE -----
 
   _outFileStreamSpec = new COutFileStream;
@@ -1607,6 +1687,11 @@ Z7_COM7F_IMF(CArchiveExtractCallback::GetStream(UInt32 index, ISequentialOutStre
 
   _outFileStream.Release();
   _bufPtrSeqOutStream.Release();
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  _asyncBufStream.Release();
+  #endif
+  // **************** NanaZip Modification End ****************
 
   _encrypted = false;
   _isSplit = false;
@@ -1944,8 +2029,103 @@ Z7_COM7F_IMF(CArchiveExtractCallback::PrepareOperation(Int32 askExtractMode))
 
 
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+bool CArchiveExtractCallback::Async_IsPossible() const
+{
+  if (_numWriteThreads == 1 || _asyncWriter_WasFailed)
+    return false;
+  if (_isSplit || !_curSize_Defined || _curSize > k_AsyncWrite_MaxFileSize)
+    return false;
+  // the items that need the path of created file after CloseFile() are written in caller thread
+  if (_item.IsAltStream
+      || _isRenamed
+      || _fi.IsLinuxSymLink()
+      || _fi.IsReparse()
+      || _ntOptions.NtSecurity.Val)
+    return false;
+#ifndef _WIN32
+  if (_fi.Owner.Id_Defined && _fi.Group.Id_Defined)
+    return false;
+#endif
+  return true;
+}
+
+HRESULT CArchiveExtractCallback::Async_CloseFile()
+{
+  CAsyncFileJob *job = new CAsyncFileJob;
+  job->Path = _diskFilePath;
+  job->DataStream = _asyncBufStream;
+  job->Data = _asyncBufStreamSpec;
+  _asyncBufStream.Release();
+
+  _curSize = job->Data->GetSize();
+  _curSize_Defined = true;
+
+ #if defined(_WIN32) && !defined(UNDER_CE) && !defined(Z7_SFX)
+  if (ZoneBuf.Size() != 0)
+    if (ZoneMode != NExtract::NZoneIdMode::kOffice ||
+        FindExt2(kOfficeExtensions, fs2us(_diskFilePath)))
+      job->ZoneBuf = ZoneBuf;
+ #endif
+
+  CFiTimesCAM t;
+  GetFiTimesCAM(_fi, t, *_arc);
+  job->CTime = t.CTime;
+  job->ATime = t.ATime;
+  job->MTime = t.MTime;
+  job->CTime_Defined = t.CTime_Defined;
+  job->ATime_Defined = t.ATime_Defined;
+  job->MTime_Defined = t.MTime_Defined;
+
+  // it's same check as in SetAttrib()
+  if (_fi.Attrib_Defined
+      && !_itemFailure
+      && !_stdOutMode
+      && _extractMode)
+  {
+    job->Attrib_Defined = true;
+    job->Attrib = _fi.Attrib;
+  }
+  _needSetAttrib = false;
+
+  _asyncWriter.Submit(job);
+  return Async_ReportErrors();
+}
+
+HRESULT CArchiveExtractCallback::Async_ReportErrors()
+{
+  CObjectVector<CAsyncFileError> errors;
+  _asyncWriter.GetErrors(errors);
+  FOR_VECTOR (i, errors)
+  {
+    const CAsyncFileError &e = errors[i];
+    RINOK(SendMessageError_with_Error(e.ErrorCode, e.Message, e.Path))
+  }
+  return S_OK;
+}
+
+HRESULT CArchiveExtractCallback::Async_Flush()
+{
+  if (!_asyncWriter.IsCreated())
+    return S_OK;
+  _asyncWriter.Flush();
+  return Async_ReportErrors();
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
 HRESULT CArchiveExtractCallback::CloseFile()
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (_asyncBufStream)
+    return Async_CloseFile();
+  #endif
+  // **************** NanaZip Modification End ****************
+
   if (!_outFileStream)
     return S_OK;
   
@@ -3075,6 +3255,16 @@ HRESULT CArchiveExtractCallback::CloseArc()
 {
   // we call CloseReparseAndFile() here because we can have non-closed file in some cases?
   HRESULT res = CloseReparseAndFile();
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  {
+    // the links and the timestamps of folders are set after all files are written
+    const HRESULT res2 = Async_Flush();
+    if (res == S_OK)
+      res = res2;
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
 #ifdef SUPPORT_LINKS
   {
     const HRESULT res2 = SetPostLinks();
@@ -21,6 +21,10 @@
 
 #include "HashCalc.h"
 
+// **************** NanaZip Modification Start ****************
+#include "AsyncFileWriter.h"
+// **************** NanaZip Modification End ****************
+
 #ifndef Z7_SFX
 
 Z7_CLASS_IMP_NOQIB_1(
@@ -442,6 +446,22 @@ private:
   CBufPtrSeqOutStream *_bufPtrSeqOutStream_Spec;
   CMyComPtr<ISequentialOutStream> _bufPtrSeqOutStream;
 
+  // **************** NanaZip Modification Start ****************
+ #ifndef Z7_ST
+  // small files are decoded to memory and then they are written by _asyncWriter threads
+  UInt32 _numWriteThreads;
+  bool _asyncWriter_WasFailed;
+  CAsyncFileWriter _asyncWriter;
+  CDynBufSeqOutStream *_asyncBufStreamSpec;
+  CMyComPtr<ISequentialOutStream> _asyncBufStream;
+
+  bool Async_IsPossible() const;
+  HRESULT Async_CloseFile();
+  HRESULT Async_ReportErrors();
+  HRESULT Async_Flush();
+ #endif
+  // **************** NanaZip Modification End ****************
+
  #ifndef Z7_SFX
   COutStreamWithHash *_hashStreamSpec;
   CMyComPtr<ISequentialOutStream> _hashStream;
@@ -535,6 +555,12 @@ public:
 
   #endif
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  void SetNumWriteThreads(UInt32 numThreads) { _numWriteThreads = numThreads; }
+  #endif
+  // **************** NanaZip Modification End ****************
+
   void InitBeforeNewArchive();
 
   void Init(
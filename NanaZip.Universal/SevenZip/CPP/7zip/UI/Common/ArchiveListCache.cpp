@@ -0,0 +1,866 @@
+﻿// ArchiveListCache.cpp
+
+#include "StdAfx.h"
+
+#include "../../../../C/7zCrc.h"
+#include "../../../../C/CpuArch.h"
+
+#include "../../../Common/ComTry.h"
+#include "../../../Common/IntToString.h"
+#include "../../../Common/StringConvert.h"
+
+#include "../../../Windows/FileDir.h"
+#include "../../../Windows/FileIO.h"
+#include "../../../Windows/FileName.h"
+#include "../../../Windows/PropVariant.h"
+
+#include "../../Common/StreamUtils.h"
+
+#include "ArchiveListCache.h"
+
+using namespace NWindows;
+using namespace NFile;
+
+static const Byte kSignature[] = { 'N', 'Z', 'L', 'C' };
+static const UInt32 kVersion = 1;
+static const unsigned kSignatureSize = sizeof(kSignature);
+// the size of data at the start and at the end of archive that is checked by CRC
+static const size_t kCheckSize = (size_t)1 << 16;
+static const UInt64 kCacheFileSizeMax = (UInt64)1 << 31;
+
+/* the properties that can be requested by UI code, even if handler doesn't
+   report them in GetPropertyInfo() / GetArchivePropertyInfo() */
+
+static const PROPID kItemProps[] =
+{
+  kpidPath,
+  kpidName,
+  kpidExtension,
+  kpidIsDir,
+  kpidSize,
+  kpidPackSize,
+  kpidAttrib,
+  kpidCTime,
+  kpidATime,
+  kpidMTime,
+  kpidPosixAttrib,
+  kpidIsAltStream,
+  kpidIsAux,
+  kpidIsDeleted,
+  kpidIsAnti,
+  kpidINode,
+  kpidStreamId,
+  kpidSymLink,
+  kpidHardLink,
+  kpidCopyLink,
+  kpidEncrypted,
+  kpidCRC,
+  kpidPosition
+};
+
+static const PROPID kArcProps[] =
+{
+  kpidErrorFlags,
+  kpidWarningFlags,
+  kpidError,
+  kpidWarning,
+  kpidPhySize,
+  kpidOffset,
+  kpidPhySizeCantBeDetected,
+  kpidUnpackSize,
+  kpidMainSubfile,
+  kpidIsTree,
+  kpidIsDeleted,
+  kpidIsAltStream,
+  kpidIsAux,
+  kpidINode,
+  kpidReadOnly,
+  kpidIsNotArcType,
+  kpidShortComment,
+  kpidTimeType,
+  kpidName,
+  kpidCTime,
+  kpidMTime
+};
+
+
+HRESULT CListCacheKey::Calc(IInStream *stream)
+{
+  Z7_DECL_CMyComPtr_QI_FROM(
+      IStreamGetProps,
+      getProps, stream)
+  if (!getProps)
+    return S_FALSE;
+  FILETIME mTime;
+  if (getProps->GetProps(&Size, NULL, NULL, &mTime, NULL) != S_OK)
+    return S_FALSE;
+  MTime = ((UInt64)mTime.dwHighDateTime << 32) | mTime.dwLowDateTime;
+
+  UInt64 pos;
+  RINOK(InStream_GetPos(stream, pos))
+  size_t size = kCheckSize;
+  if (size > Size)
+    size = (size_t)Size;
+  CByteBuffer buf;
+  buf.Alloc(size);
+  RINOK(InStream_SeekSet(stream, 0))
+  RINOK(ReadStream_FALSE(stream, buf, size))
+  HeadCrc = CrcCalc(buf, size);
+  RINOK(InStream_SeekSet(stream, Size - size))
+  RINOK(ReadStream_FALSE(stream, buf, size))
+  TailCrc = CrcCalc(buf, size);
+  return InStream_SeekSet(stream, pos);
+}
+
+
+static bool GetCacheFilePath(const FString &cacheDir, const UString &arcPath,
+    UString &fullArcPath, FString &cachePath)
+{
+  FString fullPath;
+  if (!NDir::MyGetFullPathName(us2fs(arcPath), fullPath))
+    return false;
+  fullArcPath = fs2us(fullPath);
+  char s[16];
+  ConvertUInt32ToHex8Digits(CrcCalc(fullArcPath.Ptr(), fullArcPath.Len() * sizeof(wchar_t)), s);
+  cachePath = cacheDir;
+  NName::NormalizeDirPathPrefix(cachePath);
+  cachePath += s;
+  cachePath += ".lcache";
+  return true;
+}
+
+
+/*
+The format of cache file (all numbers are little-endian):
+  Signature, Version, sizeof(wchar_t)
+  CListCacheKey
+  String: full path of archive
+  String: format name
+  Props: archive properties
+  PropInfos: item properties, PropInfos: archive properties
+  Byte: (1) if there are raw properties
+    [UInt32 NumRawProps, (String Name, UInt32 PropID) * NumRawProps]
+  UInt32 NumItems, Item * NumItems
+  UInt32 CRC of all previous data
+
+Props: UInt32 NumProps, (UInt32 PropID, UInt16 VarType, Value) * NumProps
+Item: Props [UInt32 Parent, UInt32 ParentType, (UInt32 Size, [UInt32 Type, Data]) * NumRawProps]
+String: UInt32 NumChars, wchar_t * NumChars
+*/
+
+class CListCacheOutBuf
+{
+  CByteBuffer _buf;
+  size_t _pos;
+
+  void Reserve(size_t size)
+  {
+    if (size <= _buf.Size() - _pos)
+      return;
+    size_t newSize = _buf.Size() * 2;
+    if (newSize < _pos + size)
+      newSize = _pos + size + ((size_t)1 << 16);
+    _buf.ChangeSize_KeepData(newSize, _pos);
+  }
+
+public:
+  CListCacheOutBuf(): _pos(0) {}
+
+  const Byte *GetData() const { return _buf; }
+  size_t GetPos() const { return _pos; }
+
+  void WriteBytes(const void *data, size_t size)
+  {
+    Reserve(size);
+    if (size != 0)
+      memcpy(_buf + _pos, data, size);
+    _pos += size;
+  }
+  void WriteByte(Byte b) { WriteBytes(&b, 1); }
+  void WriteUInt16(UInt16 v) { Byte b[2]; SetUi16(b, v) WriteBytes(b, 2); }
+  void WriteUInt32(UInt32 v) { Byte b[4]; SetUi32(b, v) WriteBytes(b, 4); }
+  void WriteUInt64(UInt64 v) { Byte b[8]; SetUi64(b, v) WriteBytes(b, 8); }
+  void SetUInt32At(size_t pos, UInt32 v) { SetUi32(_buf + pos, v) }
+
+  void WriteString(const wchar_t *s, unsigned len)
+  {
+    WriteUInt32(len);
+    WriteBytes(s, len * sizeof(wchar_t));
+  }
+  void WriteString(const UString &s) { WriteString(s.Ptr(), s.Len()); }
+
+  // it returns false, if the property was not written
+  bool WriteProp(PROPID propID, const PROPVARIANT &prop);
+};
+
+
+bool CListCacheOutBuf::WriteProp(PROPID propID, const PROPVARIANT &prop)
+{
+  switch (prop.vt)
+  {
+    case VT_BOOL:
+    case VT_UI1:
+    case VT_UI2:
+    case VT_UI4:
+    case VT_I4:
+    case VT_UI8:
+    case VT_I8:
+    case VT_FILETIME:
+    case VT_BSTR:
+      break;
+    default:
+      return false;
+  }
+  WriteUInt32(propID);
+  WriteUInt16(prop.vt);
+  switch (prop.vt)
+  {
+    case VT_BOOL: WriteByte(prop.boolVal != VARIANT_FALSE ? 1 : 0); break;
+    case VT_UI1: WriteByte(prop.bVal); break;
+    case VT_UI2: WriteUInt16(prop.uiVal); break;
+    case VT_UI4: WriteUInt32(prop.ulVal); break;
+    case VT_I4: WriteUInt32((UInt32)prop.lVal); break;
+    case VT_UI8: WriteUInt64(prop.uhVal.QuadPart); break;
+    case VT_I8: WriteUInt64((UInt64)prop.hVal.QuadPart); break;
+    case VT_FILETIME:
+      WriteUInt32(prop.filetime.dwLowDateTime);
+      WriteUInt32(prop.filetime.dwHighDateTime);
+      WriteUInt16(prop.wReserved1);
+      WriteUInt16(prop.wReserved2);
+      break;
+    default: // VT_BSTR
+      if (prop.bstrVal)
+        WriteString(prop.bstrVal, ::SysStringLen(prop.bstrVal));
+      else
+        WriteUInt32(0);
+      break;
+  }
+  return true;
+}
+
+
+class CListCacheInBuf
+{
+  const Byte *_buf;
+  size_t _size;
+  size_t _pos;
+
+public:
+  bool Error;
+
+  CListCacheInBuf(const Byte *buf, size_t size, size_t pos):
+      _buf(buf), _size(size), _pos(pos), Error(false) {}
+
+  size_t GetPos() const { return _pos; }
+
+  const Byte *ReadBytes(size_t size)
+  {
+    if (size > _size - _pos)
+    {
+      Error = true;
+      return NULL;
+    }
+    const Byte *p = _buf + _pos;
+    _pos += size;
+    return p;
+  }
+  Byte ReadByte() { const Byte *p = ReadBytes(1); return p ? *p : (Byte)0; }
+  UInt16 ReadUInt16() { const Byte *p = ReadBytes(2); return p ? GetUi16(p) : (UInt16)0; }
+  UInt32 ReadUInt32() { const Byte *p = ReadBytes(4); return p ? GetUi32(p) : 0; }
+  UInt64 ReadUInt64() { const Byte *p = ReadBytes(8); return p ? GetUi64(p) : 0; }
+
+  // it returns NULL, if the string is empty
+  const wchar_t *ReadString(unsigned &len)
+  {
+    const UInt32 num = ReadUInt32();
+    len = 0;
+    if (num > (_size - _pos) / sizeof(wchar_t))
+    {
+      Error = true;
+      return NULL;
+    }
+    len = num;
+    return (const wchar_t *)(const void *)ReadBytes(num * sizeof(wchar_t));
+  }
+  void ReadString(UString &s)
+  {
+    unsigned len;
+    const wchar_t *p = ReadString(len);
+    s.Empty();
+    if (p && len != 0)
+    {
+      wchar_t *dest = s.GetBuf(len);
+      memcpy(dest, p, len * sizeof(wchar_t));
+      s.ReleaseBuf_SetEnd(len);
+    }
+  }
+
+  // if (prop == NULL), it skips the value
+  void ReadPropValue(VARTYPE vt, PROPVARIANT *prop);
+  // it returns false, if there is no such property
+  bool FindProp(PROPID propID, PROPVARIANT *prop);
+  void SkipProps() { FindProp(kpidNoProperty, NULL); }
+};
+
+
+void CListCacheInBuf::ReadPropValue(VARTYPE vt, PROPVARIANT *prop)
+{
+  NCOM::CPropVariant v;
+  switch (vt)
+  {
+    case VT_BOOL: v = (ReadByte() != 0); break;
+    case VT_UI1: v = ReadByte(); break;
+    case VT_UI2: v.vt = VT_UI2; v.uiVal = ReadUInt16(); break;
+    case VT_UI4: v = ReadUInt32(); break;
+    case VT_I4: v.Set_Int32((Int32)ReadUInt32()); break;
+    case VT_UI8: v = ReadUInt64(); break;
+    case VT_I8: v.Set_Int64((Int64)ReadUInt64()); break;
+    case VT_FILETIME:
+    {
+      FILETIME ft;
+      ft.dwLowDateTime = ReadUInt32();
+      ft.dwHighDateTime = ReadUInt32();
+      const unsigned prec = ReadUInt16();
+      const unsigned ns100 = ReadUInt16();
+      v.SetAsTimeFrom_FT_Prec_Ns100(ft, prec, ns100);
+      break;
+    }
+    case VT_BSTR:
+    {
+      unsigned len;
+      const wchar_t *s = ReadString(len);
+      if (prop && !Error)
+      {
+        wchar_t *dest = v.AllocBstr(len);
+        if (len != 0)
+          memcpy(dest, s, len * sizeof(wchar_t));
+        dest[len] = 0;
+      }
+      break;
+    }
+    default:
+      Error = true;
+      return;
+  }
+  if (prop && !Error)
+    v.Detach(prop);
+}
+
+
+bool CListCacheInBuf::FindProp(PROPID propID, PROPVARIANT *prop)
+{
+  bool found = false;
+  for (UInt32 num = ReadUInt32(); num != 0 && !Error; num--)
+  {
+    const PROPID id = ReadUInt32();
+    const VARTYPE vt = (VARTYPE)ReadUInt16();
+    const bool isMatch = (id == propID && !found);
+    ReadPropValue(vt, isMatch ? prop : NULL);
+    if (isMatch)
+      found = true;
+  }
+  return found && !Error;
+}
+
+
+static HRESULT GetPropInfos(IInArchive *archive, bool isArc, CObjectVector<CListCachePropInfo> &infos)
+{
+  infos.Clear();
+  UInt32 num;
+  if (isArc)
+  {
+    RINOK(archive->GetNumberOfArchiveProperties(&num))
+  }
+  else
+  {
+    RINOK(archive->GetNumberOfProperties(&num))
+  }
+  for (UInt32 i = 0; i < num; i++)
+  {
+    CMyComBSTR name;
+    PROPID propID;
+    VARTYPE vt;
+    if (isArc)
+    {
+      RINOK(archive->GetArchivePropertyInfo(i, &name, &propID, &vt))
+    }
+    else
+    {
+      RINOK(archive->GetPropertyInfo(i, &name, &propID, &vt))
+    }
+    CListCachePropInfo &info = infos.AddNew();
+    if (name)
+      info.Name = name;
+    info.PropID = propID;
+    info.VarType = vt;
+  }
+  return S_OK;
+}
+
+
+static void WritePropInfos(CListCacheOutBuf &out, const CObjectVector<CListCachePropInfo> &infos)
+{
+  out.WriteUInt32(infos.Size());
+  FOR_VECTOR (i, infos)
+  {
+    const CListCachePropInfo &info = infos[i];
+    out.WriteString(info.Name);
+    out.WriteUInt32(info.PropID);
+    out.WriteUInt16(info.VarType);
+  }
+}
+
+
+static bool ReadPropInfos(CListCacheInBuf &in, CObjectVector<CListCachePropInfo> &infos, bool isRaw)
+{
+  infos.Clear();
+  for (UInt32 num = in.ReadUInt32(); num != 0 && !in.Error; num--)
+  {
+    CListCachePropInfo &info = infos.AddNew();
+    in.ReadString(info.Name);
+    info.PropID = in.ReadUInt32();
+    info.VarType = (VARTYPE)(isRaw ? (UInt16)VT_EMPTY : in.ReadUInt16());
+  }
+  return !in.Error;
+}
+
+
+static void AddPropIDs(CRecordVector<PROPID> &ids,
+    const CObjectVector<CListCachePropInfo> &infos,
+    const PROPID *extra, unsigned numExtra)
+{
+  ids.Clear();
+  FOR_VECTOR (i, infos)
+    ids.AddToUniqueSorted(infos[i].PropID);
+  for (unsigned i = 0; i < numExtra; i++)
+    ids.AddToUniqueSorted(extra[i]);
+}
+
+
+HRESULT ListCache_Write(const FString &cacheDir, const UString &arcPath,
+    IInStream *stream, IInArchive *archive, const UString &formatName)
+{
+  CListCacheKey key;
+  {
+    const HRESULT res = key.Calc(stream);
+    if (res != S_OK)
+      return res;
+  }
+  UString fullArcPath;
+  FString cachePath;
+  if (!GetCacheFilePath(cacheDir, arcPath, fullArcPath, cachePath))
+    return S_FALSE;
+
+  CListCacheOutBuf out;
+  out.WriteBytes(kSignature, kSignatureSize);
+  out.WriteUInt32(kVersion);
+  out.WriteUInt32(sizeof(wchar_t));
+  out.WriteUInt64(key.Size);
+  out.WriteUInt64(key.MTime);
+  out.WriteUInt32(key.HeadCrc);
+  out.WriteUInt32(key.TailCrc);
+  out.WriteString(fullArcPath);
+  out.WriteString(formatName);
+
+  CObjectVector<CListCachePropInfo> props;
+  CObjectVector<CListCachePropInfo> arcProps;
+  RINOK(GetPropInfos(archive, false, props))
+  RINOK(GetPropInfos(archive, true, arcProps))
+
+  CRecordVector<PROPID> ids;
+  {
+    AddPropIDs(ids, arcProps, kArcProps, Z7_ARRAY_SIZE(kArcProps));
+    const size_t numPos = out.GetPos();
+    out.WriteUInt32(0);
+    UInt32 num = 0;
+    FOR_VECTOR (i, ids)
+    {
+      NCOM::CPropVariant prop;
+      RINOK(archive->GetArchiveProperty(ids[i], &prop))
+      if (out.WriteProp(ids[i], prop))
+        num++;
+    }
+    out.SetUInt32At(numPos, num);
+  }
+
+  WritePropInfos(out, props);
+  WritePropInfos(out, arcProps);
+
+  Z7_DECL_CMyComPtr_QI_FROM(
+      IArchiveGetRawProps,
+      getRawProps, archive)
+  CRecordVector<PROPID> rawIDs;
+  out.WriteByte(getRawProps ? 1 : 0);
+  if (getRawProps)
+  {
+    UInt32 numRawProps;
+    RINOK(getRawProps->GetNumRawProps(&numRawProps))
+    out.WriteUInt32(numRawProps);
+    for (UInt32 i = 0; i < numRawProps; i++)
+    {
+      CMyComBSTR name;
+      PROPID propID;
+      RINOK(getRawProps->GetRawPropInfo(i, &name, &propID))
+      UString s;
+      if (name)
+        s = name;
+      out.WriteString(s);
+      out.WriteUInt32(propID);
+      rawIDs.Add(propID);
+    }
+  }
+
+  UInt32 numItems;
+  RINOK(archive->GetNumberOfItems(&numItems))
+  out.WriteUInt32(numItems);
+  AddPropIDs(ids, props, kItemProps, Z7_ARRAY_SIZE(kItemProps));
+
+  for (UInt32 index = 0; index < numItems; index++)
+  {
+    {
+      const size_t numPos = out.GetPos();
+      out.WriteUInt32(0);
+      UInt32 num = 0;
+      FOR_VECTOR (i, ids)
+      {
+        NCOM::CPropVariant prop;
+        RINOK(archive->GetProperty(index, ids[i], &prop))
+        if (out.WriteProp(ids[i], prop))
+          num++;
+      }
+      out.SetUInt32At(numPos, num);
+    }
+    if (getRawProps)
+    {
+      UInt32 parent = (UInt32)(Int32)-1;
+      UInt32 parentType = 0;
+      RINOK(getRawProps->GetParent(index, &parent, &parentType))
+      out.WriteUInt32(parent);
+      out.WriteUInt32(parentType);
+      FOR_VECTOR (i, rawIDs)
+      {
+        const void *data = NULL;
+        UInt32 dataSize = 0;
+        UInt32 propType = 0;
+        if (getRawProps->GetRawProp(index, rawIDs[i], &data, &dataSize, &propType) != S_OK || !data)
+          dataSize = 0;
+        out.WriteUInt32(dataSize);
+        if (dataSize != 0)
+        {
+          out.WriteUInt32(propType);
+          out.WriteBytes(data, dataSize);
+        }
+      }
+    }
+  }
+
+  out.WriteUInt32(CrcCalc(out.GetData(), out.GetPos()));
+
+  // we write to temp file and then rename it, so another process can't see incomplete file
+  if (!NDir::CreateComplexDir(cacheDir))
+    return GetLastError_noZero_HRESULT();
+  FString tempPath = cachePath;
+  tempPath += ".tmp";
+  {
+    NIO::COutFile file;
+    if (!file.Create_ALWAYS(tempPath))
+      return GetLastError_noZero_HRESULT();
+    if (!file.WriteFull(out.GetData(), out.GetPos()))
+    {
+      const HRESULT res = GetLastError_noZero_HRESULT();
+      file.Close();
+      NDir::DeleteFileAlways(tempPath);
+      return res;
+    }
+  }
+  NDir::DeleteFileAlways(cachePath);
+  if (!NDir::MyMoveFile(tempPath, cachePath))
+  {
+    const HRESULT res = GetLastError_noZero_HRESULT();
+    NDir::DeleteFileAlways(tempPath);
+    return res;
+  }
+  return S_OK;
+}
+
+
+HRESULT CListCacheArchive::Load(const FString &cacheDir, const UString &arcPath, IInStream *stream)
+{
+  _data.Free();
+  _items.Clear();
+  _rawItems.Clear();
+
+  CListCacheKey key;
+  {
+    const HRESULT res = key.Calc(stream);
+    if (res != S_OK)
+      return res;
+  }
+  UString fullArcPath;
+  FString cachePath;
+  if (!GetCacheFilePath(cacheDir, arcPath, fullArcPath, cachePath))
+    return S_FALSE;
+
+  size_t size;
+  {
+    NIO::CInFile file;
+    if (!file.Open(cachePath))
+      return S_FALSE;
+    UInt64 fileSize;
+    if (!file.GetLength(fileSize) || fileSize > kCacheFileSizeMax || fileSize < kSignatureSize + 4)
+      return S_FALSE;
+    size = (size_t)fileSize;
+    _data.Alloc(size);
+    size_t processed;
+    if (!file.ReadFull(_data, size, processed) || processed != size)
+      return S_FALSE;
+  }
+
+  size -= 4;
+  if (CrcCalc(_data, size) != GetUi32(_data + size)
+      || memcmp(_data, kSignature, kSignatureSize) != 0)
+    return S_FALSE;
+
+  CListCacheInBuf in(_data, size, kSignatureSize);
+  if (in.ReadUInt32() != kVersion || in.ReadUInt32() != sizeof(wchar_t))
+    return S_FALSE;
+  CListCacheKey key2;
+  key2.Size = in.ReadUInt64();
+  key2.MTime = in.ReadUInt64();
+  key2.HeadCrc = in.ReadUInt32();
+  key2.TailCrc = in.ReadUInt32();
+  if (!key.IsEqualTo(key2))
+    return S_FALSE;
+  {
+    UString s;
+    in.ReadString(s);
+    if (in.Error || s != fullArcPath)
+      return S_FALSE;
+  }
+  in.ReadString(FormatName);
+
+  _arcPropsPos = in.GetPos();
+  in.SkipProps();
+
+  if (!ReadPropInfos(in, _props, false)
+      || !ReadPropInfos(in, _arcProps, false))
+    return S_FALSE;
+
+  const bool isRaw = (in.ReadByte() != 0);
+  _rawProps.Clear();
+  if (isRaw && !ReadPropInfos(in, _rawProps, true))
+    return S_FALSE;
+
+  const UInt32 numItems = in.ReadUInt32();
+  // each item record contains 4 bytes at least
+  if (in.Error || numItems > (size - in.GetPos()) / 4)
+    return S_FALSE;
+  _items.ClearAndReserve(numItems);
+  if (isRaw)
+    _rawItems.ClearAndReserve(numItems);
+
+  for (UInt32 i = 0; i < numItems; i++)
+  {
+    _items.AddInReserved(in.GetPos());
+    in.SkipProps();
+    if (isRaw)
+    {
+      _rawItems.AddInReserved(in.GetPos());
+      in.ReadUInt32();
+      in.ReadUInt32();
+      FOR_VECTOR (k, _rawProps)
+      {
+        const UInt32 dataSize = in.ReadUInt32();
+        if (dataSize != 0)
+        {
+          in.ReadUInt32();
+          in.ReadBytes(dataSize);
+        }
+      }
+    }
+    if (in.Error)
+      return S_FALSE;
+  }
+  if (in.GetPos() != size)
+    return S_FALSE;
+  return S_OK;
+}
+
+
+HRESULT CListCacheArchive::OpenArchive()
+{
+  if (_archiveIsOpen)
+    return S_OK;
+  if (!_archive)
+    return E_FAIL;
+  RINOK(InStream_SeekToBegin(_stream))
+  const HRESULT res = _archive->Open(_stream, &_maxCheckStartPosition, NULL);
+  if (res != S_OK)
+    return (res == S_FALSE ? E_FAIL : res);
+  _archiveIsOpen = true;
+  UInt32 numItems;
+  RINOK(_archive->GetNumberOfItems(&numItems))
+  if (numItems != _items.Size())
+    return E_FAIL;
+  return S_OK;
+}
+
+
+Z7_COM7F_IMF(CListCacheArchive::Open(IInStream *, const UInt64 *, IArchiveOpenCallback *))
+{
+  return E_NOTIMPL;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::Close())
+{
+  if (!_archiveIsOpen)
+    return S_OK;
+  _archiveIsOpen = false;
+  return _archive->Close();
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetNumberOfItems(UInt32 *numItems))
+{
+  *numItems = _items.Size();
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetProperty(UInt32 index, PROPID propID, PROPVARIANT *value))
+{
+  COM_TRY_BEGIN
+  if (index >= _items.Size())
+    return E_INVALIDARG;
+  CListCacheInBuf in(_data, _data.Size(), _items[index]);
+  in.FindProp(propID, value);
+  return S_OK;
+  COM_TRY_END
+}
+
+Z7_COM7F_IMF(CListCacheArchive::Extract(const UInt32 *indices, UInt32 numItems,
+    Int32 testMode, IArchiveExtractCallback *extractCallback))
+{
+  COM_TRY_BEGIN
+  RINOK(OpenArchive())
+  return _archive->Extract(indices, numItems, testMode, extractCallback);
+  COM_TRY_END
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetArchiveProperty(PROPID propID, PROPVARIANT *value))
+{
+  COM_TRY_BEGIN
+  CListCacheInBuf in(_data, _data.Size(), _arcPropsPos);
+  in.FindProp(propID, value);
+  return S_OK;
+  COM_TRY_END
+}
+
+static HRESULT GetPropInfo(const CObjectVector<CListCachePropInfo> &infos,
+    UInt32 index, BSTR *name, PROPID *propID, VARTYPE *varType)
+{
+  if (index >= infos.Size())
+    return E_INVALIDARG;
+  const CListCachePropInfo &info = infos[index];
+  *name = NULL;
+  if (!info.Name.IsEmpty())
+  {
+    *name = ::SysAllocString(info.Name);
+    if (!*name)
+      return E_OUTOFMEMORY;
+  }
+  *propID = info.PropID;
+  if (varType)
+    *varType = info.VarType;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetNumberOfProperties(UInt32 *numProps))
+{
+  *numProps = _props.Size();
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetPropertyInfo(UInt32 index, BSTR *name, PROPID *propID, VARTYPE *varType))
+{
+  return GetPropInfo(_props, index, name, propID, varType);
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetNumberOfArchiveProperties(UInt32 *numProps))
+{
+  *numProps = _arcProps.Size();
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetArchivePropertyInfo(UInt32 index, BSTR *name, PROPID *propID, VARTYPE *varType))
+{
+  return GetPropInfo(_arcProps, index, name, propID, varType);
+}
+
+
+/* if the handler doesn't support IArchiveGetRawProps, we return
+   same values as CArc code uses, if there is no IArchiveGetRawProps */
+
+Z7_COM7F_IMF(CListCacheArchive::GetParent(UInt32 index, UInt32 *parent, UInt32 *parentType))
+{
+  *parent = (UInt32)(Int32)-1;
+  *parentType = NParentType::kDir;
+  if (index >= _rawItems.Size())
+    return S_OK;
+  CListCacheInBuf in(_data, _data.Size(), _rawItems[index]);
+  *parent = in.ReadUInt32();
+  *parentType = in.ReadUInt32();
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetRawProp(UInt32 index, PROPID propID, const void **data, UInt32 *dataSize, UInt32 *propType))
+{
+  *data = NULL;
+  *dataSize = 0;
+  *propType = 0;
+  if (index >= _rawItems.Size())
+    return S_OK;
+  CListCacheInBuf in(_data, _data.Size(), _rawItems[index]);
+  in.ReadUInt32();
+  in.ReadUInt32();
+  FOR_VECTOR (i, _rawProps)
+  {
+    const UInt32 size = in.ReadUInt32();
+    if (size == 0)
+      continue;
+    const UInt32 type = in.ReadUInt32();
+    const Byte *p = in.ReadBytes(size);
+    if (_rawProps[i].PropID == propID)
+    {
+      *data = p;
+      *dataSize = size;
+      *propType = type;
+      break;
+    }
+  }
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetNumRawProps(UInt32 *numProps))
+{
+  *numProps = _rawProps.Size();
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CListCacheArchive::GetRawPropInfo(UInt32 index, BSTR *name, PROPID *propID))
+{
+  return GetPropInfo(_rawProps, index, name, propID, NULL);
+}
+
+
+Z7_COM7F_IMF(CListCacheArchive::GetStream(UInt32 index, ISequentialInStream **stream))
+{
+  COM_TRY_BEGIN
+  *stream = NULL;
+  RINOK(OpenArchive())
+  Z7_DECL_CMyComPtr_QI_FROM(
+      IInArchiveGetStream,
+      getStream, _archive)
+  if (!getStream)
+    return S_FALSE;
+  return getStream->GetStream(index, stream);
+  COM_TRY_END
+}
@@ -0,0 +1,100 @@
+﻿// ArchiveListCache.h
+
+#ifndef ZIP7_INC_ARCHIVE_LIST_CACHE_H
+#define ZIP7_INC_ARCHIVE_LIST_CACHE_H
+
+#include "../../../Common/MyBuffer.h"
+#include "../../../Common/MyCom.h"
+#include "../../../Common/MyString.h"
+#include "../../../Common/MyVector.h"
+
+#include "../../Archive/IArchive.h"
+
+/*
+The list cache keeps the properties of all items of archive in the file
+in cache directory. So the next open of same unchanged archive file
+doesn't parse the headers of archive again.
+
+The cache file is used only if the size and the modification time of
+archive file and the checksums of the first and last 64 KB of archive file
+are same as at the moment when the cache file was written.
+
+CListCacheArchive returns the properties from the cache file.
+It's used only by l (List) command. Extract() and GetStream() calls
+open real archive handler, so the cache doesn't speed up extraction.
+It doesn't support IOutArchive, so it must not be used for update operations.
+*/
+
+struct CListCacheKey
+{
+  UInt64 Size;
+  UInt64 MTime;
+  UInt32 HeadCrc;
+  UInt32 TailCrc;
+
+  // it returns S_FALSE, if (stream) doesn't provide the size and the time of file
+  HRESULT Calc(IInStream *stream);
+
+  bool IsEqualTo(const CListCacheKey &k) const
+  {
+    return Size == k.Size
+        && MTime == k.MTime
+        && HeadCrc == k.HeadCrc
+        && TailCrc == k.TailCrc;
+  }
+};
+
+
+struct CListCachePropInfo
+{
+  UString Name;
+  PROPID PropID;
+  VARTYPE VarType;
+};
+
+
+Z7_CLASS_IMP_COM_3(
+  CListCacheArchive
+  , IInArchive
+  , IArchiveGetRawProps
+  , IInArchiveGetStream
+)
+  CByteBuffer _data;
+  size_t _arcPropsPos;
+  CRecordVector<size_t> _items;     // the positions of item records in (_data)
+  CRecordVector<size_t> _rawItems;  // the positions of raw props of items in (_data)
+  CObjectVector<CListCachePropInfo> _props;
+  CObjectVector<CListCachePropInfo> _arcProps;
+  CObjectVector<CListCachePropInfo> _rawProps;
+
+  CMyComPtr<IInArchive> _archive;
+  CMyComPtr<IInStream> _stream;
+  UInt64 _maxCheckStartPosition;
+  bool _archiveIsOpen;
+
+  HRESULT OpenArchive();
+public:
+  UString FormatName;
+
+  CListCacheArchive(): _arcPropsPos(0), _maxCheckStartPosition(0), _archiveIsOpen(false) {}
+
+  /* it reads the cache file for archive (arcPath).
+     It returns S_FALSE, if there is no cache file, or if the cache file
+     is not for current version of archive file. */
+  HRESULT Load(const FString &cacheDir, const UString &arcPath, IInStream *stream);
+
+  // (archive) is the handler that was not opened yet
+  void SetArchive(IInArchive *archive, IInStream *stream, UInt64 maxCheckStartPosition)
+  {
+    _archive = archive;
+    _stream = stream;
+    _maxCheckStartPosition = maxCheckStartPosition;
+  }
+};
+
+
+// it writes the properties of all items of open archive (archive) to cache file
+HRESULT ListCache_Write(const FString &cacheDir, const UString &arcPath,
+    IInStream *stream, IInArchive *archive, const UString &formatName);
+
+#endif
@@ -0,0 +1,252 @@
+﻿// AsyncFileWriter.cpp
+
+#include "StdAfx.h"
+
+#ifndef Z7_ST
+
+#include "../../../Common/Wildcard.h"
+
+#include "../../../Windows/FileDir.h"
+
+#include "ArchiveExtractCallback.h"
+#include "AsyncFileWriter.h"
+
+using namespace NWindows;
+using namespace NFile;
+
+static const unsigned k_AsyncWrite_NumJobsPerThread = 16;
+static const size_t k_AsyncWrite_MaxPendingSize = (size_t)1 << 26;
+
+static THREAD_FUNC_DECL AsyncFileWriterThreadFunction(void *param)
+{
+  CAsyncFileWriterThread *t = (CAsyncFileWriterThread *)param;
+  t->Writer->ThreadLoop(*t);
+  return 0;
+}
+
+CAsyncFileWriter::~CAsyncFileWriter()
+{
+  StopThreads();
+  FOR_VECTOR (i, _queue)
+    delete _queue[i];
+  FOR_VECTOR (i, _finished)
+    delete _finished[i];
+}
+
+void CAsyncFileWriter::StopThreads()
+{
+  if (_threads.IsEmpty())
+    return;
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    _exit = true;
+  }
+  // the threads finish all queued jobs before exit
+  _jobsSem.Release(_threads.Size());
+  FOR_VECTOR (i, _threads)
+    _threads[i].Thread.Wait_Close();
+  _threads.Clear();
+}
+
+HRESULT CAsyncFileWriter::Create(UInt32 numThreads)
+{
+  if (numThreads == 0)
+    numThreads = 1;
+  _maxPending = numThreads * k_AsyncWrite_NumJobsPerThread;
+  WRes wres = _jobsSem.Create(0, _maxPending + numThreads);
+  if (wres == 0)
+    wres = _jobDoneEvent.CreateIfNotCreated_Reset();
+  if (wres != 0)
+    return HRESULT_FROM_WIN32(wres);
+  for (UInt32 i = 0; i < numThreads; i++)
+  {
+    CAsyncFileWriterThread &t = _threads.AddNew();
+    t.Writer = this;
+    t.CurJob = NULL;
+    wres = t.Thread.Create(AsyncFileWriterThreadFunction, &t);
+    if (wres != 0)
+    {
+      _threads.DeleteBack();
+      StopThreads();
+      return HRESULT_FROM_WIN32(wres);
+    }
+  }
+  return S_OK;
+}
+
+void CAsyncFileWriter::ProcessJob(CAsyncFileJob &job)
+{
+  NIO::COutFile file;
+  if (!file.Create_ALWAYS(job.Path))
+  {
+    job.ErrorMessage = "Cannot open output file";
+    job.ErrorCode = GetLastError_noZero_HRESULT();
+    return;
+  }
+
+  if (!file.WriteFull(job.Data->GetBuffer(), job.Data->GetSize()))
+  {
+    job.ErrorMessage = "Cannot write to file";
+    job.ErrorCode = GetLastError_noZero_HRESULT();
+  }
+
+ #if defined(_WIN32) && !defined(UNDER_CE) && !defined(Z7_SFX)
+  // we must write zone file before setting of timestamps
+  if (job.ZoneBuf.Size() != 0)
+    WriteZoneFile_To_BaseFile(job.Path, job.ZoneBuf);
+ #endif
+
+  if (job.CTime_Defined || job.ATime_Defined || job.MTime_Defined)
+    file.SetTime(
+        job.CTime_Defined ? &job.CTime : NULL,
+        job.ATime_Defined ? &job.ATime : NULL,
+        job.MTime_Defined ? &job.MTime : NULL);
+
+  if (!file.Close())
+  {
+    if (!job.ErrorMessage)
+    {
+      job.ErrorMessage = "Cannot close output file";
+      job.ErrorCode = GetLastError_noZero_HRESULT();
+    }
+    return;
+  }
+
+  if (job.Attrib_Defined)
+    if (!NDir::SetFileAttrib_PosixHighDetect(job.Path, job.Attrib))
+    {
+      if (!job.ErrorMessage)
+      {
+        job.ErrorMessage = "Cannot set file attribute";
+        job.ErrorCode = GetLastError_noZero_HRESULT();
+      }
+    }
+}
+
+void CAsyncFileWriter::ThreadLoop(CAsyncFileWriterThread &t)
+{
+  for (;;)
+  {
+    _jobsSem.Lock();
+    CAsyncFileJob *job;
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      if (_queue.IsEmpty())
+      {
+        if (_exit)
+          return;
+        continue;
+      }
+      job = _queue[0];
+      _queue.Delete(0);
+      t.CurJob = job;
+    }
+
+    ProcessJob(*job);
+
+    /* the finished job can wait in (_finished) for previous jobs,
+       so we free the data here, and (_pendingSize) is the size of data in memory */
+    const size_t size = job->Data->GetSize();
+    job->Data = NULL;
+    job->DataStream.Release();
+   #if defined(_WIN32) && !defined(UNDER_CE) && !defined(Z7_SFX)
+    job->ZoneBuf.Free();
+   #endif
+
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      t.CurJob = NULL;
+      _numPending--;
+      _pendingSize -= size;
+      _finished.Add(job);
+    }
+    _jobDoneEvent.Set();
+  }
+}
+
+void CAsyncFileWriter::WaitFor(unsigned maxPending, size_t maxPendingSize)
+{
+  for (;;)
+  {
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      if (_numPending <= maxPending && _pendingSize <= maxPendingSize)
+        return;
+    }
+    _jobDoneEvent.Lock();
+  }
+}
+
+void CAsyncFileWriter::Submit(CAsyncFileJob *job)
+{
+  const size_t size = job->Data->GetSize();
+  // we allow one big job, if there are no other pending jobs
+  WaitFor(_maxPending - 1,
+      size >= k_AsyncWrite_MaxPendingSize ? 0 : k_AsyncWrite_MaxPendingSize - size);
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    job->Seq = _nextSeq++;
+    _queue.Add(job);
+    _numPending++;
+    _pendingSize += size;
+  }
+  _jobsSem.Release();
+}
+
+void CAsyncFileWriter::Flush()
+{
+  WaitFor(0, 0);
+}
+
+bool CAsyncFileWriter::IsPendingPath(const FString &path)
+{
+  NSynchronization::CCriticalSectionLock lock(_cs);
+  FOR_VECTOR (i, _queue)
+    if (CompareFileNames(fs2us(_queue[i]->Path), fs2us(path)) == 0)
+      return true;
+  FOR_VECTOR (i, _threads)
+  {
+    const CAsyncFileJob *job = _threads[i].CurJob;
+    if (job && CompareFileNames(fs2us(job->Path), fs2us(path)) == 0)
+      return true;
+  }
+  return false;
+}
+
+static int CompareJobsBySeq(CAsyncFileJob * const *p1, CAsyncFileJob * const *p2, void * /* param */)
+{
+  return MyCompare((*p1)->Seq, (*p2)->Seq);
+}
+
+void CAsyncFileWriter::GetErrors(CObjectVector<CAsyncFileError> &errors)
+{
+  CRecordVector<CAsyncFileJob *> finished;
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    _finished.Sort(CompareJobsBySeq, NULL);
+    // the jobs after a job that is still running are kept for next call
+    unsigned num = 0;
+    while (num < _finished.Size() && _finished[num]->Seq == _reportSeq)
+    {
+      num++;
+      _reportSeq++;
+    }
+    for (unsigned i = 0; i < num; i++)
+      finished.Add(_finished[i]);
+    _finished.DeleteFrontal(num);
+  }
+  FOR_VECTOR (i, finished)
+  {
+    CAsyncFileJob *job = finished[i];
+    if (job->ErrorMessage)
+    {
+      CAsyncFileError &e = errors.AddNew();
+      e.Path = job->Path;
+      e.Message = job->ErrorMessage;
+      e.ErrorCode = job->ErrorCode;
+    }
+    delete job;
+  }
+}
+
+#endif
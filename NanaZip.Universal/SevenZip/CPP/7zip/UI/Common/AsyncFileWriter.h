@@ -0,0 +1,130 @@
+﻿// AsyncFileWriter.h
+
+#ifndef ZIP7_INC_ASYNC_FILE_WRITER_H
+#define ZIP7_INC_ASYNC_FILE_WRITER_H
+
+#ifndef Z7_ST
+
+#include "../../../Common/MyBuffer.h"
+#include "../../../Common/MyCom.h"
+#include "../../../Common/MyString.h"
+#include "../../../Common/MyVector.h"
+
+#include "../../../Windows/FileIO.h"
+#include "../../../Windows/Synchronization.h"
+#include "../../../Windows/Thread.h"
+
+#include "../../Common/StreamObjects.h"
+
+/*
+CAsyncFileWriter moves the file system work of extraction out of decoding thread.
+The decoder writes the data of small file to memory stream (CDynBufSeqOutStream).
+Then the caller submits the job, and one of writer threads creates the file,
+writes the data, writes Zone.Identifier stream, sets timestamps, closes the file
+and sets the attributes. So the decoder can continue with next item,
+while the file system is busy with previous files.
+
+Submit() blocks, if the number of pending jobs or the size of pending data
+exceeds the limits, so the memory usage is bounded (back-pressure).
+
+The errors are collected in the writer and they are returned to the caller
+in the order of submission by GetErrors(): a finished job is returned only
+after all jobs that were submitted before it. Only the caller thread
+can call the functions of CAsyncFileWriter.
+*/
+
+struct CAsyncFileJob
+{
+  FString Path;
+  // the writer thread releases the data after writing
+  CMyComPtr<ISequentialOutStream> DataStream;
+  const CDynBufSeqOutStream *Data;
+
+  CFiTime CTime;
+  CFiTime ATime;
+  CFiTime MTime;
+  bool CTime_Defined;
+  bool ATime_Defined;
+  bool MTime_Defined;
+
+  bool Attrib_Defined;
+  UInt32 Attrib;
+
+ #if defined(_WIN32) && !defined(UNDER_CE) && !defined(Z7_SFX)
+  CByteBuffer ZoneBuf;
+ #endif
+
+  // the results:
+  UInt64 Seq;
+  const char *ErrorMessage;
+  HRESULT ErrorCode;
+
+  CAsyncFileJob():
+      Data(NULL),
+      CTime_Defined(false),
+      ATime_Defined(false),
+      MTime_Defined(false),
+      Attrib_Defined(false),
+      Attrib(0),
+      Seq(0),
+      ErrorMessage(NULL),
+      ErrorCode(S_OK)
+      {}
+};
+
+struct CAsyncFileError
+{
+  FString Path;
+  const char *Message;
+  HRESULT ErrorCode;
+};
+
+class CAsyncFileWriter;
+
+struct CAsyncFileWriterThread
+{
+  CAsyncFileWriter *Writer;
+  CAsyncFileJob *CurJob;
+  NWindows::CThread Thread;
+};
+
+class CAsyncFileWriter
+{
+  CObjectVector<CAsyncFileWriterThread> _threads;
+  CRecordVector<CAsyncFileJob *> _queue;
+  CRecordVector<CAsyncFileJob *> _finished;
+  unsigned _numPending;
+  unsigned _maxPending;
+  size_t _pendingSize;
+  UInt64 _nextSeq;
+  UInt64 _reportSeq; // Seq of first job that was not returned by GetErrors()
+  bool _exit;
+  NWindows::NSynchronization::CCriticalSection _cs;
+  NWindows::NSynchronization::CSemaphore _jobsSem;
+  NWindows::NSynchronization::CAutoResetEvent _jobDoneEvent;
+
+  void StopThreads();
+  void WaitFor(unsigned maxPending, size_t maxPendingSize);
+  static void ProcessJob(CAsyncFileJob &job);
+public:
+  CAsyncFileWriter(): _numPending(0), _maxPending(0), _pendingSize(0), _nextSeq(0), _reportSeq(0), _exit(false) {}
+  ~CAsyncFileWriter();
+
+  HRESULT Create(UInt32 numThreads);
+  bool IsCreated() const { return !_threads.IsEmpty(); }
+
+  // the writer takes the ownership of (job).
+  void Submit(CAsyncFileJob *job);
+  // it waits for all pending jobs.
+  void Flush();
+  bool IsPendingPath(const FString &path);
+  /* it returns errors of finished jobs that follow all previous jobs in
+     the order of submission, and it removes these jobs from writer. */
+  void GetErrors(CObjectVector<CAsyncFileError> &errors);
+
+  void ThreadLoop(CAsyncFileWriterThread &t);
+};
+
+#endif
+
+#endif
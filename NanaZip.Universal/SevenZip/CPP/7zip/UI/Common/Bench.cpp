@@ -2729,6 +2729,35 @@ static const CBenchMethod g_Bench[] =
   // { 10, 22, 1655,    0, 1830, "PPMDZip:x5" },
   { 10, 22, 1655,    0, 1830, "PPMD:x5" },
 
+  // **************** NanaZip Modification Start ****************
+  // the codecs of 7-Zip ZS (NanaZip.Core/Extensions/ZSCodecs):
+  // these encoders use all cores by default, so (mt1) gives the rating per thread,
+  // and (mt2) gives the rating of the internal multithreading of the codec.
+  // the complexities are estimated relative to Deflate.
+  { 20, 21,   28,    4,    4, "ZSTD:x1:mt1" },
+  { 20, 21,   34,    4,    4, "ZSTD:x3:mt1" },
+  { 10, 21,   34,    4,    4, "ZSTD:x3:mt2" },
+  { 10, 22,   70,    4,    4, "ZSTD:x5:mt1" },
+
+  { 10, 22,   40,   10,    6, "BROTLI:x1:mt1" },
+  { 10, 22,  220,   10,    6, "BROTLI:x5:mt1" },
+  { 10, 22,  220,   10,    6, "BROTLI:x5:mt2" },
+
+  { 20, 16,   14,    1,    2, "LZ4:x1:mt1" },
+  { 10, 16,  150,    1,    2, "LZ4:x5:mt1" },
+  { 10, 16,  150,    1,    2, "LZ4:x5:mt2" },
+
+  { 10, 22,   50,    3,    4, "LZ5:x1:mt1" },
+  { 10, 22,  150,    3,    4, "LZ5:x5:mt1" },
+
+  { 10, 22,   16,    2,    3, "LIZARD:x10:mt1" },
+  { 10, 22,   30,    4,    4, "LIZARD:x20:mt1" },
+  { 10, 22,   30,    4,    4, "LIZARD:x20:mt2" },
+
+  { 40, 24,  800,  145,   20, "FLZMA2:x5:mt1" },
+  { 40, 24,  800,  145,   20, "FLZMA2:x5:mt2" },
+  // **************** NanaZip Modification End ****************
+
   // {  2,  0,  -16,    0,  -16, "Swap2" },
   {  2,  0,  -16,    0,  -16, "Swap4" },
 
@@ -3639,6 +3668,88 @@ static HRESULT CrcBench(
 }
 
 
+// **************** NanaZip Modification Start ****************
+/*
+  The hashers from NanaZip.Codecs have no precomputed checksums in g_Hash[].
+  So we calculate the reference checksum with small updates of different sizes,
+  and the benchmark (that uses big updates) also checks the streaming code of hasher.
+*/
+static HRESULT GetHashCheckSum_Ref(
+    DECL_EXTERNAL_CODECS_LOC_VARS
+    const COneMethodInfo &method,
+    size_t bufferSize,
+    const Byte *fileData,
+    UInt32 &checkSum)
+{
+  CMethodId hashID;
+  if (!FindHashMethod(
+      EXTERNAL_CODECS_LOC_VARS
+      method.MethodName, hashID))
+    return E_NOTIMPL;
+  CMyComPtr<IHasher> hasher;
+  AString name;
+  RINOK(CreateHasher(EXTERNAL_CODECS_LOC_VARS hashID, name, hasher))
+  if (!hasher)
+    return E_NOTIMPL;
+  CMyComPtr<ICompressSetCoderProperties> scp;
+  hasher.QueryInterface(IID_ICompressSetCoderProperties, &scp);
+  if (scp)
+  {
+    RINOK(method.SetCoderProps(scp))
+  }
+
+  MY_ALIGN(16)
+  UInt32 hash32[64 / 4];
+  memset(hash32, 0, sizeof(hash32));
+  const UInt32 hashSize = hasher->GetDigestSize();
+  if (hashSize > sizeof(hash32))
+    return S_FALSE;
+
+  CCrcInfo_Base crcib;
+  crcib.CreateLocalBuf = false;
+  RINOK(crcib.Generate(fileData, bufferSize))
+
+  hasher->Init();
+  const Byte *data = crcib.Data;
+  size_t rem = crcib.Size;
+  UInt32 step = 1;
+  while (rem != 0)
+  {
+    const UInt32 cur = (rem < step) ? (UInt32)rem : step;
+    hasher->Update(data, cur);
+    data += cur;
+    rem -= cur;
+    // 1, 4, 13, 40, ... : unaligned sizes
+    step = step * 3 + 1;
+    if (step > ((UInt32)1 << 15))
+      step = 1;
+  }
+  hasher->Final((Byte *)(void *)hash32);
+
+  UInt32 sum = 0;
+  for (UInt32 j = 0; j < hashSize; j += 4)
+  {
+    sum = rotlFixed(sum, 11);
+    sum += GetUi32((const Byte *)(const void *)hash32 + j);
+  }
+  checkSum = sum;
+  return S_OK;
+}
+
+static bool IsHashInBenchTable(const AString &name)
+{
+  for (unsigned i = 0; i < Z7_ARRAY_SIZE(g_Hash); i++)
+  {
+    AString benchMethod (g_Hash[i].Name);
+    const int propPos = benchMethod.Find(':');
+    if (propPos >= 0)
+      benchMethod.DeleteFrom((unsigned)propPos);
+    if (benchMethod.IsEqualTo_Ascii_NoCase(name))
+      return true;
+  }
+  return false;
+}
+// **************** NanaZip Modification End ****************
 
 static HRESULT TotalBench_Hash(
     DECL_EXTERNAL_CODECS_LOC_VARS
@@ -3695,6 +3806,56 @@ static HRESULT TotalBench_Hash(
     }
     callback->NewLine();
   }
+
+  // **************** NanaZip Modification Start ****************
+  // the hashers from external codecs (NanaZip.Codecs) that are not in g_Hash[]
+  #ifdef Z7_EXTERNAL_CODECS
+  if (_externalCodecs)
+  FOR_VECTOR (i, _externalCodecs->Hashers)
+  {
+    const AString &name = _externalCodecs->Hashers[i].Name;
+    if (!DoesWildcardMatchName_NoCase(methodMask.MethodName, name))
+      continue;
+    if (IsHashInBenchTable(name))
+      continue;
+    PrintLeft(*callback->_file, name, kFieldSize_Name);
+
+    COneMethodInfo method;
+    NCOM::CPropVariant propVariant;
+    propVariant = name;
+    RINOK(method.ParseMethodFromPROPVARIANT(UString(), propVariant))
+
+    UInt32 checkSum = 0;
+    HRESULT res = GetHashCheckSum_Ref(
+        EXTERNAL_CODECS_LOC_VARS
+        method, bufSize, fileData, checkSum);
+    if (res == S_OK)
+    {
+      UInt64 speed, usage;
+      res = CrcBench(
+          EXTERNAL_CODECS_LOC_VARS
+          complexInCommands,
+          numThreads, bufSize, fileData,
+          speed, usage,
+          16 * k_Hash_Complex_Mult, // for unknown hash method
+          1, // benchWeight
+          &checkSum,
+          method,
+          printCallback,
+       #ifndef Z7_ST
+          affinityMode,
+       #endif
+          true, // showRating
+          encodeRes, showFreq, cpuFreq);
+    }
+    if (res != E_NOTIMPL)
+    {
+      RINOK(res)
+    }
+    callback->NewLine();
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
   return S_OK;
 }
 
@@ -4479,6 +4640,18 @@ HRESULT Bench(
       if (dataSize > bufSize || !use_fileData)
         dataSize = (size_t)bufSize;
       
+      // **************** NanaZip Modification Start ****************
+      // the hash methods without precomputed checksum are checked with reference checksum
+      UInt32 refCheckSum = 0;
+      const UInt32 *checkSum2 = (pow == kNumHashDictBits && !use_fileData) ? checkSum : NULL;
+      if (isHashMethod && !checkSum2)
+      {
+        RINOK(GetHashCheckSum_Ref(EXTERNAL_CODECS_LOC_VARS
+            method, dataSize, (const Byte *)fileDataBuffer, refCheckSum))
+        checkSum2 = &refCheckSum;
+      }
+      // **************** NanaZip Modification End ****************
+
       for (UInt32 iter = 0; iter < numIterations; iter++)
       {
         Print_Pow(f, pow);
@@ -4498,7 +4671,10 @@ HRESULT Bench(
               speed, usage,
               (UInt32)complexity,
               1, // benchWeight,
-              (pow == kNumHashDictBits && !use_fileData) ? checkSum : NULL,
+              // **************** NanaZip Modification Start ****************
+              // (pow == kNumHashDictBits && !use_fileData) ? checkSum : NULL,
+              checkSum2,
+              // **************** NanaZip Modification End ****************
               method,
               &f,
             #ifndef Z7_ST
@@ -4920,9 +5096,21 @@ HRESULT Bench(
 
         if (AreSameMethodNames(benchMethod, methodName))
         {
+          // **************** NanaZip Modification Start ****************
+          // the entries of ZS codecs end with (mt1) or (mt2),
+          // so "x3" uses the complexity of "x3:mt1" entry.
+          AString propsPrefix ("x5");
+          if (!method.PropsString.IsEmpty())
+            propsPrefix.SetFromWStr_if_Ascii(method.PropsString);
+          propsPrefix.Add_Colon();
+          // **************** NanaZip Modification End ****************
           if (benchProps.IsEmpty()
               || (benchProps.IsEqualTo("x5") && method.PropsString.IsEmpty())
-              || method.PropsString.IsPrefixedBy_Ascii_NoCase(benchProps))
+              || method.PropsString.IsPrefixedBy_Ascii_NoCase(benchProps)
+              // **************** NanaZip Modification Start ****************
+              || benchProps.IsPrefixedBy_Ascii_NoCase(propsPrefix)
+              // **************** NanaZip Modification End ****************
+              )
           {
             callback.BenchProps.EncComplex = h.EncComplex;
             callback.BenchProps.DecComplexCompr = h.DecComplexCompr;
@@ -296,6 +296,13 @@ struct CDirItem: public NWindows::NFile::NFind::CFileInfoBase
 
 
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+class CDirScanPrefetcher;
+#endif
+struct CDirScanNode;
+// **************** NanaZip Modification End ****************
+
 class CDirItems
 {
   UStringVector Prefixes;
@@ -306,6 +313,10 @@ class CDirItems
 
   HRESULT EnumerateDir(int phyParent, int logParent, const FString &phyPrefix);
 
+  // **************** NanaZip Modification Start ****************
+  HRESULT EnumerateOneDir_Base(const FString &phyPrefix, CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+  // **************** NanaZip Modification End ****************
+
 public:
   CObjectVector<CDirItem> Items;
 
@@ -353,6 +364,15 @@ public:
 
   IDirItemsCallback *Callback;
 
+  // **************** NanaZip Modification Start ****************
+  // the number of threads that read directories: (0) - auto, (1) - no threads
+  UInt32 NumScanThreads;
+ #ifndef Z7_ST
+  // it's set by EnumerateItems() for the time of scan
+  CDirScanPrefetcher *Prefetcher;
+ #endif
+  // **************** NanaZip Modification End ****************
+
   CDirItems();
 
   void AddDirFileInfo(int phyParent, int logParent, int secureIndex,
@@ -371,7 +391,13 @@ public:
   void DeleteLastPrefix();
 
   // HRESULT EnumerateOneDir(const FString &phyPrefix, CObjectVector<NWindows::NFile::NFind::CDirEntry> &files);
-  HRESULT EnumerateOneDir(const FString &phyPrefix, CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+  // **************** NanaZip Modification Start ****************
+  // (scanNode) is censor state of (phyPrefix) that is used to filter prefetched subdirectories
+  HRESULT EnumerateOneDir(const FString &phyPrefix, CObjectVector<NWindows::NFile::NFind::CFileInfo> &files,
+      const CDirScanNode *scanNode = NULL);
+  // it releases prefetched subdirectories of (phyPrefix) that were not requested
+  void FinishOneDir(const FString &phyPrefix, const CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+  // **************** NanaZip Modification End ****************
   
   HRESULT EnumerateItems2(
     const FString &phyPrefix,
@@ -0,0 +1,377 @@
+﻿// DirScanPrefetcher.cpp
+
+#include "StdAfx.h"
+
+#ifndef Z7_ST
+
+#include <string.h>
+
+#include "DirScanPrefetcher.h"
+
+using namespace NWindows;
+using namespace NFile;
+
+// the limits for listings that were submitted, but were not requested by walker still
+static const unsigned k_DirScan_MaxListings = (unsigned)1 << 14;
+static const unsigned k_DirScan_MaxFiles = (unsigned)1 << 18;
+
+enum
+{
+  k_Listing_Pending,
+  k_Listing_Busy,
+  k_Listing_Ready,
+  k_Listing_Failed
+};
+
+static THREAD_FUNC_DECL DirScanThreadFunction(void *param)
+{
+  ((CDirScanPrefetcher *)param)->ThreadLoop();
+  return 0;
+}
+
+// it's same as CDirItems::EnumerateOneDir(), but it returns (false) for any error
+static bool ReadListing(const FString &dirPrefix, CObjectVector<NFind::CFileInfo> &files, bool followLink)
+{
+  NFind::CEnumerator enumerator;
+  enumerator.SetDirPrefix(dirPrefix);
+
+ #ifdef _WIN32
+
+  UNUSED_VAR(followLink)
+  for (;;)
+  {
+    NFind::CFileInfo fi;
+    bool found;
+    if (!enumerator.Next(fi, found))
+      return false;
+    if (!found)
+      return true;
+    files.Add(fi);
+  }
+
+ #else
+
+  CObjectVector<NFind::CDirEntry> entries;
+  for (;;)
+  {
+    bool found;
+    NFind::CDirEntry de;
+    if (!enumerator.Next(de, found))
+      return false;
+    if (!found)
+      break;
+    entries.Add(de);
+  }
+  FOR_VECTOR (i, entries)
+  {
+    NFind::CFileInfo fi;
+    if (!enumerator.Fill_FileInfo(entries[i], fi, followLink))
+      return false;
+    files.Add(fi);
+  }
+  return true;
+
+ #endif
+}
+
+static bool NeedPrefetchDir(const NFind::CFileInfo &fi)
+{
+  if (!fi.IsDir())
+    return false;
+  // the walker doesn't enter to links in some modes, so we don't prefetch them
+ #ifdef _WIN32
+  return !fi.IsAltStream && !fi.HasReparsePoint();
+ #else
+  return !fi.IsPosixLink();
+ #endif
+}
+
+// it's not lexicographical order, but it's enough for search
+static int ComparePrefixes(const FString &s1, const FString &s2)
+{
+  if (s1.Len() != s2.Len())
+    return MyCompare(s1.Len(), s2.Len());
+  return memcmp(s1.Ptr(), s2.Ptr(), s1.Len() * sizeof(FChar));
+}
+
+CDirScanPrefetcher::~CDirScanPrefetcher()
+{
+  StopThreads();
+  FOR_VECTOR (i, _listings)
+    delete _listings[i];
+  // dropped pending listings are not in (_listings)
+  FOR_VECTOR (i, _stack)
+    if (_stack[i]->Dropped)
+      delete _stack[i];
+}
+
+void CDirScanPrefetcher::Init(UInt32 numThreads, bool followLink, const IDirScanFilter *filter)
+{
+  _numThreads = numThreads;
+  _followLink = followLink;
+  _filter = filter;
+}
+
+bool CDirScanPrefetcher::CreateThreads()
+{
+  if (_numThreads == 0)
+    _wasFailed = true;
+  if (_wasFailed)
+    return false;
+  WRes wres = _jobsSem.Create(0, k_DirScan_MaxListings * 2 + _numThreads);
+  if (wres == 0)
+    wres = _listingDoneEvent.CreateIfNotCreated_Reset();
+  if (wres == 0)
+    for (UInt32 i = 0; i < _numThreads; i++)
+    {
+      NWindows::CThread &t = _threads.AddNew();
+      if (t.Create(DirScanThreadFunction, this) != 0)
+      {
+        // we can work with smaller number of threads
+        _threads.DeleteBack();
+        break;
+      }
+    }
+  if (_threads.IsEmpty())
+  {
+    _wasFailed = true;
+    return false;
+  }
+  return true;
+}
+
+void CDirScanPrefetcher::StopThreads()
+{
+  if (_threads.IsEmpty())
+    return;
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    _exit = true;
+  }
+  /* if the semaphore has big count from listings that were taken by walker,
+     Release() can fail, but then all threads will be woken up anyway */
+  _jobsSem.Release(_threads.Size());
+  FOR_VECTOR (i, _threads)
+    _threads[i].Wait_Close();
+  _threads.Clear();
+}
+
+int CDirScanPrefetcher::FindListing(const FString &prefix, unsigned &insertPos) const
+{
+  unsigned left = 0, right = _listings.Size();
+  while (left != right)
+  {
+    const unsigned mid = (left + right) / 2;
+    const int comp = ComparePrefixes(prefix, _listings[mid]->Prefix);
+    if (comp == 0)
+      return (int)mid;
+    if (comp < 0)
+      right = mid;
+    else
+      left = mid + 1;
+  }
+  insertPos = left;
+  return -1;
+}
+
+void CDirScanPrefetcher::AddSubDirs_Locked(const FString &dirPrefix, const CDirScanNode &scanNode,
+    const CObjectVector<NFind::CFileInfo> &files)
+{
+  CRecordVector<CDirScanListing *> newListings;
+  FOR_VECTOR (i, files)
+  {
+    const NFind::CFileInfo &fi = files[i];
+    if (!NeedPrefetchDir(fi))
+      continue;
+    if (_listings.Size() >= k_DirScan_MaxListings || _numFiles >= k_DirScan_MaxFiles)
+      break;
+    FString prefix = dirPrefix;
+    prefix += fi.Name;
+    prefix.Add_PathSepar();
+    unsigned insertPos;
+    if (FindListing(prefix, insertPos) >= 0)
+      continue;
+    CDirScanNode subNode;
+    // the walker will not enter to directories that are excluded by censor
+    if (_filter && scanNode.Node)
+      if (!_filter->GetSubDirNode(scanNode, fi, subNode))
+        continue;
+    CDirScanListing *listing = new CDirScanListing;
+    listing->Prefix = prefix;
+    listing->ScanNode = subNode;
+    listing->State = k_Listing_Pending;
+    _listings.Insert(insertPos, listing);
+    newListings.Add(listing);
+  }
+  if (newListings.IsEmpty())
+    return;
+  // the walker will request the first subdirectory first, so it must be on top of stack
+  for (unsigned i = newListings.Size(); i != 0;)
+    _stack.Add(newListings[--i]);
+  _jobsSem.Release(newListings.Size());
+}
+
+void CDirScanPrefetcher::DropSubDirs_Locked(const FString &dirPrefix,
+    const CObjectVector<NFind::CFileInfo> &files)
+{
+  FOR_VECTOR (i, files)
+  {
+    const NFind::CFileInfo &fi = files[i];
+    if (!NeedPrefetchDir(fi))
+      continue;
+    FString prefix = dirPrefix;
+    prefix += fi.Name;
+    prefix.Add_PathSepar();
+    unsigned insertPos;
+    const int index = FindListing(prefix, insertPos);
+    if (index < 0)
+      continue;
+    CDirScanListing *listing = _listings[(unsigned)index];
+    _listings.Delete((unsigned)index);
+    if (listing->State == k_Listing_Pending
+        || listing->State == k_Listing_Busy)
+    {
+      // the worker will delete pending listing from stack, or busy listing after reading
+      listing->Dropped = true;
+      continue;
+    }
+    if (listing->State == k_Listing_Ready)
+    {
+      _numFiles -= listing->Files.Size();
+      // the worker has submitted the subdirectories of that listing
+      DropSubDirs_Locked(listing->Prefix, listing->Files);
+    }
+    delete listing;
+  }
+}
+
+void CDirScanPrefetcher::FinishDir(const FString &dirPrefix,
+    const CObjectVector<NFind::CFileInfo> &files)
+{
+  if (_threads.IsEmpty())
+    return;
+  NSynchronization::CCriticalSectionLock lock(_cs);
+  DropSubDirs_Locked(dirPrefix, files);
+}
+
+void CDirScanPrefetcher::SubmitSubDirs(const FString &dirPrefix, const CDirScanNode &scanNode,
+    const CObjectVector<NFind::CFileInfo> &files)
+{
+  if (_threads.IsEmpty())
+  {
+    if (_wasFailed)
+      return;
+    bool isThereDir = false;
+    FOR_VECTOR (i, files)
+      if (NeedPrefetchDir(files[i]))
+      {
+        isThereDir = true;
+        break;
+      }
+    if (!isThereDir || !CreateThreads())
+      return;
+  }
+  NSynchronization::CCriticalSectionLock lock(_cs);
+  AddSubDirs_Locked(dirPrefix, scanNode, files);
+}
+
+bool CDirScanPrefetcher::GetListing(const FString &dirPrefix,
+    CObjectVector<NFind::CFileInfo> &files)
+{
+  if (_threads.IsEmpty())
+    return false;
+  CDirScanListing *listing;
+  for (;;)
+  {
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      unsigned insertPos;
+      const int index = FindListing(dirPrefix, insertPos);
+      if (index < 0)
+        return false;
+      listing = _listings[(unsigned)index];
+      if (listing->State != k_Listing_Busy)
+      {
+        _listings.Delete((unsigned)index);
+        if (listing->State == k_Listing_Pending)
+        {
+          // the walker will read that directory itself
+          for (unsigned i = _stack.Size(); i != 0;)
+            if (_stack[--i] == listing)
+            {
+              _stack.Delete(i);
+              break;
+            }
+        }
+        else if (listing->State == k_Listing_Ready)
+          _numFiles -= listing->Files.Size();
+        break;
+      }
+    }
+    _listingDoneEvent.Lock();
+  }
+  const bool res = (listing->State == k_Listing_Ready);
+  if (res)
+    files = listing->Files;
+  delete listing;
+  return res;
+}
+
+void CDirScanPrefetcher::ThreadLoop()
+{
+  for (;;)
+  {
+    _jobsSem.Lock();
+    CDirScanListing *listing;
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      if (_exit)
+        return;
+      // the walker could take the listing from stack
+      if (_stack.IsEmpty())
+        continue;
+      listing = _stack.Back();
+      _stack.DeleteBack();
+      if (listing->Dropped)
+      {
+        delete listing;
+        continue;
+      }
+      listing->State = k_Listing_Busy;
+    }
+
+    const bool res = ReadListing(listing->Prefix, listing->Files, _followLink);
+
+    bool dropped;
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      dropped = listing->Dropped;
+      if (dropped)
+      {
+        // the walker has finished the parent directory already
+      }
+      else if (res)
+      {
+        listing->State = k_Listing_Ready;
+        _numFiles += listing->Files.Size();
+        /* we add subdirectories before the walker can get this listing.
+           Otherwise the walker could request some subdirectory before it's added,
+           and then that subdirectory would be read again without any use. */
+        AddSubDirs_Locked(listing->Prefix, listing->ScanNode, listing->Files);
+      }
+      else
+      {
+        listing->State = k_Listing_Failed;
+        listing->Files.Clear();
+      }
+    }
+    if (dropped)
+    {
+      delete listing;
+      continue;
+    }
+    _listingDoneEvent.Set();
+  }
+}
+
+#endif
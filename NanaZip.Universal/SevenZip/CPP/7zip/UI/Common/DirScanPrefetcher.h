@@ -0,0 +1,120 @@
+﻿// DirScanPrefetcher.h
+
+#ifndef ZIP7_INC_DIR_SCAN_PREFETCHER_H
+#define ZIP7_INC_DIR_SCAN_PREFETCHER_H
+
+#ifndef Z7_ST
+
+#include "../../../Common/MyString.h"
+#include "../../../Common/MyVector.h"
+#include "../../../Common/Wildcard.h"
+
+#include "../../../Windows/FileFind.h"
+#include "../../../Windows/Synchronization.h"
+#include "../../../Windows/Thread.h"
+
+/*
+CDirScanPrefetcher reads the listings of directories (names and file info)
+in worker threads, before the directory walker of CDirItems needs them.
+The walker still is single-threaded, and it adds the items to CDirItems
+in same order as before, so the result of scan doesn't depend on threads.
+
+The walker submits the subdirectories of each directory that it has read.
+The worker thread that has read some directory submits its subdirectories too.
+The pending directories are kept in one stack, and idle worker takes
+the newest directory, so the prefetching follows the depth-first order of walker.
+
+If the walker requests the directory that was not read still,
+it reads that directory itself. If the worker could not read the directory,
+the walker reads it again, so all errors are reported by walker.
+
+Each listing keeps the censor state of walker for that directory (CDirScanNode).
+The subdirectories are filtered with IDirScanFilter, so the directories
+that the walker will not enter (excluded by -x/-xr) are not read.
+When the walker has finished some directory, the listings of its subdirectories
+that were not requested will not be requested later. So FinishDir() deletes
+these listings with all their descendants, and frees the limits for other listings.
+
+The number of prefetched directories and items is limited.
+Only the walker thread can call the functions of CDirScanPrefetcher.
+*/
+
+// the censor state of walker for directory (see EnumerateDirItems()).
+// (Node == NULL) means that there is no censor, and all subdirectories are entered.
+struct CDirScanNode
+{
+  const NWildcard::CCensorNode *Node;
+  UStringVector Parts; // additional parts from (Node)
+  bool EnterToSubFolders;
+
+  CDirScanNode(): Node(NULL), EnterToSubFolders(false) {}
+};
+
+struct IDirScanFilter
+{
+  /* it returns (true), if the walker will enumerate the subdirectory (fi)
+     of directory that has (parent) state, and it sets the state of subdirectory.
+     It's called from worker threads. */
+  virtual bool GetSubDirNode(const CDirScanNode &parent,
+      const NWindows::NFile::NFind::CFileInfo &fi, CDirScanNode &sub) const = 0;
+};
+
+struct CDirScanListing
+{
+  FString Prefix;
+  CDirScanNode ScanNode;
+  CObjectVector<NWindows::NFile::NFind::CFileInfo> Files;
+  int State;
+  // the listing was deleted from (_listings), while a worker was reading it
+  bool Dropped;
+
+  CDirScanListing(): State(0), Dropped(false) {}
+};
+
+class CDirScanPrefetcher
+{
+  CObjectVector<NWindows::CThread> _threads;
+  // all listings that were not requested by walker, sorted by Prefix
+  CRecordVector<CDirScanListing *> _listings;
+  // the listings that were not taken by workers
+  CRecordVector<CDirScanListing *> _stack;
+  unsigned _numFiles;
+  UInt32 _numThreads;
+  const IDirScanFilter *_filter;
+  bool _followLink;
+  bool _exit;
+  bool _wasFailed;
+  NWindows::NSynchronization::CCriticalSection _cs;
+  NWindows::NSynchronization::CSemaphore _jobsSem;
+  NWindows::NSynchronization::CAutoResetEvent _listingDoneEvent;
+
+  bool CreateThreads();
+  void StopThreads();
+  int FindListing(const FString &prefix, unsigned &insertPos) const;
+  void AddSubDirs_Locked(const FString &dirPrefix, const CDirScanNode &scanNode,
+      const CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+  void DropSubDirs_Locked(const FString &dirPrefix,
+      const CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+public:
+  CDirScanPrefetcher(): _numFiles(0), _numThreads(0), _filter(NULL), _followLink(false), _exit(false), _wasFailed(false) {}
+  ~CDirScanPrefetcher();
+
+  // the threads are created, when the first subdirectory is submitted.
+  void Init(UInt32 numThreads, bool followLink, const IDirScanFilter *filter);
+
+  void SubmitSubDirs(const FString &dirPrefix, const CDirScanNode &scanNode,
+      const CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+  // the walker calls it after it has enumerated (dirPrefix) with all subdirectories.
+  void FinishDir(const FString &dirPrefix,
+      const CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+  /* it returns (true), if the listing of (dirPrefix) was read by worker thread.
+     if it returns (false), the caller must read the directory itself. */
+  bool GetListing(const FString &dirPrefix,
+      CObjectVector<NWindows::NFile::NFind::CFileInfo> &files);
+
+  void ThreadLoop();
+};
+
+#endif
+
+#endif
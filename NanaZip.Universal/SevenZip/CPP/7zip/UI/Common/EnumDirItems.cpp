@@ -16,12 +16,20 @@
 #include "../../../Windows/FileDir.h"
 #include "../../../Windows/FileIO.h"
 #include "../../../Windows/FileName.h"
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../../../Windows/System.h"
+#endif
+// **************** NanaZip Modification End ****************
 
 #if defined(_WIN32) && !defined(UNDER_CE)
 #define Z7_USE_SECURITY_CODE
 #include "../../../Windows/SecurityUtils.h"
 #endif
 
+// **************** NanaZip Modification Start ****************
+#include "DirScanPrefetcher.h"
+// **************** NanaZip Modification End ****************
 #include "EnumDirItems.h"
 #include "SortUtils.h"
 
@@ -190,6 +198,12 @@ CDirItems::CDirItems():
     , StoreOwnerName(false)
    #endif
     , Callback(NULL)
+    // **************** NanaZip Modification Start ****************
+    , NumScanThreads(0)
+   #ifndef Z7_ST
+    , Prefetcher(NULL)
+   #endif
+    // **************** NanaZip Modification End ****************
 {
   #ifdef Z7_USE_SECURITY_CODE
   _saclEnabled = InitLocalPrivileges();
@@ -256,7 +270,49 @@ HRESULT CDirItems::AddSecurityItem(const FString &path, int &secureIndex)
 #endif // Z7_USE_SECURITY_CODE
 
 
-HRESULT CDirItems::EnumerateOneDir(const FString &phyPrefix, CObjectVector<NFind::CFileInfo> &files)
+// **************** NanaZip Modification Start ****************
+HRESULT CDirItems::EnumerateOneDir(const FString &phyPrefix, CObjectVector<NFind::CFileInfo> &files,
+    const CDirScanNode *scanNode)
+{
+ #ifndef Z7_ST
+  if (Prefetcher)
+  {
+    // without (scanNode) the prefetcher reads all subdirectories
+    const CDirScanNode emptyNode;
+    if (!scanNode)
+      scanNode = &emptyNode;
+    if (Prefetcher->GetListing(phyPrefix, files))
+    {
+      // the worker thread has submitted the subdirectories already, if it was possible
+      Prefetcher->SubmitSubDirs(phyPrefix, *scanNode, files);
+      if (Callback && files.Size() > kScanProgressStepMask)
+        return ScanProgress(phyPrefix);
+      return S_OK;
+    }
+    const HRESULT res = EnumerateOneDir_Base(phyPrefix, files);
+    if (res == S_OK)
+      Prefetcher->SubmitSubDirs(phyPrefix, *scanNode, files);
+    return res;
+  }
+ #else
+  UNUSED_VAR(scanNode)
+ #endif
+  return EnumerateOneDir_Base(phyPrefix, files);
+}
+
+void CDirItems::FinishOneDir(const FString &phyPrefix, const CObjectVector<NFind::CFileInfo> &files)
+{
+ #ifndef Z7_ST
+  if (Prefetcher)
+    Prefetcher->FinishDir(phyPrefix, files);
+ #else
+  UNUSED_VAR(phyPrefix)
+  UNUSED_VAR(files)
+ #endif
+}
+
+HRESULT CDirItems::EnumerateOneDir_Base(const FString &phyPrefix, CObjectVector<NFind::CFileInfo> &files)
+// **************** NanaZip Modification End ****************
 {
   NFind::CEnumerator enumerator;
   // printf("\n  enumerator.SetDirPrefix(phyPrefix) \n");
@@ -782,6 +838,70 @@ static bool IsVirtualFsFolder(const FString &prefix, const UString &name)
 #endif
 
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+/* CDirScanCensorFilter repeats the censor checks of EnumerateForItem() and
+   EnumerateDirItems() for subdirectory, so the prefetcher doesn't read
+   directories where the walker will not call EnumerateOneDir(). */
+
+class CDirScanCensorFilter Z7_final: public IDirScanFilter
+{
+public:
+  bool SymLinks;
+
+  CDirScanCensorFilter(): SymLinks(false) {}
+
+  bool GetSubDirNode(const CDirScanNode &parent, const NFind::CFileInfo &fi,
+      CDirScanNode &sub) const Z7_override
+  {
+    const NWildcard::CCensorNode &curNode = *parent.Node;
+    const UString name = fs2us(fi.Name);
+    UStringVector newParts = parent.Parts;
+    newParts.Add(name);
+    if (curNode.CheckPathToRoot(false, newParts, false))
+      return false;
+    bool enterToSubFolders = parent.EnterToSubFolders;
+    if (curNode.CheckPathToRoot(true, newParts, false))
+      enterToSubFolders = true;
+
+    const NWildcard::CCensorNode *nextNode = NULL;
+    if (parent.Parts.IsEmpty())
+    {
+      const int index = curNode.FindSubNode(name);
+      if (index >= 0)
+      {
+        nextNode = &curNode.SubNodes[(unsigned)index];
+        newParts.Clear();
+      }
+    }
+    if (!nextNode)
+    {
+      if (!enterToSubFolders)
+        return false;
+     #ifdef _WIN32
+      if (SymLinks && fi.HasReparsePoint())
+        return false;
+     #endif
+      nextNode = &curNode;
+    }
+
+    if (!enterToSubFolders && nextNode->NeedCheckSubDirs())
+      enterToSubFolders = true;
+    // the walker uses direct names instead of dir enumerator in that case
+    if (newParts.IsEmpty() && !enterToSubFolders && CanUseFsDirect(*nextNode))
+      return false;
+
+    sub.Node = nextNode;
+    sub.Parts = newParts;
+    sub.EnterToSubFolders = enterToSubFolders;
+    return true;
+  }
+};
+
+#endif
+// **************** NanaZip Modification End ****************
+
 
 static HRESULT EnumerateDirItems(
     const NWildcard::CCensorNode &curNode,
@@ -1102,7 +1222,17 @@ static HRESULT EnumerateDirItems(
   // for (int y = 0; y < 1; y++)
   {
     // files.Clear();
+    // **************** NanaZip Modification Start ****************
+   #ifndef Z7_ST
+    CDirScanNode scanNode;
+    scanNode.Node = &curNode;
+    scanNode.Parts = addParts;
+    scanNode.EnterToSubFolders = enterToSubFolders;
+    RINOK(dirItems.EnumerateOneDir(phyPrefix, files, &scanNode))
+   #else
     RINOK(dirItems.EnumerateOneDir(phyPrefix, files))
+   #endif
+    // **************** NanaZip Modification End ****************
   /*
   FOR_VECTOR (i, files)
   {
@@ -1155,16 +1285,24 @@ static HRESULT EnumerateDirItems(
     }
   }
 
+  // **************** NanaZip Modification Start ****************
+  dirItems.FinishOneDir(phyPrefix, files);
+  // **************** NanaZip Modification End ****************
   return S_OK;
 }
 
 
 
 
-HRESULT EnumerateItems(
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+static const UInt32 k_DirScan_MaxThreads = 8;
+#endif
+
+static HRESULT EnumerateCensorItems(
     const NWildcard::CCensor &censor,
     const NWildcard::ECensorPathMode pathMode,
-    const UString &addPathPrefix, // prefix that will be added to Logical Path
+    const UString &addPathPrefix,
     CDirItems &dirItems)
 {
   FOR_VECTOR (i, censor.Pairs)
@@ -1186,6 +1324,40 @@ HRESULT EnumerateItems(
         false // enterToSubFolders
         ))
   }
+  return S_OK;
+}
+
+HRESULT EnumerateItems(
+    const NWildcard::CCensor &censor,
+    const NWildcard::ECensorPathMode pathMode,
+    const UString &addPathPrefix, // prefix that will be added to Logical Path
+    CDirItems &dirItems)
+{
+ #ifndef Z7_ST
+  // (filter) is used by threads of (prefetcher), so it's destroyed after (prefetcher)
+  CDirScanCensorFilter filter;
+  filter.SymLinks = dirItems.SymLinks;
+  CDirScanPrefetcher prefetcher;
+  if (dirItems.NumScanThreads != 1)
+  {
+    UInt32 numThreads = dirItems.NumScanThreads;
+    if (numThreads == 0)
+    {
+      // the threads mostly wait for file system, so we use more threads than CPUs
+      numThreads = NSystem::GetNumberOfProcessors() * 2;
+      if (numThreads > k_DirScan_MaxThreads)
+        numThreads = k_DirScan_MaxThreads;
+    }
+    prefetcher.Init(numThreads, !dirItems.SymLinks, &filter);
+    dirItems.Prefetcher = &prefetcher;
+  }
+ #endif
+  const HRESULT res = EnumerateCensorItems(censor, pathMode, addPathPrefix, dirItems);
+ #ifndef Z7_ST
+  dirItems.Prefetcher = NULL;
+ #endif
+  RINOK(res)
+  // **************** NanaZip Modification End ****************
   dirItems.ReserveDown();
 
  #if defined(_WIN32) && !defined(UNDER_CE)
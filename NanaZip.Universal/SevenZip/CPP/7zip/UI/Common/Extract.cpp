@@ -421,6 +421,11 @@ HRESULT Extract(
   #ifndef Z7_SFX
   ecs->SetHashMethods(hash);
   #endif
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  ecs->SetNumWriteThreads(options.NumWriteThreads);
+  #endif
+  // **************** NanaZip Modification End ****************
 
   if (multi)
   {
@@ -28,6 +28,10 @@ struct CExtractOptionsBase
   CBoolPair ElimDup;
   // **************** NanaZip Modification Start ****************
   CBoolPair SmartExtract;
+  // the number of threads that create and write small output files.
+  // 0 : the number of processors (up to 8), 1 : files are written by caller thread.
+  // It's set by -swt switch.
+  UInt32 NumWriteThreads;
   // **************** NanaZip Modification End ****************
 
   bool ExcludeDirItems;
@@ -46,6 +50,9 @@ struct CExtractOptionsBase
   UString HashDir;
 
   CExtractOptionsBase():
+      // **************** NanaZip Modification Start ****************
+      NumWriteThreads(0),
+      // **************** NanaZip Modification End ****************
       ExcludeDirItems(false),
       ExcludeFileItems(false),
       PathMode_Force(false),
@@ -9,6 +9,14 @@
 #include "../../../Common/IntToString.h"
 #include "../../../Common/StringToInt.h"
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+#include "../../../Windows/Synchronization.h"
+#include "../../../Windows/System.h"
+#include "../../../Windows/Thread.h"
+#endif
+// **************** NanaZip Modification End ****************
+
 #include "../../Common/FileStreams.h"
 #include "../../Common/ProgressUtils.h"
 #include "../../Common/StreamObjects.h"
@@ -122,8 +130,232 @@ HRESULT CHashBundle::SetMethods(DECL_EXTERNAL_CODECS_LOC_VARS const UStringVecto
   return S_OK;
 }
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+/*
+  CHashBundleMt runs every hasher of the bundle in its own thread.
+  The data is read once to a ring of shared buffers.
+  Each buffer is reference-counted by the hashers that still have to process it,
+  so fast hashers can run ahead of slow ones by up to (k_HashMt_NumBufs) buffers.
+*/
+
+static const unsigned k_HashMt_NumBufs = 4;
+static const UInt32 k_HashMt_BufSize = (UInt32)1 << 20;
+
+class CHashBundleMt;
+
+struct CHasherThread
+{
+  CHashBundleMt *Mt;
+  IHasher *Hasher;
+  UInt64 NextSeq;
+  NWindows::NSynchronization::CAutoResetEvent WorkEvent;
+  NWindows::CThread Thread;
+};
+
+static THREAD_FUNC_DECL HasherThreadFunction(void *param);
+
+class CHashBundleMt
+{
+  CObjectVector<CHasherThread> _threads;
+  Byte *_bufs[k_HashMt_NumBufs];
+  UInt32 _sizes[k_HashMt_NumBufs];
+  unsigned _numRefs[k_HashMt_NumBufs];
+  UInt64 _producedSeq;
+  bool _exit;
+  NWindows::NSynchronization::CCriticalSection _cs;
+  NWindows::NSynchronization::CSemaphore _freeBufs;
+public:
+  CHashBundleMt(): _producedSeq(0), _exit(false)
+  {
+    for (unsigned i = 0; i < k_HashMt_NumBufs; i++)
+      _bufs[i] = NULL;
+  }
+  ~CHashBundleMt();
+  HRESULT Create(CObjectVector<CHasherState> &hashers);
+  void ThreadLoop(CHasherThread &t);
+
+  // the following functions are called only by the producer thread
+  Byte *GetBuf()
+  {
+    _freeBufs.Lock();
+    return _bufs[(unsigned)(_producedSeq % k_HashMt_NumBufs)];
+  }
+  void ReturnBuf() { _freeBufs.Release(); }
+  void PushBuf(UInt32 size);
+  void WaitIdle();
+};
+
+HRESULT CHashBundleMt::Create(CObjectVector<CHasherState> &hashers)
+{
+  for (unsigned i = 0; i < k_HashMt_NumBufs; i++)
+  {
+    _bufs[i] = (Byte *)::MidAlloc(k_HashMt_BufSize);
+    if (!_bufs[i])
+      return E_OUTOFMEMORY;
+  }
+  WRes wres = _freeBufs.Create(k_HashMt_NumBufs, k_HashMt_NumBufs);
+  if (wres != 0)
+    return HRESULT_FROM_WIN32(wres);
+  FOR_VECTOR (i, hashers)
+  {
+    CHasherThread &t = _threads.AddNew();
+    t.Mt = this;
+    t.Hasher = hashers[i].Hasher;
+    t.NextSeq = 0;
+    wres = t.WorkEvent.CreateIfNotCreated_Reset();
+    if (wres == 0)
+      wres = t.Thread.Create(HasherThreadFunction, &t);
+    if (wres != 0)
+    {
+      _threads.DeleteBack();
+      return HRESULT_FROM_WIN32(wres);
+    }
+  }
+  return S_OK;
+}
+
+CHashBundleMt::~CHashBundleMt()
+{
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    _exit = true;
+  }
+  FOR_VECTOR (i, _threads)
+  {
+    CHasherThread &t = _threads[i];
+    t.WorkEvent.Set();
+    t.Thread.Wait_Close();
+  }
+  for (unsigned i = 0; i < k_HashMt_NumBufs; i++)
+    ::MidFree(_bufs[i]);
+}
+
+void CHashBundleMt::ThreadLoop(CHasherThread &t)
+{
+  for (;;)
+  {
+    unsigned slot;
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (t.NextSeq == _producedSeq)
+      {
+        if (_exit)
+          return;
+        slot = k_HashMt_NumBufs;
+      }
+      else
+        slot = (unsigned)(t.NextSeq % k_HashMt_NumBufs);
+    }
+    if (slot == k_HashMt_NumBufs)
+    {
+      t.WorkEvent.Lock();
+      continue;
+    }
+    t.Hasher->Update(_bufs[slot], _sizes[slot]);
+    bool isFree;
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      t.NextSeq++;
+      isFree = (--_numRefs[slot] == 0);
+    }
+    if (isFree)
+      _freeBufs.Release();
+  }
+}
+
+static THREAD_FUNC_DECL HasherThreadFunction(void *param)
+{
+  CHasherThread *t = (CHasherThread *)param;
+  t->Mt->ThreadLoop(*t);
+  return 0;
+}
+
+void CHashBundleMt::PushBuf(UInt32 size)
+{
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    const unsigned slot = (unsigned)(_producedSeq % k_HashMt_NumBufs);
+    _sizes[slot] = size;
+    _numRefs[slot] = _threads.Size();
+    _producedSeq++;
+  }
+  FOR_VECTOR (i, _threads)
+    _threads[i].WorkEvent.Set();
+}
+
+void CHashBundleMt::WaitIdle()
+{
+  for (unsigned i = 0; i < k_HashMt_NumBufs; i++)
+    _freeBufs.Lock();
+  _freeBufs.Release(k_HashMt_NumBufs);
+}
+
+CHashBundle::~CHashBundle()
+{
+  delete _mt;
+}
+
+HRESULT CHashBundle::SetNumThreads(UInt32 numThreads)
+{
+  delete _mt;
+  _mt = NULL;
+  if (numThreads <= 1 || Hashers.Size() <= 1)
+    return S_OK;
+  CHashBundleMt *mt = new CHashBundleMt;
+  const HRESULT res = mt->Create(Hashers);
+  if (res != S_OK)
+  {
+    delete mt;
+    return res;
+  }
+  _mt = mt;
+  return S_OK;
+}
+
+void CHashBundle::SetHashersNumThreads(UInt32 numThreads)
+{
+  const PROPID propID = NCoderPropID::kNumThreads;
+  NWindows::NCOM::CPropVariant prop = (UInt32)numThreads;
+  FOR_VECTOR (i, Hashers)
+  {
+    CMyComPtr<ICompressSetCoderProperties> scp;
+    Hashers[i].Hasher.QueryInterface(IID_ICompressSetCoderProperties, &scp);
+    // the hashers without threads can reject that property
+    if (scp)
+      scp->SetCoderProperties(&propID, &prop, 1);
+  }
+}
+
+void *CHashBundle::Mt_GetBuf(UInt32 &size)
+{
+  size = k_HashMt_BufSize;
+  return _mt->GetBuf();
+}
+
+void CHashBundle::Mt_ReturnBuf()
+{
+  _mt->ReturnBuf();
+}
+
+void CHashBundle::Mt_UpdateBuf(UInt32 size)
+{
+  CurSize += size;
+  _mt->PushBuf(size);
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
 void CHashBundle::InitForNewFile()
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (_mt)
+    _mt->WaitIdle();
+  #endif
+  // **************** NanaZip Modification End ****************
   CurSize = 0;
   FOR_VECTOR (i, Hashers)
   {
@@ -135,6 +367,26 @@ void CHashBundle::InitForNewFile()
 
 void CHashBundle::Update(const void *data, UInt32 size)
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  if (_mt)
+  {
+    // the caller owns (data), so we copy it to the shared buffers
+    while (size != 0)
+    {
+      UInt32 cur;
+      Byte *buf = (Byte *)Mt_GetBuf(cur);
+      if (cur > size)
+        cur = size;
+      memcpy(buf, data, cur);
+      Mt_UpdateBuf(cur);
+      data = (const Byte *)data + cur;
+      size -= cur;
+    }
+    return;
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
   CurSize += size;
   FOR_VECTOR (i, Hashers)
     Hashers[i].Hasher->Update(data, size);
@@ -190,6 +442,22 @@ void CHasherState::AddDigest(unsigned groupIndex, const Byte *data)
 
 void CHashBundle::Final(bool isDir, bool isAltStream, const UString &path)
 {
+  // **************** NanaZip Modification Start ****************
+  Final2(isDir, isAltStream, path, false);
+}
+
+void CHashBundle::Final_DigestsReady(bool isDir, bool isAltStream, const UString &path)
+{
+  Final2(isDir, isAltStream, path, true);
+}
+
+void CHashBundle::Final2(bool isDir, bool isAltStream, const UString &path, bool digestsReady)
+{
+  #ifndef Z7_ST
+  if (_mt)
+    _mt->WaitIdle();
+  #endif
+  // **************** NanaZip Modification End ****************
   if (isDir)
     NumDirs++;
   else if (isAltStream)
@@ -213,6 +481,9 @@ void CHashBundle::Final(bool isDir, bool isAltStream, const UString &path)
     CHasherState &h = Hashers[i];
     if (!isDir)
     {
+      // **************** NanaZip Modification Start ****************
+      if (!digestsReady)
+      // **************** NanaZip Modification End ****************
       h.Hasher->Final(h.Digests[0]); // k_HashCalc_Index_Current
       if (!isAltStream)
         h.AddDigest(k_HashCalc_Index_DataSum, h.Digests[0]);
@@ -469,6 +740,331 @@ static void WriteLine(CDynLimBuf &hashFileString,
 }
 
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+
+/*
+  CHashFilesMt hashes several files at the same time.
+  Every worker thread has its own CHashBundle and stores the data digests
+  of the file to a result slot. The caller thread reports the results
+  in the original order of items and computes the sums in its own bundle.
+  The workers can't run ahead of the reported item by more than the number of slots.
+*/
+
+static const unsigned k_HashMt_MinFilesPerThread = 2;
+static const unsigned k_HashMt_SlotsPerThread = 4;
+static const UInt32 k_HashMt_FileBufSize = (UInt32)1 << 18;
+
+struct CHashFileResult
+{
+  bool IsReady;
+  bool IsDir;
+  bool IsAltStream;
+  bool OpenFailed;
+  DWORD OpenError;
+  HRESULT Res;
+  UInt64 Size;     // the size of opened file before reading
+  UInt64 DataSize; // the number of hashed bytes
+  CByteBuffer Digests;
+};
+
+class CHashFilesMt;
+
+struct CHashFileThread
+{
+  CHashFilesMt *Mt;
+  CHashBundle Bundle;
+  NWindows::CThread Thread;
+};
+
+static THREAD_FUNC_DECL HashFileThreadFunction(void *param);
+
+class CHashFilesMt
+{
+  const CDirItems *_dirItems;
+  const CHashOptions *_options;
+  CObjectVector<CHashFileThread> _threads;
+  CObjArray<CHashFileResult> _results;
+  unsigned _numSlots;
+  unsigned _nextItem;
+  bool _stop;
+  UInt64 _completeValue;
+  NWindows::NSynchronization::CCriticalSection _cs;
+  NWindows::NSynchronization::CAutoResetEvent _resultEvent;
+  NWindows::NSynchronization::CSemaphore _freeSlots;
+
+  bool AddProgress(UInt32 size);
+  void ProcessItem(CHashFileThread &t, unsigned index, CHashFileResult &r, void *buf);
+public:
+  CHashFilesMt(): _numSlots(0), _nextItem(0), _stop(false), _completeValue(0) {}
+  ~CHashFilesMt();
+  HRESULT Create(DECL_EXTERNAL_CODECS_LOC_VARS
+      const CDirItems &dirItems, const CHashOptions &options,
+      UInt32 numThreads, unsigned numHashers);
+  void ThreadLoop(CHashFileThread &t);
+
+  // returns NULL, if the result for (index) is not ready yet
+  const CHashFileResult *GetResult(unsigned index, UInt64 &completeValue);
+  void WaitResult() { _resultEvent.Lock(); }
+  void ReleaseResult(unsigned index);
+};
+
+HRESULT CHashFilesMt::Create(DECL_EXTERNAL_CODECS_LOC_VARS
+    const CDirItems &dirItems, const CHashOptions &options,
+    UInt32 numThreads, unsigned numHashers)
+{
+  _dirItems = &dirItems;
+  _options = &options;
+  if (numThreads > dirItems.Items.Size())
+    numThreads = dirItems.Items.Size();
+  _numSlots = numThreads * k_HashMt_SlotsPerThread;
+  _results.Alloc(_numSlots);
+  for (unsigned k = 0; k < _numSlots; k++)
+  {
+    _results[k].IsReady = false;
+    _results[k].Digests.Alloc((size_t)numHashers * k_HashCalc_DigestSize_Max);
+  }
+
+  WRes wres = _resultEvent.CreateIfNotCreated_Reset();
+  if (wres == 0)
+    wres = _freeSlots.Create(_numSlots, _numSlots + numThreads);
+  if (wres != 0)
+    return HRESULT_FROM_WIN32(wres);
+
+  for (UInt32 i = 0; i < numThreads; i++)
+  {
+    CHashFileThread &t = _threads.AddNew();
+    t.Mt = this;
+    HRESULT res = t.Bundle.SetMethods(EXTERNAL_CODECS_LOC_VARS options.Methods);
+    if (res == S_OK)
+    {
+      // the files are hashed in parallel already, so the hashers don't need own threads
+      t.Bundle.SetHashersNumThreads(1);
+      wres = t.Thread.Create(HashFileThreadFunction, &t);
+      if (wres != 0)
+        res = HRESULT_FROM_WIN32(wres);
+    }
+    if (res != S_OK)
+    {
+      _threads.DeleteBack();
+      return res;
+    }
+  }
+  return S_OK;
+}
+
+CHashFilesMt::~CHashFilesMt()
+{
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    _stop = true;
+  }
+  // the workers can wait for free slots, so we wake them up
+  _freeSlots.Release(_threads.Size());
+  FOR_VECTOR (i, _threads)
+    _threads[i].Thread.Wait_Close();
+}
+
+bool CHashFilesMt::AddProgress(UInt32 size)
+{
+  bool stop;
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    _completeValue += size;
+    stop = _stop;
+  }
+  _resultEvent.Set();
+  return !stop;
+}
+
+void CHashFilesMt::ProcessItem(CHashFileThread &t, unsigned index, CHashFileResult &r, void *buf)
+{
+  const CDirItem &di = _dirItems->Items[index];
+  r.IsDir = false;
+  r.IsAltStream = false;
+  r.OpenFailed = false;
+  r.OpenError = 0;
+  r.Res = S_OK;
+  r.Size = 0;
+  r.DataSize = 0;
+  if (!buf)
+  {
+    r.Res = E_OUTOFMEMORY;
+    return;
+  }
+ #ifdef _WIN32
+  r.IsAltStream = di.IsAltStream;
+ #endif
+
+  CMyComPtr<ISequentialInStream> inStream;
+  #ifndef UNDER_CE
+  if (di.ReparseData.Size() != 0)
+  {
+    CBufInStream *inStreamSpec = new CBufInStream();
+    inStream = inStreamSpec;
+    inStreamSpec->Init(di.ReparseData, di.ReparseData.Size());
+  }
+  else
+  #endif
+  {
+    CInFileStream *inStreamSpec = new CInFileStream;
+    inStreamSpec->Set_PreserveATime(_options->PreserveATime);
+    inStream = inStreamSpec;
+    r.IsDir = di.IsDir();
+    if (!r.IsDir)
+    {
+      if (!inStreamSpec->OpenShared(_dirItems->GetPhyPath(index), _options->OpenShareForWrite))
+      {
+        r.OpenFailed = true;
+        r.OpenError = ::GetLastError();
+        return;
+      }
+      if (inStreamSpec->GetSize(&r.Size) != S_OK)
+        r.Size = 0;
+    }
+  }
+
+  if (r.IsDir)
+    return;
+
+  CHashBundle &hb = t.Bundle;
+  hb.InitForNewFile();
+  for (;;)
+  {
+    UInt32 size;
+    r.Res = inStream->Read(buf, k_HashMt_FileBufSize, &size);
+    if (r.Res != S_OK || size == 0)
+      break;
+    hb.Update(buf, size);
+    r.DataSize += size;
+    if (!AddProgress(size))
+    {
+      r.Res = E_ABORT;
+      break;
+    }
+  }
+  FOR_VECTOR (k, hb.Hashers)
+    hb.Hashers[k].Hasher->Final(r.Digests + (size_t)k * k_HashCalc_DigestSize_Max);
+}
+
+void CHashFilesMt::ThreadLoop(CHashFileThread &t)
+{
+  CHashMidBuf buf;
+  const bool bufIsAllocated = buf.Alloc(k_HashMt_FileBufSize);
+  for (;;)
+  {
+    _freeSlots.Lock();
+    unsigned index;
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (_stop || _nextItem == _dirItems->Items.Size())
+        break;
+      index = _nextItem++;
+    }
+    CHashFileResult &r = _results[index % _numSlots];
+    ProcessItem(t, index, r, bufIsAllocated ? (void *)buf : NULL);
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      r.IsReady = true;
+    }
+    _resultEvent.Set();
+  }
+  // another worker can wait for that slot
+  _freeSlots.Release();
+}
+
+static THREAD_FUNC_DECL HashFileThreadFunction(void *param)
+{
+  CHashFileThread *t = (CHashFileThread *)param;
+  t->Mt->ThreadLoop(*t);
+  return 0;
+}
+
+const CHashFileResult *CHashFilesMt::GetResult(unsigned index, UInt64 &completeValue)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+  completeValue = _completeValue;
+  const CHashFileResult &r = _results[index % _numSlots];
+  return r.IsReady ? &r : NULL;
+}
+
+void CHashFilesMt::ReleaseResult(unsigned index)
+{
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    _results[index % _numSlots].IsReady = false;
+  }
+  _freeSlots.Release();
+}
+
+static HRESULT HashCalc_Files_Mt(
+    DECL_EXTERNAL_CODECS_LOC_VARS
+    const CDirItems &dirItems,
+    const CHashOptions &options,
+    UInt32 numThreads,
+    UInt64 totalSize,
+    CHashBundle &hb,
+    IHashCallbackUI *callback)
+{
+  CHashFilesMt mt;
+  RINOK(mt.Create(EXTERNAL_CODECS_LOC_VARS dirItems, options, numThreads, hb.Hashers.Size()))
+
+  UInt64 completeValue = 0;
+  for (unsigned i = 0; i < dirItems.Items.Size(); i++)
+  {
+    const CHashFileResult *r;
+    for (;;)
+    {
+      r = mt.GetResult(i, completeValue);
+      RINOK(callback->SetCompleted(&completeValue))
+      if (r)
+        break;
+      mt.WaitResult();
+    }
+
+    if (r->OpenFailed)
+    {
+      const HRESULT res = callback->OpenFileError(dirItems.GetPhyPath(i), r->OpenError);
+      hb.NumErrors++;
+      if (res != S_FALSE)
+        return res;
+      mt.ReleaseResult(i);
+      continue;
+    }
+    RINOK(r->Res)
+
+    const CDirItem &di = dirItems.Items[i];
+    if (r->Size > di.Size)
+    {
+      totalSize += r->Size - di.Size;
+      RINOK(callback->SetTotal(totalSize))
+    }
+
+    const UString path = dirItems.GetLogPath(i);
+    const bool isDir = r->IsDir;
+    const UInt64 fileSize = r->DataSize;
+    RINOK(callback->GetStream(path, isDir))
+
+    hb.InitForNewFile();
+    if (!isDir)
+      FOR_VECTOR (k, hb.Hashers)
+      {
+        CHasherState &h = hb.Hashers[k];
+        memcpy(h.Digests[k_HashCalc_Index_Current],
+            r->Digests + (size_t)k * k_HashCalc_DigestSize_Max, h.DigestSize);
+      }
+    hb.SetSize(fileSize);
+    hb.Final_DigestsReady(isDir, r->IsAltStream, path);
+    mt.ReleaseResult(i);
+
+    RINOK(callback->SetOperationResult(fileSize, hb, !isDir))
+  }
+  return callback->SetCompleted(&completeValue);
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
 HRESULT HashCalc(
     DECL_EXTERNAL_CODECS_LOC_VARS
     const NWildcard::CCensor &censor,
@@ -496,6 +1092,9 @@ HRESULT HashCalc(
     dirItems.ExcludeFileItems = censor.ExcludeFileItems;
 
     dirItems.ShareForWrite = options.OpenShareForWrite;
+    // **************** NanaZip Modification Start ****************
+    dirItems.NumScanThreads = options.NumScanThreads;
+    // **************** NanaZip Modification End ****************
 
     HRESULT res = EnumerateItems(censor,
         options.PathMode,
@@ -538,6 +1137,27 @@ HRESULT HashCalc(
 
   RINOK(callback->BeforeFirstFile(hb))
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_ST
+  {
+    UInt32 numThreads = options.NumThreads;
+    if (numThreads == 0)
+      numThreads = NWindows::NSystem::GetNumberOfProcessors();
+    if (numThreads > 1 && !options.StdInMode
+        && dirItems.Items.Size() >= numThreads * k_HashMt_MinFilesPerThread)
+    {
+      RINOK(HashCalc_Files_Mt(EXTERNAL_CODECS_LOC_VARS
+          dirItems, options, numThreads, totalSize, hb, callback))
+      return callback->AfterLastFile(hb);
+    }
+    RINOK(hb.SetNumThreads(numThreads))
+    // the hashers use internal threads only if -mmt was specified
+    if (options.NumThreads > 1)
+      hb.SetHashersNumThreads(options.NumThreads);
+  }
+  #endif
+  // **************** NanaZip Modification End ****************
+
   /*
   CDynLimBuf hashFileString((size_t)1 << 31);
   const bool needGenerate = !options.HashFilePath.IsEmpty();
@@ -625,18 +1245,47 @@ HRESULT HashCalc(
     
     if (!isDir)
     {
+      // **************** NanaZip Modification Start ****************
+      #ifndef Z7_ST
+      // the shared buffers of hasher threads are larger than (buf)
+      const UInt32 progressMask = hb.IsMt() ? 0x7 : 0xFF;
+      #else
+      const UInt32 progressMask = 0xFF;
+      #endif
+      // **************** NanaZip Modification End ****************
       for (UInt32 step = 0;; step++)
       {
-        if ((step & 0xFF) == 0)
+        if ((step & progressMask) == 0)
         {
           // printf("\ncompl = %d\n", (unsigned)(completeValue >> 20));
           RINOK(callback->SetCompleted(&completeValue))
         }
         UInt32 size;
+        // **************** NanaZip Modification Start ****************
+        #ifndef Z7_ST
+        if (hb.IsMt())
+        {
+          // we read directly to the buffer shared by the hasher threads
+          UInt32 bufSize;
+          void *mtBuf = hb.Mt_GetBuf(bufSize);
+          const HRESULT res = inStream->Read(mtBuf, bufSize, &size);
+          if (res != S_OK || size == 0)
+          {
+            hb.Mt_ReturnBuf();
+            RINOK(res)
+            break;
+          }
+          hb.Mt_UpdateBuf(size);
+        }
+        else
+        #endif
+        // **************** NanaZip Modification End ****************
+        {
         RINOK(inStream->Read(buf, kBufSize, &size))
         if (size == 0)
           break;
         hb.Update(buf, size);
+        }
         fileSize += size;
         completeValue += size;
       }
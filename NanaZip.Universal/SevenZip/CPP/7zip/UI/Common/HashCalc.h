@@ -78,6 +78,12 @@ DECLARE_INTERFACE(IHashCalc)
 
 Z7_PURE_INTERFACES_END
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_ST
+class CHashBundleMt;
+#endif
+// **************** NanaZip Modification End ****************
+
 struct CHashBundle Z7_final: public IHashCalc
 {
   CObjectVector<CHasherState> Hashers;
@@ -100,12 +106,44 @@ struct CHashBundle Z7_final: public IHashCalc
   CHashBundle()
   {
     NumDirs = NumFiles = NumAltStreams = FilesSize = AltStreamsSize = NumErrors = 0;
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_ST
+    _mt = NULL;
+    #endif
+    // **************** NanaZip Modification End ****************
   }
 
   void InitForNewFile() Z7_override;
   void Update(const void *data, UInt32 size) Z7_override;
   void SetSize(UInt64 size) Z7_override;
   void Final(bool isDir, bool isAltStream, const UString &path) Z7_override;
+
+  // **************** NanaZip Modification Start ****************
+  /* the caller has already stored the data digests
+     to Digests[k_HashCalc_Index_Current] of all hashers */
+  void Final_DigestsReady(bool isDir, bool isAltStream, const UString &path);
+
+  #ifndef Z7_ST
+  ~CHashBundle();
+
+  /* (numThreads > 1) and (Hashers.Size() > 1) :
+     every hasher runs in its own thread over shared read buffers */
+  HRESULT SetNumThreads(UInt32 numThreads);
+  // it sets the number of internal threads of hashers that support it (BLAKE3)
+  void SetHashersNumThreads(UInt32 numThreads);
+  bool IsMt() const { return _mt != NULL; }
+  // these functions are allowed only in mt mode:
+  void *Mt_GetBuf(UInt32 &size);
+  void Mt_ReturnBuf();
+  void Mt_UpdateBuf(UInt32 size);
+  #endif
+private:
+  #ifndef Z7_ST
+  CHashBundleMt *_mt;
+  Z7_CLASS_NO_COPY(CHashBundle)
+  #endif
+  void Final2(bool isDir, bool isAltStream, const UString &path, bool digestsReady);
+  // **************** NanaZip Modification End ****************
 };
 
 Z7_PURE_INTERFACES_BEGIN
@@ -199,12 +237,22 @@ struct CHashOptions
 
   NWildcard::ECensorPathMode PathMode;
 
+  // **************** NanaZip Modification Start ****************
+  UInt32 NumThreads; // 0 : the number of processors
+  UInt32 NumScanThreads; // -sdt switch, 0 : auto
+  // **************** NanaZip Modification End ****************
+
   CHashOptions():
       PreserveATime(false),
       OpenShareForWrite(false),
       StdInMode(false),
       AltStreamsMode(false),
-      PathMode(NWildcard::k_RelatPath) {}
+      PathMode(NWildcard::k_RelatPath)
+      // **************** NanaZip Modification Start ****************
+      , NumThreads(0)
+      , NumScanThreads(0)
+      // **************** NanaZip Modification End ****************
+      {}
 };
 
 
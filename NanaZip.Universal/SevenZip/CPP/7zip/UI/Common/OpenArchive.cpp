@@ -18,6 +18,9 @@
 #include "../../../Common/Wildcard.h"
 
 #include "../../../Windows/FileDir.h"
+// **************** NanaZip Modification Start ****************
+#include "../../../Windows/FileName.h"
+// **************** NanaZip Modification End ****************
 
 #include "../../Common/FileStreams.h"
 #include "../../Common/LimitedStreams.h"
@@ -33,6 +36,12 @@
 #include "SetProperties.h"
 #endif
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_SFX
+#include "ArchiveListCache.h"
+#endif
+// **************** NanaZip Modification End ****************
+
 #ifndef Z7_SFX
 #ifdef SHOW_DEBUG_INFO
 #define PRF(x) x
@@ -3022,8 +3031,101 @@ HRESULT CArc::OpenStream2(const COpenOptions &op)
 
 
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_SFX
+
+HRESULT CArc::OpenFromListCache(const COpenOptions &op, bool &isOpened)
+{
+  isOpened = false;
+  if (op.ListCacheDir.IsEmpty()
+      || !op.stream
+      || op.stdInMode
+      || !op.openType.CanReturnArc)
+    return S_OK;
+
+  CListCacheArchive *cacheSpec = new CListCacheArchive;
+  CMyComPtr<IInArchive> cache = cacheSpec;
+  if (cacheSpec->Load(op.ListCacheDir, op.filePath, op.stream) != S_OK)
+    return S_OK;
+
+  const int formatIndex = op.codecs->FindFormatForArchiveType(cacheSpec->FormatName);
+  if (formatIndex < 0)
+    return S_OK;
+  if (op.openType.FormatIndex >= 0 && op.openType.FormatIndex != formatIndex)
+    return S_OK;
+  if (op.excludedFormats && op.excludedFormats->FindInSorted(formatIndex) >= 0)
+    return S_OK;
+
+  CMyComPtr<IInArchive> archive;
+  RINOK(PrepareToOpen(op, (unsigned)formatIndex, archive))
+  if (!archive)
+    return S_OK;
+  cacheSpec->SetArchive(archive, op.stream, kMaxCheckStartPosition);
+
+  Archive = cache;
+  GetRawProps.Release();
+  GetRootProps.Release();
+  FormatIndex = formatIndex;
+  IsParseArc = false;
+  ArcStreamOffset = 0;
+  ErrorInfo.ClearErrors();
+  ErrorInfo.ErrorFormatIndex = -1;
+  RINOK(InStream_GetSize_SeekToBegin(op.stream, FileSize))
+  RINOK(ReadBasicProps(Archive, 0, S_OK))
+  isOpened = true;
+  return S_OK;
+}
+
+
+/* we don't write list cache for archives that can't be reopened
+   from cache file with same result:
+   - the archive that was opened with password.
+   - multivolume archives.
+   - the archive that was found after the start of file.
+   - the archives that have subfile that must be opened as nested archive. */
+
+bool CArc::CanWriteListCache(const COpenOptions &op)
+{
+  if (op.ListCacheDir.IsEmpty()
+      || !op.stream
+      || op.stdInMode
+      || FormatIndex < 0
+      || IsParseArc
+      || ArcStreamOffset != 0
+      || Offset != 0
+      || IsTree
+      || GetRootProps)
+    return false;
+  if (op.callbackSpec)
+  {
+    if (op.callbackSpec->PasswordWasAsked)
+      return false;
+    unsigned numVolumes = 0;
+    FOR_VECTOR (i, op.callbackSpec->FileNames_WasUsed)
+      if (op.callbackSpec->FileNames_WasUsed[i])
+        numVolumes++;
+    if (numVolumes > 1)
+      return false;
+  }
+  NCOM::CPropVariant prop;
+  if (Archive->GetArchiveProperty(kpidMainSubfile, &prop) != S_OK
+      || prop.vt != VT_EMPTY)
+    return false;
+  return true;
+}
+
+#endif
+// **************** NanaZip Modification End ****************
+
 HRESULT CArc::OpenStream(const COpenOptions &op)
 {
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_SFX
+  bool openedFromListCache = false;
+  RINOK(OpenFromListCache(op, openedFromListCache))
+  if (!openedFromListCache)
+  #endif
+  // **************** NanaZip Modification End ****************
   RINOK(OpenStream2(op))
   // PrintNumber("op.formatIndex 3", op.formatIndex);
 
@@ -3064,6 +3166,15 @@ HRESULT CArc::OpenStream(const COpenOptions &op)
         DefaultName = GetDefaultName2(fileName, extInfo.Ext, extInfo.AddExt);
       }
     }
+
+    // **************** NanaZip Modification Start ****************
+    #ifndef Z7_SFX
+    // the errors of list cache writing are ignored
+    if (!openedFromListCache && CanWriteListCache(op))
+      ListCache_Write(op.ListCacheDir, op.filePath, op.stream, Archive,
+          op.codecs->Formats[(unsigned)FormatIndex].Name);
+    #endif
+    // **************** NanaZip Modification End ****************
   }
 
   return S_OK;
@@ -3081,6 +3192,45 @@ HRESULT CArc::OpenStream(const COpenOptions &op)
 
 #endif
 
+// **************** NanaZip Modification Start ****************
+/*
+We map the archive file to memory, if it's local file.
+The handlers can read the headers directly from the mapping
+via IStreamGetMappedView, and usual Read() calls are served
+from the mapping without system calls.
+The files on network and removable drives are not mapped,
+because the access to mapping raises exception, if the drive is lost.
+The handlers that read the mapping directly must catch such exception.
+*/
+static const UInt64 k_MapView_MinSize = (UInt64)1 << 16;
+static const UInt64 k_MapView_MaxSize = (UInt64)1 << (sizeof(size_t) > 4 ? 40 : 28);
+
+static bool IsMapView_Allowed(const UString &path)
+{
+ #ifdef _WIN32
+  #ifdef UNDER_CE
+  UNUSED_VAR(path)
+  return false;
+  #else
+  FString fullPath;
+  if (!NFile::NName::GetFullPath(us2fs(path), fullPath))
+    return false;
+  /* the folder on fixed drive can be mount point of another volume.
+     So we check the type of volume that contains the file */
+  const UString fullPathU = fs2us(fullPath);
+  WCHAR root[MAX_PATH + 1];
+  if (!::GetVolumePathNameW(fullPathU, root, MAX_PATH + 1))
+    return false;
+  return ::GetDriveTypeW(root) == DRIVE_FIXED;
+  #endif
+ #else
+  // CInFileStream::MapView() maps only regular files
+  UNUSED_VAR(path)
+  return true;
+ #endif
+}
+// **************** NanaZip Modification End ****************
+
 HRESULT CArc::OpenStreamOrFile(COpenOptions &op)
 {
   CMyComPtr<IInStream> fileStream;
@@ -3104,6 +3254,10 @@ HRESULT CArc::OpenStreamOrFile(COpenOptions &op)
     Path = filePath;
     if (!fileStreamSpec->Open(us2fs(Path)))
       return GetLastError_noZero_HRESULT();
+    // **************** NanaZip Modification Start ****************
+    if (IsMapView_Allowed(Path))
+      fileStreamSpec->MapView(k_MapView_MinSize, k_MapView_MaxSize);
+    // **************** NanaZip Modification End ****************
     op.stream = fileStream;
     #ifdef Z7_SFX
     IgnoreSplit = true;
@@ -3201,6 +3355,10 @@ void CArchiveLink::Release()
   NonOpen_ArcPath.Empty();
   while (!Arcs.IsEmpty())
     Arcs.DeleteBack();
+  // **************** NanaZip Modification Start ****************
+  BlockCache.Release();
+  BlockCacheSpec = NULL;
+  // **************** NanaZip Modification End ****************
 }
 
 /*
@@ -3232,6 +3390,28 @@ void CArchiveLink::Set_ErrorsText()
 }
 */
 
+// **************** NanaZip Modification Start ****************
+#ifndef Z7_SFX
+static const unsigned kBlockCache_BlockSizeLog = 16;
+static const UInt64 kBlockCache_Size = (UInt64)1 << 25;
+
+// the handlers of disk images and partition tables
+// that give random access stream for nested archive
+static const char * const k_BlockCache_Formats[] =
+{
+    "vhd"
+  , "vhdx"
+  , "vmdk"
+  , "vdi"
+  , "qcow"
+  , "dmg"
+  , "mbr"
+  , "gpt"
+  , "apm"
+};
+#endif
+// **************** NanaZip Modification End ****************
+
 HRESULT CArchiveLink::Open(COpenOptions &op)
 {
   Release();
@@ -3343,6 +3523,29 @@ HRESULT CArchiveLink::Open(COpenOptions &op)
     CMyComPtr<IInStream> subStream;
     if (subSeqStream.QueryInterface(IID_IInStream, &subStream) != S_OK || !subStream)
       break;
+
+    // **************** NanaZip Modification Start ****************
+    /* the handler of nested archive usually reads small records at random
+       positions, and each such read goes through all the outer levels.
+       So we read the data of the outer image levels via the shared block cache. */
+    #ifndef Z7_SFX
+    if (arc.FormatIndex >= 0
+        && IsNameFromList(op.codecs->Formats[(unsigned)arc.FormatIndex].Name,
+            k_BlockCache_Formats, Z7_ARRAY_SIZE(k_BlockCache_Formats)))
+    {
+      if (!BlockCache)
+      {
+        BlockCacheSpec = new CBlockCache;
+        BlockCache = BlockCacheSpec;
+        BlockCacheSpec->Init(kBlockCache_BlockSizeLog, kBlockCache_Size);
+      }
+      CBlockCacheInStream *cacheStreamSpec = new CBlockCacheInStream;
+      CMyComPtr<IInStream> cacheStream = cacheStreamSpec;
+      RINOK(cacheStreamSpec->Init(subStream, BlockCacheSpec))
+      subStream = cacheStream;
+    }
+    #endif
+    // **************** NanaZip Modification End ****************
     
     CArc arc2;
     RINOK(arc.GetItem_Path(mainSubfile, arc2.Path))
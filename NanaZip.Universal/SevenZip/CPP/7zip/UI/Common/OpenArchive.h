@@ -5,6 +5,10 @@
 
 #include "../../../Windows/PropVariant.h"
 
+// **************** NanaZip Modification Start ****************
+#include "../../Common/BlockCacheStream.h"
+// **************** NanaZip Modification End ****************
+
 #include "ArchiveOpenCallback.h"
 #include "LoadCodecs.h"
 #include "Property.h"
@@ -131,6 +135,11 @@ struct COpenOptions
   bool stdInMode;
   UString filePath;
 
+  // **************** NanaZip Modification Start ****************
+  // the directory for list cache files. Empty string disables list cache.
+  FString ListCacheDir;
+  // **************** NanaZip Modification End ****************
+
   COpenOptions():
       codecs(NULL),
       types(NULL),
@@ -270,6 +279,13 @@ class CArc
   HRESULT CheckZerosTail(const COpenOptions &op, UInt64 offset);
   HRESULT OpenStream2(const COpenOptions &options);
 
+  // **************** NanaZip Modification Start ****************
+  #ifndef Z7_SFX
+  HRESULT OpenFromListCache(const COpenOptions &options, bool &isOpened);
+  bool CanWriteListCache(const COpenOptions &options);
+  #endif
+  // **************** NanaZip Modification End ****************
+
   #ifndef Z7_SFX
   // parts.Back() can contain alt stream name "nams:AltName"
   HRESULT GetItem_PathToParent(UInt32 index, UInt32 parent, UStringVector &parts) const;
@@ -402,6 +418,13 @@ struct CArchiveLink
 
   CArcErrorInfo NonOpen_ErrorInfo;
 
+  // **************** NanaZip Modification Start ****************
+  /* the block cache shared by the streams of nested archives
+     (VHDX -> GPT -> NTFS). It's created only if there is nested archive. */
+  CBlockCache *BlockCacheSpec;
+  CMyComPtr<IUnknown> BlockCache;
+  // **************** NanaZip Modification End ****************
+
   // UString ErrorsText;
   // void Set_ErrorsText();
 
@@ -409,6 +432,9 @@ struct CArchiveLink
       VolumesSize(0),
       IsOpen(false),
       PasswordWasAsked(false)
+      // **************** NanaZip Modification Start ****************
+      , BlockCacheSpec(NULL)
+      // **************** NanaZip Modification End ****************
       {}
 
   void KeepModeForNextOpen();
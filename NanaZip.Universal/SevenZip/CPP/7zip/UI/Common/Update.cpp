@@ -1394,6 +1394,10 @@ HRESULT UpdateArchive(
       dirItems.StoreOwnerName = options.StoreOwnerName.Val;
      #endif
 
+      // **************** NanaZip Modification Start ****************
+      dirItems.NumScanThreads = options.NumScanThreads;
+      // **************** NanaZip Modification End ****************
+
       const HRESULT res = EnumerateItems(censor,
           options.PathMode,
           UString(), // options.AddPathPrefix,
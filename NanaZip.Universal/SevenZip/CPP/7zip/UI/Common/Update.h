@@ -107,6 +107,12 @@ struct CUpdateOptions
   EArcNameMode ArcNameMode;
   NWildcard::ECensorPathMode PathMode;
 
+  // **************** NanaZip Modification Start ****************
+  // the number of threads that read directories while scanning: (0) - auto, (1) - no extra threads.
+  // It's set by -sdt switch.
+  UInt32 NumScanThreads;
+  // **************** NanaZip Modification End ****************
+
   CCompressionMethodMode MethodMode;
 
   CObjectVector<CUpdateArchiveCommand> Commands;
@@ -144,6 +150,9 @@ struct CUpdateOptions
 
     ArcNameMode(k_ArcNameMode_Smart),
     PathMode(NWildcard::k_RelatPath)
+    // **************** NanaZip Modification Start ****************
+    , NumScanThreads(0)
+    // **************** NanaZip Modification End ****************
     
     {}
 
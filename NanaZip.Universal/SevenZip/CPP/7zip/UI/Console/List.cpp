@@ -1180,6 +1180,9 @@ HRESULT ListArchives(
     options.stdInMode = stdInMode;
     options.stream = NULL;
     options.filePath = arcPath;
+    // **************** NanaZip Modification Start ****************
+    options.ListCacheDir = listOptions.ListCacheDir;
+    // **************** NanaZip Modification End ****************
 
     if (enableHeaders)
     {
@@ -1391,6 +1394,16 @@ HRESULT ListArchives(
         PrintPropPair_Path(g_StdOut, arcLink.NonOpen_ArcPath);
         PrintArcTypeError(g_StdOut, codecs->Formats[(unsigned)arcLink.NonOpen_ErrorInfo.ErrorFormatIndex].Name, false);
       }
+      // **************** NanaZip Modification Start ****************
+      if (techMode && arcLink.BlockCacheSpec)
+      {
+        UInt64 numHits, numMisses;
+        arcLink.BlockCacheSpec->GetStat(numHits, numMisses);
+        g_StdOut << "----------\n";
+        g_StdOut << "Block Cache Hits = " << numHits << endl;
+        g_StdOut << "Block Cache Misses = " << numMisses << endl;
+      }
+      // **************** NanaZip Modification End ****************
     }
     
     stat2total.Update(stat2);
@@ -12,6 +12,9 @@ struct CListOptions
   bool ExcludeDirItems;
   bool ExcludeFileItems;
   bool DisablePercents;
+  // **************** NanaZip Modification Start ****************
+  FString ListCacheDir;
+  // **************** NanaZip Modification End ****************
 
   CListOptions():
     ExcludeDirItems(false),
@@ -191,9 +191,15 @@ static const char * const kHelpString =
 #endif
     "|*] : set hash function for x, e, h commands\n"
     "  -sdel : delete files after compression\n"
+    // **************** NanaZip Modification Start ****************
+    "  -sdt{N} : set number of threads that read directories while scanning (1 : no extra threads)\n"
+    // **************** NanaZip Modification End ****************
     "  -seml[.] : send archive by email\n"
     "  -sfx[{name}] : Create SFX archive\n"
     "  -si[{name}] : read data from stdin\n"
+    // **************** NanaZip Modification Start ****************
+    "  -slc{dir} : use archive list cache in {dir} for l (List) command\n"
+    // **************** NanaZip Modification End ****************
     "  -slp : set Large Pages mode\n"
     "  -slt : show technical information for l (List) command\n"
     "  -snh : store hard links as links\n"
@@ -211,6 +217,9 @@ static const char * const kHelpString =
     "  -stl : set archive timestamp from the most recently modified file\n"
     "  -stm{HexMask} : set CPU thread affinity mask (hexadecimal number)\n"
     "  -stx{Type} : exclude archive type\n"
+    // **************** NanaZip Modification Start ****************
+    "  -swt{N} : set number of threads that write extracted files (1 : no extra threads)\n"
+    // **************** NanaZip Modification End ****************
     "  -t{Type} : Set type of archive\n"
     "  -u[-][p#][q#][r#][x#][y#][z#][!newArchiveName] : Update options\n"
     "  -v{Size}[b|k|m|g] : Create volumes\n"
@@ -1586,6 +1595,9 @@ int Main2(
       lo.ExcludeDirItems = options.Censor.ExcludeDirItems;
       lo.ExcludeFileItems = options.Censor.ExcludeFileItems;
       lo.DisablePercents = options.DisablePercents;
+      // **************** NanaZip Modification Start ****************
+      lo.ListCacheDir = options.ListCacheDir;
+      // **************** NanaZip Modification End ****************
 
       hresultMain = ListArchives(
           lo,
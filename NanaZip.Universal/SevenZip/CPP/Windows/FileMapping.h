@@ -5,10 +5,22 @@
 
 #include "../Common/MyTypes.h"
 
+// **************** NanaZip Modification Start ****************
+#ifdef _WIN32
 #include "Handle.h"
+#else
+#include <sys/mman.h>
+#endif
+
+#include "FileIO.h"
+// **************** NanaZip Modification End ****************
 
 namespace NWindows {
 
+// **************** NanaZip Modification Start ****************
+#ifdef _WIN32
+// **************** NanaZip Modification End ****************
+
 class CFileMapping: public CHandle
 {
 public:
@@ -61,6 +73,73 @@ public:
   ~CFileUnmapper() { ::UnmapViewOfFile(_data); }
 };
 
+// **************** NanaZip Modification Start ****************
+#endif // _WIN32
+
+namespace NFile {
+namespace NIO {
+
+/*
+CInFileView maps the data of opened file [0, size) to memory for reading.
+The view stays valid after closing of (file) until Close() is called.
+If the file is changed or truncated by another process,
+the access to the view can raise exception (SIGBUS in POSIX),
+so the caller must map only local files that are opened for reading.
+*/
+
+class CInFileView  MY_UNCOPYABLE
+{
+  const Byte *_data;
+  size_t _size;
+public:
+  CInFileView(): _data(NULL), _size(0) {}
+  ~CInFileView() { Close(); }
+
+  bool IsMapped() const { return _data != NULL; }
+  const Byte *GetData() const { return _data; }
+  size_t GetSize() const { return _size; }
+
+  bool Map(const CInFile &file, UInt64 size)
+  {
+    Close();
+    if (size == 0 || size != (size_t)size)
+      return false;
+   #ifdef _WIN32
+    const HANDLE mapping = ::CreateFileMapping(file.GetHandle(), NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+      return false;
+    // the view keeps the reference to mapping object
+    _data = (const Byte *)::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    ::CloseHandle(mapping);
+    if (!_data)
+      return false;
+   #else
+    void *p = ::mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, file.GetHandle(), 0);
+    if (p == MAP_FAILED)
+      return false;
+    _data = (const Byte *)p;
+   #endif
+    _size = (size_t)size;
+    return true;
+  }
+
+  void Close()
+  {
+    if (!_data)
+      return;
+   #ifdef _WIN32
+    ::UnmapViewOfFile(_data);
+   #else
+    ::munmap((void *)_data, _size);
+   #endif
+    _data = NULL;
+    _size = 0;
+  }
+};
+
+}}
+// **************** NanaZip Modification End ****************
+
 }
 
 #endif